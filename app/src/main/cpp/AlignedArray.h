@@ -0,0 +1,57 @@
+//
+// Growable array of plain-old-data elements on cache-line aligned storage,
+// for the SoA arrays the SIMD kernels stream through. Capacity grows
+// geometrically and is only given back by the destructor, so resizing back
+// and forth (every surface change) does not reallocate.
+//
+
+#ifndef OPENGL_DEMO_ALIGNEDARRAY_H
+#define OPENGL_DEMO_ALIGNEDARRAY_H
+
+#include <stdlib.h>
+#include <string.h>
+
+// A cache line on every target; also a multiple of every SIMD width used.
+#define ALIGNED_ARRAY_ALIGNMENT 64
+
+template <typename T>
+class AlignedArray {
+public:
+    AlignedArray() : mData(NULL), mSize(0), mCapacity(0) {}
+    ~AlignedArray() { free(mData); }
+    AlignedArray(const AlignedArray&) = delete;
+    AlignedArray& operator=(const AlignedArray&) = delete;
+
+    // Keeps the first elements up to the new size; new elements are not
+    // initialized. Out of memory, returns false and leaves the array as it
+    // was.
+    bool resize(size_t count) {
+        if (count > mCapacity) {
+            size_t capacity = mCapacity * 2 > count ? mCapacity * 2 : count;
+            void* data = NULL;
+            if (posix_memalign(&data, ALIGNED_ARRAY_ALIGNMENT, capacity * sizeof(T)) != 0)
+                return false;
+            if (mSize)
+                memcpy(data, mData, mSize * sizeof(T));
+            free(mData);
+            mData = (T*)data;
+            mCapacity = capacity;
+        }
+        mSize = count;
+        return true;
+    }
+
+    T* data() { return mData; }
+    const T* data() const { return mData; }
+    size_t size() const { return mSize; }
+    size_t capacity() const { return mCapacity; }
+    T& operator[](size_t i) { return mData[i]; }
+    const T& operator[](size_t i) const { return mData[i]; }
+
+private:
+    T* mData;
+    size_t mSize;
+    size_t mCapacity;
+};
+
+#endif //OPENGL_DEMO_ALIGNEDARRAY_H
@@ -0,0 +1,312 @@
+//
+// Asynchronous frame readback on a shared context, see AsyncReadback.h.
+//
+
+#include "AsyncReadback.h"
+
+#include <string.h>
+
+// The readback thread wakes up this often while a fence is pending, so a
+// lost context can't hang it forever.
+#define READBACK_WAIT_TIMEOUT_NS 100000000ull
+
+AsyncReadback::AsyncReadback()
+:   mWidth(0),
+    mHeight(0),
+    mYuv(false),
+    mSequence(0),
+    mDisplay(EGL_NO_DISPLAY),
+    mContext(EGL_NO_CONTEXT),
+    mSurface(EGL_NO_SURFACE),
+    mThreadStatus(0),
+    mQuit(false),
+    mIssued(0),
+    mCompleted(0)
+{
+    for (int i = 0; i < READBACK_BUFFERS; i++) {
+        mBuffers[i].buffer = 0;
+        mBuffers[i].fence = 0;
+        mBuffers[i].sequence = 0;
+        mBuffers[i].capturedNs = 0;
+    }
+    resetStats();
+}
+
+AsyncReadback::~AsyncReadback() {
+    // destroy() should have run with the context current; only make sure
+    // the thread doesn't outlive its owner.
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mQueued.notify_all();
+        mThread.join();
+    }
+}
+
+bool AsyncReadback::init(int width, int height, bool yuv, const Callback& callback,
+        GLStateCache& state) {
+    mWidth = width;
+    mHeight = height;
+    mYuv = yuv;
+    mCallback = callback;
+    mSequence = 0;
+    mIssued = mCompleted = 0;
+
+    for (int i = 0; i < READBACK_BUFFERS; i++) {
+        glGenBuffers(1, &mBuffers[i].buffer);
+        state.bindBuffer(GL_PIXEL_PACK_BUFFER, mBuffers[i].buffer);
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)width * height * 4, NULL, GL_STREAM_READ);
+        if (yuv)
+            mBuffers[i].yuv.resize(i420Size(width, height));
+    }
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (checkGlError("AsyncReadback::init")) {
+        destroy(state);
+        return false;
+    }
+
+    if (!startThread())
+        ALOGV("readback: no shared context on a thread, delivering from the render thread");
+    return true;
+}
+
+bool AsyncReadback::startThread() {
+    mDisplay = eglGetCurrentDisplay();
+    EGLContext shared = eglGetCurrentContext();
+    if (shared == EGL_NO_CONTEXT)
+        return false;
+
+    // A context like the renderer's, in the same share group.
+    EGLint configId = 0, version = 0;
+    eglQueryContext(mDisplay, shared, EGL_CONFIG_ID, &configId);
+    eglQueryContext(mDisplay, shared, EGL_CONTEXT_CLIENT_VERSION, &version);
+    const EGLint configAttribs[] = { EGL_CONFIG_ID, configId, EGL_NONE };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(mDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs < 1)
+        return false;
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, version, EGL_NONE };
+    mContext = eglCreateContext(mDisplay, config, shared, contextAttribs);
+    if (mContext == EGL_NO_CONTEXT)
+        return false;
+    if (!hasEglExtension(mDisplay, "EGL_KHR_surfaceless_context")) {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        mSurface = eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+        if (mSurface == EGL_NO_SURFACE) {
+            destroyContext();
+            return false;
+        }
+    }
+
+    mThreadStatus = 0;
+    mQuit = false;
+    mThread = std::thread(&AsyncReadback::threadLoop, this);
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDelivered.wait(lock, [this] { return mThreadStatus != 0; });
+    if (mThreadStatus > 0)
+        return true;
+    lock.unlock();
+    mThread.join();
+    destroyContext();
+    return false;
+}
+
+void AsyncReadback::destroyContext() {
+    if (mSurface != EGL_NO_SURFACE)
+        eglDestroySurface(mDisplay, mSurface);
+    if (mContext != EGL_NO_CONTEXT)
+        eglDestroyContext(mDisplay, mContext);
+    mSurface = EGL_NO_SURFACE;
+    mContext = EGL_NO_CONTEXT;
+}
+
+void AsyncReadback::destroy(GLStateCache& state) {
+    if (isInitialized())
+        flush(state);
+    if (mThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mQuit = true;
+        }
+        mQueued.notify_all();
+        mThread.join();
+    }
+    destroyContext();
+
+    for (int i = 0; i < READBACK_BUFFERS; i++) {
+        if (mBuffers[i].fence)
+            glDeleteSync(mBuffers[i].fence);
+        state.forgetBuffer(mBuffers[i].buffer);
+        glDeleteBuffers(1, &mBuffers[i].buffer);
+        mBuffers[i].buffer = 0;
+        mBuffers[i].fence = 0;
+        std::vector<uint8_t>().swap(mBuffers[i].yuv);
+    }
+    mIssued = mCompleted = 0;
+}
+
+void AsyncReadback::threadLoop() {
+    bool current = eglMakeCurrent(mDisplay, mSurface, mSurface, mContext) == EGL_TRUE;
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mThreadStatus = current ? 1 : -1;
+    }
+    mDelivered.notify_all();
+    if (!current)
+        return;
+
+    for (;;) {
+        Buffer* buffer;
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mQueued.wait(lock, [this] { return mQuit || mCompleted != mIssued; });
+            if (mCompleted == mIssued)
+                break;
+            buffer = &mBuffers[mCompleted % READBACK_BUFFERS];
+        }
+        deliver(*buffer, NULL);
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mCompleted++;
+        }
+        mDelivered.notify_all();
+    }
+
+    eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+}
+
+void AsyncReadback::deliver(Buffer& buffer, GLStateCache* state) {
+    GLenum result;
+    do {
+        result = glClientWaitSync(buffer.fence, 0, READBACK_WAIT_TIMEOUT_NS);
+    } while (result == GL_TIMEOUT_EXPIRED);
+    if (result == GL_WAIT_FAILED)
+        ALOGE("readback: waiting for frame %u failed", buffer.sequence);
+    glDeleteSync(buffer.fence);
+    buffer.fence = 0;
+
+    if (state)
+        state->bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.buffer);
+    else
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, buffer.buffer);
+    const GLsizeiptr rowBytes = (GLsizeiptr)mWidth * 4;
+    const uint8_t* pixels = (const uint8_t*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+            rowBytes * mHeight, GL_MAP_READ_BIT);
+    uint64_t start = nowNs();
+    uint64_t convertNs = 0, callbackNs = 0;
+    if (pixels) {
+        ReadbackFrame frame;
+        frame.rgba = pixels + rowBytes * (mHeight - 1);
+        frame.stride = -rowBytes;
+        frame.width = mWidth;
+        frame.height = mHeight;
+        frame.sequence = buffer.sequence;
+        frame.capturedNs = buffer.capturedNs;
+        memset(&frame.yuv, 0, sizeof(frame.yuv));
+        if (mYuv) {
+            frame.yuv = i420Planes(&buffer.yuv[0], mWidth, mHeight);
+            rgbaToI420(frame.rgba, frame.stride, mWidth, mHeight, frame.yuv);
+            convertNs = nowNs() - start;
+        }
+        uint64_t callbackStart = nowNs();
+        mCallback(frame);
+        callbackNs = nowNs() - callbackStart;
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+        ALOGE("readback: mapping frame %u failed", buffer.sequence);
+    }
+
+    if (state) {
+        state->bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else {
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        // The unmap has to be done before the render context reads into
+        // the buffer again.
+        glFinish();
+    }
+
+    std::lock_guard<std::mutex> lock(mMutex);
+    if (pixels)
+        mStats.delivered++;
+    mStats.latencyNs += start - buffer.capturedNs;
+    mStats.convertNs += convertNs;
+    mStats.callbackNs += callbackNs;
+}
+
+void AsyncReadback::poll(GLStateCache& state, bool wait) {
+    while (mCompleted != mIssued) {
+        Buffer& buffer = mBuffers[mCompleted % READBACK_BUFFERS];
+        if (!wait) {
+            GLint status = GL_UNSIGNALED;
+            glGetSynciv(buffer.fence, GL_SYNC_STATUS, 1, NULL, &status);
+            if (status != GL_SIGNALED)
+                break;
+        }
+        deliver(buffer, &state);
+        std::lock_guard<std::mutex> lock(mMutex);
+        mCompleted++;
+    }
+}
+
+void AsyncReadback::capture(GLStateCache& state, GLuint framebuffer, bool wait) {
+    uint64_t start = nowNs();
+    unsigned int sequence = mSequence++;
+    if (!isThreaded())
+        poll(state, wait && mIssued - mCompleted == READBACK_BUFFERS);
+    {
+        // Only this thread queues, so mIssued can be read outside the lock.
+        std::unique_lock<std::mutex> lock(mMutex);
+        if (mIssued - mCompleted == READBACK_BUFFERS) {
+            if (!wait) {
+                mStats.dropped++;
+                mStats.captureNs += nowNs() - start;
+                return;
+            }
+            mStats.stalls++;
+            mDelivered.wait(lock, [this] { return mIssued - mCompleted < READBACK_BUFFERS; });
+        }
+    }
+
+    Buffer& buffer = mBuffers[mIssued % READBACK_BUFFERS];
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, buffer.buffer);
+    glReadPixels(0, 0, mWidth, mHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    // Unbound, so the next capture() rebinds it: a shared object changed
+    // by another context is only guaranteed up to date once rebound.
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    buffer.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    buffer.sequence = sequence;
+    buffer.capturedNs = start;
+    // The readback thread's wait can't flush this context's commands.
+    glFlush();
+
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mIssued++;
+        mStats.captured++;
+        mStats.captureNs += nowNs() - start;
+    }
+    mQueued.notify_one();
+}
+
+void AsyncReadback::flush(GLStateCache& state) {
+    if (!isThreaded()) {
+        poll(state, true);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDelivered.wait(lock, [this] { return mCompleted == mIssued; });
+}
+
+AsyncReadback::Stats AsyncReadback::stats() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    return mStats;
+}
+
+void AsyncReadback::resetStats() {
+    std::lock_guard<std::mutex> lock(mMutex);
+    memset(&mStats, 0, sizeof(mStats));
+}
@@ -0,0 +1,131 @@
+//
+// Asynchronous readback of rendered frames, for recording or streaming.
+// capture() only queues a glReadPixels into one of a ring of pixel pack
+// buffers and fences it; a thread with its own EGL context, sharing the
+// renderer's objects, waits for the fence, maps the buffer and hands the
+// mapped pixels to a callback. The render thread never waits for the GPU,
+// and the pixels are not copied on the way.
+//
+// Optionally the thread also converts each frame to I420 for a video
+// encoder, with the SIMD kernel of YuvConvert.h, into a buffer per slot.
+//
+// When no shared context can be made current on the thread, frames are
+// delivered from capture() on the render thread instead, once their fence
+// has passed, without waiting.
+//
+
+#ifndef OPENGL_DEMO_ASYNCREADBACK_H
+#define OPENGL_DEMO_ASYNCREADBACK_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <EGL/egl.h>
+
+#include "gles3jni.h"
+#include "YuvConvert.h"
+
+// Readbacks in flight; a frame is dropped when all are.
+#define READBACK_BUFFERS 3
+
+// A delivered frame. Valid only during the callback: rgba points into the
+// mapped pixel pack buffer.
+struct ReadbackFrame {
+    // Top row first. Rows are stride bytes apart; stride is negative, as GL
+    // returns rows bottom up.
+    const uint8_t* rgba;
+    ptrdiff_t stride;
+    int width;
+    int height;
+    unsigned int sequence;  // capture() calls before this one, dropped included
+    uint64_t capturedNs;    // nowNs() at capture()
+    // Top row first, when converting; all NULL otherwise.
+    I420Planes yuv;
+};
+
+class AsyncReadback {
+public:
+    typedef std::function<void(const ReadbackFrame& frame)> Callback;
+
+    struct Stats {
+        unsigned int captured;
+        unsigned int dropped;       // every buffer still in flight
+        unsigned int stalls;        // waits for a free buffer
+        unsigned int delivered;
+        uint64_t captureNs;         // render thread time inside capture(), stalls included
+        uint64_t latencyNs;         // capture() to callback, summed
+        uint64_t convertNs;         // YUV conversion, summed
+        uint64_t callbackNs;
+    };
+
+    AsyncReadback();
+    ~AsyncReadback();
+
+    // Reads back width x height frames. The render context must be current;
+    // callback runs on the readback thread, or inside capture() without one.
+    bool init(int width, int height, bool yuv, const Callback& callback, GLStateCache& state);
+    // Delivers the frames in flight, stops the thread and deletes the GL
+    // objects. The owner's context must be current.
+    void destroy(GLStateCache& state);
+    bool isInitialized() const { return mBuffers[0].buffer != 0; }
+    // Whether frames are delivered on the readback thread.
+    bool isThreaded() const { return mThread.joinable(); }
+
+    // Queues a readback of the lower left width x height pixels of color
+    // attachment 0 of framebuffer. When no buffer is free the frame is
+    // dropped, or with wait set, capture() blocks until one is: for output
+    // that can't lose frames. Leaves framebuffer bound for reading.
+    void capture(GLStateCache& state, GLuint framebuffer, bool wait = false);
+    // Blocks until every captured frame has been delivered.
+    void flush(GLStateCache& state);
+
+    Stats stats();
+    void resetStats();
+
+private:
+    struct Buffer {
+        GLuint buffer;
+        GLsync fence;
+        unsigned int sequence;
+        uint64_t capturedNs;
+        std::vector<uint8_t> yuv;
+    };
+
+    bool startThread();
+    void destroyContext();
+    void threadLoop();
+    // Maps buffer, whose fence has passed, and runs the callback. state is
+    // NULL on the readback thread, whose context GLStateCache doesn't track.
+    void deliver(Buffer& buffer, GLStateCache* state);
+    // Delivers finished frames on the render thread; waits for all of them
+    // when wait is set.
+    void poll(GLStateCache& state, bool wait);
+
+    int mWidth;
+    int mHeight;
+    bool mYuv;
+    Callback mCallback;
+    Buffer mBuffers[READBACK_BUFFERS];
+    unsigned int mSequence;
+
+    // The readback thread and its context.
+    std::thread mThread;
+    EGLDisplay mDisplay;
+    EGLContext mContext;
+    EGLSurface mSurface;    // 1x1 pbuffer without EGL_KHR_surfaceless_context
+    int mThreadStatus;  // 0 while starting, then 1 running or -1 failed
+
+    // Guards the counters below, mThreadStatus and mStats.
+    std::mutex mMutex;
+    std::condition_variable mQueued;
+    std::condition_variable mDelivered;
+    bool mQuit;
+    unsigned int mIssued;       // buffers ever queued
+    unsigned int mCompleted;    // buffers ever delivered and free again
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_ASYNCREADBACK_H
@@ -0,0 +1,407 @@
+//
+// Headless batch rendering of model images, see BatchRenderer.h.
+//
+
+#include "BatchRenderer.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+#include <EGL/eglext.h>
+
+#include "glm/gtc/matrix_transform.hpp"
+#include "glm/gtc/type_ptr.hpp"
+
+#include "ImageFile.h"
+#include "RenderPass.h"
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+static const char BATCH_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "layout(location = " STRV(BATCH_POS_ATTRIB) ") in vec3 pos;\n"
+        "layout(location = " STRV(BATCH_NORMAL_ATTRIB) ") in vec3 normal;\n"
+        "uniform mat4 mvp_mat;\n"
+        "out vec3 v_world_pos;\n"
+        "out vec3 v_normal;\n"
+        "void main() {\n"
+        "    gl_Position = mvp_mat * vec4(pos, 1.0);\n"
+        "    v_world_pos = pos;\n"
+        "    v_normal = normal;\n"
+        "}\n";
+
+// The main shader's Cook-Torrance key light on a neutral grey dielectric,
+// with a sky-to-ground ambient in place of the image-based lighting: asset
+// previews show the shape, not the demo's lights.
+static const char BATCH_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "in vec3 v_world_pos;\n"
+        "in vec3 v_normal;\n"
+        "out vec4 outColor;\n"
+        "uniform vec3 eyePos;\n"
+        "uniform vec3 keyDir;\n"
+        "#define PI 3.14159265\n"
+        "const float alpha = 0.4;\n"
+        "const vec3 f0 = vec3(0.04);\n"
+        "const vec3 albedo = vec3(0.7);\n"
+        "const vec3 sky = vec3(0.45, 0.48, 0.55);\n"
+        "const vec3 ground = vec3(0.18, 0.16, 0.15);\n"
+        "float geometry_ggx(float ndotv, float k) {\n"
+        "    return ndotv / (ndotv * (1.0 - k) + k);\n"
+        "}\n"
+        "void main() {\n"
+        "    vec3 n = normalize(v_normal);\n"
+        "    vec3 v = normalize(eyePos - v_world_pos);\n"
+        // Asset meshes are often open, single sided or wound inconsistently:
+        // light the side that is seen.
+        "    if (dot(n, v) < 0.0) n = -n;\n"
+        "    vec3 h = normalize(keyDir + v);\n"
+        "    float n_dot_l = max(dot(n, keyDir), 0.0);\n"
+        "    float n_dot_v = max(dot(n, v), 0.0);\n"
+        "    float n_dot_h = dot(n, h);\n"
+        "    float D = alpha * alpha / (PI * pow(n_dot_h * n_dot_h * (alpha * alpha - 1.0) + 1.0, 2.0));\n"
+        "    float k = (alpha + 1.0) * (alpha + 1.0) / 8.0;\n"
+        "    float G = geometry_ggx(n_dot_v, k) * geometry_ggx(n_dot_l, k);\n"
+        "    vec3 F = f0 + (1.0 - f0) * pow(clamp(1.0 - max(dot(h, v), 0.0), 0.0, 1.0), 5.0);\n"
+        "    vec3 specular = D * G * F / max(4.0 * n_dot_v * n_dot_l, 0.001);\n"
+        "    vec3 direct = ((1.0 - F) * albedo / PI + specular) * 2.5 * n_dot_l;\n"
+        "    vec3 ambient = albedo * mix(ground, sky, 0.5 + 0.5 * n.y);\n"
+        "    outColor = vec4(clamp(direct + ambient, 0.0, 1.0), 1.0);\n"
+        "}\n";
+
+// ---------------------------------------------------------------------------
+
+HeadlessContext::HeadlessContext()
+:   mDisplay(EGL_NO_DISPLAY),
+    mContext(EGL_NO_CONTEXT),
+    mSurface(EGL_NO_SURFACE)
+{}
+
+HeadlessContext::~HeadlessContext() {
+    destroy();
+}
+
+bool HeadlessContext::create() {
+    mDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    if (mDisplay == EGL_NO_DISPLAY || !eglInitialize(mDisplay, NULL, NULL)) {
+        ALOGE("HeadlessContext: no EGL display");
+        mDisplay = EGL_NO_DISPLAY;
+        return false;
+    }
+    bool surfaceless = hasEglExtension(mDisplay, "EGL_KHR_surfaceless_context");
+    const EGLint configAttribs[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT_KHR,
+        EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(mDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs < 1) {
+        ALOGE("HeadlessContext: no ES 3 config");
+        destroy();
+        return false;
+    }
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint contextAttribs[] = { EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE };
+    mContext = eglCreateContext(mDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+    if (mContext != EGL_NO_CONTEXT && !surfaceless) {
+        const EGLint pbufferAttribs[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+        mSurface = eglCreatePbufferSurface(mDisplay, config, pbufferAttribs);
+    }
+    if (mContext == EGL_NO_CONTEXT || (!surfaceless && mSurface == EGL_NO_SURFACE) ||
+            !eglMakeCurrent(mDisplay, mSurface, mSurface, mContext)) {
+        ALOGE("HeadlessContext: can't make a context current, error 0x%x", eglGetError());
+        destroy();
+        return false;
+    }
+    return true;
+}
+
+void HeadlessContext::destroy() {
+    if (mDisplay == EGL_NO_DISPLAY)
+        return;
+    if (eglGetCurrentContext() == mContext)
+        eglMakeCurrent(mDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (mSurface != EGL_NO_SURFACE)
+        eglDestroySurface(mDisplay, mSurface);
+    if (mContext != EGL_NO_CONTEXT)
+        eglDestroyContext(mDisplay, mContext);
+    // The display stays initialized: terminating it would take any other
+    // context of the process with it.
+    eglReleaseThread();
+    mDisplay = EGL_NO_DISPLAY;
+    mContext = EGL_NO_CONTEXT;
+    mSurface = EGL_NO_SURFACE;
+}
+
+// ---------------------------------------------------------------------------
+
+BatchRenderer::BatchRenderer()
+:   mColor(-1),
+    mMsaaColor(-1),
+    mMsaaDepth(-1),
+    mDepth(-1),
+    mProgram(0),
+    mMvpUniform(-1),
+    mEyePosUniform(-1),
+    mKeyDirUniform(-1),
+    mVAO(0),
+    mVB(0),
+    mIB(0),
+    mIndexCount(0)
+{
+    memset(&mOptions, 0, sizeof(mOptions));
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+BatchRenderer::~BatchRenderer() {
+    if (mProgram)
+        destroy();
+}
+
+bool BatchRenderer::init(const BatchOptions& options) {
+    mOptions = options;
+    mOutputDir = options.outputDir ? options.outputDir : ".";
+    mOptions.outputDir = mOutputDir.c_str();
+    if (mOptions.views < 1)
+        mOptions.views = 1;
+
+    mProgram = createProgram(BATCH_VERTEX_SHADER, BATCH_FRAGMENT_SHADER);
+    if (!mProgram)
+        return false;
+    mMvpUniform = glGetUniformLocation(mProgram, "mvp_mat");
+    mEyePosUniform = glGetUniformLocation(mProgram, "eyePos");
+    mKeyDirUniform = glGetUniformLocation(mProgram, "keyDir");
+
+    glGenVertexArrays(1, &mVAO);
+    glGenBuffers(1, &mVB);
+    glGenBuffers(1, &mIB);
+    mGLState.bindVertexArray(mVAO);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB);
+    glVertexAttribPointer(BATCH_POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
+            (const GLvoid*)offsetof(Vertex2, Position));
+    glEnableVertexAttribArray(BATCH_POS_ATTRIB);
+    glVertexAttribPointer(BATCH_NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
+            (const GLvoid*)offsetof(Vertex2, Normal));
+    glEnableVertexAttribArray(BATCH_NORMAL_ATTRIB);
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mIB);
+    mGLState.bindVertexArray(0);
+
+    // The targets are kept for the whole batch.
+    GLint maxSamples = 1;
+    glGetInternalformativ(GL_RENDERBUFFER, GL_RGBA8, GL_SAMPLES, 1, &maxSamples);
+    GLsizei samples = BATCH_MSAA_SAMPLES < maxSamples ? BATCH_MSAA_SAMPLES : maxSamples;
+    RenderTargetDesc color = { mOptions.width, mOptions.height, GL_RGBA8, 1 };
+    RenderTargetDesc depth = { mOptions.width, mOptions.height, GL_DEPTH_COMPONENT24, 1 };
+    mColor = mTargets.acquire(color, mGLState);
+    if (samples > 1) {
+        color.samples = depth.samples = samples;
+        mMsaaColor = mTargets.acquire(color, mGLState);
+        mMsaaDepth = mTargets.acquire(depth, mGLState);
+    } else {
+        mDepth = mTargets.acquire(depth, mGLState);
+    }
+
+    if (!mReadback.init(mOptions.width, mOptions.height, false,
+            [this](const ReadbackFrame& frame) { writeImage(frame); }, mGLState)) {
+        destroy();
+        return false;
+    }
+    if (checkGlError("BatchRenderer::init")) {
+        destroy();
+        return false;
+    }
+    ALOGV("batch: %dx%d, %u views per model, %d samples, %s", mOptions.width, mOptions.height,
+          mOptions.views, samples > 1 ? samples : 1,
+          mReadback.isThreaded() ? "written on the readback thread" : "written on the render thread");
+    return true;
+}
+
+void BatchRenderer::destroy() {
+    mReadback.destroy(mGLState);
+    mTargets.destroy(mGLState);
+    mColor = mMsaaColor = mMsaaDepth = mDepth = -1;
+    mGLState.forgetBuffer(mVB);
+    mGLState.forgetBuffer(mIB);
+    glDeleteBuffers(1, &mVB);
+    glDeleteBuffers(1, &mIB);
+    glDeleteVertexArrays(1, &mVAO);
+    glDeleteProgram(mProgram);
+    mVB = mIB = mVAO = mProgram = 0;
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+void BatchRenderer::upload(const Mesh& mesh) {
+    mGLState.bindVertexArray(mVAO);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)(mesh.vertices.size() * sizeof(Vertex2)),
+            &mesh.vertices[0], GL_STATIC_DRAW);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, (GLsizeiptr)(mesh.indices.size() * sizeof(unsigned int)),
+            &mesh.indices[0], GL_STATIC_DRAW);
+    mIndexCount = (unsigned int)mesh.indices.size();
+}
+
+// View 0 looks at the model from +z, the others follow counterclockwise
+// seen from above. The key light is fixed relative to the camera, above
+// and to the left, so every view is lit alike.
+void BatchRenderer::drawView(const Mesh& mesh, unsigned int view) {
+    const glm::vec3 up(0.0f, 1.0f, 0.0f);
+    const float aspect = float(mOptions.width) / float(mOptions.height);
+    const float halfFovX = atanf(tanf(0.5f * BATCH_FOV_Y) * aspect);
+    const float halfFov = aspect < 1.0f ? halfFovX : 0.5f * BATCH_FOV_Y;
+    const float radius = mesh.sphere.radius > 0.0f ? mesh.sphere.radius : 1.0f;
+    const float distance = BATCH_FRAMING * radius / sinf(halfFov);
+    const float azimuth = float(TWO_PI) * view / mOptions.views;
+    const float elevation = BATCH_ELEVATION_DEGREES * float(M_PI) / 180.0f;
+    const glm::vec3 toEye(cosf(elevation) * sinf(azimuth), sinf(elevation),
+            cosf(elevation) * cosf(azimuth));
+    const glm::vec3 eye = mesh.sphere.center + distance * toEye;
+    const glm::vec3 right = glm::normalize(glm::cross(up, toEye));
+    const glm::vec3 keyDir = glm::normalize(toEye + 0.8f * up - 0.6f * right);
+
+    glm::mat4 view_mat = glm::lookAt(eye, mesh.sphere.center, up);
+    float near = distance - 1.01f * radius;
+    if (near < 0.01f * distance)
+        near = 0.01f * distance;
+    glm::mat4 project_mat = glm::perspective(BATCH_FOV_Y, aspect, near, distance + 1.01f * radius);
+    glm::mat4 mvp_mat = project_mat * view_mat;
+
+    GLuint framebuffer = mMsaaColor >= 0 ?
+            mTargets.framebuffer(mMsaaColor, mMsaaDepth) : mTargets.framebuffer(mColor, mDepth);
+    RenderPass pass(framebuffer, mOptions.width, mOptions.height);
+    // Transparent background, for thumbnails over any UI.
+    memset(pass.clearColor, 0, sizeof(pass.clearColor));
+    if (mMsaaColor >= 0) {
+        pass.resolveFramebuffer = mTargets.framebuffer(mColor);
+        pass.colorStore = STORE_ACTION_RESOLVE;
+    }
+    pass.begin(mGLState);
+    mGLState.setEnabled(GL_DEPTH_TEST, true);
+    mGLState.setEnabled(GL_BLEND, false);
+    mGLState.setEnabled(GL_CULL_FACE, false);
+    mGLState.useProgram(mProgram);
+    glUniformMatrix4fv(mMvpUniform, 1, GL_FALSE, glm::value_ptr(mvp_mat));
+    glUniform3fv(mEyePosUniform, 1, glm::value_ptr(eye));
+    glUniform3fv(mKeyDirUniform, 1, glm::value_ptr(keyDir));
+    mGLState.bindVertexArray(mVAO);
+    glDrawElements(GL_TRIANGLES, (GLsizei)mIndexCount, GL_UNSIGNED_INT, 0);
+    pass.end(mGLState);
+}
+
+// On the readback thread, straight from the mapped pixels.
+void BatchRenderer::writeImage(const ReadbackFrame& frame) {
+    uint64_t start = nowNs();
+    const std::string& path = mImageNames[frame.sequence % (READBACK_BUFFERS + 1)];
+    bool ok = mOptions.format == BATCH_FORMAT_PNG ?
+            writePng(path.c_str(), frame.rgba, frame.stride, frame.width, frame.height) :
+            writeRaw(path.c_str(), frame.rgba, frame.stride, frame.width, frame.height);
+    if (ok)
+        mStats.images++;
+    else
+        mStats.writeErrors++;
+    mStats.writeNs += nowNs() - start;
+}
+
+static void loadMesh(const std::string& path, Mesh* mesh, bool* loaded, uint64_t* loadNs) {
+    uint64_t start = nowNs();
+    *loaded = LoadMesh(path.c_str(), mesh);
+    *loadNs += nowNs() - start;
+}
+
+// The file name without directories or extension.
+static std::string modelName(const std::string& path) {
+    size_t slash = path.find_last_of('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    size_t dot = name.find_last_of('.');
+    return dot == std::string::npos || dot == 0 ? name : name.substr(0, dot);
+}
+
+unsigned int BatchRenderer::run(const std::vector<std::string>& paths) {
+    uint64_t start = nowNs();
+    unsigned int rendered = 0;
+    unsigned int sequence = 0;
+    if (paths.empty())
+        return 0;
+
+    // Two meshes: one rendering, the next one loading.
+    Mesh meshes[2];
+    bool loaded[2] = { false, false };
+    std::thread loader(loadMesh, paths[0], &meshes[0], &loaded[0], &mStats.loadNs);
+    for (size_t i = 0; i < paths.size(); i++) {
+        const unsigned int current = i & 1;
+        uint64_t waitStart = nowNs();
+        loader.join();
+        mStats.loadWaitNs += nowNs() - waitStart;
+        if (i + 1 < paths.size()) {
+            loader = std::thread(loadMesh, paths[i + 1], &meshes[current ^ 1],
+                    &loaded[current ^ 1], &mStats.loadNs);
+        }
+
+        const Mesh& mesh = meshes[current];
+        if (!loaded[current]) {
+            ALOGE("batch: can't load %s, skipped", paths[i].c_str());
+            mStats.failed++;
+            continue;
+        }
+        upload(mesh);
+
+        const std::string name = mOutputDir + "/" + modelName(paths[i]);
+        for (unsigned int view = 0; view < mOptions.views; view++) {
+            drawView(mesh, view);
+            char suffix[64];
+            if (mOptions.format == BATCH_FORMAT_PNG)
+                snprintf(suffix, sizeof(suffix), "_%03u.png", view);
+            else
+                snprintf(suffix, sizeof(suffix), "_%03u_%dx%d.rgba", view,
+                        mOptions.width, mOptions.height);
+            mImageNames[sequence++ % (READBACK_BUFFERS + 1)] = name + suffix;
+            mReadback.capture(mGLState, mTargets.framebuffer(mColor), true);
+        }
+        rendered++;
+        mStats.models++;
+    }
+    mReadback.flush(mGLState);
+    checkGlError("BatchRenderer::run");
+    mStats.totalNs += nowNs() - start;
+    return rendered;
+}
+
+// ---------------------------------------------------------------------------
+
+int renderBatch(const std::vector<std::string>& paths, const BatchOptions& options) {
+    HeadlessContext context;
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT && !context.create())
+        return -1;
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if (!version || !strstr(version, "OpenGL ES 3.")) {
+        ALOGE("batch: needs OpenGL ES 3, got %s", version ? version : "nothing");
+        return -1;
+    }
+#if DYNAMIC_ES3
+    if (!gl3stubInit())
+        return -1;
+#endif
+
+    BatchRenderer renderer;
+    if (!renderer.init(options))
+        return -1;
+    unsigned int rendered = renderer.run(paths);
+    renderer.destroy();
+
+    const BatchRenderer::Stats& stats = renderer.stats();
+    double seconds = stats.totalNs * 1e-9;
+    unsigned int models = stats.models > 0 ? stats.models : 1;
+    unsigned int images = stats.images > 0 ? stats.images : 1;
+    ALOGV("batch: %u models (%u failed), %u images (%u write errors) in %.2f s: "
+          "%.2f models/s, %.1f images/s; loading %.1f ms/model on the loader, "
+          "%.1f ms waited for in all; writing %.1f ms/image",
+          stats.models, stats.failed, stats.images, stats.writeErrors, seconds,
+          seconds > 0.0 ? stats.models / seconds : 0.0, seconds > 0.0 ? stats.images / seconds : 0.0,
+          stats.loadNs * 1e-6 / (models + stats.failed), stats.loadWaitNs * 1e-6,
+          stats.writeNs * 1e-6 / images);
+    return (int)rendered;
+}
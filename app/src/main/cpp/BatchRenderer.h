@@ -0,0 +1,135 @@
+//
+// Headless batch rendering for the asset pipeline: thumbnails and
+// turntables of a list of models, without the activity or a window.
+// Each model is loaded with LoadMesh, framed by its bounding sphere and
+// rendered from views evenly spaced around it into an offscreen target,
+// then written as PNG or raw RGBA by the readback thread of AsyncReadback.
+//
+// While one model renders the next one loads on a thread of its own, so
+// with enough views per model the GPU and the encoder hide the loading.
+//
+// Besides GLES3JNILib.renderBatch, tools/BatchMain.cpp runs it as a
+// standalone executable, batch_render, with no app process.
+//
+
+#ifndef OPENGL_DEMO_BATCHRENDERER_H
+#define OPENGL_DEMO_BATCHRENDERER_H
+
+#include <string>
+#include <vector>
+
+#include <EGL/egl.h>
+
+#include "gles3jni.h"
+#include "AsyncReadback.h"
+#include "Mesh.h"
+#include "RenderTargetPool.h"
+
+#define BATCH_POS_ATTRIB 0
+#define BATCH_NORMAL_ATTRIB 1
+
+// The camera orbits this high above the model's center, and frames its
+// bounding sphere with this much margin.
+#define BATCH_ELEVATION_DEGREES 20.0f
+#define BATCH_FRAMING 1.05f
+#define BATCH_FOV_Y (0.25f * (float)M_PI)
+// Antialiasing of the offscreen target, clamped to what GL_RGBA8 allows.
+#define BATCH_MSAA_SAMPLES 4
+
+enum BatchImageFormat {
+    BATCH_FORMAT_PNG,
+    BATCH_FORMAT_RAW,   // width x height x 4 bytes, top row first
+};
+
+struct BatchOptions {
+    int width;
+    int height;
+    unsigned int views;     // per model, the first one from the front (+z)
+    BatchImageFormat format;
+    // Images are written here as <model>_<view>.png, or
+    // <model>_<view>_<width>x<height>.rgba; model is the file name without
+    // its extension.
+    const char* outputDir;
+};
+
+// An ES 3 context with no window surface, current on the thread that
+// created it: surfaceless where EGL_KHR_surfaceless_context allows, on a
+// 1x1 pbuffer otherwise. Rendering goes to framebuffer objects.
+class HeadlessContext {
+public:
+    HeadlessContext();
+    ~HeadlessContext();
+
+    bool create();
+    void destroy();
+
+private:
+    EGLDisplay mDisplay;
+    EGLContext mContext;
+    EGLSurface mSurface;
+};
+
+class BatchRenderer {
+public:
+    struct Stats {
+        unsigned int models;        // rendered
+        unsigned int failed;        // failed to load
+        unsigned int images;        // written
+        unsigned int writeErrors;
+        uint64_t totalNs;
+        uint64_t loadNs;            // on the loader thread, summed
+        uint64_t loadWaitNs;        // render thread waiting for the loader
+        uint64_t writeNs;           // encoding and writing, on the readback thread
+    };
+
+    BatchRenderer();
+    ~BatchRenderer();
+
+    // A context must be current; see HeadlessContext.
+    bool init(const BatchOptions& options);
+    // Deletes the GL objects. The context must be current.
+    void destroy();
+
+    // Renders every model in paths, in order. Returns the number rendered;
+    // models that fail to load are skipped.
+    unsigned int run(const std::vector<std::string>& paths);
+
+    const Stats& stats() const { return mStats; }
+
+private:
+    // Uploads mesh to the vertex and index buffers.
+    void upload(const Mesh& mesh);
+    void drawView(const Mesh& mesh, unsigned int view);
+    void writeImage(const ReadbackFrame& frame);
+
+    BatchOptions mOptions;
+    std::string mOutputDir;
+    GLStateCache mGLState;
+    RenderTargetPool mTargets;
+    int mColor;
+    int mMsaaColor;     // -1 without multisampling
+    int mMsaaDepth;
+    int mDepth;
+    GLuint mProgram;
+    GLint mMvpUniform;
+    GLint mEyePosUniform;
+    GLint mKeyDirUniform;
+    GLuint mVAO;
+    GLuint mVB;
+    GLuint mIB;
+    unsigned int mIndexCount;
+    AsyncReadback mReadback;
+
+    // File names of the frames in flight, by ReadbackFrame::sequence.
+    // capture() keeps at most READBACK_BUFFERS frames in flight, so one
+    // more entry is never overwritten before its frame is written.
+    std::string mImageNames[READBACK_BUFFERS + 1];
+    Stats mStats;
+};
+
+// Renders paths with options on a HeadlessContext of its own, or on the
+// current context if there is one, and reports the throughput. Returns the
+// number of models rendered, or -1 without a usable ES 3 context.
+int renderBatch(const std::vector<std::string>& paths, const BatchOptions& options);
+
+#endif //OPENGL_DEMO_BATCHRENDERER_H
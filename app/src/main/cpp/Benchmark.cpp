@@ -0,0 +1,820 @@
+//
+// Microbenchmarks, see Benchmark.h.
+//
+
+#include "Benchmark.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#include <EGL/egl.h>
+
+#include "glm/gtc/matrix_transform.hpp"
+
+#include "gles3jni.h"
+#include "AsyncReadback.h"
+#include "ClusteredLighting.h"
+#include "Culling.h"
+#include "DepthOfField.h"
+#include "DynamicResolution.h"
+#include "InstanceKernel.h"
+#include "MatrixMath.h"
+#include "RenderPass.h"
+#include "Simd.h"
+#include "ToneMapper.h"
+#include "WorkerPool.h"
+#include "YuvConvert.h"
+
+// Every measurement processes about this many items in total.
+#define BENCH_ITEMS_PER_RUN (1u << 24)
+// drand48 seed of the simulated frame time noise.
+#define BENCH_DYNRES_SEED 0xd1e5
+
+template <typename Fn>
+static double nsPerItem(unsigned int items, Fn fn) {
+    unsigned int iterations = BENCH_ITEMS_PER_RUN / items;
+    if (iterations < 4)
+        iterations = 4;
+    fn();   // warm up caches and the worker pool
+    uint64_t start = nowNs();
+    for (unsigned int i = 0; i < iterations; i++)
+        fn();
+    return double(nowNs() - start) / (double(iterations) * items);
+}
+
+void runBenchmarks() {
+    ALOGV("Benchmarks: %u threads", WorkerPool::shared().threadCount());
+    benchStepKernel();
+    benchCulling();
+    benchMatrixMath();
+    benchStateCache();
+    benchClusteredLights();
+    benchDynamicResolution();
+    benchDepthOfField();
+    benchHdrFormats();
+    benchReadback();
+}
+
+void benchStepKernel() {
+    const float scale[2] = {0.05f, 0.08f};
+    const float dt = 1.0f / 60.0f;
+
+    for (unsigned int n = 256; n <= (1u << 20); n *= 4) {
+        std::vector<float> velocities(n), angles(n), reference(n);
+        std::vector<float> transforms(4*n), referenceTransforms(4*n);
+        for (unsigned int i = 0; i < n; i++) {
+            velocities[i] = float(MAX_ROT_SPEED * (2.0*drand48() - 1.0));
+            angles[i] = reference[i] = float(drand48() * TWO_PI);
+        }
+
+        // Parity on one step from identical state.
+        stepInstancesScalar(&reference[0], &velocities[0], scale, dt, 0, n, &referenceTransforms[0]);
+        stepInstancesRange(&angles[0], &velocities[0], scale, dt, 0, n, &transforms[0]);
+        float maxError = 0.0f;
+        for (unsigned int i = 0; i < 4*n; i++)
+            maxError = fmaxf(maxError, fabsf(transforms[i] - referenceTransforms[i]));
+
+        double scalar = nsPerItem(n, [&] {
+            stepInstancesScalar(&angles[0], &velocities[0], scale, dt, 0, n, &transforms[0]);
+        });
+        double simd = nsPerItem(n, [&] {
+            stepInstancesRange(&angles[0], &velocities[0], scale, dt, 0, n, &transforms[0]);
+        });
+        double threaded = nsPerItem(n, [&] {
+            WorkerPool::shared().parallelFor(n, 4096, [&](unsigned int begin, unsigned int end) {
+                stepInstancesRange(&angles[0], &velocities[0], scale, dt, begin, end, &transforms[0]);
+            });
+        });
+
+        ALOGV("step %8u instances: scalar %6.2f ns, simd %6.2f ns (%4.1fx), "
+              "threaded %6.2f ns (%4.1fx) per instance, max error %.2e%s",
+              n, scalar, simd, scalar / simd, threaded, scalar / threaded, maxError,
+              n >= PARALLEL_STEP_MIN_INSTANCES ? " [threaded in renderer]" : "");
+    }
+}
+
+void benchCulling() {
+    // Camera at the origin looking down -z; spheres fill a 200^3 box around
+    // it, so only a small fraction lands inside the 45 degree frustum.
+    glm::mat4 viewProj = glm::perspective((float)M_PI_4, 16.0f / 9.0f, 0.1f, 100.0f) *
+            glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    Frustum frustum;
+    extractFrustum(viewProj, &frustum);
+
+    for (unsigned int n = 1024; n <= (1u << 20); n *= 16) {
+        std::vector<float> x(n), y(n), z(n), r(n);
+        std::vector<unsigned int> visible(n), referenceVisible(n);
+        for (unsigned int i = 0; i < n; i++) {
+            x[i] = float(200.0 * drand48() - 100.0);
+            y[i] = float(200.0 * drand48() - 100.0);
+            z[i] = float(200.0 * drand48() - 100.0);
+            r[i] = float(0.1 + 2.0 * drand48());
+        }
+
+        unsigned int numVisible = 0, numReference = 0;
+        double scalar = nsPerItem(n, [&] {
+            numReference = cullSpheresScalar(frustum, &x[0], &y[0], &z[0], &r[0], 0.0f, n,
+                    &referenceVisible[0]);
+        });
+        double simd = nsPerItem(n, [&] {
+            numVisible = cullSpheres(frustum, &x[0], &y[0], &z[0], &r[0], 0.0f, n, &visible[0]);
+        });
+        bool match = numVisible == numReference &&
+                std::equal(visible.begin(), visible.begin() + numVisible, referenceVisible.begin());
+
+        ALOGV("cull %8u spheres: scalar %5.2f ns, simd %5.2f ns (%4.1fx) per sphere, "
+              "%.1f M spheres/s, %.1f%% visible%s",
+              n, scalar, simd, scalar / simd, 1000.0 / simd, 100.0 * numVisible / n,
+              match ? "" : " MISMATCH");
+    }
+}
+
+// Largest difference between two matrices, relative to the reference's
+// magnitude where that is over 1.
+static float matrixError(const glm::mat4& m, const glm::mat4& reference) {
+    float maxError = 0.0f;
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 4; r++)
+            maxError = fmaxf(maxError, fabsf(m[c][r] - reference[c][r]) /
+                    fmaxf(1.0f, fabsf(reference[c][r])));
+    return maxError;
+}
+
+// out[i] = m * in[i] for count vectors, the batch counterpart of
+// mat4Multiply(). Only measured: the renderers move points through
+// mat4TransformPoints().
+static void mat4TransformBatch(const glm::aligned_mat4& m, const glm::aligned_vec4* in,
+        glm::aligned_vec4* out, unsigned int count) {
+    // The columns stay in registers; each vector is four splats and four
+    // multiply-adds, two vectors per iteration to overlap their chains.
+    const v4f c0 = v4fLoad(&m[0][0]), c1 = v4fLoad(&m[1][0]);
+    const v4f c2 = v4fLoad(&m[2][0]), c3 = v4fLoad(&m[3][0]);
+    unsigned int i = 0;
+    for (; i + 2 <= count; i += 2) {
+        const float* p = &in[i][0];
+        const float* q = &in[i + 1][0];
+        v4f r = v4fMul(c0, v4fSplat(p[0]));
+        v4f s = v4fMul(c0, v4fSplat(q[0]));
+        r = v4fMadd(c1, v4fSplat(p[1]), r);
+        s = v4fMadd(c1, v4fSplat(q[1]), s);
+        r = v4fMadd(c2, v4fSplat(p[2]), r);
+        s = v4fMadd(c2, v4fSplat(q[2]), s);
+        r = v4fMadd(c3, v4fSplat(p[3]), r);
+        s = v4fMadd(c3, v4fSplat(q[3]), s);
+        v4fStore(&out[i][0], r);
+        v4fStore(&out[i + 1][0], s);
+    }
+    for (; i < count; i++)
+        out[i] = m * in[i];
+}
+
+void benchMatrixMath() {
+    // Object-to-world matrices: translation in a 100^3 box, any rotation,
+    // scale 0.5 to 2 per axis, so every one is comfortably invertible.
+    const unsigned int n = 4096;
+    std::vector<glm::mat4> packed(n), packedOut(n);
+    std::vector<glm::aligned_mat4> aligned(n), alignedOut(n), simdOut(n);
+    for (unsigned int i = 0; i < n; i++) {
+        glm::vec3 axis = glm::normalize(glm::vec3(float(drand48() - 0.5), float(drand48() - 0.5),
+                float(drand48() - 0.5)) + glm::vec3(0.0f, 1e-3f, 0.0f));
+        packed[i] = glm::scale(glm::rotate(glm::translate(glm::mat4(1.0f),
+                        glm::vec3(float(100.0 * drand48() - 50.0), float(100.0 * drand48() - 50.0),
+                                float(100.0 * drand48() - 50.0))),
+                        float(drand48() * TWO_PI), axis),
+                glm::vec3(float(0.5 + 1.5 * drand48()), float(0.5 + 1.5 * drand48()),
+                        float(0.5 + 1.5 * drand48())));
+        aligned[i] = packed[i];
+    }
+
+    // Chained products, a[i] * a[i + 1], as when concatenating transforms.
+    double glmNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            packedOut[i] = packed[i] * packed[(i + 1) & (n - 1)];
+    });
+    double alignedNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            alignedOut[i] = aligned[i] * aligned[(i + 1) & (n - 1)];
+    });
+    double simdNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            mat4Multiply(aligned[i], aligned[(i + 1) & (n - 1)], &simdOut[i]);
+    });
+    float maxError = 0.0f;
+    for (unsigned int i = 0; i < n; i++)
+        maxError = fmaxf(maxError, fmaxf(matrixError(alignedOut[i], packedOut[i]),
+                matrixError(simdOut[i], packedOut[i])));
+    ALOGV("mat4 * mat4: glm %5.2f ns, glm aligned %5.2f ns (%4.1fx), simd %5.2f ns (%4.1fx) "
+          "per product, max error %.2e", glmNs, alignedNs, glmNs / alignedNs, simdNs,
+          glmNs / simdNs, maxError);
+
+    // One matrix through a batch of points, as when moving instances or
+    // lights to view space; the count is not a multiple of 4.
+    const unsigned int m = 65536 + 3;
+    std::vector<glm::vec4> points(m), pointsOut(m);
+    std::vector<glm::aligned_vec4> alignedPoints(m), alignedPointsOut(m), simdPointsOut(m);
+    for (unsigned int i = 0; i < m; i++) {
+        points[i] = glm::vec4(float(100.0 * drand48() - 50.0), float(100.0 * drand48() - 50.0),
+                float(100.0 * drand48() - 50.0), 1.0f);
+        alignedPoints[i] = points[i];
+    }
+    const glm::mat4& transform = packed[0];
+    const glm::aligned_mat4& alignedTransform = aligned[0];
+    glmNs = nsPerItem(m, [&] {
+        for (unsigned int i = 0; i < m; i++)
+            pointsOut[i] = transform * points[i];
+    });
+    alignedNs = nsPerItem(m, [&] {
+        for (unsigned int i = 0; i < m; i++)
+            alignedPointsOut[i] = alignedTransform * alignedPoints[i];
+    });
+    simdNs = nsPerItem(m, [&] {
+        mat4TransformBatch(alignedTransform, &alignedPoints[0], &simdPointsOut[0], m);
+    });
+    maxError = 0.0f;
+    for (unsigned int i = 0; i < m; i++)
+        for (int c = 0; c < 4; c++) {
+            float scale = fmaxf(1.0f, fabsf(pointsOut[i][c]));
+            maxError = fmaxf(maxError, fabsf(alignedPointsOut[i][c] - pointsOut[i][c]) / scale);
+            maxError = fmaxf(maxError, fabsf(simdPointsOut[i][c] - pointsOut[i][c]) / scale);
+        }
+    ALOGV("mat4 * vec4: glm %5.2f ns, glm aligned %5.2f ns (%4.1fx), simd batch %5.2f ns "
+          "(%4.1fx) per vector, max error %.2e", glmNs, alignedNs, glmNs / alignedNs, simdNs,
+          glmNs / simdNs, maxError);
+
+    glmNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            packedOut[i] = glm::inverse(packed[i]);
+    });
+    alignedNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            alignedOut[i] = glm::inverse(aligned[i]);
+    });
+    simdNs = nsPerItem(n, [&] {
+        for (unsigned int i = 0; i < n; i++)
+            simdOut[i] = mat4Inverse(aligned[i]);
+    });
+    // The inverse times the original should also come back to identity.
+    maxError = 0.0f;
+    float identityError = 0.0f;
+    for (unsigned int i = 0; i < n; i++) {
+        maxError = fmaxf(maxError, fmaxf(matrixError(alignedOut[i], packedOut[i]),
+                matrixError(simdOut[i], packedOut[i])));
+        identityError = fmaxf(identityError,
+                matrixError(glm::mat4(simdOut[i]) * packed[i], glm::mat4(1.0f)));
+    }
+    ALOGV("inverse(mat4): glm %5.2f ns, glm aligned %5.2f ns (%4.1fx), simd %5.2f ns (%4.1fx) "
+          "per inverse, max error %.2e, identity error %.2e", glmNs, alignedNs,
+          glmNs / alignedNs, simdNs, glmNs / simdNs, maxError, identityError);
+}
+
+// Shaped like RendererES3::draw() before the cache: every sub-mesh batch
+// re-sets program, VAO and textures, most of which are already bound.
+static void issueStateFrame(GLuint program, GLuint vao, GLuint vb, const GLuint* textures,
+        unsigned int batches) {
+    glViewport(0, 0, 1, 1);
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_BLEND);
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    for (unsigned int i = 0; i < batches; i++) {
+        glUseProgram(program);
+        glBindVertexArray(vao);
+        glBindBuffer(GL_ARRAY_BUFFER, vb);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, textures[0]);
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, textures[1]);
+    }
+}
+
+static void issueStateFrame(GLStateCache& state, GLuint program, GLuint vao, GLuint vb,
+        const GLuint* textures, unsigned int batches) {
+    state.viewport(0, 0, 1, 1);
+    state.setEnabled(GL_DEPTH_TEST, true);
+    state.setEnabled(GL_BLEND, true);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    for (unsigned int i = 0; i < batches; i++) {
+        state.useProgram(program);
+        state.bindVertexArray(vao);
+        state.bindBuffer(GL_ARRAY_BUFFER, vb);
+        state.bindTexture(0, GL_TEXTURE_2D, textures[0]);
+        state.bindTexture(1, GL_TEXTURE_2D, textures[1]);
+    }
+}
+
+void benchStateCache() {
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT) {
+        ALOGV("state cache: no GL context, skipped");
+        return;
+    }
+
+    static const char VS[] = "#version 100\nvoid main() { gl_Position = vec4(0.0); }\n";
+    static const char FS[] = "#version 100\nvoid main() { gl_FragColor = vec4(0.0); }\n";
+    GLuint program = createProgram(VS, FS);
+    GLuint vao, vb, textures[2];
+    glGenVertexArrays(1, &vao);
+    glGenBuffers(1, &vb);
+    glGenTextures(2, textures);
+
+    // The raw frame makes 4 + 7 calls per batch.
+    for (unsigned int batches = 1; batches <= 64; batches *= 8) {
+        unsigned int calls = 4 + 7*batches;
+        GLStateCache state;
+        double raw = nsPerItem(calls, [&] {
+            issueStateFrame(program, vao, vb, textures, batches);
+        });
+        state.resetStats();
+        double cached = nsPerItem(calls, [&] {
+            issueStateFrame(state, program, vao, vb, textures, batches);
+        });
+        const GLStateCache::Stats& stats = state.stats();
+        ALOGV("state %2u batches (%3u calls): raw %6.1f ns, cached %6.1f ns (%4.1fx) per call, "
+              "%.1f%% filtered",
+              batches, calls, raw, cached, raw / cached,
+              100.0 * stats.filtered / (stats.issued + stats.filtered));
+    }
+
+    glFinish();
+    glBindVertexArray(0);
+    glUseProgram(0);
+    glDeleteTextures(2, textures);
+    glDeleteBuffers(1, &vb);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(program);
+}
+
+#define BENCH_DOF_WIDTH 1280
+#define BENCH_DOF_HEIGHT 720
+#define BENCH_DOF_FRAMES 20
+
+void benchClusteredLights() {
+    // 720p view down -z from the origin, so view and world space coincide.
+    const float near = 0.1f, far = 100.0f;
+    glm::mat4 projection = glm::perspective((float)M_PI_4, 16.0f / 9.0f, near, far);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f));
+    ClusteredLighting simd, scalar;
+    simd.setCamera(view, projection, near, far, 1280, 720);
+    scalar.setCamera(view, projection, near, far, 1280, 720);
+
+    for (unsigned int n = 1; n <= CLUSTER_MAX_LIGHTS; n *= 4) {
+        // Depth uniform in [1, 60], spread over a slightly wider cone than
+        // the frustum, radius 0.5 to 4.
+        std::vector<PointLight> lights(n);
+        for (unsigned int i = 0; i < n; i++) {
+            float d = float(1.0 + 59.0 * drand48());
+            lights[i].position = glm::vec3(d * float(1.6 * drand48() - 0.8),
+                    d * float(0.9 * drand48() - 0.45), -d);
+            lights[i].radius = float(0.5 + 3.5 * drand48());
+            lights[i].color = glm::vec3(1.0f);
+        }
+
+        const unsigned int pairs = n * CLUSTER_COUNT;
+        double reference = nsPerItem(pairs, [&] {
+            scalar.assignScalar(&lights[0], n);
+        });
+        double threaded = nsPerItem(pairs, [&] {
+            simd.assign(&lights[0], n);
+        });
+        bool match = simd.clusterGrid() == scalar.clusterGrid() &&
+                simd.lightIndices() == scalar.lightIndices();
+
+        ALOGV("clusters %4u lights: scalar %8.1f us, sliced simd %7.1f us (%4.1fx) per update, "
+              "%.1f lights per lit cluster%s",
+              n, reference * pairs * 0.001, threaded * pairs * 0.001, reference / threaded,
+              simd.stats().activeClusters ?
+                  double(simd.stats().indices) / simd.stats().activeClusters : 0.0,
+              match ? "" : " MISMATCH");
+        simd.resetStats();
+        scalar.resetStats();
+    }
+}
+
+bool benchDynamicResolution() {
+    const float target = 14.0f;
+    // Frame time = fixed + perPixel * pixel fraction, in ms.
+    struct Phase {
+        const char* name;
+        float fixed;
+        float perPixel;
+    };
+    const Phase phases[] = {
+        { "heavy", 2.0f, 20.0f },
+        { "throttled", 2.0f, 30.0f },
+        { "light", 2.0f, 8.0f },
+    };
+    const int framesPerPhase = 300;
+    // Results arrive this many frames late, like DYNRES_TIMER_QUERIES.
+    const int latency = 3;
+    // The mean of this many frames must stay within tolerance of the target
+    // from the settle frame on, unless the scale is pinned at a bound.
+    const int window = 10;
+    const float tolerance = 0.12f;
+
+    // The same noise every run, so a failure reproduces.
+    srand48(BENCH_DYNRES_SEED);
+    ResolutionController controller;
+    controller.reset(target);
+    std::vector<float> scales(latency, controller.scale());
+    bool converged = true;
+    for (size_t p = 0; p < sizeof(phases) / sizeof(phases[0]); p++) {
+        std::vector<float> times(framesPerPhase);
+        std::vector<float> used(framesPerPhase);
+        unsigned int changes = 0;
+        for (int f = 0; f < framesPerPhase; f++) {
+            // The frame rendered latency frames ago is the one measured now.
+            float scale = scales[0];
+            float noise = float(1.0 + 0.1 * (drand48() - 0.5));
+            times[f] = (phases[p].fixed + phases[p].perPixel * scale * scale) * noise;
+            used[f] = scale;
+            float previous = controller.scale();
+            scales.erase(scales.begin());
+            scales.push_back(controller.update(times[f]));
+            if (controller.scale() != previous)
+                changes++;
+        }
+
+        int settled = -1;
+        for (int f = framesPerPhase - window; f >= 0; f--) {
+            float mean = 0.0f;
+            for (int i = f; i < f + window; i++)
+                mean += times[i] / window;
+            bool pinned = (used[f] == DYNRES_MAX_SCALE && mean < target) ||
+                    (used[f] == DYNRES_MIN_SCALE && mean > target);
+            if (!pinned && fabsf(mean - target) > tolerance * target)
+                break;
+            settled = f;
+        }
+        float mean = 0.0f;
+        for (int i = framesPerPhase - window; i < framesPerPhase; i++)
+            mean += times[i] / window;
+        if (settled >= 0 && settled < framesPerPhase / 2) {
+            ALOGV("dynres %-9s: settled in %3d frames at scale %.4f, %.2f ms (target %.1f), "
+                  "%u scale changes", phases[p].name, settled, controller.scale(), mean, target,
+                  changes);
+        } else {
+            ALOGE("dynres %-9s: did not converge, scale %.4f, %.2f ms (target %.1f)",
+                  phases[p].name, controller.scale(), mean, target);
+            converged = false;
+        }
+    }
+    return converged;
+}
+
+// Finishes every frame so the timing covers exactly one frame's GPU work.
+template <typename Fn>
+static double gpuMsPerFrame(Fn fn) {
+    fn();
+    glFinish();
+    uint64_t start = nowNs();
+    for (int i = 0; i < BENCH_DOF_FRAMES; i++) {
+        fn();
+        glFinish();
+    }
+    return double(nowNs() - start) / (BENCH_DOF_FRAMES * 1000000.0);
+}
+
+void benchDepthOfField() {
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT) {
+        ALOGV("dof: no GL context, skipped");
+        return;
+    }
+
+    const int w = BENCH_DOF_WIDTH, h = BENCH_DOF_HEIGHT;
+    GLStateCache state;
+    RenderTargetPool pool;
+    DepthOfField dof;
+    if (!dof.init() || !dof.initReference()) {
+        ALOGE("dof: setup failed");
+        dof.destroy();
+        return;
+    }
+    dof.resize(w, h, 1);
+
+    // Noise color, and depth ramping left to right so the CoC goes from
+    // zero to the maximum for both versions.
+    std::vector<uint32_t> color(w * h), depthRgba(w * h), depth(w * h);
+    for (int i = 0; i < w * h; i++) {
+        color[i] = (uint32_t)lrand48() | 0xff000000u;
+        float d = float(i % w) / (w - 1);
+        depthRgba[i] = (uint32_t)(d * 255.0f) | 0xff000000u;
+        depth[i] = (uint32_t)(d * 4294967295.0);
+    }
+    GLuint sceneTextures[2];
+    glGenTextures(2, sceneTextures);
+    state.bindTexture(0, GL_TEXTURE_2D, sceneTextures[0]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    state.bindTexture(0, GL_TEXTURE_2D, sceneTextures[1]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, &depth[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    dof.setFocus(0.2f, 2.0f * DOF_MAX_COC_PX, 0.1f, 100.0f);
+
+    GLuint depthTexture, outputTexture, output;
+    glGenTextures(1, &depthTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, depthTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &depthRgba[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glGenTextures(1, &outputTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, outputTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glGenFramebuffers(1, &output);
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, outputTexture, 0);
+
+    double reference = gpuMsPerFrame([&] {
+        dof.applyReference(state, sceneTextures[0], depthTexture, output);
+    });
+    bool compute = dof.usesCompute();
+    dof.setComputeEnabled(false);
+    double separable = gpuMsPerFrame([&] {
+        dof.apply(state, pool, sceneTextures[0], sceneTextures[1], output, w, h);
+        pool.endFrame(state);
+    });
+    // Per output pixel: 1 + 3 full-res taps, plus a quarter of the 8 + 2 * 9
+    // half-res ones.
+    float taps = 4.0f + (8 + 2 * (2 * DOF_BLUR_TAPS_PER_SIDE + 1)) / 4.0f;
+    ALOGV("dof %dx%d: reference gather %.2f ms (up to 100 taps/px), "
+          "multi-pass %.2f ms (%.1f taps/px), %.1fx",
+          w, h, reference, separable, taps, reference / separable);
+
+    if (compute) {
+        dof.setComputeEnabled(true);
+        dof.dispatcher().resetStats();
+        double kernels = gpuMsPerFrame([&] {
+            dof.apply(state, pool, sceneTextures[0], sceneTextures[1], output, w, h);
+            pool.endFrame(state);
+        });
+        // Per output pixel: 3 full-res fetches in the composite, a quarter
+        // of the downsample's 8, and a quarter of the blur's tile plus
+        // apron over the tile, in both directions.
+        const int apron = int(0.5f * DOF_MAX_COC_PX) + 1;
+        float fetches = 3.0f + (8.0f + 2.0f * (DOF_COMPUTE_TILE + 2 * apron) / DOF_COMPUTE_TILE) / 4.0f;
+        ALOGV("dof %dx%d: compute %.2f ms (%.1f fetches/px), %.1fx the multi-pass; "
+              "%u barriers over %u dispatches",
+              w, h, kernels, fetches, separable / kernels, dof.dispatcher().barriers(),
+              dof.dispatcher().dispatches());
+    } else {
+        ALOGV("dof: no ES 3.1 compute, kernels skipped");
+    }
+    const RenderTargetPool::Stats& targets = pool.stats();
+    ALOGV("dof %dx%d: intermediate targets %.2f MB with aliasing, %.2f MB without; "
+          "%llu allocations over %d frames",
+          w, h, targets.peakBytes / 1048576.0f, targets.peakUnaliasedBytes / 1048576.0f,
+          (unsigned long long)targets.allocations, BENCH_DOF_FRAMES + 1);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &output);
+    glDeleteTextures(1, &outputTexture);
+    glDeleteTextures(1, &depthTexture);
+    glDeleteTextures(2, sceneTextures);
+    pool.destroy(state);
+    dof.destroy();
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// Fullscreen HDR test pattern: luminance from 1/64 to 64 left to right,
+// hue changing top to bottom.
+static const char HDR_FILL_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "out vec2 vTexCood;\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    vTexCood = p;\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+static const char HDR_FILL_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    vec3 hue = 0.5 + 0.5 * cos(6.2832 * (vTexCood.y + vec3(0.0, 0.33, 0.67)));\n"
+        "    outColor = vec4(hue * exp2(12.0 * vTexCood.x - 6.0), 1.0);\n"
+        "}\n";
+
+void benchHdrFormats() {
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT) {
+        ALOGV("hdr: no GL context, skipped");
+        return;
+    }
+
+    const int w = BENCH_DOF_WIDTH, h = BENCH_DOF_HEIGHT;
+    GLStateCache state;
+    ToneMapper toneMapper;
+    GLuint fill = createProgram(HDR_FILL_VERTEX_SHADER, HDR_FILL_FRAGMENT_SHADER);
+    if (!toneMapper.init(state) || !fill) {
+        ALOGV("hdr: no float color targets, skipped");
+        toneMapper.destroy(state);
+        glDeleteProgram(fill);
+        return;
+    }
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+
+    // The first renderable one is the quality reference.
+    static const struct {
+        GLenum format;
+        const char* name;
+        int bytesPerPixel;
+    } formats[] = {
+        { GL_RGBA32F, "RGBA32F", 16 },
+        { GL_RGBA16F, "RGBA16F", 8 },
+        { GL_R11F_G11F_B10F, "R11F_G11F_B10F", 4 },
+        { GL_RGBA8, "RGBA8", 4 },
+    };
+    const int formatCount = sizeof(formats) / sizeof(formats[0]);
+    GLuint textures[formatCount + 1], framebuffers[formatCount + 1];
+    glGenTextures(formatCount + 1, textures);
+    glGenFramebuffers(formatCount + 1, framebuffers);
+    // The output, tonemapped to 8 bits.
+    GLuint output = framebuffers[formatCount];
+    state.bindTexture(0, GL_TEXTURE_2D, textures[formatCount]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+            textures[formatCount], 0);
+
+    std::vector<uint8_t> reference, pixels(w * h * 4);
+    for (int f = 0; f < formatCount; f++) {
+        if (!ToneMapper::isColorRenderable(formats[f].format, state))
+            continue;
+        state.bindTexture(0, GL_TEXTURE_2D, textures[f]);
+        glTexStorage2D(GL_TEXTURE_2D, 1, formats[f].format, w, h);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[f]);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[f], 0);
+
+        // The scene pass writes the target once, the fused tonemap reads it
+        // once.
+        double ms = gpuMsPerFrame([&] {
+            RenderPass scene(framebuffers[f], w, h);
+            scene.colorLoad = LOAD_ACTION_DONT_CARE;
+            scene.begin(state);
+            state.setEnabled(GL_BLEND, false);
+            state.setEnabled(GL_DEPTH_TEST, false);
+            state.bindVertexArray(vao);
+            state.useProgram(fill);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            scene.end(state);
+            RenderPass resolve(output, w, h);
+            resolve.colorLoad = LOAD_ACTION_DONT_CARE;
+            resolve.begin(state);
+            toneMapper.resolve(state, textures[f]);
+            resolve.end(state);
+        });
+
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        if (reference.empty())
+            reference = pixels;
+        int maxError = 0;
+        double sumError = 0.0;
+        for (size_t i = 0; i < pixels.size(); i++) {
+            int error = abs(int(pixels[i]) - int(reference[i]));
+            maxError = std::max(maxError, error);
+            sumError += error;
+        }
+        ALOGV("hdr %dx%d %-15s: %.2f ms fill + tonemap, %.1f MB/frame; "
+              "output error %d max, %.3f mean (8-bit steps)",
+              w, h, formats[f].name, ms, 2.0 * w * h * formats[f].bytesPerPixel / 1048576.0,
+              maxError, sumError / pixels.size());
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(formatCount + 1, framebuffers);
+    for (int i = 0; i <= formatCount; i++)
+        state.forgetTexture(textures[i]);
+    glDeleteTextures(formatCount + 1, textures);
+    glDeleteVertexArrays(1, &vao);
+    glDeleteProgram(fill);
+    toneMapper.destroy(state);
+    glBindVertexArray(0);
+    glUseProgram(0);
+}
+
+// ---------------------------------------------------------------------------
+
+#define BENCH_READBACK_WIDTH 1920
+#define BENCH_READBACK_HEIGHT 1080
+#define BENCH_READBACK_FRAMES 120
+
+// Clears the target to a color encoding the frame number, for the callback
+// to check it got the right frame.
+static void clearToSequence(GLStateCache& state, unsigned int sequence) {
+    state.setEnabled(GL_SCISSOR_TEST, false);
+    glClearColor((sequence & 0xff) / 255.0f, ((sequence >> 8) & 0xff) / 255.0f, 0.5f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static void benchAsyncReadback(GLStateCache& state, GLuint framebuffer, bool yuv) {
+    const int w = BENCH_READBACK_WIDTH, h = BENCH_READBACK_HEIGHT;
+    std::atomic<unsigned int> mismatches(0);
+    AsyncReadback readback;
+    bool ok = readback.init(w, h, yuv, [&](const ReadbackFrame& frame) {
+        const uint8_t* top = frame.rgba;
+        const uint8_t* bottom = frame.rgba + (h - 1) * frame.stride + (w - 1) * 4;
+        uint8_t r = frame.sequence & 0xff, g = (frame.sequence >> 8) & 0xff;
+        if (top[0] != r || top[1] != g || bottom[0] != r || bottom[1] != g)
+            mismatches++;
+    }, state);
+    if (!ok) {
+        ALOGV("readback: no pixel pack buffers, skipped");
+        return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, w, h);
+    uint64_t start = nowNs();
+    for (unsigned int i = 0; i < BENCH_READBACK_FRAMES; i++) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        clearToSequence(state, i);
+        readback.capture(state, framebuffer);
+    }
+    uint64_t renderNs = nowNs() - start;
+    readback.flush(state);
+    double seconds = double(nowNs() - start) / 1e9;
+
+    AsyncReadback::Stats stats = readback.stats();
+    unsigned int delivered = std::max(stats.delivered, 1u);
+    ALOGV("readback %dx%d async%s (%s): %.1f frames/s, %.0f MB/s sustained; render thread "
+          "%.2f ms/frame, %.3f ms in capture(); %u/%u dropped, %.1f ms latency, "
+          "%.2f ms YUV, %u wrong frames",
+          w, h, yuv ? " + I420" : "", readback.isThreaded() ? "thread" : "polled",
+          stats.delivered / seconds, stats.delivered * (w * h * 4.0) / (seconds * 1048576.0),
+          renderNs / (BENCH_READBACK_FRAMES * 1e6),
+          stats.captureNs / (BENCH_READBACK_FRAMES * 1e6),
+          stats.dropped, BENCH_READBACK_FRAMES, stats.latencyNs / (delivered * 1e6),
+          stats.convertNs / (delivered * 1e6), mismatches.load());
+    readback.destroy(state);
+}
+
+void benchReadback() {
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT) {
+        ALOGV("readback: no GL context, skipped");
+        return;
+    }
+
+    const int w = BENCH_READBACK_WIDTH, h = BENCH_READBACK_HEIGHT;
+    GLStateCache state;
+    GLuint texture, framebuffer;
+    glGenTextures(1, &texture);
+    state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    glViewport(0, 0, w, h);
+
+    // The render thread waiting on every frame.
+    std::vector<uint8_t> pixels(w * h * 4);
+    unsigned int mismatches = 0;
+    uint64_t start = nowNs();
+    for (unsigned int i = 0; i < BENCH_READBACK_FRAMES; i++) {
+        clearToSequence(state, i);
+        glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+        if (pixels[0] != (i & 0xff))
+            mismatches++;
+    }
+    double seconds = double(nowNs() - start) / 1e9;
+    ALOGV("readback %dx%d glReadPixels: %.1f frames/s, %.0f MB/s, render thread "
+          "%.2f ms/frame, %u wrong frames",
+          w, h, BENCH_READBACK_FRAMES / seconds,
+          BENCH_READBACK_FRAMES * (w * h * 4.0) / (seconds * 1048576.0),
+          seconds * 1000.0 / BENCH_READBACK_FRAMES, mismatches);
+
+    benchAsyncReadback(state, framebuffer, false);
+    benchAsyncReadback(state, framebuffer, true);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    state.forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+
+    // The conversion alone, on a noisy frame read bottom up.
+    for (size_t i = 0; i < pixels.size(); i++)
+        pixels[i] = (uint8_t)(rand() >> 4);
+    std::vector<uint8_t> reference(i420Size(w, h)), converted(i420Size(w, h));
+    const uint8_t* top = &pixels[(h - 1) * w * 4];
+    double scalarNs = nsPerItem(w * h, [&] {
+        rgbaToI420Scalar(top, -w * 4, w, h, i420Planes(&reference[0], w, h));
+    });
+    double simdNs = nsPerItem(w * h, [&] {
+        rgbaToI420(top, -w * 4, w, h, i420Planes(&converted[0], w, h));
+    });
+    ALOGV("readback %dx%d I420: scalar %.2f ms, SIMD %.2f ms (%.1fx), %s",
+          w, h, scalarNs * w * h / 1e6, simdNs * w * h / 1e6, scalarNs / simdNs,
+          reference == converted ? "bit exact" : "MISMATCH");
+}
@@ -0,0 +1,56 @@
+//
+// Microbenchmarks for the per-frame work: CPU kernels, and with a GL
+// context the state cache, post passes and readback. Results go to logcat.
+//
+
+#ifndef OPENGL_DEMO_BENCHMARK_H
+#define OPENGL_DEMO_BENCHMARK_H
+
+// Runs every benchmark below in sequence. Only the GL ones need a current
+// context; they are skipped without one.
+void runBenchmarks();
+
+// Renderer::step animation: scalar vs SIMD vs threaded, 256 .. 1M instances.
+void benchStepKernel();
+
+// Frustum culling of SoA bounding spheres: scalar vs SIMD throughput.
+void benchCulling();
+
+// MatrixMath against GLM on random TRS matrices: mat4 products, a mat4
+// through a batch of vec4s, and inverses, each with GLM's packed types,
+// its aligned ones (its SSE kernels on x86, scalar on arm64) and the SIMD
+// kernels, checked against packed GLM.
+void benchMatrixMath();
+
+// A frame's worth of mostly redundant state calls, issued raw vs through
+// GLStateCache. Measures the CPU time spent in the driver.
+void benchStateCache();
+
+// ClusteredLighting assignment for 1 .. 1024 lights spread through the
+// frustum: brute-force scalar reference vs the per-slice SIMD version on
+// the worker pool. CPU only.
+void benchClusteredLights();
+
+// ResolutionController against a simulated GPU whose frame time is linear
+// in the pixel count, with noise and readback latency, through a load
+// increase (throttling) and a drop. Returns whether the time settles near
+// the target in each phase, which the host regression runner checks. CPU
+// only.
+bool benchDynamicResolution();
+
+// DepthOfField passes vs the original single-pass gather at 1280x720, with
+// a depth ramp covering the whole CoC range. GPU time, measured with glFinish.
+void benchDepthOfField();
+
+// A scene target written once and tonemapped once at 1280x720 in each
+// renderable color format, with an HDR gradient: GPU time, bytes through
+// the target, and the 8-bit output's error against the widest format.
+void benchHdrFormats();
+
+// Readback of 1920x1080 frames: glReadPixels on the render thread vs
+// AsyncReadback, with and without I420 conversion, as sustained frames and
+// MB per second and render thread time; then the conversion kernel alone,
+// scalar vs SIMD, checked bit exact.
+void benchReadback();
+
+#endif //OPENGL_DEMO_BENCHMARK_H
@@ -0,0 +1,318 @@
+//
+// Clustered light assignment and upload, see ClusteredLighting.h.
+//
+
+#include "ClusteredLighting.h"
+
+#include <math.h>
+#include <string.h>
+
+#include "MatrixMath.h"
+#include "Simd.h"
+#include "WorkerPool.h"
+
+#define CLUSTER_TILES (CLUSTER_TILES_X * CLUSTER_TILES_Y)
+// Position of the padding lights; far enough that no froxel is in reach,
+// close enough that the squared distance stays finite.
+#define CLUSTER_PAD_POSITION 1e18f
+// Below this many lights waking the workers costs more than the assignment.
+#define CLUSTER_PARALLEL_MIN_LIGHTS 16
+
+ClusteredLighting::ClusteredLighting()
+:   mLightTexture(0),
+    mClusterTexture(0),
+    mIndexTexture(0),
+    mView(1.0f),
+    mNear(0.0f),
+    mFar(0.0f),
+    mWidth(0),
+    mHeight(0),
+    mBounds(CLUSTER_COUNT),
+    mLightData(8 * CLUSTER_MAX_LIGHTS, 0.0f),
+    mNumLights(0),
+    mSliceLights(CLUSTER_SLICES),
+    mSliceIndices(CLUSTER_SLICES),
+    mSliceCounts(CLUSTER_COUNT, 0),
+    mGrid(2 * CLUSTER_COUNT, 0)
+{
+    memset(&mBounds[0], 0, mBounds.size() * sizeof(Bounds));
+    resetStats();
+}
+
+bool ClusteredLighting::init(GLStateCache& state) {
+    glGenTextures(1, &mLightTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, mLightTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA32F, CLUSTER_MAX_LIGHTS, 2);
+
+    glGenTextures(1, &mClusterTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, mClusterTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG32UI, CLUSTER_TILES, CLUSTER_SLICES);
+
+    glGenTextures(1, &mIndexTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, mIndexTexture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_R16UI, CLUSTER_INDEX_WIDTH, CLUSTER_INDEX_ROWS);
+
+    // Only ever read with texelFetch; integer textures must not filter.
+    const GLuint textures[3] = {mLightTexture, mClusterTexture, mIndexTexture};
+    for (int i = 0; i < 3; i++) {
+        state.bindTexture(0, GL_TEXTURE_2D, textures[i]);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    }
+
+    // Start with empty clusters until the first assignment.
+    state.bindTexture(0, GL_TEXTURE_2D, mClusterTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_TILES, CLUSTER_SLICES, GL_RG_INTEGER,
+            GL_UNSIGNED_INT, &mGrid[0]);
+    return !checkGlError("ClusteredLighting::init");
+}
+
+void ClusteredLighting::destroy() {
+    glDeleteTextures(1, &mLightTexture);
+    glDeleteTextures(1, &mClusterTexture);
+    glDeleteTextures(1, &mIndexTexture);
+    mLightTexture = mClusterTexture = mIndexTexture = 0;
+}
+
+void ClusteredLighting::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void ClusteredLighting::setCamera(const glm::mat4& view, const glm::mat4& projection,
+        float near, float far, int width, int height) {
+    mView = view;
+    mNear = near;
+    mFar = far;
+    mWidth = width;
+    mHeight = height;
+
+    // A view-space point at depth d projects to ndc x = x * p00 / d.
+    const float invP00 = 1.0f / projection[0][0];
+    const float invP11 = 1.0f / projection[1][1];
+    for (int s = 0; s < CLUSTER_SLICES; s++) {
+        float dNear = near * powf(far / near, float(s) / CLUSTER_SLICES);
+        float dFar = near * powf(far / near, float(s + 1) / CLUSTER_SLICES);
+        for (int ty = 0; ty < CLUSTER_TILES_Y; ty++) {
+            float y0 = (-1.0f + 2.0f * ty / CLUSTER_TILES_Y) * invP11;
+            float y1 = (-1.0f + 2.0f * (ty + 1) / CLUSTER_TILES_Y) * invP11;
+            for (int tx = 0; tx < CLUSTER_TILES_X; tx++) {
+                float x0 = (-1.0f + 2.0f * tx / CLUSTER_TILES_X) * invP00;
+                float x1 = (-1.0f + 2.0f * (tx + 1) / CLUSTER_TILES_X) * invP00;
+                Bounds& b = mBounds[(s * CLUSTER_TILES_Y + ty) * CLUSTER_TILES_X + tx];
+                b.minX = fminf(x0 * dNear, x0 * dFar);
+                b.maxX = fmaxf(x1 * dNear, x1 * dFar);
+                b.minY = fminf(y0 * dNear, y0 * dFar);
+                b.maxY = fmaxf(y1 * dNear, y1 * dFar);
+                b.minZ = -dFar;
+                b.maxZ = -dNear;
+            }
+        }
+    }
+}
+
+glm::vec4 ClusteredLighting::clusterParams() const {
+    float logRange = logf(mFar / mNear);
+    return glm::vec4(float(mWidth) / CLUSTER_TILES_X, float(mHeight) / CLUSTER_TILES_Y,
+            CLUSTER_SLICES / logRange, -CLUSTER_SLICES * logf(mNear) / logRange);
+}
+
+static void resizeSoA(std::vector<float>* x, std::vector<float>* y, std::vector<float>* z,
+        std::vector<float>* r, std::vector<uint16_t>* index, size_t size) {
+    x->resize(size);
+    y->resize(size);
+    z->resize(size);
+    r->resize(size);
+    index->resize(size);
+}
+
+void ClusteredLighting::prepareLights(const PointLight* lights, unsigned int count) {
+    mNumLights = count < CLUSTER_MAX_LIGHTS ? count : CLUSTER_MAX_LIGHTS;
+    unsigned int padded = (mNumLights + 3) & ~3u;
+    LightSoA& v = mViewLights;
+    resizeSoA(&v.x, &v.y, &v.z, &v.r, &v.index, padded);
+
+    for (unsigned int i = 0; i < mNumLights; i++) {
+        const PointLight& light = lights[i];
+        float* position = &mLightData[4 * i];
+        float* color = &mLightData[4 * (CLUSTER_MAX_LIGHTS + i)];
+        position[0] = light.position.x;
+        position[1] = light.position.y;
+        position[2] = light.position.z;
+        position[3] = light.radius;
+        color[0] = light.color.r;
+        color[1] = light.color.g;
+        color[2] = light.color.b;
+        color[3] = 0.0f;
+
+        v.x[i] = light.position.x;
+        v.y[i] = light.position.y;
+        v.z[i] = light.position.z;
+        v.r[i] = light.radius;
+        v.index[i] = (uint16_t)i;
+    }
+    // Into view space in place, four lights at a time.
+    if (mNumLights)
+        mat4TransformPoints(mView, &v.x[0], &v.y[0], &v.z[0], mNumLights, &v.x[0], &v.y[0], &v.z[0]);
+    for (unsigned int i = mNumLights; i < padded; i++) {
+        v.x[i] = v.y[i] = v.z[i] = CLUSTER_PAD_POSITION;
+        v.r[i] = 0.0f;
+        v.index[i] = 0;
+    }
+}
+
+// Lights of one depth slice, then one list per froxel of the slice. The
+// sphere-box test is the squared distance from the center to the froxel's
+// view-space box against the squared radius.
+void ClusteredLighting::assignSlice(unsigned int slice) {
+    const LightSoA& all = mViewLights;
+    const Bounds& sliceBounds = mBounds[slice * CLUSTER_TILES];
+    LightSoA& lights = mSliceLights[slice];
+    lights.x.clear();
+    lights.y.clear();
+    lights.z.clear();
+    lights.r.clear();
+    lights.index.clear();
+    for (unsigned int i = 0; i < mNumLights; i++) {
+        if (all.z[i] - all.r[i] > sliceBounds.maxZ || all.z[i] + all.r[i] < sliceBounds.minZ)
+            continue;
+        lights.x.push_back(all.x[i]);
+        lights.y.push_back(all.y[i]);
+        lights.z.push_back(all.z[i]);
+        lights.r.push_back(all.r[i]);
+        lights.index.push_back(all.index[i]);
+    }
+    const unsigned int count = (unsigned int)lights.x.size();
+    const unsigned int padded = (count + 3) & ~3u;
+    resizeSoA(&lights.x, &lights.y, &lights.z, &lights.r, &lights.index, padded);
+    for (unsigned int i = count; i < padded; i++) {
+        lights.x[i] = lights.y[i] = lights.z[i] = CLUSTER_PAD_POSITION;
+        lights.r[i] = 0.0f;
+    }
+
+    std::vector<uint16_t>& indices = mSliceIndices[slice];
+    indices.clear();
+    const v4f zero = v4fSplat(0.0f);
+    for (unsigned int t = 0; t < CLUSTER_TILES; t++) {
+        const Bounds& b = mBounds[slice * CLUSTER_TILES + t];
+        const v4f minX = v4fSplat(b.minX), maxX = v4fSplat(b.maxX);
+        const v4f minY = v4fSplat(b.minY), maxY = v4fSplat(b.maxY);
+        const v4f minZ = v4fSplat(b.minZ), maxZ = v4fSplat(b.maxZ);
+        unsigned int numInCluster = 0;
+        for (unsigned int i = 0; i < padded; i += 4) {
+            v4f x = v4fLoad(&lights.x[i]);
+            v4f y = v4fLoad(&lights.y[i]);
+            v4f z = v4fLoad(&lights.z[i]);
+            v4f r = v4fLoad(&lights.r[i]);
+            v4f dx = v4fMax(v4fMax(v4fSub(minX, x), v4fSub(x, maxX)), zero);
+            v4f dy = v4fMax(v4fMax(v4fSub(minY, y), v4fSub(y, maxY)), zero);
+            v4f dz = v4fMax(v4fMax(v4fSub(minZ, z), v4fSub(z, maxZ)), zero);
+            v4f distSq = v4fMadd(dx, dx, v4fMadd(dy, dy, v4fMul(dz, dz)));
+            unsigned int mask = v4mMoveMask(v4fCmpLe(distSq, v4fMul(r, r)));
+            while (mask) {
+                unsigned int lane = __builtin_ctz(mask);
+                indices.push_back(lights.index[i + lane]);
+                numInCluster++;
+                mask &= mask - 1;
+            }
+        }
+        mSliceCounts[slice * CLUSTER_TILES + t] = numInCluster;
+    }
+}
+
+// Concatenates the per-slice lists into the uploaded index list, in cluster
+// order, dropping whatever does not fit.
+void ClusteredLighting::gatherSlices() {
+    mIndices.clear();
+    for (unsigned int s = 0; s < CLUSTER_SLICES; s++) {
+        const std::vector<uint16_t>& sliceIndices = mSliceIndices[s];
+        size_t consumed = 0;
+        for (unsigned int t = 0; t < CLUSTER_TILES; t++) {
+            unsigned int c = s * CLUSTER_TILES + t;
+            unsigned int count = mSliceCounts[c];
+            unsigned int first = (unsigned int)mIndices.size();
+            unsigned int kept = first + count <= CLUSTER_MAX_INDICES ?
+                    count : CLUSTER_MAX_INDICES - first;
+            mIndices.insert(mIndices.end(), sliceIndices.begin() + consumed,
+                    sliceIndices.begin() + consumed + kept);
+            consumed += count;
+            mGrid[2*c + 0] = first;
+            mGrid[2*c + 1] = kept;
+            mStats.droppedIndices += count - kept;
+        }
+    }
+}
+
+void ClusteredLighting::finishAssignment(uint64_t startNs) {
+    mStats.assignments++;
+    mStats.lights += mNumLights;
+    mStats.indices += mIndices.size();
+    for (unsigned int c = 0; c < CLUSTER_COUNT; c++)
+        mStats.activeClusters += mGrid[2*c + 1] != 0;
+    // The upload sends whole rows; the padding is never read.
+    size_t rows = (mIndices.size() + CLUSTER_INDEX_WIDTH - 1) / CLUSTER_INDEX_WIDTH;
+    mIndices.resize(rows * CLUSTER_INDEX_WIDTH, 0);
+    mStats.assignNs += nowNs() - startNs;
+}
+
+void ClusteredLighting::assign(const PointLight* lights, unsigned int count) {
+    uint64_t startNs = nowNs();
+    prepareLights(lights, count);
+    WorkerPool::shared().parallelFor(CLUSTER_SLICES,
+            mNumLights < CLUSTER_PARALLEL_MIN_LIGHTS ? CLUSTER_SLICES : 1,
+            [this](unsigned int begin, unsigned int end) {
+        for (unsigned int s = begin; s < end; s++)
+            assignSlice(s);
+    });
+    gatherSlices();
+    finishAssignment(startNs);
+}
+
+void ClusteredLighting::assignScalar(const PointLight* lights, unsigned int count) {
+    uint64_t startNs = nowNs();
+    prepareLights(lights, count);
+    const LightSoA& v = mViewLights;
+    mIndices.clear();
+    for (unsigned int c = 0; c < CLUSTER_COUNT; c++) {
+        const Bounds& b = mBounds[c];
+        unsigned int first = (unsigned int)mIndices.size();
+        unsigned int numInCluster = 0;
+        for (unsigned int i = 0; i < mNumLights; i++) {
+            float dx = fmaxf(fmaxf(b.minX - v.x[i], v.x[i] - b.maxX), 0.0f);
+            float dy = fmaxf(fmaxf(b.minY - v.y[i], v.y[i] - b.maxY), 0.0f);
+            float dz = fmaxf(fmaxf(b.minZ - v.z[i], v.z[i] - b.maxZ), 0.0f);
+            if (dx*dx + (dy*dy + dz*dz) > v.r[i] * v.r[i])
+                continue;
+            if (mIndices.size() < CLUSTER_MAX_INDICES) {
+                mIndices.push_back(v.index[i]);
+                numInCluster++;
+            } else {
+                mStats.droppedIndices++;
+            }
+        }
+        mGrid[2*c + 0] = first;
+        mGrid[2*c + 1] = numInCluster;
+    }
+    finishAssignment(startNs);
+}
+
+void ClusteredLighting::upload(GLStateCache& state) {
+    uint64_t startNs = nowNs();
+    if (mNumLights > 0) {
+        state.bindTexture(0, GL_TEXTURE_2D, mLightTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, mNumLights, 1, GL_RGBA, GL_FLOAT, &mLightData[0]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 1, mNumLights, 1, GL_RGBA, GL_FLOAT,
+                &mLightData[4 * CLUSTER_MAX_LIGHTS]);
+    }
+
+    state.bindTexture(0, GL_TEXTURE_2D, mClusterTexture);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_TILES, CLUSTER_SLICES, GL_RG_INTEGER,
+            GL_UNSIGNED_INT, &mGrid[0]);
+
+    unsigned int rows = (unsigned int)mIndices.size() / CLUSTER_INDEX_WIDTH;
+    if (rows > 0) {
+        state.bindTexture(0, GL_TEXTURE_2D, mIndexTexture);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, CLUSTER_INDEX_WIDTH, rows, GL_RED_INTEGER,
+                GL_UNSIGNED_SHORT, &mIndices[0]);
+    }
+    mStats.uploadNs += nowNs() - startNs;
+}
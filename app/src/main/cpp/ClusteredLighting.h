@@ -0,0 +1,137 @@
+//
+// Clustered forward lighting. The view frustum is split into a grid of
+// froxels, CLUSTER_TILES_X x CLUSTER_TILES_Y screen tiles by CLUSTER_SLICES
+// exponential depth slices. Every frame the point lights are assigned to
+// the froxels they touch on the CPU, and the result is uploaded as three
+// textures the fragment shader reads with texelFetch:
+//   light data:    RGBA32F, CLUSTER_MAX_LIGHTS x 2, row 0 = world position
+//                  and radius, row 1 = color
+//   cluster grid:  RG32UI, (tiles x * tiles y) x slices, (first index, count)
+//   light indices: R16UI, CLUSTER_INDEX_WIDTH wide, row-major list
+// so each fragment only loops over the lights of its own cluster.
+//
+
+#ifndef OPENGL_DEMO_CLUSTEREDLIGHTING_H
+#define OPENGL_DEMO_CLUSTEREDLIGHTING_H
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/type_aligned.hpp"
+
+#include "gles3jni.h"
+
+#define CLUSTER_TILES_X 16
+#define CLUSTER_TILES_Y 9
+#define CLUSTER_SLICES 24
+#define CLUSTER_COUNT (CLUSTER_TILES_X * CLUSTER_TILES_Y * CLUSTER_SLICES)
+#define CLUSTER_MAX_LIGHTS 1024
+// The index texture is this wide; its height bounds the indices per frame.
+#define CLUSTER_INDEX_WIDTH 1024
+#define CLUSTER_INDEX_ROWS 128
+#define CLUSTER_MAX_INDICES (CLUSTER_INDEX_WIDTH * CLUSTER_INDEX_ROWS)
+
+struct PointLight {
+    glm::vec3 position;     // world space
+    float radius;           // no contribution beyond this distance
+    glm::vec3 color;
+};
+
+class ClusteredLighting {
+public:
+    // Summed over every assignment since resetStats().
+    struct Stats {
+        unsigned int assignments;
+        uint64_t lights;
+        uint64_t indices;
+        uint64_t activeClusters;    // clusters with at least one light
+        uint64_t droppedIndices;    // past CLUSTER_MAX_INDICES
+        uint64_t assignNs;
+        uint64_t uploadNs;
+    };
+
+    ClusteredLighting();
+
+    bool init(GLStateCache& state);
+    // Deletes the textures. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mLightTexture != 0; }
+
+    // Rebuilds the froxel bounds. projection must be a symmetric perspective
+    // with the given near and far planes; width and height are the viewport.
+    void setCamera(const glm::mat4& view, const glm::mat4& projection, float near, float far,
+            int width, int height);
+
+    // Assigns lights to clusters on the worker pool, SIMD over 4 lights per
+    // froxel test. Only the first CLUSTER_MAX_LIGHTS are used. Needs no GL.
+    void assign(const PointLight* lights, unsigned int count);
+    // Single-threaded scalar version of assign(), kept as reference. Produces
+    // the same lists in the same order.
+    void assignScalar(const PointLight* lights, unsigned int count);
+    // Uploads the last assignment.
+    void upload(GLStateCache& state);
+
+    GLuint lightTexture() const { return mLightTexture; }
+    GLuint clusterTexture() const { return mClusterTexture; }
+    GLuint indexTexture() const { return mIndexTexture; }
+    // For the shader: tile size in pixels, then scale and bias that map
+    // log(view depth) to the slice index.
+    glm::vec4 clusterParams() const;
+
+    // (first index, count) per cluster, x fastest, then y, then slice. The
+    // index list is zero-padded to whole texture rows.
+    const std::vector<uint32_t>& clusterGrid() const { return mGrid; }
+    const std::vector<uint16_t>& lightIndices() const { return mIndices; }
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+private:
+    // View-space bounds of one froxel.
+    struct Bounds {
+        float minX, maxX;
+        float minY, maxY;
+        float minZ, maxZ;
+    };
+
+    // View-space lights, SoA, padded to a multiple of 4 with lights that
+    // touch nothing.
+    struct LightSoA {
+        std::vector<float> x, y, z, r;
+        std::vector<uint16_t> index;
+    };
+
+    void prepareLights(const PointLight* lights, unsigned int count);
+    void assignSlice(unsigned int slice);
+    void gatherSlices();
+    void finishAssignment(uint64_t startNs);
+
+    GLuint mLightTexture;
+    GLuint mClusterTexture;
+    GLuint mIndexTexture;
+
+    glm::aligned_mat4 mView;
+    float mNear;
+    float mFar;
+    int mWidth;
+    int mHeight;
+    std::vector<Bounds> mBounds;    // CLUSTER_COUNT
+
+    // Lights of this frame: world space for the upload, laid out like the
+    // light texture, and view space for the assignment.
+    std::vector<float> mLightData;
+    unsigned int mNumLights;
+    LightSoA mViewLights;
+    // Per slice: lights overlapping its depth range, and the per-froxel
+    // lists built from them.
+    std::vector<LightSoA> mSliceLights;
+    std::vector<std::vector<uint16_t> > mSliceIndices;
+    std::vector<uint32_t> mSliceCounts;     // CLUSTER_COUNT, count per froxel
+
+    std::vector<uint32_t> mGrid;
+    std::vector<uint16_t> mIndices;
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_CLUSTEREDLIGHTING_H
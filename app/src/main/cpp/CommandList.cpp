@@ -0,0 +1,317 @@
+//
+// Deferred command recording, see CommandList.h.
+//
+
+#include "CommandList.h"
+
+#include <string.h>
+
+namespace {
+
+struct CommandHeader {
+    uint32_t type;
+    uint32_t words;     // whole command including payload, in 8-byte words
+};
+
+struct UseProgramCmd {
+    CommandHeader header;
+    GLuint program;
+};
+
+struct BindVertexArrayCmd {
+    CommandHeader header;
+    GLuint vao;
+};
+
+struct BindTextureCmd {
+    CommandHeader header;
+    GLuint unit;
+    GLenum target;
+    GLuint texture;
+};
+
+struct BindBufferCmd {
+    CommandHeader header;
+    GLenum target;
+    GLuint buffer;
+};
+
+struct BindUniformBlockCmd {
+    CommandHeader header;
+    GLuint binding;
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+struct VertexStreamCmd {
+    CommandHeader header;
+    GLuint attrib;
+    GLint components;
+    GLsizei stride;
+    GLuint buffer;
+    uintptr_t offset;
+};
+
+struct DepthStateCmd {
+    CommandHeader header;
+    GLenum func;
+    uint8_t depthWrite;
+    uint8_t colorWrite;
+};
+
+struct DrawCmd {
+    CommandHeader header;
+    GLenum mode;
+    GLsizei count;
+    GLenum indexType;
+    GLsizei instanceCount;
+    uintptr_t first;
+};
+
+struct DrawIndirectCmd {
+    CommandHeader header;
+    GLenum mode;
+    GLenum indexType;
+    GLuint buffer;
+    uintptr_t offset;
+};
+
+// Followed by size bytes of data.
+struct UpdateBufferCmd {
+    CommandHeader header;
+    GLenum target;
+    GLuint buffer;
+    GLintptr offset;
+    GLsizeiptr size;
+};
+
+struct CopyBufferCmd {
+    CommandHeader header;
+    GLuint src;
+    GLuint dst;
+    GLintptr srcOffset;
+    GLintptr dstOffset;
+    GLsizeiptr size;
+};
+
+} // namespace
+
+CommandList::CommandList()
+:   mUsed(0),
+    mCount(0)
+{}
+
+void CommandList::reset() {
+    mUsed = 0;
+    mCount = 0;
+}
+
+template <typename T>
+T* CommandList::alloc(CommandType type, size_t payloadBytes) {
+    size_t words = (sizeof(T) + payloadBytes + sizeof(uint64_t) - 1) / sizeof(uint64_t);
+    if (mUsed + words > mArena.size())
+        mArena.resize(2 * (mUsed + words));
+    T* cmd = reinterpret_cast<T*>(&mArena[mUsed]);
+    cmd->header.type = type;
+    cmd->header.words = (uint32_t)words;
+    mUsed += words;
+    mCount++;
+    return cmd;
+}
+
+void CommandList::useProgram(GLuint program) {
+    alloc<UseProgramCmd>(CMD_USE_PROGRAM, 0)->program = program;
+}
+
+void CommandList::bindVertexArray(GLuint vao) {
+    alloc<BindVertexArrayCmd>(CMD_BIND_VERTEX_ARRAY, 0)->vao = vao;
+}
+
+void CommandList::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    BindTextureCmd* cmd = alloc<BindTextureCmd>(CMD_BIND_TEXTURE, 0);
+    cmd->unit = unit;
+    cmd->target = target;
+    cmd->texture = texture;
+}
+
+void CommandList::bindBuffer(GLenum target, GLuint buffer) {
+    BindBufferCmd* cmd = alloc<BindBufferCmd>(CMD_BIND_BUFFER, 0);
+    cmd->target = target;
+    cmd->buffer = buffer;
+}
+
+void CommandList::bindUniformBlock(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size) {
+    BindUniformBlockCmd* cmd = alloc<BindUniformBlockCmd>(CMD_BIND_UNIFORM_BLOCK, 0);
+    cmd->binding = binding;
+    cmd->buffer = buffer;
+    cmd->offset = offset;
+    cmd->size = size;
+}
+
+void CommandList::vertexStream(GLuint attrib, GLint components, GLsizei stride, GLuint buffer,
+        uintptr_t offset) {
+    VertexStreamCmd* cmd = alloc<VertexStreamCmd>(CMD_VERTEX_STREAM, 0);
+    cmd->attrib = attrib;
+    cmd->components = components;
+    cmd->stride = stride;
+    cmd->buffer = buffer;
+    cmd->offset = offset;
+}
+
+void CommandList::depthState(GLenum func, bool depthWrite, bool colorWrite) {
+    DepthStateCmd* cmd = alloc<DepthStateCmd>(CMD_DEPTH_STATE, 0);
+    cmd->func = func;
+    cmd->depthWrite = depthWrite;
+    cmd->colorWrite = colorWrite;
+}
+
+void CommandList::draw(GLenum mode, GLsizei count, GLenum indexType, uintptr_t first,
+        GLsizei instanceCount) {
+    DrawCmd* cmd = alloc<DrawCmd>(CMD_DRAW, 0);
+    cmd->mode = mode;
+    cmd->count = count;
+    cmd->indexType = indexType;
+    cmd->instanceCount = instanceCount;
+    cmd->first = first;
+}
+
+void CommandList::drawIndirect(GLenum mode, GLenum indexType, GLuint buffer, uintptr_t offset) {
+    DrawIndirectCmd* cmd = alloc<DrawIndirectCmd>(CMD_DRAW_INDIRECT, 0);
+    cmd->mode = mode;
+    cmd->indexType = indexType;
+    cmd->buffer = buffer;
+    cmd->offset = offset;
+}
+
+void CommandList::updateBuffer(GLenum target, GLuint buffer, GLintptr offset, GLsizeiptr size,
+        const void* data) {
+    UpdateBufferCmd* cmd = alloc<UpdateBufferCmd>(CMD_UPDATE_BUFFER, (size_t)size);
+    cmd->target = target;
+    cmd->buffer = buffer;
+    cmd->offset = offset;
+    cmd->size = size;
+    memcpy(cmd + 1, data, (size_t)size);
+}
+
+void CommandList::copyBuffer(GLuint src, GLintptr srcOffset, GLuint dst, GLintptr dstOffset,
+        GLsizeiptr size) {
+    CopyBufferCmd* cmd = alloc<CopyBufferCmd>(CMD_COPY_BUFFER, 0);
+    cmd->src = src;
+    cmd->dst = dst;
+    cmd->srcOffset = srcOffset;
+    cmd->dstOffset = dstOffset;
+    cmd->size = size;
+}
+
+void CommandList::execute(GLStateCache& state, Stats* stats) const {
+    Stats local;
+    memset(&local, 0, sizeof(local));
+
+    size_t pos = 0;
+    while (pos < mUsed) {
+        const uint64_t* at = &mArena[pos];
+        const CommandHeader* header = reinterpret_cast<const CommandHeader*>(at);
+        pos += header->words;
+
+        switch (header->type) {
+            case CMD_USE_PROGRAM: {
+                const UseProgramCmd* cmd = reinterpret_cast<const UseProgramCmd*>(at);
+                if (state.useProgram(cmd->program))
+                    local.programSwitches++;
+                break;
+            }
+            case CMD_BIND_VERTEX_ARRAY: {
+                const BindVertexArrayCmd* cmd = reinterpret_cast<const BindVertexArrayCmd*>(at);
+                if (state.bindVertexArray(cmd->vao))
+                    local.vaoSwitches++;
+                break;
+            }
+            case CMD_BIND_TEXTURE: {
+                const BindTextureCmd* cmd = reinterpret_cast<const BindTextureCmd*>(at);
+                if (state.bindTexture(cmd->unit, cmd->target, cmd->texture))
+                    local.textureSwitches++;
+                break;
+            }
+            case CMD_BIND_BUFFER: {
+                const BindBufferCmd* cmd = reinterpret_cast<const BindBufferCmd*>(at);
+                state.bindBuffer(cmd->target, cmd->buffer);
+                break;
+            }
+            case CMD_BIND_UNIFORM_BLOCK: {
+                const BindUniformBlockCmd* cmd = reinterpret_cast<const BindUniformBlockCmd*>(at);
+                state.bindBufferRange(GL_UNIFORM_BUFFER, cmd->binding, cmd->buffer,
+                        cmd->offset, cmd->size);
+                break;
+            }
+            case CMD_VERTEX_STREAM: {
+                const VertexStreamCmd* cmd = reinterpret_cast<const VertexStreamCmd*>(at);
+                state.bindBuffer(GL_ARRAY_BUFFER, cmd->buffer);
+                glVertexAttribPointer(cmd->attrib, cmd->components, GL_FLOAT, GL_FALSE,
+                        cmd->stride, (const GLvoid*)cmd->offset);
+                break;
+            }
+            case CMD_DEPTH_STATE: {
+                const DepthStateCmd* cmd = reinterpret_cast<const DepthStateCmd*>(at);
+                state.depthFunc(cmd->func);
+                state.depthMask(cmd->depthWrite != 0);
+                state.colorMask(cmd->colorWrite != 0);
+                break;
+            }
+            case CMD_DRAW: {
+                const DrawCmd* cmd = reinterpret_cast<const DrawCmd*>(at);
+                if (cmd->indexType) {
+                    if (cmd->instanceCount)
+                        glDrawElementsInstanced(cmd->mode, cmd->count, cmd->indexType,
+                                (const GLvoid*)cmd->first, cmd->instanceCount);
+                    else
+                        glDrawElements(cmd->mode, cmd->count, cmd->indexType,
+                                (const GLvoid*)cmd->first);
+                } else {
+                    if (cmd->instanceCount)
+                        glDrawArraysInstanced(cmd->mode, (GLint)cmd->first, cmd->count,
+                                cmd->instanceCount);
+                    else
+                        glDrawArrays(cmd->mode, (GLint)cmd->first, cmd->count);
+                }
+                local.draws++;
+                break;
+            }
+            case CMD_DRAW_INDIRECT: {
+#if HAVE_ES31_API
+                const DrawIndirectCmd* cmd = reinterpret_cast<const DrawIndirectCmd*>(at);
+                state.bindBuffer(GL_DRAW_INDIRECT_BUFFER, cmd->buffer);
+                glDrawElementsIndirect(cmd->mode, cmd->indexType, (const GLvoid*)cmd->offset);
+                local.draws++;
+#endif
+                break;
+            }
+            case CMD_UPDATE_BUFFER: {
+                const UpdateBufferCmd* cmd = reinterpret_cast<const UpdateBufferCmd*>(at);
+                state.bindBuffer(cmd->target, cmd->buffer);
+                glBufferSubData(cmd->target, cmd->offset, cmd->size, cmd + 1);
+                break;
+            }
+            case CMD_COPY_BUFFER: {
+                const CopyBufferCmd* cmd = reinterpret_cast<const CopyBufferCmd*>(at);
+                state.bindBuffer(GL_COPY_READ_BUFFER, cmd->src);
+                state.bindBuffer(GL_COPY_WRITE_BUFFER, cmd->dst);
+                glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                        cmd->srcOffset, cmd->dstOffset, cmd->size);
+                break;
+            }
+            default:
+                ALOGE("CommandList: unknown command %u", header->type);
+                return;
+        }
+        local.commands++;
+    }
+
+    if (stats) {
+        stats->commands += local.commands;
+        stats->draws += local.draws;
+        stats->programSwitches += local.programSwitches;
+        stats->textureSwitches += local.textureSwitches;
+        stats->vaoSwitches += local.vaoSwitches;
+    }
+}
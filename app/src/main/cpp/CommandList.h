@@ -0,0 +1,87 @@
+//
+// Deferred command recording. A CommandList is a linear arena of POD
+// commands that any thread can fill without touching GL; only the thread
+// that owns the context replays it. Lists recorded in parallel are then
+// executed one after another in a fixed order.
+//
+
+#ifndef OPENGL_DEMO_COMMANDLIST_H
+#define OPENGL_DEMO_COMMANDLIST_H
+
+#include <vector>
+
+#include "gles3jni.h"
+
+enum CommandType {
+    CMD_USE_PROGRAM,
+    CMD_BIND_VERTEX_ARRAY,
+    CMD_BIND_TEXTURE,
+    CMD_BIND_BUFFER,
+    CMD_BIND_UNIFORM_BLOCK,
+    CMD_VERTEX_STREAM,
+    CMD_DEPTH_STATE,
+    CMD_DRAW,
+    CMD_DRAW_INDIRECT,
+    CMD_UPDATE_BUFFER,
+    CMD_COPY_BUFFER,
+};
+
+class CommandList {
+public:
+    struct Stats {
+        unsigned int commands;
+        unsigned int draws;
+        unsigned int programSwitches;
+        unsigned int textureSwitches;
+        unsigned int vaoSwitches;
+    };
+
+    CommandList();
+
+    // Forgets the recorded commands but keeps the arena for the next frame.
+    void reset();
+    bool empty() const { return mCount == 0; }
+    unsigned int commandCount() const { return mCount; }
+    size_t sizeBytes() const { return mUsed * sizeof(uint64_t); }
+
+    // Recording. Never calls GL, so it is safe on any thread as long as each
+    // list has one writer.
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    void bindBuffer(GLenum target, GLuint buffer);
+    // glBindBufferRange(GL_UNIFORM_BUFFER, binding, ...).
+    void bindUniformBlock(GLuint binding, GLuint buffer, GLintptr offset, GLsizeiptr size);
+    // Points float attribute attrib at buffer + offset.
+    void vertexStream(GLuint attrib, GLint components, GLsizei stride, GLuint buffer,
+            uintptr_t offset);
+    // Depth function and depth/color write masks.
+    void depthState(GLenum func, bool depthWrite, bool colorWrite);
+    // indexType 0 draws arrays, and first is then the first vertex rather
+    // than a byte offset into the index buffer. instanceCount 0 is a plain draw.
+    void draw(GLenum mode, GLsizei count, GLenum indexType, uintptr_t first,
+            GLsizei instanceCount);
+    // glDrawElementsIndirect with the command at offset in buffer. Needs an
+    // ES 3.1 context.
+    void drawIndirect(GLenum mode, GLenum indexType, GLuint buffer, uintptr_t offset);
+    // data is copied into the list and uploaded with glBufferSubData.
+    void updateBuffer(GLenum target, GLuint buffer, GLintptr offset, GLsizeiptr size,
+            const void* data);
+    void copyBuffer(GLuint src, GLintptr srcOffset, GLuint dst, GLintptr dstOffset,
+            GLsizeiptr size);
+
+    // Replays the list on the GL thread, with state changes filtered through
+    // state. Counters are added to *stats if it isn't NULL.
+    void execute(GLStateCache& state, Stats* stats) const;
+
+private:
+    template <typename T>
+    T* alloc(CommandType type, size_t payloadBytes);
+
+    // 8-byte words, so every command and payload stays 8-byte aligned.
+    std::vector<uint64_t> mArena;
+    size_t mUsed;
+    unsigned int mCount;
+};
+
+#endif //OPENGL_DEMO_COMMANDLIST_H
@@ -0,0 +1,63 @@
+//
+// Compute kernel dispatch with lazy memory barriers, see ComputeDispatcher.h.
+//
+
+#include "ComputeDispatcher.h"
+
+ComputeDispatcher::ComputeDispatcher()
+:   mPending(0),
+    mDispatches(0),
+    mBarriers(0)
+{}
+
+void ComputeDispatcher::resetStats() {
+    mDispatches = 0;
+    mBarriers = 0;
+}
+
+#if HAVE_ES31_API
+
+bool ComputeDispatcher::isSupported() {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    return major > 3 || (major == 3 && minor >= 1);
+}
+
+void ComputeDispatcher::bindOutput(GLuint unit, GLuint texture, GLenum format) {
+    glBindImageTexture(unit, texture, 0, GL_FALSE, 0, GL_WRITE_ONLY, format);
+}
+
+void ComputeDispatcher::dispatch(int width, int height, int groupWidth, int groupHeight) {
+    glDispatchCompute((GLuint)((width + groupWidth - 1) / groupWidth),
+            (GLuint)((height + groupHeight - 1) / groupHeight), 1);
+    // Whatever reads next, it doesn't see these writes yet.
+    mPending = GL_ALL_BARRIER_BITS;
+    mDispatches++;
+}
+
+void ComputeDispatcher::beforeRead(GLbitfield barriers) {
+    GLbitfield needed = mPending & barriers;
+    if (!needed)
+        return;
+    glMemoryBarrier(needed);
+    mPending &= ~needed;
+    mBarriers++;
+}
+
+#else
+
+bool ComputeDispatcher::isSupported() {
+    return false;
+}
+
+void ComputeDispatcher::bindOutput(GLuint, GLuint, GLenum) {
+}
+
+void ComputeDispatcher::dispatch(int, int, int, int) {
+}
+
+void ComputeDispatcher::beforeRead(GLbitfield) {
+}
+
+#endif
@@ -0,0 +1,52 @@
+//
+// Dispatch and synchronization of post-processing compute kernels (ES 3.1).
+// Kernels read their inputs through samplers with texelFetch and write one
+// pool target bound as an image. Image stores are incoherent: later reads
+// only see them after a glMemoryBarrier with the bit of the kind of read.
+// The dispatcher remembers that a dispatch left writes behind and issues
+// the barrier lazily, when something says it is about to read, with only
+// the bits that read needs: independent dispatches get none, a chain of
+// kernels one per link.
+//
+// Only image load/store formats can be bound: RGBA8, RGBA16F, RGBA32F,
+// R32F and the integer ones, not R8 or R11F_G11F_B10F. Pool targets have
+// immutable storage, which images need.
+//
+
+#ifndef OPENGL_DEMO_COMPUTEDISPATCHER_H
+#define OPENGL_DEMO_COMPUTEDISPATCHER_H
+
+#include "gles3jni.h"
+
+class ComputeDispatcher {
+public:
+    ComputeDispatcher();
+
+    // True on an ES 3.1 context, when built with the ES 3.1 API.
+    static bool isSupported();
+
+    // Binds level 0 of texture to an image unit for the next dispatch to
+    // write.
+    void bindOutput(GLuint unit, GLuint texture, GLenum format);
+    // Runs the current program over a width x height grid of invocations,
+    // in work groups of groupWidth x groupHeight, rounding up.
+    void dispatch(int width, int height, int groupWidth, int groupHeight);
+    // Call before a dispatch, draw or blit reads textures that dispatches
+    // have written, with the barrier bits of the read, such as
+    // GL_TEXTURE_FETCH_BARRIER_BIT for samplers or
+    // GL_FRAMEBUFFER_BARRIER_BIT for attachments.
+    void beforeRead(GLbitfield barriers);
+
+    // Since the last resetStats().
+    unsigned int dispatches() const { return mDispatches; }
+    unsigned int barriers() const { return mBarriers; }
+    void resetStats();
+
+private:
+    // Barrier bits not issued since the last dispatch.
+    GLbitfield mPending;
+    unsigned int mDispatches;
+    unsigned int mBarriers;
+};
+
+#endif //OPENGL_DEMO_COMPUTEDISPATCHER_H
@@ -0,0 +1,95 @@
+//
+// SoA frustum culling, see Culling.h.
+//
+
+#include "Culling.h"
+
+#include "Simd.h"
+
+void extractFrustum(const glm::mat4& viewProj, Frustum* frustum) {
+    // glm is column-major: row i is (m[0][i], m[1][i], m[2][i], m[3][i]).
+    glm::vec4 rows[4];
+    for (int i = 0; i < 4; i++)
+        rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+
+    frustum->planes[0] = rows[3] + rows[0];     // left
+    frustum->planes[1] = rows[3] - rows[0];     // right
+    frustum->planes[2] = rows[3] + rows[1];     // bottom
+    frustum->planes[3] = rows[3] - rows[1];     // top
+    frustum->planes[4] = rows[3] + rows[2];     // near
+    frustum->planes[5] = rows[3] - rows[2];     // far
+
+    for (int i = 0; i < 6; i++) {
+        glm::vec4& p = frustum->planes[i];
+        p /= glm::length(glm::vec3(p));
+    }
+}
+
+Frustum offsetFrustum(const Frustum& f, const glm::vec3& offset) {
+    Frustum result = f;
+    for (int i = 0; i < 6; i++)
+        result.planes[i].w += glm::dot(glm::vec3(f.planes[i]), offset);
+    return result;
+}
+
+unsigned int cullSpheresScalar(const Frustum& f, const float* x, const float* y, const float* z,
+        const float* radius, float uniformRadius, unsigned int count, unsigned int* visible) {
+    unsigned int numVisible = 0;
+    for (unsigned int i = 0; i < count; i++) {
+        float r = radius ? radius[i] : uniformRadius;
+        bool inside = true;
+        for (int p = 0; p < 6 && inside; p++) {
+            const glm::vec4& plane = f.planes[p];
+            inside = plane.x*x[i] + plane.y*y[i] + plane.z*z[i] + plane.w > -r;
+        }
+        if (inside)
+            visible[numVisible++] = i;
+    }
+    return numVisible;
+}
+
+unsigned int cullSpheres(const Frustum& f, const float* x, const float* y, const float* z,
+        const float* radius, float uniformRadius, unsigned int count, unsigned int* visible) {
+    v4f px[6], py[6], pz[6], pw[6];
+    for (int p = 0; p < 6; p++) {
+        px[p] = v4fSplat(f.planes[p].x);
+        py[p] = v4fSplat(f.planes[p].y);
+        pz[p] = v4fSplat(f.planes[p].z);
+        pw[p] = v4fSplat(f.planes[p].w);
+    }
+    const v4f zero = v4fSplat(0.0f);
+    const v4f uniformR = v4fSplat(uniformRadius);
+
+    unsigned int numVisible = 0;
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4f sx = v4fLoad(x + i);
+        v4f sy = v4fLoad(y + i);
+        v4f sz = v4fLoad(z + i);
+        v4f sr = radius ? v4fLoad(radius + i) : uniformR;
+
+        // inside while distance + radius > 0 for every plane
+        v4m inside = v4fCmpGt(v4fAdd(v4fMadd(px[0], sx, v4fMadd(py[0], sy,
+                v4fMadd(pz[0], sz, pw[0]))), sr), zero);
+        for (int p = 1; p < 6; p++) {
+            v4f d = v4fMadd(px[p], sx, v4fMadd(py[p], sy, v4fMadd(pz[p], sz, pw[p])));
+            inside = v4mAnd(inside, v4fCmpGt(v4fAdd(d, sr), zero));
+        }
+
+        unsigned int mask = v4mMoveMask(inside);
+        while (mask) {
+            unsigned int lane = __builtin_ctz(mask);
+            visible[numVisible++] = i + lane;
+            mask &= mask - 1;
+        }
+    }
+
+    if (i < count) {
+        unsigned int tail = cullSpheresScalar(f, x + i, y + i, z + i, radius ? radius + i : NULL,
+                uniformRadius, count - i, visible + numVisible);
+        for (unsigned int t = 0; t < tail; t++)
+            visible[numVisible + t] += i;
+        numVisible += tail;
+    }
+    return numVisible;
+}
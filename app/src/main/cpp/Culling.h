@@ -0,0 +1,35 @@
+//
+// View frustum culling of bounding spheres stored as SoA arrays.
+//
+
+#ifndef OPENGL_DEMO_CULLING_H
+#define OPENGL_DEMO_CULLING_H
+
+#include "glm/glm.hpp"
+
+// Planes (a, b, c, d) with a*x + b*y + c*z + d >= 0 on the inside,
+// normalized so the result is a distance in world units.
+struct Frustum {
+    glm::vec4 planes[6];
+};
+
+// Gribb/Hartmann plane extraction from a projection * view matrix.
+void extractFrustum(const glm::mat4& viewProj, Frustum* frustum);
+
+// Moves every plane by -offset, so testing p against the result is the
+// same as testing p + offset against f. Used to cull a submesh over all
+// instance positions without building per-instance spheres.
+Frustum offsetFrustum(const Frustum& f, const glm::vec3& offset);
+
+// Tests spheres (x[i], y[i], z[i], radius[i]) against the frustum four at a
+// time and writes the indices of those not fully outside to visible, in
+// increasing order. radius may be NULL, in which case every sphere has
+// uniformRadius. Returns the number of visible spheres.
+unsigned int cullSpheres(const Frustum& f, const float* x, const float* y, const float* z,
+        const float* radius, float uniformRadius, unsigned int count, unsigned int* visible);
+
+// Scalar version of cullSpheres(), kept as reference.
+unsigned int cullSpheresScalar(const Frustum& f, const float* x, const float* y, const float* z,
+        const float* radius, float uniformRadius, unsigned int count, unsigned int* visible);
+
+#endif //OPENGL_DEMO_CULLING_H
@@ -0,0 +1,618 @@
+//
+// Multi-pass depth of field, see DepthOfField.h.
+//
+
+#include "DepthOfField.h"
+#include "ToneMapper.h"
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+// Shared by every pass: one triangle covering the viewport.
+static const char FULLSCREEN_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "out vec2 vTexCood;\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    vTexCood = p;\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// cocParams: near, far, 1 / focus distance, CoC scale (normalized to
+// DOF_MAX_COC_PX). Gives the CoC radius / DOF_MAX_COC_PX.
+#define COC_FUNCTION \
+        "uniform highp vec4 cocParams;\n" \
+        "highp float circleOfConfusion(highp float depth) {\n" \
+        "    highp float z = cocParams.x * cocParams.y / (cocParams.y - depth * (cocParams.y - cocParams.x));\n" \
+        "    return clamp(abs(cocParams.z - 1.0 / z) * cocParams.w, 0.0, 1.0);\n" \
+        "}\n"
+
+static const char COC_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D depthTexture;\n"
+        COC_FUNCTION
+        "void main() {\n"
+        "    outColor = vec4(circleOfConfusion(texture(depthTexture, vTexCood).r));\n"
+        "}\n";
+
+// 2x2 box weighted by CoC, so sharp pixels don't bleed into the blurred
+// half-res image. Alpha keeps the largest CoC of the four.
+static const char DOWNSAMPLE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D colorTexture;\n"
+        "uniform sampler2D cocTexture;\n"
+        "uniform vec2 texelSize;\n"
+        "void main() {\n"
+        "    vec2 o = 0.5 * texelSize;\n"
+        "    vec2 uv[4] = vec2[4](vTexCood + vec2(-o.x, -o.y), vTexCood + vec2(o.x, -o.y),\n"
+        "                         vTexCood + vec2(-o.x, o.y), vTexCood + vec2(o.x, o.y));\n"
+        "    vec3 sum = vec3(0.0);\n"
+        "    float weights = 0.0;\n"
+        "    float maxCoc = 0.0;\n"
+        "    for (int i = 0; i < 4; i++) {\n"
+        "        float coc = texture(cocTexture, uv[i]).r;\n"
+        "        float w = coc + 0.001;\n"
+        "        sum += w * texture(colorTexture, uv[i]).rgb;\n"
+        "        weights += w;\n"
+        "        maxCoc = max(maxCoc, coc);\n"
+        "    }\n"
+        "    outColor = vec4(sum / weights, maxCoc);\n"
+        "}\n";
+
+// One direction of the separable blur. The taps are spread evenly over the
+// pixel's own CoC, so the count is fixed, and a tap only contributes if its
+// CoC reaches back to this pixel.
+static const char BLUR_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "#define TAPS " STRV(DOF_BLUR_TAPS_PER_SIDE) "\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D source;\n"
+        "uniform vec2 texelStep;\n"
+        "uniform float maxRadius;\n"
+        "void main() {\n"
+        "    vec4 center = texture(source, vTexCood);\n"
+        "    float radius = center.a * maxRadius;\n"
+        "    vec3 sum = center.rgb;\n"
+        "    float weights = 1.0;\n"
+        "    for (int i = 1; i <= TAPS; i++) {\n"
+        "        float d = radius * float(i) / float(TAPS);\n"
+        "        vec2 offset = d * texelStep;\n"
+        "        vec4 a = texture(source, vTexCood + offset);\n"
+        "        vec4 b = texture(source, vTexCood - offset);\n"
+        "        float wa = clamp(a.a * maxRadius - d + 1.0, 0.0, 1.0);\n"
+        "        float wb = clamp(b.a * maxRadius - d + 1.0, 0.0, 1.0);\n"
+        "        sum += wa * a.rgb + wb * b.rgb;\n"
+        "        weights += wa + wb;\n"
+        "    }\n"
+        "    outColor = vec4(sum / weights, center.a);\n"
+        "}\n";
+
+// Fades from the sharp scene to the blurred image over the first couple of
+// pixels of CoC.
+static const char COMPOSITE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "#define MAX_COC " STRV(DOF_MAX_COC_PX) "\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D colorTexture;\n"
+        "uniform sampler2D blurTexture;\n"
+        "uniform sampler2D cocTexture;\n"
+        TONEMAP_FUNCTION
+        "void main() {\n"
+        "    vec4 sharp = texture(colorTexture, vTexCood);\n"
+        "    vec3 blurred = texture(blurTexture, vTexCood).rgb;\n"
+        "    float coc = texture(cocTexture, vTexCood).r * MAX_COC;\n"
+        "    float blend = clamp((coc - 0.5) / 1.5, 0.0, 1.0);\n"
+        "    outColor = vec4(toneMap(mix(sharp.rgb, blurred, blend)), sharp.a);\n"
+        "}\n";
+
+// The compute chain keeps no full-res CoC target (R8 can't be an image), so
+// its composite works the CoC out from depth again, in the same one fetch.
+static const char COMPOSITE_DEPTH_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "#define MAX_COC " STRV(DOF_MAX_COC_PX) "\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D colorTexture;\n"
+        "uniform sampler2D blurTexture;\n"
+        "uniform highp sampler2D depthTexture;\n"
+        COC_FUNCTION
+        TONEMAP_FUNCTION
+        "void main() {\n"
+        "    vec4 sharp = texture(colorTexture, vTexCood);\n"
+        "    vec3 blurred = texture(blurTexture, vTexCood).rgb;\n"
+        "    float coc = circleOfConfusion(texture(depthTexture, vTexCood).r) * MAX_COC;\n"
+        "    float blend = clamp((coc - 0.5) / 1.5, 0.0, 1.0);\n"
+        "    outColor = vec4(toneMap(mix(sharp.rgb, blurred, blend)), sharp.a);\n"
+        "}\n";
+
+// Compute version of the CoC and downsample passes in one: each invocation
+// fetches its four full-res texels, color and depth, exactly once.
+#define DOWNSAMPLE_COMPUTE_BODY \
+        "layout(local_size_x = 8, local_size_y = 8) in;\n" \
+        "layout(HALF_FORMAT, binding = 0) writeonly uniform mediump image2D halfImage;\n" \
+        "uniform mediump sampler2D colorTexture;\n" \
+        "uniform highp sampler2D depthTexture;\n" \
+        COC_FUNCTION \
+        "void main() {\n" \
+        "    ivec2 p = ivec2(gl_GlobalInvocationID.xy);\n" \
+        "    if (any(greaterThanEqual(p, imageSize(halfImage))))\n" \
+        "        return;\n" \
+        "    ivec2 last = textureSize(colorTexture, 0) - 1;\n" \
+        "    vec3 sum = vec3(0.0);\n" \
+        "    float weights = 0.0;\n" \
+        "    float maxCoc = 0.0;\n" \
+        "    for (int i = 0; i < 4; i++) {\n" \
+        "        ivec2 q = min(2 * p + ivec2(i & 1, i >> 1), last);\n" \
+        "        float coc = circleOfConfusion(texelFetch(depthTexture, q, 0).r);\n" \
+        "        float w = coc + 0.001;\n" \
+        "        sum += w * texelFetch(colorTexture, q, 0).rgb;\n" \
+        "        weights += w;\n" \
+        "        maxCoc = max(maxCoc, coc);\n" \
+        "    }\n" \
+        "    imageStore(halfImage, p, vec4(sum / weights, maxCoc));\n" \
+        "}\n"
+
+// Compute version of the blur. A work group is TILE pixels of one row (or
+// column), which first load themselves and an apron as wide as the largest
+// radius into shared memory, one fetch each. The taps then read and
+// interpolate shared memory the way the fragment version's bilinear taps do
+// the texture.
+#define BLUR_COMPUTE_BODY \
+        "#define TILE " STRV(DOF_COMPUTE_TILE) "\n" \
+        "#define TAPS " STRV(DOF_BLUR_TAPS_PER_SIDE) "\n" \
+        "#define MAX_RADIUS (0.5 * " STRV(DOF_MAX_COC_PX) ")\n" \
+        "layout(local_size_x = TILE) in;\n" \
+        "layout(HALF_FORMAT, binding = 0) writeonly uniform mediump image2D blurred;\n" \
+        "uniform mediump sampler2D source;\n" \
+        "uniform bool vertical;\n" \
+        "const int APRON = int(MAX_RADIUS) + 1;\n" \
+        "shared vec4 line[TILE + 2 * APRON];\n" \
+        "ivec2 texel(int along, int across) {\n" \
+        "    return vertical ? ivec2(across, along) : ivec2(along, across);\n" \
+        "}\n" \
+        "vec4 tap(float at) {\n" \
+        "    int i = int(at);\n" \
+        "    return mix(line[i], line[i + 1], at - float(i));\n" \
+        "}\n" \
+        "void main() {\n" \
+        "    ivec2 size = textureSize(source, 0);\n" \
+        "    int extent = vertical ? size.y : size.x;\n" \
+        "    int first = int(gl_WorkGroupID.x) * TILE - APRON;\n" \
+        "    int across = int(gl_GlobalInvocationID.y);\n" \
+        "    for (int i = int(gl_LocalInvocationID.x); i < TILE + 2 * APRON; i += TILE)\n" \
+        "        line[i] = texelFetch(source, texel(clamp(first + i, 0, extent - 1), across), 0);\n" \
+        "    memoryBarrierShared();\n" \
+        "    barrier();\n" \
+        "    int at = int(gl_LocalInvocationID.x) + APRON;\n" \
+        "    if (first + at >= extent)\n" \
+        "        return;\n" \
+        "    vec4 center = line[at];\n" \
+        "    float radius = center.a * MAX_RADIUS;\n" \
+        "    vec3 sum = center.rgb;\n" \
+        "    float weights = 1.0;\n" \
+        "    for (int i = 1; i <= TAPS; i++) {\n" \
+        "        float d = radius * float(i) / float(TAPS);\n" \
+        "        vec4 a = tap(float(at) + d);\n" \
+        "        vec4 b = tap(float(at) - d);\n" \
+        "        float wa = clamp(a.a * MAX_RADIUS - d + 1.0, 0.0, 1.0);\n" \
+        "        float wb = clamp(b.a * MAX_RADIUS - d + 1.0, 0.0, 1.0);\n" \
+        "        sum += wa * a.rgb + wb * b.rgb;\n" \
+        "        weights += wa + wb;\n" \
+        "    }\n" \
+        "    imageStore(blurred, texel(first + at, across), vec4(sum / weights, center.a));\n" \
+        "}\n"
+
+// The original O(r^2) gather, kept as reference. Taps a square of up to
+// 10x10 texels at a fixed 1/1280 step.
+static const char FRAGMENT_SHADER_DOF[] =
+        "#version 300 es\n"
+                "precision mediump float;\n"
+                "out vec4 outColor;\n"
+                "in vec2 vTexCood;\n"
+                "uniform sampler2D texture0;\n"
+                "uniform sampler2D texture1;\n"
+                ""
+                "vec4 uniformDistribution(float c, sampler2D texture_orig, vec2 tex_c) {\n"
+                "    if (c < 0.0000001) { return texture(texture_orig, tex_c); }\n"
+                "    float r = c / 2.0f;\n"
+                "    float a = 4.0 * r * r;\n"
+                "    vec4 dis_color;\n"
+                "    float step = 1.0f / 1280.0f;\n"
+                "    //vec4 intensity = texture(texture_orig, tex_c) / a;\n"
+                "    for (float row = -step * r; row <= step * r; row += step) {\n"
+                "        for (float col = -step * r; col <= step * r; col += step) {\n"
+                "            dis_color += texture(texture_orig, vec2(tex_c.x + row, tex_c.y + col));\n"
+                "        }\n"
+                "    }\n"
+                "    dis_color /= a;\n"
+                "    return dis_color;\n"
+                "}\n"
+                ""
+                ""
+                "void main() {\n"
+                "//outColor = texture(texture0, vTexCood);\n"
+                "float depth = texture(texture1, vTexCood).r;\n"
+                "float real_z = (0.1 * 100.0) / (100.0 - depth * (100.0 - 0.1));\n"
+                ""
+                "float c = 2.0 * abs(5.0 * (10.0 - 1.0 / real_z) - 1.0);\n"
+                "c = c > 18.0f ? 18.0f : c;\n"
+                "    float r = c / 2.0f;\n"
+                "    float even_r = roundEven(r);\n"
+                ""
+                "    vec4 dis_color = vec4(0, 0, 0, 1.0);\n"
+                "    float step = 1.0f / 1280.0f;\n"
+                "    float index = 0.0;\n"
+                "    for (float row = -even_r; row <= even_r; row += 2.0) {\n"
+                "        for (float col = -even_r; col <= even_r; col += 2.0) {\n"
+                "dis_color += texture(texture0, vec2(vTexCood.x + col * step, vTexCood.y + row * step));\n"
+                "index++;\n"
+                "        }\n"
+                "    }\n"
+                "    dis_color /= index;\n"
+                "    outColor = dis_color;\n"                ""
+                ""
+                ""
+                "}\n";
+
+// The half-res targets are RGBA8 for LDR scenes and RGBA16F for HDR ones,
+// and an image's format is part of its declaration.
+static const char DOWNSAMPLE_COMPUTE_SHADER[] =
+        "#version 310 es\n#define HALF_FORMAT rgba8\n" DOWNSAMPLE_COMPUTE_BODY;
+static const char DOWNSAMPLE_COMPUTE_SHADER_HDR[] =
+        "#version 310 es\n#define HALF_FORMAT rgba16f\n" DOWNSAMPLE_COMPUTE_BODY;
+static const char BLUR_COMPUTE_SHADER[] =
+        "#version 310 es\n#define HALF_FORMAT rgba8\n" BLUR_COMPUTE_BODY;
+static const char BLUR_COMPUTE_SHADER_HDR[] =
+        "#version 310 es\n#define HALF_FORMAT rgba16f\n" BLUR_COMPUTE_BODY;
+
+DepthOfField::DepthOfField()
+:   mVAO(0),
+    mCocProgram(0),
+    mDownsampleProgram(0),
+    mBlurProgram(0),
+    mCompositeProgram(0),
+    mReferenceProgram(0),
+    mCocParamsUniform(-1),
+    mDownsampleTexelUniform(-1),
+    mBlurStepUniform(-1),
+    mBlurRadiusUniform(-1),
+    mDownsampleKernel(0),
+    mBlurKernel(0),
+    mCompositeDepthProgram(0),
+    mKernelCocParamsUniform(-1),
+    mBlurVerticalUniform(-1),
+    mCompositeCocParamsUniform(-1),
+    mComputeEnabled(true),
+    mSceneFormat(GL_RGBA8),
+    mHalfFormat(GL_RGBA8),
+    mExposure(0.0f),
+    mCompositeExposureUniform(-1),
+    mCompositeDepthExposureUniform(-1),
+    mSceneColor(-1),
+    mSceneDepth(-1),
+    mMsaaColor(-1),
+    mMsaaDepth(-1),
+    mSamples(1),
+    mWidth(0),
+    mHeight(0),
+    mFocusDistance(1.0f),
+    mAperture(0.0f),
+    mNear(0.1f),
+    mFar(100.0f)
+{
+}
+
+bool DepthOfField::init(GLenum sceneFormat) {
+    mSceneFormat = sceneFormat;
+    mHalfFormat = sceneFormat == GL_RGBA8 ? GL_RGBA8 : GL_RGBA16F;
+    mCocProgram = createProgram(FULLSCREEN_VERTEX_SHADER, COC_FRAGMENT_SHADER);
+    mDownsampleProgram = createProgram(FULLSCREEN_VERTEX_SHADER, DOWNSAMPLE_FRAGMENT_SHADER);
+    mBlurProgram = createProgram(FULLSCREEN_VERTEX_SHADER, BLUR_FRAGMENT_SHADER);
+    mCompositeProgram = createProgram(FULLSCREEN_VERTEX_SHADER, COMPOSITE_FRAGMENT_SHADER);
+    if (!mCocProgram || !mDownsampleProgram || !mBlurProgram || !mCompositeProgram) {
+        destroy();
+        return false;
+    }
+
+    mCocParamsUniform = glGetUniformLocation(mCocProgram, "cocParams");
+    mDownsampleTexelUniform = glGetUniformLocation(mDownsampleProgram, "texelSize");
+    mBlurStepUniform = glGetUniformLocation(mBlurProgram, "texelStep");
+    mBlurRadiusUniform = glGetUniformLocation(mBlurProgram, "maxRadius");
+    mCompositeExposureUniform = glGetUniformLocation(mCompositeProgram, "exposure");
+
+    // Sampler units never change.
+    glUseProgram(mDownsampleProgram);
+    glUniform1i(glGetUniformLocation(mDownsampleProgram, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(mDownsampleProgram, "cocTexture"), 1);
+    glUseProgram(mCompositeProgram);
+    glUniform1i(glGetUniformLocation(mCompositeProgram, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(mCompositeProgram, "blurTexture"), 1);
+    glUniform1i(glGetUniformLocation(mCompositeProgram, "cocTexture"), 2);
+    glUseProgram(0);
+
+    glGenVertexArrays(1, &mVAO);
+    if (ComputeDispatcher::isSupported() && !initCompute())
+        ALOGV("DepthOfField: compute kernels unavailable, using fragment passes");
+    return !checkGlError("DepthOfField::init");
+}
+
+// Failing here only leaves the fragment passes.
+bool DepthOfField::initCompute() {
+#if HAVE_ES31_API
+    bool hdr = mHalfFormat == GL_RGBA16F;
+    mDownsampleKernel = createComputeProgram(hdr ? DOWNSAMPLE_COMPUTE_SHADER_HDR :
+            DOWNSAMPLE_COMPUTE_SHADER);
+    mBlurKernel = createComputeProgram(hdr ? BLUR_COMPUTE_SHADER_HDR : BLUR_COMPUTE_SHADER);
+    mCompositeDepthProgram = createProgram(FULLSCREEN_VERTEX_SHADER,
+            COMPOSITE_DEPTH_FRAGMENT_SHADER);
+    if (!mDownsampleKernel || !mBlurKernel || !mCompositeDepthProgram) {
+        glDeleteProgram(mDownsampleKernel);
+        glDeleteProgram(mBlurKernel);
+        glDeleteProgram(mCompositeDepthProgram);
+        mDownsampleKernel = mBlurKernel = mCompositeDepthProgram = 0;
+        return false;
+    }
+
+    mKernelCocParamsUniform = glGetUniformLocation(mDownsampleKernel, "cocParams");
+    mBlurVerticalUniform = glGetUniformLocation(mBlurKernel, "vertical");
+    mCompositeCocParamsUniform = glGetUniformLocation(mCompositeDepthProgram, "cocParams");
+    mCompositeDepthExposureUniform = glGetUniformLocation(mCompositeDepthProgram, "exposure");
+    glUseProgram(mDownsampleKernel);
+    glUniform1i(glGetUniformLocation(mDownsampleKernel, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(mDownsampleKernel, "depthTexture"), 1);
+    glUseProgram(mCompositeDepthProgram);
+    glUniform1i(glGetUniformLocation(mCompositeDepthProgram, "colorTexture"), 0);
+    glUniform1i(glGetUniformLocation(mCompositeDepthProgram, "blurTexture"), 1);
+    glUniform1i(glGetUniformLocation(mCompositeDepthProgram, "depthTexture"), 2);
+    glUseProgram(0);
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool DepthOfField::initReference() {
+    mReferenceProgram = createProgram(FULLSCREEN_VERTEX_SHADER, FRAGMENT_SHADER_DOF);
+    if (!mReferenceProgram)
+        return false;
+    glUseProgram(mReferenceProgram);
+    glUniform1i(glGetUniformLocation(mReferenceProgram, "texture0"), 0);
+    glUniform1i(glGetUniformLocation(mReferenceProgram, "texture1"), 1);
+    glUseProgram(0);
+    return true;
+}
+
+void DepthOfField::destroy() {
+    glDeleteVertexArrays(1, &mVAO);
+    glDeleteProgram(mCocProgram);
+    glDeleteProgram(mDownsampleProgram);
+    glDeleteProgram(mBlurProgram);
+    glDeleteProgram(mCompositeProgram);
+    glDeleteProgram(mReferenceProgram);
+    glDeleteProgram(mDownsampleKernel);
+    glDeleteProgram(mBlurKernel);
+    glDeleteProgram(mCompositeDepthProgram);
+    mVAO = 0;
+    mCocProgram = mDownsampleProgram = mBlurProgram = mCompositeProgram = mReferenceProgram = 0;
+    mDownsampleKernel = mBlurKernel = mCompositeDepthProgram = 0;
+}
+
+void DepthOfField::resize(int w, int h, int samples) {
+    // Float formats may allow fewer samples than GL_MAX_SAMPLES.
+    GLint maxSamples = 1;
+    glGetInternalformativ(GL_RENDERBUFFER, mSceneFormat, GL_SAMPLES, 1, &maxSamples);
+    mSamples = samples < maxSamples ? samples : maxSamples;
+    if (mSamples < 1)
+        mSamples = 1;
+    mWidth = w;
+    mHeight = h;
+}
+
+void DepthOfField::setExposure(float exposure) {
+    mExposure = exposure;
+}
+
+void DepthOfField::setFocus(float focusDistance, float aperture, float near, float far) {
+    mFocusDistance = focusDistance;
+    mAperture = aperture;
+    mNear = near;
+    mFar = far;
+}
+
+// Depth is kept for the CoC pass. Multisampled color and depth are both
+// resolved into the textures and never written back themselves.
+RenderPass DepthOfField::scenePass(RenderTargetPool& pool) {
+    RenderPass pass(pool.framebuffer(mSceneColor, mSceneDepth), mWidth, mHeight);
+    pass.depthStore = STORE_ACTION_STORE;
+    if (mSamples > 1) {
+        pass.resolveFramebuffer = pass.framebuffer;
+        pass.framebuffer = pool.framebuffer(mMsaaColor, mMsaaDepth);
+        pass.colorStore = STORE_ACTION_RESOLVE;
+        pass.depthStore = STORE_ACTION_RESOLVE;
+    }
+    return pass;
+}
+
+void DepthOfField::beginScene(GLStateCache& state, RenderTargetPool& pool) {
+    RenderTargetDesc color = { mWidth, mHeight, mSceneFormat, 1 };
+    RenderTargetDesc depth = { mWidth, mHeight, GL_DEPTH_COMPONENT24, 1 };
+    mSceneColor = pool.acquire(color, state);
+    mSceneDepth = pool.acquire(depth, state);
+    if (mSamples > 1) {
+        color.samples = depth.samples = mSamples;
+        mMsaaColor = pool.acquire(color, state);
+        mMsaaDepth = pool.acquire(depth, state);
+    }
+    scenePass(pool).begin(state);
+}
+
+void DepthOfField::endScene(GLStateCache& state, RenderTargetPool& pool) {
+    scenePass(pool).end(state);
+    if (mSamples > 1) {
+        pool.release(mMsaaColor);
+        pool.release(mMsaaDepth);
+        mMsaaColor = mMsaaDepth = -1;
+    }
+}
+
+// Every post pass overwrites its whole target, so nothing is loaded, and
+// none of them has a depth buffer worth keeping.
+void DepthOfField::drawFullscreen(GLStateCache& state, GLuint framebuffer, int w, int h) {
+    RenderPass pass(framebuffer, w, h);
+    pass.colorLoad = LOAD_ACTION_DONT_CARE;
+    pass.depthLoad = LOAD_ACTION_DONT_CARE;
+    pass.begin(state);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    pass.end(state);
+}
+
+void DepthOfField::apply(GLStateCache& state, RenderTargetPool& pool, GLuint output,
+        int outputWidth, int outputHeight) {
+    apply(state, pool, pool.name(mSceneColor), pool.name(mSceneDepth), output, outputWidth,
+            outputHeight);
+    pool.release(mSceneColor);
+    pool.release(mSceneDepth);
+    mSceneColor = mSceneDepth = -1;
+}
+
+// Each target is released after the last pass reading it, so the vertical
+// blur reuses the downsampled one.
+void DepthOfField::apply(GLStateCache& state, RenderTargetPool& pool, GLuint colorTexture,
+        GLuint depthTexture, GLuint output, int outputWidth, int outputHeight) {
+    if (usesCompute()) {
+        applyCompute(state, pool, colorTexture, depthTexture, output, outputWidth, outputHeight);
+        return;
+    }
+
+    const int halfW = (mWidth + 1) / 2;
+    const int halfH = (mHeight + 1) / 2;
+    const RenderTargetDesc cocDesc = { mWidth, mHeight, GL_R8, 1 };
+    const RenderTargetDesc halfDesc = { halfW, halfH, mHalfFormat, 1 };
+
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+
+    // The target size replaces the hard-coded 1/1280 step of the reference.
+    int coc = pool.acquire(cocDesc, state);
+    state.useProgram(mCocProgram);
+    float cocScale = mAperture * (mHeight / 720.0f) / DOF_MAX_COC_PX;
+    glUniform4f(mCocParamsUniform, mNear, mFar, 1.0f / mFocusDistance, cocScale);
+    state.bindTexture(0, GL_TEXTURE_2D, depthTexture);
+    drawFullscreen(state, pool.framebuffer(coc), mWidth, mHeight);
+
+    int half = pool.acquire(halfDesc, state);
+    state.useProgram(mDownsampleProgram);
+    glUniform2f(mDownsampleTexelUniform, 1.0f / mWidth, 1.0f / mHeight);
+    state.bindTexture(0, GL_TEXTURE_2D, colorTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, pool.name(coc));
+    drawFullscreen(state, pool.framebuffer(half), halfW, halfH);
+
+    int blurH = pool.acquire(halfDesc, state);
+    state.useProgram(mBlurProgram);
+    glUniform1f(mBlurRadiusUniform, 0.5f * DOF_MAX_COC_PX);
+    glUniform2f(mBlurStepUniform, 1.0f / halfW, 0.0f);
+    state.bindTexture(0, GL_TEXTURE_2D, pool.name(half));
+    drawFullscreen(state, pool.framebuffer(blurH), halfW, halfH);
+    pool.release(half);
+
+    int blurV = pool.acquire(halfDesc, state);
+    glUniform2f(mBlurStepUniform, 0.0f, 1.0f / halfH);
+    state.bindTexture(0, GL_TEXTURE_2D, pool.name(blurH));
+    drawFullscreen(state, pool.framebuffer(blurV), halfW, halfH);
+    pool.release(blurH);
+
+    state.useProgram(mCompositeProgram);
+    glUniform1f(mCompositeExposureUniform, mExposure);
+    state.bindTexture(0, GL_TEXTURE_2D, colorTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, pool.name(blurV));
+    state.bindTexture(2, GL_TEXTURE_2D, pool.name(coc));
+    drawFullscreen(state, output, outputWidth, outputHeight);
+    pool.release(blurV);
+    pool.release(coc);
+    checkGlError("DepthOfField::apply");
+}
+
+#if HAVE_ES31_API
+
+// Same target reuse as the fragment passes. Each kernel's writes are made
+// visible to the next one's texel fetches, and the last one's to the
+// composite's, just before they read.
+void DepthOfField::applyCompute(GLStateCache& state, RenderTargetPool& pool,
+        GLuint colorTexture, GLuint depthTexture, GLuint output, int outputWidth,
+        int outputHeight) {
+    const int halfW = (mWidth + 1) / 2;
+    const int halfH = (mHeight + 1) / 2;
+    const RenderTargetDesc halfDesc = { halfW, halfH, mHalfFormat, 1 };
+    const float cocScale = mAperture * (mHeight / 720.0f) / DOF_MAX_COC_PX;
+
+    int half = pool.acquire(halfDesc, state);
+    state.useProgram(mDownsampleKernel);
+    glUniform4f(mKernelCocParamsUniform, mNear, mFar, 1.0f / mFocusDistance, cocScale);
+    state.bindTexture(0, GL_TEXTURE_2D, colorTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, depthTexture);
+    mDispatcher.bindOutput(0, pool.name(half), mHalfFormat);
+    mDispatcher.dispatch(halfW, halfH, 8, 8);
+
+    int blurH = pool.acquire(halfDesc, state);
+    state.useProgram(mBlurKernel);
+    glUniform1i(mBlurVerticalUniform, 0);
+    state.bindTexture(0, GL_TEXTURE_2D, pool.name(half));
+    mDispatcher.bindOutput(0, pool.name(blurH), mHalfFormat);
+    mDispatcher.beforeRead(GL_TEXTURE_FETCH_BARRIER_BIT);
+    mDispatcher.dispatch(halfW, halfH, DOF_COMPUTE_TILE, 1);
+    pool.release(half);
+
+    int blurV = pool.acquire(halfDesc, state);
+    glUniform1i(mBlurVerticalUniform, 1);
+    state.bindTexture(0, GL_TEXTURE_2D, pool.name(blurH));
+    mDispatcher.bindOutput(0, pool.name(blurV), mHalfFormat);
+    mDispatcher.beforeRead(GL_TEXTURE_FETCH_BARRIER_BIT);
+    mDispatcher.dispatch(halfH, halfW, DOF_COMPUTE_TILE, 1);
+    pool.release(blurH);
+
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mCompositeDepthProgram);
+    glUniform4f(mCompositeCocParamsUniform, mNear, mFar, 1.0f / mFocusDistance, cocScale);
+    glUniform1f(mCompositeDepthExposureUniform, mExposure);
+    state.bindTexture(0, GL_TEXTURE_2D, colorTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, pool.name(blurV));
+    state.bindTexture(2, GL_TEXTURE_2D, depthTexture);
+    mDispatcher.beforeRead(GL_TEXTURE_FETCH_BARRIER_BIT);
+    drawFullscreen(state, output, outputWidth, outputHeight);
+    pool.release(blurV);
+    checkGlError("DepthOfField::applyCompute");
+}
+
+#else
+
+void DepthOfField::applyCompute(GLStateCache&, RenderTargetPool&, GLuint, GLuint, GLuint, int,
+        int) {
+}
+
+#endif
+
+void DepthOfField::applyReference(GLStateCache& state, GLuint colorTexture, GLuint depthTexture,
+        GLuint output) {
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mReferenceProgram);
+    state.bindTexture(0, GL_TEXTURE_2D, colorTexture);
+    state.bindTexture(1, GL_TEXTURE_2D, depthTexture);
+    drawFullscreen(state, output, mWidth, mHeight);
+    checkGlError("DepthOfField::applyReference");
+}
@@ -0,0 +1,144 @@
+//
+// Multi-pass depth of field. The scene is rendered into an offscreen
+// target, then:
+//   1. CoC:        full res, circle of confusion from scene depth into R8
+//   2. downsample: half res, CoC-weighted 2x2 prefilter, max CoC in alpha
+//   3. blur:       half res, separable, fixed taps spread over each pixel's CoC
+//   4. composite:  full res, sharp scene blended with the upsampled blur
+// Every pass has a constant tap count, whatever the blur radius. The scene
+// may be multisampled, in which case it is resolved at the end of its pass.
+// All targets are transient, taken from a RenderTargetPool for the frame.
+//
+// On ES 3.1, passes 1 to 3 run as compute kernels instead: CoC and
+// downsample fused into one, and a blur whose work groups share their
+// texels through shared memory, so a texel is fetched about once per
+// direction instead of once per tap reaching it. The composite stays a
+// fragment pass, since the output may be the default framebuffer. The
+// fragment passes are the fallback everywhere else.
+//
+// An HDR scene keeps its float format through the half-res passes
+// (RGBA16F) and is tonemapped by the composite, see ToneMapper.h.
+//
+
+#ifndef OPENGL_DEMO_DEPTHOFFIELD_H
+#define OPENGL_DEMO_DEPTHOFFIELD_H
+
+#include "gles3jni.h"
+#include "ComputeDispatcher.h"
+#include "RenderPass.h"
+#include "RenderTargetPool.h"
+
+// Largest CoC radius in full-resolution pixels, as in the original shader.
+#define DOF_MAX_COC_PX 18.0f
+// Taps on each side of the center in one blur direction.
+#define DOF_BLUR_TAPS_PER_SIDE 4
+// Pixels of a row or column per work group of the compute blur.
+#define DOF_COMPUTE_TILE 64
+
+class DepthOfField {
+public:
+    DepthOfField();
+
+    // sceneFormat is the scene color format: GL_RGBA8, or a float one for
+    // an HDR scene.
+    bool init(GLenum sceneFormat = GL_RGBA8);
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mCocProgram != 0; }
+
+    // Sets the scene size. samples > 1 renders the scene multisampled,
+    // clamped to what the scene format allows. Allocates nothing.
+    void resize(int w, int h, int samples);
+    // Distances are view-space, in the units of the projection's near/far.
+    // aperture scales the CoC: radius = aperture * |1/focus - 1/z| pixels at
+    // 720 lines, clamped to DOF_MAX_COC_PX.
+    void setFocus(float focusDistance, float aperture, float near, float far);
+    // Exposure of the composite's tonemap, 0 to write the scene as it is.
+    void setExposure(float exposure);
+
+    // Starts the scene pass: acquires, binds and clears the scene target.
+    // Draw the scene, then call endScene() and apply().
+    void beginScene(GLStateCache& state, RenderTargetPool& pool);
+    // Resolves the scene if it is multisampled.
+    void endScene(GLStateCache& state, RenderTargetPool& pool);
+    // Runs the passes on the scene, composites into the output framebuffer
+    // and releases the scene target. The composite fills the whole output,
+    // upscaling bilinearly if it is larger than the scene; its previous
+    // color and depth are dropped. Leaves blending and depth testing
+    // disabled.
+    void apply(GLStateCache& state, RenderTargetPool& pool, GLuint output, int outputWidth,
+            int outputHeight);
+    // Same, on a scene given as a color and a depth texture.
+    void apply(GLStateCache& state, RenderTargetPool& pool, GLuint colorTexture,
+            GLuint depthTexture, GLuint output, int outputWidth, int outputHeight);
+
+    // Whether apply() runs the compute kernels. They are used whenever
+    // init() could build them; disabling them falls back to the fragment
+    // passes, for comparison.
+    bool usesCompute() const { return mComputeEnabled && mDownsampleKernel != 0; }
+    void setComputeEnabled(bool enabled) { mComputeEnabled = enabled; }
+    // Dispatch and barrier counts of the compute kernels.
+    ComputeDispatcher& dispatcher() { return mDispatcher; }
+
+    int sceneSamples() const { return mSamples; }
+    // Pool targets of the resolved scene between endScene() and apply(), for
+    // passes that draw over it first.
+    int sceneColorTarget() const { return mSceneColor; }
+    int sceneDepthTarget() const { return mSceneDepth; }
+
+    // The original single-pass square gather (FRAGMENT_SHADER_DOF), kept as
+    // the reference for quality and speed. Reads color from colorTexture and
+    // depth from the red channel of depthTexture.
+    bool initReference();
+    void applyReference(GLStateCache& state, GLuint colorTexture, GLuint depthTexture,
+            GLuint output);
+
+private:
+    RenderPass scenePass(RenderTargetPool& pool);
+    void drawFullscreen(GLStateCache& state, GLuint framebuffer, int w, int h);
+    bool initCompute();
+    void applyCompute(GLStateCache& state, RenderTargetPool& pool, GLuint colorTexture,
+            GLuint depthTexture, GLuint output, int outputWidth, int outputHeight);
+
+    GLuint mVAO;    // empty, the fullscreen triangle comes from gl_VertexID
+    GLuint mCocProgram;
+    GLuint mDownsampleProgram;
+    GLuint mBlurProgram;
+    GLuint mCompositeProgram;
+    GLuint mReferenceProgram;
+    GLint mCocParamsUniform;
+    GLint mDownsampleTexelUniform;
+    GLint mBlurStepUniform;
+    GLint mBlurRadiusUniform;
+    // Compute path, 0 without ES 3.1.
+    GLuint mDownsampleKernel;
+    GLuint mBlurKernel;
+    GLuint mCompositeDepthProgram;
+    GLint mKernelCocParamsUniform;
+    GLint mBlurVerticalUniform;
+    GLint mCompositeCocParamsUniform;
+    ComputeDispatcher mDispatcher;
+    bool mComputeEnabled;
+    GLenum mSceneFormat;
+    GLenum mHalfFormat;     // of the half-res targets
+    float mExposure;
+    GLint mCompositeExposureUniform;
+    GLint mCompositeDepthExposureUniform;
+
+    // Pool targets of the scene between beginScene() and apply(), -1 when
+    // not acquired. The multisampled ones are resolved into the others.
+    int mSceneColor;
+    int mSceneDepth;
+    int mMsaaColor;
+    int mMsaaDepth;
+    int mSamples;
+    int mWidth;
+    int mHeight;
+
+    float mFocusDistance;
+    float mAperture;
+    float mNear;
+    float mFar;
+};
+
+#endif //OPENGL_DEMO_DEPTHOFFIELD_H
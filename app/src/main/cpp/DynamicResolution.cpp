@@ -0,0 +1,241 @@
+//
+// Dynamic resolution controller and upscale, see DynamicResolution.h.
+//
+
+#include "DynamicResolution.h"
+#include "ToneMapper.h"
+
+#include <string.h>
+
+// From GL_EXT_disjoint_timer_query, which the ES 3 headers lack.
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
+
+// PID gains, per frame, on the relative error (target - time) / target.
+#define DYNRES_KP 0.25f
+#define DYNRES_KI 0.06f
+#define DYNRES_KD 0.05f
+// Exponential smoothing of the measured time, 1 = none.
+#define DYNRES_SMOOTHING 0.3f
+// Errors below this are ignored. Adjacent scale steps are about 10-20%
+// apart in cost, so there is always a step inside the band to settle on.
+#define DYNRES_DEADBAND 0.1f
+// The continuous scale must move this many steps away before the step
+// changes.
+#define DYNRES_HYSTERESIS 0.6f
+// Unsharp mask strength at DYNRES_MIN_SCALE, fading out towards 1.
+#define DYNRES_SHARPNESS 0.5f
+
+static const char UPSCALE_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "out vec2 vTexCood;\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    vTexCood = p;\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// Bilinear, plus an unsharp mask over the 4 source neighbours, clamped to
+// their range so edges don't ring. Sharpened before the tonemap, so the
+// mask works on scene values.
+static const char UPSCALE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D source;\n"
+        "uniform vec2 texelSize;\n"
+        "uniform float sharpness;\n"
+        TONEMAP_FUNCTION
+        "void main() {\n"
+        "    vec4 center = texture(source, vTexCood);\n"
+        "    if (sharpness <= 0.0) {\n"
+        "        outColor = vec4(toneMap(center.rgb), center.a);\n"
+        "        return;\n"
+        "    }\n"
+        "    vec3 l = texture(source, vTexCood - vec2(texelSize.x, 0.0)).rgb;\n"
+        "    vec3 r = texture(source, vTexCood + vec2(texelSize.x, 0.0)).rgb;\n"
+        "    vec3 d = texture(source, vTexCood - vec2(0.0, texelSize.y)).rgb;\n"
+        "    vec3 u = texture(source, vTexCood + vec2(0.0, texelSize.y)).rgb;\n"
+        "    vec3 lo = min(center.rgb, min(min(l, r), min(d, u)));\n"
+        "    vec3 hi = max(center.rgb, max(max(l, r), max(d, u)));\n"
+        "    vec3 sharp = center.rgb + sharpness * (center.rgb - 0.25 * (l + r + d + u));\n"
+        "    outColor = vec4(toneMap(clamp(sharp, lo, hi)), center.a);\n"
+        "}\n";
+
+static float clampf(float x, float lo, float hi) {
+    return x < lo ? lo : (x > hi ? hi : x);
+}
+
+// ---------------------------------------------------------------------------
+
+ResolutionController::ResolutionController() {
+    reset(16.0f);
+}
+
+void ResolutionController::reset(float targetMs) {
+    mTargetMs = targetMs;
+    mFilteredMs = 0.0f;
+    mFraction = DYNRES_MAX_SCALE * DYNRES_MAX_SCALE;
+    mError[0] = mError[1] = 0.0f;
+    mScale = DYNRES_MAX_SCALE;
+}
+
+// Velocity form: the PID output is a change of the pixel fraction, and the
+// fraction is clamped, so the integral can't wind up at either bound.
+float ResolutionController::update(float frameMs) {
+    if (mFilteredMs > 0.0f)
+        mFilteredMs += DYNRES_SMOOTHING * (frameMs - mFilteredMs);
+    else
+        mFilteredMs = frameMs;
+
+    float e = (mTargetMs - mFilteredMs) / mTargetMs;
+    if (fabsf(e) < DYNRES_DEADBAND)
+        e = 0.0f;
+    float delta = DYNRES_KP * (e - mError[0]) + DYNRES_KI * e +
+            DYNRES_KD * (e - 2.0f * mError[0] + mError[1]);
+    mError[1] = mError[0];
+    mError[0] = e;
+    mFraction = clampf(mFraction + delta, DYNRES_MIN_SCALE * DYNRES_MIN_SCALE,
+            DYNRES_MAX_SCALE * DYNRES_MAX_SCALE);
+
+    float scale = sqrtf(mFraction);
+    if (fabsf(scale - mScale) > DYNRES_HYSTERESIS * DYNRES_SCALE_STEP) {
+        float stepped = floorf(scale / DYNRES_SCALE_STEP + 0.5f) * DYNRES_SCALE_STEP;
+        mScale = clampf(stepped, DYNRES_MIN_SCALE, DYNRES_MAX_SCALE);
+    }
+    return mScale;
+}
+
+// ---------------------------------------------------------------------------
+
+DynamicResolution::DynamicResolution()
+:   mQueryHead(0),
+    mQueriesPending(0),
+    mQueryActive(false),
+    mVAO(0),
+    mUpscaleProgram(0),
+    mTexelSizeUniform(-1),
+    mSharpnessUniform(-1),
+    mExposureUniform(-1)
+{
+    memset(mQueries, 0, sizeof(mQueries));
+    resetStats();
+}
+
+bool DynamicResolution::init(float targetMs) {
+    mUpscaleProgram = createProgram(UPSCALE_VERTEX_SHADER, UPSCALE_FRAGMENT_SHADER);
+    if (!mUpscaleProgram)
+        return false;
+    mTexelSizeUniform = glGetUniformLocation(mUpscaleProgram, "texelSize");
+    mSharpnessUniform = glGetUniformLocation(mUpscaleProgram, "sharpness");
+    mExposureUniform = glGetUniformLocation(mUpscaleProgram, "exposure");
+    glUseProgram(mUpscaleProgram);
+    glUniform1i(glGetUniformLocation(mUpscaleProgram, "source"), 0);
+    glUseProgram(0);
+    glGenVertexArrays(1, &mVAO);
+
+    if (hasExtension("GL_EXT_disjoint_timer_query"))
+        glGenQueries(DYNRES_TIMER_QUERIES, mQueries);
+    ALOGV("Dynamic resolution: %.1f ms target, measured with %s", targetMs,
+            hasGpuTimer() ? "GPU timer queries" : "the CPU frame interval");
+
+    mController.reset(targetMs);
+    mQueryHead = mQueriesPending = 0;
+    mQueryActive = false;
+    return !checkGlError("DynamicResolution::init");
+}
+
+void DynamicResolution::destroy() {
+    if (hasGpuTimer())
+        glDeleteQueries(DYNRES_TIMER_QUERIES, mQueries);
+    glDeleteVertexArrays(1, &mVAO);
+    glDeleteProgram(mUpscaleProgram);
+    memset(mQueries, 0, sizeof(mQueries));
+    mVAO = 0;
+    mUpscaleProgram = 0;
+}
+
+void DynamicResolution::beginFrame() {
+    // All queries waiting for results: skip timing this frame rather than
+    // block on the oldest one.
+    if (!hasGpuTimer() || mQueriesPending == DYNRES_TIMER_QUERIES)
+        return;
+    glBeginQuery(GL_TIME_ELAPSED_EXT, mQueries[mQueryHead]);
+    mQueryActive = true;
+}
+
+void DynamicResolution::endFrame(uint64_t cpuFrameNs) {
+    float frameMs = -1.0f;
+    if (hasGpuTimer()) {
+        if (mQueryActive) {
+            glEndQuery(GL_TIME_ELAPSED_EXT);
+            mQueryHead = (mQueryHead + 1) % DYNRES_TIMER_QUERIES;
+            mQueriesPending++;
+            mQueryActive = false;
+        }
+        // A disjoint event (clock change, context loss) invalidates every
+        // query in flight.
+        GLint disjoint = 0;
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+        while (mQueriesPending > 0) {
+            unsigned int oldest = (mQueryHead + DYNRES_TIMER_QUERIES - mQueriesPending) %
+                    DYNRES_TIMER_QUERIES;
+            GLuint available = 0;
+            glGetQueryObjectuiv(mQueries[oldest], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                break;
+            GLuint ns = 0;
+            glGetQueryObjectuiv(mQueries[oldest], GL_QUERY_RESULT, &ns);
+            mQueriesPending--;
+            if (!disjoint)
+                frameMs = ns * 0.000001f;
+        }
+    } else if (cpuFrameNs > 0) {
+        frameMs = cpuFrameNs * 0.000001f;
+    }
+
+    mStats.frames++;
+    mStats.scaleSum += scale();
+    if (frameMs < 0.0f)
+        return;
+    float previous = scale();
+    mController.update(frameMs);
+    mStats.measurements++;
+    mStats.frameMsSum += frameMs;
+    if (scale() != previous)
+        mStats.scaleChanges++;
+}
+
+void DynamicResolution::scaledSize(int width, int height, int* scaledWidth,
+        int* scaledHeight) const {
+    float s = scale();
+    *scaledWidth = (int)(width * s + 0.5f);
+    *scaledHeight = (int)(height * s + 0.5f);
+    if (*scaledWidth < 1)
+        *scaledWidth = 1;
+    if (*scaledHeight < 1)
+        *scaledHeight = 1;
+}
+
+void DynamicResolution::upscale(GLStateCache& state, GLuint source, int sourceWidth,
+        int sourceHeight, float exposure) {
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mUpscaleProgram);
+    glUniform2f(mTexelSizeUniform, 1.0f / sourceWidth, 1.0f / sourceHeight);
+    glUniform1f(mSharpnessUniform, DYNRES_SHARPNESS * (DYNRES_MAX_SCALE - scale()) /
+            (DYNRES_MAX_SCALE - DYNRES_MIN_SCALE));
+    glUniform1f(mExposureUniform, exposure);
+    state.bindTexture(0, GL_TEXTURE_2D, source);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+void DynamicResolution::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
@@ -0,0 +1,99 @@
+//
+// Dynamic resolution. The 3D scene is rendered at a scale of the surface
+// size, between DYNRES_MIN_SCALE and DYNRES_MAX_SCALE, and upscaled to it.
+// The scale follows a PID controller fed with the GPU time of each frame,
+// from GL_EXT_disjoint_timer_query when available and the CPU frame
+// interval otherwise, so the frame time holds near the target as the GPU
+// clock drops under thermal throttling.
+//
+
+#ifndef OPENGL_DEMO_DYNAMICRESOLUTION_H
+#define OPENGL_DEMO_DYNAMICRESOLUTION_H
+
+#include "gles3jni.h"
+
+#define DYNRES_MIN_SCALE 0.5f
+#define DYNRES_MAX_SCALE 1.0f
+// The scale moves in steps this big, so the targets only change size, and
+// get reallocated, when the load really shifts.
+#define DYNRES_SCALE_STEP 0.0625f
+// Timer queries in flight; results are read this many frames late.
+#define DYNRES_TIMER_QUERIES 4
+
+// The control loop alone, without GL. It controls the fraction of pixels
+// (scale squared), which the fragment cost is linear in.
+class ResolutionController {
+public:
+    ResolutionController();
+
+    // Starts over at full resolution.
+    void reset(float targetMs);
+    // Feeds one measured frame time and returns the new scale, a multiple
+    // of DYNRES_SCALE_STEP.
+    float update(float frameMs);
+
+    float scale() const { return mScale; }
+    float targetMs() const { return mTargetMs; }
+
+private:
+    float mTargetMs;
+    float mFilteredMs;      // 0 until the first measurement
+    float mFraction;        // continuous pixel fraction
+    float mError[2];        // errors of the last two updates
+    float mScale;
+};
+
+class DynamicResolution {
+public:
+    struct Stats {
+        unsigned int frames;
+        unsigned int measurements;
+        unsigned int scaleChanges;
+        double scaleSum;
+        double frameMsSum;
+    };
+
+    DynamicResolution();
+
+    bool init(float targetMs);
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mUpscaleProgram != 0; }
+    bool hasGpuTimer() const { return mQueries[0] != 0; }
+
+    // Brackets the frame's GPU work. endFrame() reads whatever timer results
+    // have arrived, or uses cpuFrameNs without a timer, and updates the scale.
+    void beginFrame();
+    void endFrame(uint64_t cpuFrameNs);
+
+    float scale() const { return mController.scale(); }
+    // The surface size scaled, at least 1x1.
+    void scaledSize(int width, int height, int* scaledWidth, int* scaledHeight) const;
+
+    // Draws source over the whole of the bound framebuffer's viewport with
+    // bilinear filtering, sharpened when the scale is below 1. A positive
+    // exposure tonemaps an HDR source on the way, see ToneMapper.h.
+    void upscale(GLStateCache& state, GLuint source, int sourceWidth, int sourceHeight,
+            float exposure = 0.0f);
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+private:
+    ResolutionController mController;
+
+    GLuint mQueries[DYNRES_TIMER_QUERIES];
+    unsigned int mQueryHead;        // next query to begin
+    unsigned int mQueriesPending;   // ended, result not read yet
+    bool mQueryActive;
+
+    GLuint mVAO;
+    GLuint mUpscaleProgram;
+    GLint mTexelSizeUniform;
+    GLint mSharpnessUniform;
+    GLint mExposureUniform;
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_DYNAMICRESOLUTION_H
@@ -0,0 +1,232 @@
+//
+// Redundant GL state filtering, see GLStateCache.h.
+//
+
+#include "gles3jni.h"
+
+#include <string.h>
+
+GLStateCache::GLStateCache() {
+    invalidate();
+    resetStats();
+}
+
+void GLStateCache::invalidate() {
+    mProgramKnown = false;
+    mProgram = 0;
+    mVaoKnown = false;
+    mVao = 0;
+    memset(mBufferKnown, 0, sizeof(mBufferKnown));
+    memset(mBuffers, 0, sizeof(mBuffers));
+    mActiveUnitKnown = false;
+    mActiveUnit = 0;
+    memset(mTextureKnown, 0, sizeof(mTextureKnown));
+    memset(mTextures, 0, sizeof(mTextures));
+    memset(mCaps, -1, sizeof(mCaps));
+    mBlendKnown = false;
+    mBlendSrc = mBlendDst = 0;
+    mDepthFuncKnown = false;
+    mDepthFunc = 0;
+    mDepthMask = -1;
+    mColorMask = -1;
+    mViewportKnown = false;
+    memset(mViewport, 0, sizeof(mViewport));
+}
+
+void GLStateCache::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+int GLStateCache::bufferSlot(GLenum target) {
+    switch (target) {
+        case GL_ARRAY_BUFFER:               return 0;
+        case GL_ELEMENT_ARRAY_BUFFER:       return 1;
+        case GL_UNIFORM_BUFFER:             return 2;
+        case GL_PIXEL_PACK_BUFFER:          return 3;
+        case GL_PIXEL_UNPACK_BUFFER:        return 4;
+        case GL_COPY_READ_BUFFER:           return 5;
+        case GL_COPY_WRITE_BUFFER:          return 6;
+        case GL_TRANSFORM_FEEDBACK_BUFFER:  return 7;
+#if HAVE_ES31_API
+        case GL_DRAW_INDIRECT_BUFFER:       return 8;
+#endif
+        default:                            return -1;
+    }
+}
+
+int GLStateCache::textureSlot(GLenum target) {
+    switch (target) {
+        case GL_TEXTURE_2D:         return 0;
+        case GL_TEXTURE_CUBE_MAP:   return 1;
+        case GL_TEXTURE_2D_ARRAY:   return 2;
+        case GL_TEXTURE_3D:         return 3;
+        default:                    return -1;
+    }
+}
+
+int GLStateCache::capSlot(GLenum cap) {
+    switch (cap) {
+        case GL_BLEND:          return 0;
+        case GL_DEPTH_TEST:     return 1;
+        case GL_CULL_FACE:      return 2;
+        case GL_SCISSOR_TEST:   return 3;
+        case GL_STENCIL_TEST:   return 4;
+        default:                return -1;
+    }
+}
+
+bool GLStateCache::useProgram(GLuint program) {
+    if (mProgramKnown && mProgram == program)
+        return filter();
+    glUseProgram(program);
+    mProgramKnown = true;
+    mProgram = program;
+    return issue();
+}
+
+bool GLStateCache::bindVertexArray(GLuint vao) {
+    if (mVaoKnown && mVao == vao)
+        return filter();
+    glBindVertexArray(vao);
+    mVaoKnown = true;
+    mVao = vao;
+    // The element array binding is part of the VAO.
+    mBufferKnown[bufferSlot(GL_ELEMENT_ARRAY_BUFFER)] = false;
+    return issue();
+}
+
+bool GLStateCache::bindBuffer(GLenum target, GLuint buffer) {
+    int slot = bufferSlot(target);
+    if (slot < 0) {
+        glBindBuffer(target, buffer);
+        return issue();
+    }
+    if (mBufferKnown[slot] && mBuffers[slot] == buffer)
+        return filter();
+    glBindBuffer(target, buffer);
+    mBufferKnown[slot] = true;
+    mBuffers[slot] = buffer;
+    return issue();
+}
+
+bool GLStateCache::bindBufferRange(GLenum target, GLuint index, GLuint buffer,
+        GLintptr offset, GLsizeiptr size) {
+    glBindBufferRange(target, index, buffer, offset, size);
+    int slot = bufferSlot(target);
+    if (slot >= 0) {
+        mBufferKnown[slot] = true;
+        mBuffers[slot] = buffer;
+    }
+    return issue();
+}
+
+bool GLStateCache::activeTexture(GLuint unit) {
+    if (mActiveUnitKnown && mActiveUnit == unit)
+        return filter();
+    glActiveTexture(GL_TEXTURE0 + unit);
+    mActiveUnitKnown = true;
+    mActiveUnit = unit;
+    return issue();
+}
+
+bool GLStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture) {
+    int slot = textureSlot(target);
+    if (slot >= 0 && unit < STATE_CACHE_TEXTURE_UNITS &&
+            mTextureKnown[unit][slot] && mTextures[unit][slot] == texture)
+        return filter();
+    activeTexture(unit);
+    glBindTexture(target, texture);
+    if (slot >= 0 && unit < STATE_CACHE_TEXTURE_UNITS) {
+        mTextureKnown[unit][slot] = true;
+        mTextures[unit][slot] = texture;
+    }
+    return issue();
+}
+
+bool GLStateCache::setEnabled(GLenum cap, bool enabled) {
+    int slot = capSlot(cap);
+    if (slot >= 0 && mCaps[slot] == (enabled ? 1 : 0))
+        return filter();
+    if (enabled)
+        glEnable(cap);
+    else
+        glDisable(cap);
+    if (slot >= 0)
+        mCaps[slot] = enabled ? 1 : 0;
+    return issue();
+}
+
+bool GLStateCache::blendFunc(GLenum src, GLenum dst) {
+    if (mBlendKnown && mBlendSrc == src && mBlendDst == dst)
+        return filter();
+    glBlendFunc(src, dst);
+    mBlendKnown = true;
+    mBlendSrc = src;
+    mBlendDst = dst;
+    return issue();
+}
+
+bool GLStateCache::depthFunc(GLenum func) {
+    if (mDepthFuncKnown && mDepthFunc == func)
+        return filter();
+    glDepthFunc(func);
+    mDepthFuncKnown = true;
+    mDepthFunc = func;
+    return issue();
+}
+
+bool GLStateCache::depthMask(bool write) {
+    if (mDepthMask == (write ? 1 : 0))
+        return filter();
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+    mDepthMask = write ? 1 : 0;
+    return issue();
+}
+
+bool GLStateCache::colorMask(bool write) {
+    if (mColorMask == (write ? 1 : 0))
+        return filter();
+    GLboolean b = write ? GL_TRUE : GL_FALSE;
+    glColorMask(b, b, b, b);
+    mColorMask = write ? 1 : 0;
+    return issue();
+}
+
+bool GLStateCache::viewport(GLint x, GLint y, GLsizei w, GLsizei h) {
+    if (mViewportKnown && mViewport[0] == x && mViewport[1] == y &&
+            mViewport[2] == w && mViewport[3] == h)
+        return filter();
+    glViewport(x, y, w, h);
+    mViewportKnown = true;
+    mViewport[0] = x;
+    mViewport[1] = y;
+    mViewport[2] = w;
+    mViewport[3] = h;
+    return issue();
+}
+
+void GLStateCache::forgetBuffer(GLuint buffer) {
+    for (int i = 0; i < BUFFER_TARGETS; i++) {
+        if (mBuffers[i] == buffer)
+            mBufferKnown[i] = false;
+    }
+}
+
+void GLStateCache::forgetTexture(GLuint texture) {
+    for (int unit = 0; unit < STATE_CACHE_TEXTURE_UNITS; unit++) {
+        for (int i = 0; i < TEXTURE_TARGETS; i++) {
+            if (mTextures[unit][i] == texture)
+                mTextureKnown[unit][i] = false;
+        }
+    }
+}
+
+void GLStateCache::forgetProgram(GLuint program) {
+    if (mProgram == program)
+        mProgramKnown = false;
+}
+
+void GLStateCache::forgetVertexArray(GLuint vao) {
+    if (mVao == vao)
+        mVaoKnown = false;
+}
@@ -0,0 +1,89 @@
+//
+// Shadow copy of the GL state the renderers touch most. Setters only reach
+// the driver when the value actually changes. Anything that changes state
+// behind the cache's back (or loses the context) must call invalidate().
+//
+// Included from gles3jni.h, which provides the GL headers.
+//
+
+#ifndef OPENGL_DEMO_GLSTATECACHE_H
+#define OPENGL_DEMO_GLSTATECACHE_H
+
+#define STATE_CACHE_TEXTURE_UNITS 16
+
+class GLStateCache {
+public:
+    struct Stats {
+        unsigned int issued;    // calls passed on to GL
+        unsigned int filtered;  // redundant calls dropped
+    };
+
+    GLStateCache();
+
+    // Marks every cached value unknown, so the next set of each is issued.
+    void invalidate();
+
+    // Each setter returns true if it issued a GL call.
+    bool useProgram(GLuint program);
+    bool bindVertexArray(GLuint vao);
+    bool bindBuffer(GLenum target, GLuint buffer);
+    // Indexed bindings aren't cached; this always issues, and records the
+    // generic binding that glBindBufferRange sets as a side effect.
+    bool bindBufferRange(GLenum target, GLuint index, GLuint buffer, GLintptr offset,
+            GLsizeiptr size);
+    // Binds texture to target on unit, selecting the unit if needed.
+    bool bindTexture(GLuint unit, GLenum target, GLuint texture);
+    bool activeTexture(GLuint unit);
+    bool setEnabled(GLenum cap, bool enabled);
+    bool blendFunc(GLenum src, GLenum dst);
+    bool depthFunc(GLenum func);
+    bool depthMask(bool write);
+    bool colorMask(bool write);
+    bool viewport(GLint x, GLint y, GLsizei w, GLsizei h);
+
+    // Call when deleting objects that may still be bound, since GL unbinds
+    // them implicitly.
+    void forgetBuffer(GLuint buffer);
+    void forgetTexture(GLuint texture);
+    void forgetProgram(GLuint program);
+    void forgetVertexArray(GLuint vao);
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+private:
+    enum { BUFFER_TARGETS = 9, TEXTURE_TARGETS = 4, CAPS = 5 };
+
+    static int bufferSlot(GLenum target);
+    static int textureSlot(GLenum target);
+    static int capSlot(GLenum cap);
+
+    bool issue() { mStats.issued++; return true; }
+    bool filter() { mStats.filtered++; return false; }
+
+    // Unknown values are stored as these sentinels.
+    bool mProgramKnown;
+    GLuint mProgram;
+    bool mVaoKnown;
+    GLuint mVao;
+    bool mBufferKnown[BUFFER_TARGETS];
+    GLuint mBuffers[BUFFER_TARGETS];
+    bool mActiveUnitKnown;
+    GLuint mActiveUnit;
+    bool mTextureKnown[STATE_CACHE_TEXTURE_UNITS][TEXTURE_TARGETS];
+    GLuint mTextures[STATE_CACHE_TEXTURE_UNITS][TEXTURE_TARGETS];
+    int8_t mCaps[CAPS];             // -1 unknown, 0 off, 1 on
+    bool mBlendKnown;
+    GLenum mBlendSrc;
+    GLenum mBlendDst;
+    bool mDepthFuncKnown;
+    GLenum mDepthFunc;
+    int8_t mDepthMask;
+    int8_t mColorMask;
+    bool mViewportKnown;
+    GLint mViewport[4];
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_GLSTATECACHE_H
@@ -0,0 +1,156 @@
+//
+// GPU-driven frustum culling, see GpuCuller.h.
+//
+
+#include "GpuCuller.h"
+
+#include <string.h>
+
+#include "glm/gtc/type_ptr.hpp"
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+// One invocation per (instance, submesh), x over instances and y over
+// submeshes. Spheres are relative to an instance, as in Mesh.
+static const char CULL_COMPUTE_SHADER[] =
+        "#version 310 es\n"
+        "layout(local_size_x = " STRV(GPU_CULL_GROUP_SIZE) ") in;\n"
+        "struct Command {\n"
+        "    uint count;\n"
+        "    uint instanceCount;\n"
+        "    uint firstIndex;\n"
+        "    uint baseVertex;\n"
+        "    uint reserved;\n"
+        "};\n"
+        "layout(std430, binding = 0) readonly buffer Instances { vec4 instances[]; };\n"
+        "layout(std430, binding = 1) readonly buffer Bounds { vec4 spheres[]; };\n"
+        "layout(std430, binding = 2) buffer Commands { Command commands[]; };\n"
+        "layout(std430, binding = 3) writeonly buffer Visible { float visible[]; };\n"
+        "uniform vec4 planes[6];\n"
+        "uniform uint instanceCount;\n"
+        "void main() {\n"
+        "    uint instance = gl_GlobalInvocationID.x;\n"
+        "    uint subMesh = gl_GlobalInvocationID.y;\n"
+        "    if (instance >= instanceCount)\n"
+        "        return;\n"
+        "    vec3 position = instances[instance].xyz;\n"
+        "    vec4 sphere = spheres[subMesh];\n"
+        "    vec3 center = sphere.xyz + position;\n"
+        "    for (int i = 0; i < 6; i++) {\n"
+        "        if (dot(planes[i].xyz, center) + planes[i].w < -sphere.w)\n"
+        "            return;\n"
+        "    }\n"
+        "    uint slot = atomicAdd(commands[subMesh].instanceCount, 1u);\n"
+        "    uint at = 3u * (subMesh * instanceCount + slot);\n"
+        "    visible[at] = position.x;\n"
+        "    visible[at + 1u] = position.y;\n"
+        "    visible[at + 2u] = position.z;\n"
+        "}\n";
+
+GpuCuller::GpuCuller()
+:   mProgram(0),
+    mPlanesUniform(-1),
+    mInstanceCountUniform(-1),
+    mInstanceCount(0),
+    mSubMeshCount(0)
+{
+    memset(mBuffers, 0, sizeof(mBuffers));
+}
+
+#if HAVE_ES31_API
+
+bool GpuCuller::init() {
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major < 3 || (major == 3 && minor < 1))
+        return false;
+
+    mProgram = createComputeProgram(CULL_COMPUTE_SHADER);
+    if (!mProgram)
+        return false;
+    mPlanesUniform = glGetUniformLocation(mProgram, "planes");
+    mInstanceCountUniform = glGetUniformLocation(mProgram, "instanceCount");
+    glGenBuffers(BUFFER_COUNT, mBuffers);
+    return !checkGlError("GpuCuller::init");
+}
+
+void GpuCuller::setObjects(const float* x, const float* y, const float* z, unsigned int count,
+        const std::vector<SubMesh>& subMeshes, GLStateCache& state) {
+    mInstanceCount = count;
+    mSubMeshCount = (unsigned int)subMeshes.size();
+
+    std::vector<float> instances(4 * (count > 0 ? count : 1), 0.0f);
+    for (unsigned int i = 0; i < count; i++) {
+        instances[4*i + 0] = x[i];
+        instances[4*i + 1] = y[i];
+        instances[4*i + 2] = z[i];
+    }
+    std::vector<float> spheres(4 * (mSubMeshCount > 0 ? mSubMeshCount : 1), 0.0f);
+    mResetCommands.resize(mSubMeshCount);
+    for (unsigned int s = 0; s < mSubMeshCount; s++) {
+        memcpy(&spheres[4*s], glm::value_ptr(subMeshes[s].sphere.center), 3*sizeof(float));
+        spheres[4*s + 3] = subMeshes[s].sphere.radius;
+        DrawElementsIndirectCommand command = {subMeshes[s].indexCount, 0,
+                subMeshes[s].firstIndex, 0, 0};
+        mResetCommands[s] = command;
+    }
+
+    state.bindBuffer(GL_COPY_WRITE_BUFFER, mBuffers[BUFFER_INSTANCES]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(instances.size() * sizeof(float)),
+            &instances[0], GL_STATIC_DRAW);
+    state.bindBuffer(GL_COPY_WRITE_BUFFER, mBuffers[BUFFER_BOUNDS]);
+    glBufferData(GL_COPY_WRITE_BUFFER, (GLsizeiptr)(spheres.size() * sizeof(float)),
+            &spheres[0], GL_STATIC_DRAW);
+    state.bindBuffer(GL_COPY_WRITE_BUFFER, mBuffers[BUFFER_COMMANDS]);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+            (GLsizeiptr)((mSubMeshCount > 0 ? mSubMeshCount : 1) * sizeof(DrawElementsIndirectCommand)),
+            NULL, GL_DYNAMIC_DRAW);
+    state.bindBuffer(GL_COPY_WRITE_BUFFER, mBuffers[BUFFER_VISIBLE]);
+    glBufferData(GL_COPY_WRITE_BUFFER,
+            (GLsizeiptr)((objectCount() > 0 ? objectCount() : 1) * 3*sizeof(float)),
+            NULL, GL_DYNAMIC_COPY);
+    checkGlError("GpuCuller::setObjects");
+}
+
+void GpuCuller::cull(const Frustum& frustum, GLStateCache& state) {
+    if (objectCount() == 0)
+        return;
+    state.bindBuffer(GL_COPY_WRITE_BUFFER, mBuffers[BUFFER_COMMANDS]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, 0,
+            (GLsizeiptr)(mSubMeshCount * sizeof(DrawElementsIndirectCommand)), &mResetCommands[0]);
+
+    state.useProgram(mProgram);
+    glUniform4fv(mPlanesUniform, 6, glm::value_ptr(frustum.planes[0]));
+    glUniform1ui(mInstanceCountUniform, mInstanceCount);
+    for (GLuint i = 0; i < BUFFER_COUNT; i++)
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, i, mBuffers[i]);
+    glDispatchCompute((mInstanceCount + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE,
+            mSubMeshCount, 1);
+    // The commands are read as indirect draw parameters, the positions as
+    // vertex attributes.
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
+
+#else
+
+bool GpuCuller::init() {
+    return false;
+}
+
+void GpuCuller::setObjects(const float*, const float*, const float*, unsigned int,
+        const std::vector<SubMesh>&, GLStateCache&) {
+}
+
+void GpuCuller::cull(const Frustum&, GLStateCache&) {
+}
+
+#endif
+
+void GpuCuller::destroy() {
+    glDeleteBuffers(BUFFER_COUNT, mBuffers);
+    glDeleteProgram(mProgram);
+    memset(mBuffers, 0, sizeof(mBuffers));
+    mProgram = 0;
+}
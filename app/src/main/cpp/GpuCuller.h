@@ -0,0 +1,80 @@
+//
+// GPU-driven frustum culling for ES 3.1. Instance positions and submesh
+// bounding spheres live in shader storage buffers; a compute shader tests
+// every (submesh, instance) pair, packs the positions of the visible ones
+// per submesh and counts them into one DrawElementsIndirectCommand per
+// submesh. The CPU then issues one glDrawElementsIndirect per submesh
+// without knowing what survived, so submission cost doesn't grow with the
+// instance count.
+//
+// ES 3.1 indirect draws have no base instance, so each submesh's visible
+// instances start at instanceOffset(subMesh) and the instance attribute is
+// pointed there before its draw.
+//
+
+#ifndef OPENGL_DEMO_GPUCULLER_H
+#define OPENGL_DEMO_GPUCULLER_H
+
+#include <vector>
+
+#include "gles3jni.h"
+#include "Culling.h"
+#include "Mesh.h"
+
+// Compute work group size; instances per invocation row.
+#define GPU_CULL_GROUP_SIZE 64
+
+// Layout of the indirect draw buffer, as glDrawElementsIndirect reads it.
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint reservedMustBeZero;
+};
+
+class GpuCuller {
+public:
+    GpuCuller();
+
+    // Returns false on contexts below ES 3.1, or without the ES 3.1 API at
+    // build time.
+    bool init();
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mProgram != 0; }
+
+    // Uploads instance positions (SoA, count of them) and the submeshes'
+    // bounds and index ranges, and sizes the output buffers.
+    void setObjects(const float* x, const float* y, const float* z, unsigned int count,
+            const std::vector<SubMesh>& subMeshes, GLStateCache& state);
+    // Dispatches the cull. Draws issued afterwards see its commands and
+    // visible instances.
+    void cull(const Frustum& frustum, GLStateCache& state);
+
+    unsigned int objectCount() const { return mInstanceCount * mSubMeshCount; }
+    // Indirect command of a submesh in commandBuffer().
+    GLuint commandBuffer() const { return mBuffers[BUFFER_COMMANDS]; }
+    uintptr_t commandOffset(unsigned int subMesh) const {
+        return subMesh * sizeof(DrawElementsIndirectCommand);
+    }
+    // Visible positions of a submesh in instanceBuffer(), 3 floats each.
+    GLuint instanceBuffer() const { return mBuffers[BUFFER_VISIBLE]; }
+    uintptr_t instanceOffset(unsigned int subMesh) const {
+        return (uintptr_t)subMesh * mInstanceCount * 3*sizeof(float);
+    }
+
+private:
+    enum {BUFFER_INSTANCES, BUFFER_BOUNDS, BUFFER_COMMANDS, BUFFER_VISIBLE, BUFFER_COUNT};
+
+    GLuint mProgram;
+    GLint mPlanesUniform;
+    GLint mInstanceCountUniform;
+    GLuint mBuffers[BUFFER_COUNT];
+    unsigned int mInstanceCount;
+    unsigned int mSubMeshCount;
+    // Commands with zero instances, uploaded before every cull.
+    std::vector<DrawElementsIndirectCommand> mResetCommands;
+};
+
+#endif //OPENGL_DEMO_GPUCULLER_H
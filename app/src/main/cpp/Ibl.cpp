@@ -0,0 +1,754 @@
+//
+// Image-based lighting precomputation, see Ibl.h.
+//
+
+#include "Ibl.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "glm/glm.hpp"
+
+#include "WorkerPool.h"
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+// Bump whenever the generated data changes, so old cache files are ignored.
+#define IBL_CACHE_VERSION 1
+#define IBL_CACHE_MAGIC 0x314c4249u     // "IBL1"
+// The SH projection runs on the first environment mip at most this wide.
+#define IBL_SH_MAX_WIDTH 128
+
+// ---------------------------------------------------------------------------
+// Environment
+
+void makeSkyEnvironment(int width, int height, Environment* env) {
+    const glm::vec3 sunDir = glm::normalize(glm::vec3(0.4f, 0.6f, -0.7f));
+    env->width = width;
+    env->height = height;
+    env->rgb.resize(3 * width * height);
+    for (int y = 0; y < height; y++) {
+        float theta = (y + 0.5f) / height * (float)M_PI;
+        for (int x = 0; x < width; x++) {
+            float phi = ((x + 0.5f) / width - 0.5f) * 2.0f * (float)M_PI;
+            glm::vec3 dir(sinf(theta) * sinf(phi), cosf(theta), -sinf(theta) * cosf(phi));
+
+            glm::vec3 c;
+            if (dir.y >= 0.0f) {
+                c = glm::mix(glm::vec3(0.9f, 0.95f, 1.0f), glm::vec3(0.25f, 0.45f, 0.9f),
+                        powf(dir.y, 0.5f));
+            } else {
+                c = glm::mix(glm::vec3(0.35f, 0.3f, 0.25f), glm::vec3(0.1f, 0.09f, 0.08f),
+                        powf(-dir.y, 0.5f));
+            }
+            float sun = glm::dot(dir, sunDir);
+            if (sun > 0.998f)
+                c += glm::vec3(40.0f, 36.0f, 30.0f);
+            float* out = &env->rgb[3 * (y * width + x)];
+            out[0] = c.r;
+            out[1] = c.g;
+            out[2] = c.b;
+        }
+    }
+}
+
+static float srgbToLinear(uint32_t c) {
+    float v = c / 255.0f;
+    return v <= 0.04045f ? v / 12.92f : powf((v + 0.055f) / 1.055f, 2.4f);
+}
+
+void environmentFromRgba(const uint32_t* data, int width, int height, Environment* env) {
+    env->width = width;
+    env->height = height;
+    env->rgb.resize(3 * width * height);
+    for (int i = 0; i < width * height; i++) {
+        env->rgb[3*i + 0] = srgbToLinear(data[i] & 0xff);
+        env->rgb[3*i + 1] = srgbToLinear((data[i] >> 8) & 0xff);
+        env->rgb[3*i + 2] = srgbToLinear((data[i] >> 16) & 0xff);
+    }
+}
+
+// 2x2 box-filtered chain down to 1 pixel high, used to pick a pre-blurred
+// source per sample when prefiltering.
+static void buildEnvironmentMips(const Environment& env, std::vector<Environment>* mips) {
+    mips->assign(1, env);
+    while (mips->back().height > 1 && mips->back().width > 1) {
+        const Environment& src = mips->back();
+        Environment dst;
+        dst.width = src.width / 2;
+        dst.height = src.height / 2;
+        dst.rgb.resize(3 * dst.width * dst.height);
+        for (int y = 0; y < dst.height; y++) {
+            for (int x = 0; x < dst.width; x++) {
+                for (int c = 0; c < 3; c++) {
+                    const float* s = &src.rgb[3 * (2*y * src.width + 2*x) + c];
+                    dst.rgb[3 * (y * dst.width + x) + c] = 0.25f *
+                            (s[0] + s[3] + s[3 * src.width] + s[3 * src.width + 3]);
+                }
+            }
+        }
+        mips->push_back(dst);
+    }
+}
+
+static glm::vec2 directionToEquirect(const glm::vec3& d) {
+    return glm::vec2(atan2f(d.x, -d.z) * (0.5f / (float)M_PI) + 0.5f,
+            acosf(glm::clamp(d.y, -1.0f, 1.0f)) / (float)M_PI);
+}
+
+static glm::vec3 sampleBilinear(const Environment& env, const glm::vec2& uv) {
+    float fx = uv.x * env.width - 0.5f;
+    float fy = uv.y * env.height - 0.5f;
+    int x0 = (int)floorf(fx);
+    int y0 = (int)floorf(fy);
+    float tx = fx - x0;
+    float ty = fy - y0;
+    glm::vec3 result(0.0f);
+    for (int j = 0; j < 2; j++) {
+        int y = glm::clamp(y0 + j, 0, env.height - 1);
+        for (int i = 0; i < 2; i++) {
+            int x = ((x0 + i) % env.width + env.width) % env.width;
+            const float* p = &env.rgb[3 * (y * env.width + x)];
+            float w = (i ? tx : 1.0f - tx) * (j ? ty : 1.0f - ty);
+            result += w * glm::vec3(p[0], p[1], p[2]);
+        }
+    }
+    return result;
+}
+
+static glm::vec3 sampleEnvironment(const std::vector<Environment>& mips, const glm::vec3& dir,
+        float lod) {
+    glm::vec2 uv = directionToEquirect(dir);
+    lod = glm::clamp(lod, 0.0f, float(mips.size() - 1));
+    int level = (int)lod;
+    if (level + 1 >= (int)mips.size())
+        return sampleBilinear(mips[level], uv);
+    return glm::mix(sampleBilinear(mips[level], uv), sampleBilinear(mips[level + 1], uv),
+            lod - level);
+}
+
+// ---------------------------------------------------------------------------
+// Sampling helpers, mirrored by the GPU shaders below.
+
+static glm::vec2 hammersley(uint32_t i, uint32_t n) {
+    uint32_t bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    return glm::vec2(float(i) / float(n), float(bits) * 2.3283064365386963e-10f);
+}
+
+// GGX half vector around n, for a = roughness^2.
+static glm::vec3 importanceSampleGgx(const glm::vec2& xi, float a, const glm::vec3& n) {
+    float phi = 2.0f * (float)M_PI * xi.x;
+    float cosTheta = sqrtf((1.0f - xi.y) / (1.0f + (a*a - 1.0f) * xi.y));
+    float sinTheta = sqrtf(1.0f - cosTheta * cosTheta);
+    glm::vec3 h(sinTheta * cosf(phi), sinTheta * sinf(phi), cosTheta);
+
+    glm::vec3 up = fabsf(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+    glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+    glm::vec3 bitangent = glm::cross(n, tangent);
+    return tangent * h.x + bitangent * h.y + n * h.z;
+}
+
+// Direction through texel center (x, y) of a GL cubemap face.
+static glm::vec3 cubeDirection(int face, int x, int y, int size) {
+    float s = 2.0f * (x + 0.5f) / size - 1.0f;
+    float t = 2.0f * (y + 0.5f) / size - 1.0f;
+    glm::vec3 d;
+    switch (face) {
+        case 0:  d = glm::vec3( 1.0f,   -t,   -s); break;
+        case 1:  d = glm::vec3(-1.0f,   -t,    s); break;
+        case 2:  d = glm::vec3(    s, 1.0f,    t); break;
+        case 3:  d = glm::vec3(    s,-1.0f,   -t); break;
+        case 4:  d = glm::vec3(    s,   -t, 1.0f); break;
+        default: d = glm::vec3(   -s,   -t,-1.0f); break;
+    }
+    return glm::normalize(d);
+}
+
+static uint16_t floatToHalf(float f) {
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t biased = (x >> 23) & 0xffu;
+    uint32_t mantissa = x & 0x7fffffu;
+    if (biased == 0xffu)
+        return (uint16_t)(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+    int exponent = (int)biased - 127 + 15;
+    if (exponent >= 31)
+        return (uint16_t)(sign | 0x7c00u);
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return (uint16_t)sign;
+        mantissa |= 0x800000u;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        if ((mantissa >> (shift - 1)) & 1u)
+            half++;
+        return (uint16_t)(sign | half);
+    }
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    if (mantissa & 0x1000u)
+        half++;     // a carry into the exponent still rounds correctly
+    return (uint16_t)half;
+}
+
+// ---------------------------------------------------------------------------
+// CPU generation
+
+struct IblData {
+    std::vector<uint16_t> lut;                  // RG, IBL_LUT_SIZE^2
+    float sh[3 * IBL_SH_COEFFS];
+    std::vector<uint16_t> cube[IBL_CUBE_MIPS];  // RGBA, 6 faces per mip
+};
+
+static int cubeMipSize(int mip) {
+    return IBL_CUBE_SIZE >> mip;
+}
+
+static void generateBrdfLut(std::vector<uint16_t>* lut) {
+    lut->resize(2 * IBL_LUT_SIZE * IBL_LUT_SIZE);
+    WorkerPool::shared().parallelFor(IBL_LUT_SIZE, 4, [lut](unsigned int begin, unsigned int end) {
+        for (unsigned int y = begin; y < end; y++) {
+            float roughness = (y + 0.5f) / IBL_LUT_SIZE;
+            float a = roughness * roughness;
+            float k = a / 2.0f;
+            for (int x = 0; x < IBL_LUT_SIZE; x++) {
+                float nDotV = (x + 0.5f) / IBL_LUT_SIZE;
+                glm::vec3 v(sqrtf(1.0f - nDotV * nDotV), 0.0f, nDotV);
+                float scale = 0.0f, bias = 0.0f;
+                for (uint32_t i = 0; i < IBL_LUT_SAMPLES; i++) {
+                    glm::vec3 h = importanceSampleGgx(hammersley(i, IBL_LUT_SAMPLES), a,
+                            glm::vec3(0.0f, 0.0f, 1.0f));
+                    glm::vec3 l = 2.0f * glm::dot(v, h) * h - v;
+                    float nDotL = l.z;
+                    if (nDotL <= 0.0f)
+                        continue;
+                    float nDotH = fmaxf(h.z, 0.0f);
+                    float vDotH = fmaxf(glm::dot(v, h), 0.0f);
+                    float g = (nDotV / (nDotV * (1.0f - k) + k)) * (nDotL / (nDotL * (1.0f - k) + k));
+                    float gVis = g * vDotH / (nDotH * nDotV);
+                    float fc = powf(1.0f - vDotH, 5.0f);
+                    scale += (1.0f - fc) * gVis;
+                    bias += fc * gVis;
+                }
+                uint16_t* out = &(*lut)[2 * (y * IBL_LUT_SIZE + x)];
+                out[0] = floatToHalf(scale / IBL_LUT_SAMPLES);
+                out[1] = floatToHalf(bias / IBL_LUT_SAMPLES);
+            }
+        }
+    });
+}
+
+// Projects the environment onto the first three SH bands and folds in the
+// cosine lobe convolution (pi, 2pi/3, pi/4) and the 1/pi of the Lambert BRDF.
+static void projectIrradianceSh(const Environment& env, float* sh) {
+    static const float BAND_SCALE[IBL_SH_COEFFS] = {
+        1.0f, 2.0f/3.0f, 2.0f/3.0f, 2.0f/3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f,
+    };
+    double sums[3 * IBL_SH_COEFFS] = {0.0};
+    for (int y = 0; y < env.height; y++) {
+        float theta = (y + 0.5f) / env.height * (float)M_PI;
+        float solidAngle = (2.0f * (float)M_PI / env.width) * ((float)M_PI / env.height) * sinf(theta);
+        for (int x = 0; x < env.width; x++) {
+            float phi = ((x + 0.5f) / env.width - 0.5f) * 2.0f * (float)M_PI;
+            float dx = sinf(theta) * sinf(phi), dy = cosf(theta), dz = -sinf(theta) * cosf(phi);
+            float basis[IBL_SH_COEFFS] = {
+                0.282095f,
+                0.488603f * dy, 0.488603f * dz, 0.488603f * dx,
+                1.092548f * dx * dy, 1.092548f * dy * dz, 0.315392f * (3.0f * dz * dz - 1.0f),
+                1.092548f * dx * dz, 0.546274f * (dx * dx - dy * dy),
+            };
+            const float* c = &env.rgb[3 * (y * env.width + x)];
+            for (int i = 0; i < IBL_SH_COEFFS; i++) {
+                for (int ch = 0; ch < 3; ch++)
+                    sums[3*i + ch] += c[ch] * basis[i] * solidAngle;
+            }
+        }
+    }
+    for (int i = 0; i < IBL_SH_COEFFS; i++) {
+        for (int ch = 0; ch < 3; ch++)
+            sh[3*i + ch] = float(sums[3*i + ch] * BAND_SCALE[i]);
+    }
+}
+
+static const Environment& shSource(const std::vector<Environment>& mips) {
+    size_t level = 0;
+    while (level + 1 < mips.size() && mips[level].width > IBL_SH_MAX_WIDTH)
+        level++;
+    return mips[level];
+}
+
+// Filtered importance sampling: each sample reads the environment mip whose
+// texels roughly match the solid angle the sample stands for.
+static glm::vec3 prefilter(const std::vector<Environment>& mips, const glm::vec3& n, float a) {
+    const float texelSolidAngle = 4.0f * (float)M_PI / (mips[0].width * mips[0].height);
+    glm::vec3 sum(0.0f);
+    float weights = 0.0f;
+    for (uint32_t i = 0; i < IBL_PREFILTER_SAMPLES; i++) {
+        glm::vec3 h = importanceSampleGgx(hammersley(i, IBL_PREFILTER_SAMPLES), a, n);
+        float nDotH = glm::dot(n, h);
+        glm::vec3 l = 2.0f * nDotH * h - n;
+        float nDotL = glm::dot(n, l);
+        if (nDotL <= 0.0f)
+            continue;
+        // With n = v the pdf of l is D / 4.
+        float denom = nDotH * nDotH * (a*a - 1.0f) + 1.0f;
+        float d = a * a / ((float)M_PI * denom * denom);
+        float sampleSolidAngle = 1.0f / (IBL_PREFILTER_SAMPLES * d * 0.25f + 0.0001f);
+        float lod = 0.5f * log2f(sampleSolidAngle / texelSolidAngle) + 1.0f;
+        sum += sampleEnvironment(mips, l, lod) * nDotL;
+        weights += nDotL;
+    }
+    return weights > 0.0f ? sum / weights : sum;
+}
+
+static void generatePrefilteredCube(const std::vector<Environment>& mips,
+        std::vector<uint16_t>* cube) {
+    for (int mip = 0; mip < IBL_CUBE_MIPS; mip++) {
+        const int size = cubeMipSize(mip);
+        const float roughness = float(mip) / (IBL_CUBE_MIPS - 1);
+        const float a = roughness * roughness;
+        std::vector<uint16_t>& out = cube[mip];
+        out.resize(6 * 4 * size * size);
+        // One job per face row.
+        WorkerPool::shared().parallelFor(6 * size, 4,
+                [&, size, a, mip](unsigned int begin, unsigned int end) {
+            for (unsigned int row = begin; row < end; row++) {
+                int face = row / size;
+                int y = row % size;
+                for (int x = 0; x < size; x++) {
+                    glm::vec3 n = cubeDirection(face, x, y, size);
+                    glm::vec3 c = mip == 0 ? sampleEnvironment(mips, n, 0.0f) : prefilter(mips, n, a);
+                    uint16_t* texel = &out[4 * ((face * size + y) * size + x)];
+                    texel[0] = floatToHalf(c.r);
+                    texel[1] = floatToHalf(c.g);
+                    texel[2] = floatToHalf(c.b);
+                    texel[3] = floatToHalf(1.0f);
+                }
+            }
+        });
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Disk cache
+
+static std::string g_cacheDir(IBL_CACHE_DIR);
+
+void setIblCacheDir(const char* dir) {
+    g_cacheDir = dir;
+}
+
+// Creates the cache directory if needed; false if it can't be written.
+static bool openCacheDir() {
+    if (mkdir(g_cacheDir.c_str(), 0755) != 0 && errno != EEXIST) {
+        ALOGE("IBL: can't create %s (errno %d)", g_cacheDir.c_str(), errno);
+        return false;
+    }
+    if (access(g_cacheDir.c_str(), W_OK) != 0) {
+        ALOGE("IBL: can't write to %s (errno %d)", g_cacheDir.c_str(), errno);
+        return false;
+    }
+    return true;
+}
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+static uint64_t hashEnvironment(const Environment& env) {
+    const int params[] = {IBL_CACHE_VERSION, IBL_LUT_SIZE, IBL_LUT_SAMPLES, IBL_CUBE_SIZE,
+            IBL_CUBE_MIPS, IBL_PREFILTER_SAMPLES, env.width, env.height};
+    uint64_t hash = fnv1a(14695981039346656037ull, params, sizeof(params));
+    return fnv1a(hash, &env.rgb[0], env.rgb.size() * sizeof(float));
+}
+
+struct IblCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+};
+
+static void cachePath(uint64_t hash, char* path, size_t size) {
+    snprintf(path, size, "%s/%016llx.ibl", g_cacheDir.c_str(), (unsigned long long)hash);
+}
+
+static bool loadCache(uint64_t hash, IblData* data) {
+    char path[256];
+    cachePath(hash, path, sizeof(path));
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    IblCacheHeader header;
+    bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == IBL_CACHE_MAGIC && header.version == IBL_CACHE_VERSION &&
+            header.hash == hash;
+    data->lut.resize(2 * IBL_LUT_SIZE * IBL_LUT_SIZE);
+    ok = ok && fread(&data->lut[0], sizeof(uint16_t), data->lut.size(), file) == data->lut.size();
+    ok = ok && fread(data->sh, sizeof(data->sh), 1, file) == 1;
+    for (int mip = 0; ok && mip < IBL_CUBE_MIPS; mip++) {
+        std::vector<uint16_t>& cube = data->cube[mip];
+        cube.resize(6 * 4 * cubeMipSize(mip) * cubeMipSize(mip));
+        ok = fread(&cube[0], sizeof(uint16_t), cube.size(), file) == cube.size();
+    }
+    fclose(file);
+    if (!ok)
+        ALOGE("IBL: ignoring bad cache file %s", path);
+    return ok;
+}
+
+static void saveCache(uint64_t hash, const IblData& data) {
+    char path[256];
+    cachePath(hash, path, sizeof(path));
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        ALOGE("IBL: can't write %s (errno %d)", path, errno);
+        return;
+    }
+    IblCacheHeader header = {IBL_CACHE_MAGIC, IBL_CACHE_VERSION, hash};
+    bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    ok = ok && fwrite(&data.lut[0], sizeof(uint16_t), data.lut.size(), file) == data.lut.size();
+    ok = ok && fwrite(data.sh, sizeof(data.sh), 1, file) == 1;
+    for (int mip = 0; ok && mip < IBL_CUBE_MIPS; mip++)
+        ok = fwrite(&data.cube[mip][0], sizeof(uint16_t), data.cube[mip].size(), file) ==
+                data.cube[mip].size();
+    if (fclose(file) != 0 || !ok) {
+        ALOGE("IBL: failed writing %s", path);
+        remove(path);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// GPU generation, used when the CPU path would run on a single core or
+// would have to run again on every launch for lack of a cache.
+
+static const char IBL_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "out vec2 vTexCood;\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    vTexCood = p;\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// The bit reversal needs 32-bit uints, so the shaders ask for highp int.
+#define IBL_SHADER_SAMPLING \
+        "#define PI 3.14159265\n" \
+        "vec2 hammersley(uint i, uint n) {\n" \
+        "    uint bits = (i << 16u) | (i >> 16u);\n" \
+        "    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);\n" \
+        "    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);\n" \
+        "    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);\n" \
+        "    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);\n" \
+        "    return vec2(float(i) / float(n), float(bits) * 2.3283064365386963e-10);\n" \
+        "}\n" \
+        "vec3 importanceSampleGgx(vec2 xi, float a, vec3 n) {\n" \
+        "    float phi = 2.0 * PI * xi.x;\n" \
+        "    float cosTheta = sqrt((1.0 - xi.y) / (1.0 + (a * a - 1.0) * xi.y));\n" \
+        "    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);\n" \
+        "    vec3 h = vec3(sinTheta * cos(phi), sinTheta * sin(phi), cosTheta);\n" \
+        "    vec3 up = abs(n.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);\n" \
+        "    vec3 tangent = normalize(cross(up, n));\n" \
+        "    vec3 bitangent = cross(n, tangent);\n" \
+        "    return tangent * h.x + bitangent * h.y + n * h.z;\n" \
+        "}\n"
+
+static const char BRDF_LUT_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "precision highp int;\n"
+        "#define SAMPLES " STRV(IBL_LUT_SAMPLES) "u\n"
+        IBL_SHADER_SAMPLING
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    float nDotV = vTexCood.x;\n"
+        "    float a = vTexCood.y * vTexCood.y;\n"
+        "    float k = a / 2.0;\n"
+        "    vec3 v = vec3(sqrt(1.0 - nDotV * nDotV), 0.0, nDotV);\n"
+        "    vec2 sum = vec2(0.0);\n"
+        "    for (uint i = 0u; i < SAMPLES; i++) {\n"
+        "        vec3 h = importanceSampleGgx(hammersley(i, SAMPLES), a, vec3(0.0, 0.0, 1.0));\n"
+        "        vec3 l = 2.0 * dot(v, h) * h - v;\n"
+        "        float nDotL = l.z;\n"
+        "        if (nDotL <= 0.0) continue;\n"
+        "        float nDotH = max(h.z, 0.0);\n"
+        "        float vDotH = max(dot(v, h), 0.0);\n"
+        "        float g = (nDotV / (nDotV * (1.0 - k) + k)) * (nDotL / (nDotL * (1.0 - k) + k));\n"
+        "        float gVis = g * vDotH / (nDotH * nDotV);\n"
+        "        float fc = pow(1.0 - vDotH, 5.0);\n"
+        "        sum += vec2((1.0 - fc) * gVis, fc * gVis);\n"
+        "    }\n"
+        "    outColor = vec4(sum / float(SAMPLES), 0.0, 1.0);\n"
+        "}\n";
+
+static const char PREFILTER_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "precision highp int;\n"
+        "#define SAMPLES " STRV(IBL_PREFILTER_SAMPLES) "u\n"
+        IBL_SHADER_SAMPLING
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D environment;\n"
+        "uniform int face;\n"
+        "uniform float roughness;\n"
+        "uniform float texelSolidAngle;\n"
+        "vec3 cubeDirection(vec2 st) {\n"
+        "    float s = 2.0 * st.x - 1.0, t = 2.0 * st.y - 1.0;\n"
+        "    if (face == 0) return vec3(1.0, -t, -s);\n"
+        "    if (face == 1) return vec3(-1.0, -t, s);\n"
+        "    if (face == 2) return vec3(s, 1.0, t);\n"
+        "    if (face == 3) return vec3(s, -1.0, -t);\n"
+        "    if (face == 4) return vec3(s, -t, 1.0);\n"
+        "    return vec3(-s, -t, -1.0);\n"
+        "}\n"
+        "vec3 sampleEnvironment(vec3 d, float lod) {\n"
+        "    vec2 uv = vec2(atan(d.x, -d.z) * (0.5 / PI) + 0.5, acos(clamp(d.y, -1.0, 1.0)) / PI);\n"
+        "    return textureLod(environment, uv, lod).rgb;\n"
+        "}\n"
+        "void main() {\n"
+        "    vec3 n = normalize(cubeDirection(vTexCood));\n"
+        "    if (roughness == 0.0) { outColor = vec4(sampleEnvironment(n, 0.0), 1.0); return; }\n"
+        "    float a = roughness * roughness;\n"
+        "    vec3 sum = vec3(0.0);\n"
+        "    float weights = 0.0;\n"
+        "    for (uint i = 0u; i < SAMPLES; i++) {\n"
+        "        vec3 h = importanceSampleGgx(hammersley(i, SAMPLES), a, n);\n"
+        "        float nDotH = dot(n, h);\n"
+        "        vec3 l = 2.0 * nDotH * h - n;\n"
+        "        float nDotL = dot(n, l);\n"
+        "        if (nDotL <= 0.0) continue;\n"
+        "        float denom = nDotH * nDotH * (a * a - 1.0) + 1.0;\n"
+        "        float d = a * a / (PI * denom * denom);\n"
+        "        float sampleSolidAngle = 1.0 / (float(SAMPLES) * d * 0.25 + 0.0001);\n"
+        "        float lod = 0.5 * log2(sampleSolidAngle / texelSolidAngle) + 1.0;\n"
+        "        sum += sampleEnvironment(l, lod) * nDotL;\n"
+        "        weights += nDotL;\n"
+        "    }\n"
+        "    outColor = vec4(sum / max(weights, 0.0001), 1.0);\n"
+        "}\n";
+
+// ---------------------------------------------------------------------------
+
+ImageBasedLighting::ImageBasedLighting()
+:   mSource(SOURCE_NONE),
+    mBrdfLut(0),
+    mPrefiltered(0)
+{
+    memset(mSh, 0, sizeof(mSh));
+}
+
+void ImageBasedLighting::destroy() {
+    glDeleteTextures(1, &mBrdfLut);
+    glDeleteTextures(1, &mPrefiltered);
+    mBrdfLut = mPrefiltered = 0;
+    mSource = SOURCE_NONE;
+    memset(mSh, 0, sizeof(mSh));
+}
+
+// Reads the bound size x size float framebuffer into channels halfs per
+// texel.
+static void readHalfs(int size, int channels, std::vector<float>* texels, uint16_t* halfs) {
+    texels->resize(4 * size * size);
+    glReadPixels(0, 0, size, size, GL_RGBA, GL_FLOAT, &(*texels)[0]);
+    for (int i = 0; i < size * size; i++) {
+        for (int c = 0; c < channels; c++)
+            halfs[channels*i + c] = floatToHalf((*texels)[4*i + c]);
+    }
+}
+
+static void setSampling(GLenum target, GLenum minFilter) {
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, minFilter);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+bool ImageBasedLighting::init(const Environment& env, GLStateCache& state) {
+    uint64_t startNs = nowNs();
+    uint64_t hash = hashEnvironment(env);
+
+    IblData data;
+    bool cacheWritable = openCacheDir();
+    if (loadCache(hash, &data)) {
+        mSource = SOURCE_CACHE;
+    } else if ((WorkerPool::shared().threadCount() == 1 || !cacheWritable) &&
+            generateOnGpu(env, state, cacheWritable ? &data : NULL)) {
+        mSource = SOURCE_GPU;
+        if (!data.lut.empty())
+            saveCache(hash, data);
+        ALOGV("IBL: generated on the GPU in %.1f ms%s", (nowNs() - startNs) * 0.000001f,
+              data.lut.empty() ? "" : ", cached");
+        return true;
+    } else {
+        std::vector<Environment> mips;
+        buildEnvironmentMips(env, &mips);
+        generateBrdfLut(&data.lut);
+        projectIrradianceSh(shSource(mips), data.sh);
+        generatePrefilteredCube(mips, data.cube);
+        if (cacheWritable)
+            saveCache(hash, data);
+        mSource = SOURCE_CPU;
+    }
+
+    memcpy(mSh, data.sh, sizeof(mSh));
+
+    glGenTextures(1, &mBrdfLut);
+    state.bindTexture(0, GL_TEXTURE_2D, mBrdfLut);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RG16F, IBL_LUT_SIZE, IBL_LUT_SIZE);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, IBL_LUT_SIZE, IBL_LUT_SIZE, GL_RG, GL_HALF_FLOAT,
+            &data.lut[0]);
+    setSampling(GL_TEXTURE_2D, GL_LINEAR);
+
+    glGenTextures(1, &mPrefiltered);
+    state.bindTexture(0, GL_TEXTURE_CUBE_MAP, mPrefiltered);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, IBL_CUBE_MIPS, GL_RGBA16F, IBL_CUBE_SIZE, IBL_CUBE_SIZE);
+    for (int mip = 0; mip < IBL_CUBE_MIPS; mip++) {
+        int size = cubeMipSize(mip);
+        for (int face = 0; face < 6; face++)
+            glTexSubImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mip, 0, 0, size, size,
+                    GL_RGBA, GL_HALF_FLOAT, &data.cube[mip][4 * face * size * size]);
+    }
+    setSampling(GL_TEXTURE_CUBE_MAP, GL_LINEAR_MIPMAP_LINEAR);
+
+    ALOGV("IBL: %s in %.1f ms", mSource == SOURCE_CACHE ? "loaded from cache" : "generated on CPU",
+          (nowNs() - startNs) * 0.000001f);
+    return !checkGlError("ImageBasedLighting::init");
+}
+
+bool ImageBasedLighting::generateOnGpu(const Environment& env, GLStateCache& state,
+        IblData* readback) {
+    // Without float color buffers the targets fall back to 8 bits, which
+    // clamps the specular environment to LDR.
+    bool floatTargets = hasExtension("GL_EXT_color_buffer_float") ||
+            hasExtension("GL_EXT_color_buffer_half_float");
+    GLenum lutFormat = floatTargets ? GL_RG16F : GL_RG8;
+    GLenum cubeFormat = floatTargets ? GL_RGBA16F : GL_RGBA8;
+    // 8-bit results would put clamped data in the cache.
+    if (!floatTargets)
+        readback = NULL;
+
+    GLuint lutProgram = createProgram(IBL_VERTEX_SHADER, BRDF_LUT_FRAGMENT_SHADER);
+    GLuint prefilterProgram = createProgram(IBL_VERTEX_SHADER, PREFILTER_FRAGMENT_SHADER);
+    if (!lutProgram || !prefilterProgram) {
+        glDeleteProgram(lutProgram);
+        glDeleteProgram(prefilterProgram);
+        return false;
+    }
+
+    // The SH projection is cheap enough to stay on the CPU, and the source
+    // mips are uploaded for filtered importance sampling.
+    std::vector<Environment> mips;
+    buildEnvironmentMips(env, &mips);
+    projectIrradianceSh(shSource(mips), mSh);
+
+    GLuint envTexture;
+    glGenTextures(1, &envTexture);
+    state.bindTexture(0, GL_TEXTURE_2D, envTexture);
+    glTexStorage2D(GL_TEXTURE_2D, (GLsizei)mips.size(), GL_RGBA16F, env.width, env.height);
+    std::vector<uint16_t> halfs;
+    for (size_t level = 0; level < mips.size(); level++) {
+        const Environment& mip = mips[level];
+        halfs.resize(4 * mip.width * mip.height);
+        for (int i = 0; i < mip.width * mip.height; i++) {
+            for (int c = 0; c < 3; c++)
+                halfs[4*i + c] = floatToHalf(mip.rgb[3*i + c]);
+            halfs[4*i + 3] = floatToHalf(1.0f);
+        }
+        glTexSubImage2D(GL_TEXTURE_2D, (GLint)level, 0, 0, mip.width, mip.height, GL_RGBA,
+                GL_HALF_FLOAT, &halfs[0]);
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+    glGenTextures(1, &mBrdfLut);
+    state.bindTexture(0, GL_TEXTURE_2D, mBrdfLut);
+    glTexStorage2D(GL_TEXTURE_2D, 1, lutFormat, IBL_LUT_SIZE, IBL_LUT_SIZE);
+    setSampling(GL_TEXTURE_2D, GL_LINEAR);
+    glGenTextures(1, &mPrefiltered);
+    state.bindTexture(0, GL_TEXTURE_CUBE_MAP, mPrefiltered);
+    glTexStorage2D(GL_TEXTURE_CUBE_MAP, IBL_CUBE_MIPS, cubeFormat, IBL_CUBE_SIZE, IBL_CUBE_SIZE);
+    setSampling(GL_TEXTURE_CUBE_MAP, GL_LINEAR_MIPMAP_LINEAR);
+
+    GLuint vao, framebuffer;
+    glGenVertexArrays(1, &vao);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state.bindVertexArray(vao);
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+
+    state.useProgram(lutProgram);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mBrdfLut, 0);
+    state.viewport(0, 0, IBL_LUT_SIZE, IBL_LUT_SIZE);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    std::vector<float> texels;
+    if (readback) {
+        readback->lut.resize(2 * IBL_LUT_SIZE * IBL_LUT_SIZE);
+        readHalfs(IBL_LUT_SIZE, 2, &texels, &readback->lut[0]);
+    }
+
+    state.useProgram(prefilterProgram);
+    state.bindTexture(0, GL_TEXTURE_2D, envTexture);
+    glUniform1i(glGetUniformLocation(prefilterProgram, "environment"), 0);
+    glUniform1f(glGetUniformLocation(prefilterProgram, "texelSolidAngle"),
+            4.0f * (float)M_PI / (env.width * env.height));
+    GLint faceUniform = glGetUniformLocation(prefilterProgram, "face");
+    GLint roughnessUniform = glGetUniformLocation(prefilterProgram, "roughness");
+    for (int mip = 0; mip < IBL_CUBE_MIPS; mip++) {
+        int size = cubeMipSize(mip);
+        glUniform1f(roughnessUniform, float(mip) / (IBL_CUBE_MIPS - 1));
+        state.viewport(0, 0, size, size);
+        if (readback)
+            readback->cube[mip].resize(6 * 4 * size * size);
+        for (int face = 0; face < 6; face++) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                    GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, mPrefiltered, mip);
+            glUniform1i(faceUniform, face);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            if (readback)
+                readHalfs(size, 4, &texels, &readback->cube[mip][4 * face * size * size]);
+        }
+    }
+    if (readback) {
+        memcpy(readback->sh, mSh, sizeof(mSh));
+        // A failed read leaves the textures usable, just not cacheable.
+        if (checkGlError("ImageBasedLighting::generateOnGpu readback"))
+            readback->lut.clear();
+    }
+
+    bool ok = !checkGlError("ImageBasedLighting::generateOnGpu");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    state.bindVertexArray(0);
+    state.forgetVertexArray(vao);
+    glDeleteVertexArrays(1, &vao);
+    state.forgetTexture(envTexture);
+    glDeleteTextures(1, &envTexture);
+    state.useProgram(0);
+    glDeleteProgram(lutProgram);
+    glDeleteProgram(prefilterProgram);
+    if (!ok)
+        destroy();
+    return ok;
+}
@@ -0,0 +1,81 @@
+//
+// Image-based lighting with the split-sum approximation. From an
+// equirectangular environment it builds
+//   - a BRDF integration LUT (RG16F), indexed by (N.V, roughness),
+//   - 9 SH coefficients of the diffuse irradiance, already convolved with
+//     the cosine lobe and divided by pi,
+//   - a GGX-prefiltered RGBA16F cubemap, one roughness step per mip.
+// Results come from the disk cache if the environment was seen before,
+// otherwise they are generated on the worker pool and cached. When only
+// one core is available or the cache can't be written, they are rendered
+// on the GPU instead, and read back into the cache when it can be.
+//
+
+#ifndef OPENGL_DEMO_IBL_H
+#define OPENGL_DEMO_IBL_H
+
+#include <vector>
+
+#include "gles3jni.h"
+
+#define IBL_LUT_SIZE 64
+#define IBL_LUT_SAMPLES 256
+#define IBL_CUBE_SIZE 64
+#define IBL_CUBE_MIPS 5
+#define IBL_PREFILTER_SAMPLES 128
+#define IBL_SH_COEFFS 9
+// Cache directory until setIblCacheDir() is called.
+#define IBL_CACHE_DIR "/data/local/tmp/ibl"
+
+// Linear RGB, equirectangular: u follows atan(x, -z), v goes from +y down.
+struct Environment {
+    int width;
+    int height;
+    std::vector<float> rgb;
+};
+
+// Sky gradient with a sun, for when no environment image is given.
+void makeSkyEnvironment(int width, int height, Environment* env);
+// From an RGBA8 sRGB bitmap.
+void environmentFromRgba(const uint32_t* data, int width, int height, Environment* env);
+
+// Where init() reads and writes cache files, created if missing. An
+// installed app should pass its Context.getCacheDir(); the default is only
+// writable from adb shell.
+void setIblCacheDir(const char* dir);
+
+struct IblData;
+
+class ImageBasedLighting {
+public:
+    enum Source { SOURCE_NONE, SOURCE_CACHE, SOURCE_CPU, SOURCE_GPU };
+
+    ImageBasedLighting();
+
+    // Builds everything for env. Needs the GL context for the upload.
+    bool init(const Environment& env, GLStateCache& state);
+    // Deletes the GL objects and zeroes the SH, which leaves no ambient
+    // light: the zero texture names sample as black. The owner's context
+    // must be current.
+    void destroy();
+    bool isInitialized() const { return mBrdfLut != 0; }
+    Source source() const { return mSource; }
+
+    GLuint brdfLut() const { return mBrdfLut; }
+    GLuint prefilteredEnv() const { return mPrefiltered; }
+    // IBL_SH_COEFFS RGB triples, for a vec3[9] uniform.
+    const float* shIrradiance() const { return mSh; }
+    float prefilteredMaxLod() const { return float(IBL_CUBE_MIPS - 1); }
+
+private:
+    // Fills readback for the cache when it isn't NULL and the targets are
+    // float.
+    bool generateOnGpu(const Environment& env, GLStateCache& state, IblData* readback);
+
+    Source mSource;
+    GLuint mBrdfLut;
+    GLuint mPrefiltered;
+    float mSh[3 * IBL_SH_COEFFS];
+};
+
+#endif //OPENGL_DEMO_IBL_H
@@ -0,0 +1,236 @@
+//
+// PNG and raw image output, see ImageFile.h.
+//
+
+#include "ImageFile.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <zlib.h>
+
+#include "gles3jni.h"
+
+// Compressed bytes per IDAT chunk.
+#define PNG_CHUNK_BYTES 65536
+
+static const uint8_t PNG_SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+
+static void putBigEndian(uint8_t* p, uint32_t value) {
+    p[0] = (uint8_t)(value >> 24);
+    p[1] = (uint8_t)(value >> 16);
+    p[2] = (uint8_t)(value >> 8);
+    p[3] = (uint8_t)value;
+}
+
+static uint32_t getBigEndian(const uint8_t* p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+// Length, type, data and the CRC of type and data.
+static bool writeChunk(FILE* file, const char* type, const uint8_t* data, uint32_t length) {
+    uint8_t header[8];
+    putBigEndian(header, length);
+    memcpy(header + 4, type, 4);
+    uLong crc = crc32(0L, header + 4, 4);
+    if (length)
+        crc = crc32(crc, data, length);
+    uint8_t trailer[4];
+    putBigEndian(trailer, (uint32_t)crc);
+    return fwrite(header, 1, 8, file) == 8 &&
+            (length == 0 || fwrite(data, 1, length, file) == length) &&
+            fwrite(trailer, 1, 4, file) == 4;
+}
+
+// Deflates into IDAT chunks of PNG_CHUNK_BYTES, the last one shorter.
+struct IdatWriter {
+    FILE* file;
+    z_stream stream;
+    uint8_t out[PNG_CHUNK_BYTES];
+};
+
+static bool deflateIdat(IdatWriter& writer, const uint8_t* data, uInt size, int flush) {
+    writer.stream.next_in = (Bytef*)data;
+    writer.stream.avail_in = size;
+    for (;;) {
+        int result = deflate(&writer.stream, flush);
+        if (result == Z_STREAM_ERROR)
+            return false;
+        bool full = writer.stream.avail_out == 0;
+        if (full || result == Z_STREAM_END) {
+            uint32_t produced = (uint32_t)(sizeof(writer.out) - writer.stream.avail_out);
+            if (produced && !writeChunk(writer.file, "IDAT", writer.out, produced))
+                return false;
+            writer.stream.next_out = writer.out;
+            writer.stream.avail_out = sizeof(writer.out);
+        }
+        if (result == Z_STREAM_END || (!full && flush != Z_FINISH))
+            return true;
+    }
+}
+
+bool writePng(const char* path, const uint8_t* rgba, ptrdiff_t stride, int width, int height) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        ALOGE("writePng: can't open %s", path);
+        return false;
+    }
+
+    uint8_t ihdr[13];
+    putBigEndian(ihdr, (uint32_t)width);
+    putBigEndian(ihdr + 4, (uint32_t)height);
+    ihdr[8] = 8;    // bits per channel
+    ihdr[9] = 6;    // RGBA
+    ihdr[10] = 0;   // deflate
+    ihdr[11] = 0;   // adaptive filtering, of which only None is used
+    ihdr[12] = 0;   // not interlaced
+    bool ok = fwrite(PNG_SIGNATURE, 1, 8, file) == 8 && writeChunk(file, "IHDR", ihdr, 13);
+
+    // Each row is a filter type byte followed by the row as is, fed to
+    // zlib in place.
+    IdatWriter* writer = new IdatWriter;
+    writer->file = file;
+    memset(&writer->stream, 0, sizeof(writer->stream));
+    writer->stream.next_out = writer->out;
+    writer->stream.avail_out = sizeof(writer->out);
+    bool deflating = ok && deflateInit(&writer->stream, IMAGE_PNG_COMPRESSION) == Z_OK;
+    ok = deflating;
+    static const uint8_t FILTER_NONE = 0;
+    for (int y = 0; ok && y < height; y++) {
+        ok = deflateIdat(*writer, &FILTER_NONE, 1, Z_NO_FLUSH) &&
+                deflateIdat(*writer, rgba + y * stride, (uInt)width * 4, Z_NO_FLUSH);
+    }
+    ok = ok && deflateIdat(*writer, NULL, 0, Z_FINISH);
+    if (deflating)
+        deflateEnd(&writer->stream);
+    delete writer;
+
+    ok = ok && writeChunk(file, "IEND", NULL, 0);
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        ALOGE("writePng: writing %s failed", path);
+    return ok;
+}
+
+bool writeRaw(const char* path, const uint8_t* rgba, ptrdiff_t stride, int width, int height) {
+    FILE* file = fopen(path, "wb");
+    if (!file) {
+        ALOGE("writeRaw: can't open %s", path);
+        return false;
+    }
+    bool ok = true;
+    for (int y = 0; ok && y < height; y++)
+        ok = fwrite(rgba + y * stride, 4, (size_t)width, file) == (size_t)width;
+    ok = fclose(file) == 0 && ok;
+    if (!ok)
+        ALOGE("writeRaw: writing %s failed", path);
+    return ok;
+}
+
+// The predictor of filter type 4, from the left, up and upper left bytes.
+static uint8_t paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a), pb = abs(p - b), pc = abs(p - c);
+    if (pa <= pb && pa <= pc)
+        return (uint8_t)a;
+    return (uint8_t)(pb <= pc ? b : c);
+}
+
+// Undoes filter on row in place; previous is the row above, unfiltered, or
+// NULL for the first. bpp is the distance to the left byte.
+static bool unfilterRow(uint8_t filter, uint8_t* row, const uint8_t* previous, size_t bytes,
+        size_t bpp) {
+    for (size_t i = 0; i < bytes; i++) {
+        int left = i >= bpp ? row[i - bpp] : 0;
+        int up = previous ? previous[i] : 0;
+        int upLeft = previous && i >= bpp ? previous[i - bpp] : 0;
+        switch (filter) {
+            case 0: break;
+            case 1: row[i] = (uint8_t)(row[i] + left); break;
+            case 2: row[i] = (uint8_t)(row[i] + up); break;
+            case 3: row[i] = (uint8_t)(row[i] + ((left + up) >> 1)); break;
+            case 4: row[i] = (uint8_t)(row[i] + paeth(left, up, upLeft)); break;
+            default: return false;
+        }
+    }
+    return true;
+}
+
+bool readPng(const char* path, std::vector<uint8_t>* rgba, int* width, int* height) {
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return false;
+
+    // The IDAT chunks are concatenated and inflated in one go.
+    uint8_t signature[8];
+    bool ok = fread(signature, 1, 8, file) == 8 && memcmp(signature, PNG_SIGNATURE, 8) == 0;
+    uint32_t w = 0, h = 0;
+    int channels = 0;
+    bool ended = false;
+    std::vector<uint8_t> compressed;
+    while (ok && !ended) {
+        uint8_t header[8];
+        if (fread(header, 1, 8, file) != 8) {
+            ok = false;
+            break;
+        }
+        uint32_t length = getBigEndian(header);
+        if (length > 0x7fffffffu) {
+            ok = false;
+            break;
+        }
+        if (memcmp(header + 4, "IHDR", 4) == 0) {
+            uint8_t ihdr[13];
+            ok = length == 13 && fread(ihdr, 1, 13, file) == 13;
+            w = getBigEndian(ihdr);
+            h = getBigEndian(ihdr + 4);
+            channels = ihdr[9] == 6 ? 4 : (ihdr[9] == 2 ? 3 : 0);
+            ok = ok && w > 0 && h > 0 && w < 65536 && h < 65536 && ihdr[8] == 8 &&
+                    channels && ihdr[10] == 0 && ihdr[11] == 0 && ihdr[12] == 0;
+            length = 0;
+        } else if (memcmp(header + 4, "IDAT", 4) == 0) {
+            size_t size = compressed.size();
+            compressed.resize(size + length);
+            ok = length == 0 || fread(&compressed[size], 1, length, file) == length;
+            length = 0;
+        } else if (memcmp(header + 4, "IEND", 4) == 0) {
+            ended = true;
+        }
+        // Skips what is left of the chunk, then its CRC.
+        ok = ok && fseek(file, (long)length + 4, SEEK_CUR) == 0;
+    }
+    fclose(file);
+    if (!ok || !channels || compressed.empty()) {
+        ALOGE("readPng: %s is not an 8-bit RGB or RGBA PNG", path);
+        return false;
+    }
+
+    const size_t rowBytes = (size_t)w * channels;
+    std::vector<uint8_t> filtered(h * (rowBytes + 1));
+    uLongf inflated = (uLongf)filtered.size();
+    if (uncompress(&filtered[0], &inflated, &compressed[0], (uLong)compressed.size()) != Z_OK ||
+            inflated != filtered.size()) {
+        ALOGE("readPng: %s: bad image data", path);
+        return false;
+    }
+
+    rgba->resize((size_t)w * h * 4);
+    for (uint32_t y = 0; y < h; y++) {
+        uint8_t* row = &filtered[y * (rowBytes + 1)];
+        const uint8_t* previous = y > 0 ? row - rowBytes : NULL;
+        if (!unfilterRow(row[0], row + 1, previous, rowBytes, (size_t)channels)) {
+            ALOGE("readPng: %s: bad filter type %d", path, row[0]);
+            return false;
+        }
+        uint8_t* dst = &(*rgba)[(size_t)y * w * 4];
+        for (uint32_t x = 0; x < w; x++) {
+            memcpy(dst + 4 * x, row + 1 + channels * x, (size_t)channels);
+            if (channels == 3)
+                dst[4 * x + 3] = 255;
+        }
+    }
+    *width = (int)w;
+    *height = (int)h;
+    return true;
+}
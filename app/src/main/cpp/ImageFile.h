@@ -0,0 +1,28 @@
+//
+// Writing RGBA8 images to files: PNG, deflated with zlib row by row straight
+// from the caller's pixels, or raw bytes. Reading PNGs back, for comparing
+// against stored images.
+//
+
+#ifndef OPENGL_DEMO_IMAGEFILE_H
+#define OPENGL_DEMO_IMAGEFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// zlib level for PNG output: thumbnails favour speed over size.
+#define IMAGE_PNG_COMPRESSION 1
+
+// Both take the top row first; rows are stride bytes apart, negative for
+// images stored bottom up. Return false when the file can't be written.
+bool writePng(const char* path, const uint8_t* rgba, ptrdiff_t stride, int width, int height);
+// width * height * 4 bytes, top row first, with no header.
+bool writeRaw(const char* path, const uint8_t* rgba, ptrdiff_t stride, int width, int height);
+
+// Reads an 8-bit RGBA or RGB PNG, not interlaced, into rgba as RGBA8, top
+// row first; RGB gets an alpha of 255. Returns false for anything else, or
+// a damaged file.
+bool readPng(const char* path, std::vector<uint8_t>* rgba, int* width, int* height);
+
+#endif //OPENGL_DEMO_IMAGEFILE_H
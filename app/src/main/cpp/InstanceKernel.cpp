@@ -0,0 +1,71 @@
+//
+// SoA SIMD instance animation, see InstanceKernel.h.
+//
+
+#include "InstanceKernel.h"
+
+#include <math.h>
+
+#include "Simd.h"
+#include "WorkerPool.h"
+
+#define TWO_PI_F 6.28318530717958647692f
+
+// Keeps chunk boundaries on 4-instance (64-byte) output blocks.
+#define PARALLEL_STEP_GRAIN 4096
+
+void stepInstancesScalar(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int begin, unsigned int end, float* transforms) {
+    for (unsigned int i = begin; i < end; i++) {
+        angles[i] += velocities[i] * dt;
+        if (angles[i] >= TWO_PI_F) {
+            angles[i] -= TWO_PI_F;
+        } else if (angles[i] <= -TWO_PI_F) {
+            angles[i] += TWO_PI_F;
+        }
+
+        float s = sinf(angles[i]);
+        float c = cosf(angles[i]);
+        transforms[4*i + 0] =  c * scale[0];
+        transforms[4*i + 1] =  s * scale[1];
+        transforms[4*i + 2] = -s * scale[0];
+        transforms[4*i + 3] =  c * scale[1];
+    }
+}
+
+void stepInstancesRange(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int begin, unsigned int end, float* transforms) {
+    const v4f vdt = v4fSplat(dt);
+    const v4f twoPi = v4fSplat(TWO_PI_F);
+    const v4f negTwoPi = v4fSplat(-TWO_PI_F);
+    const v4f scale0 = v4fSplat(scale[0]);
+    const v4f scale1 = v4fSplat(scale[1]);
+    const v4f negScale0 = v4fSplat(-scale[0]);
+
+    unsigned int i = begin;
+    for (; i + 4 <= end; i += 4) {
+        v4f a = v4fMadd(v4fLoad(velocities + i), vdt, v4fLoad(angles + i));
+        a = v4fSelect(v4fCmpGe(a, twoPi), v4fSub(a, twoPi), a);
+        a = v4fSelect(v4fCmpLe(a, negTwoPi), v4fAdd(a, twoPi), a);
+        v4fStore(angles + i, a);
+
+        v4f s, c;
+        v4fSinCos(a, &s, &c);
+        v4fStoreInterleaved4(transforms + 4*i,
+                v4fMul(c, scale0), v4fMul(s, scale1),
+                v4fMul(s, negScale0), v4fMul(c, scale1));
+    }
+    stepInstancesScalar(angles, velocities, scale, dt, i, end, transforms);
+}
+
+void stepInstances(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int count, float* transforms) {
+    if (count < PARALLEL_STEP_MIN_INSTANCES) {
+        stepInstancesRange(angles, velocities, scale, dt, 0, count, transforms);
+        return;
+    }
+    WorkerPool::shared().parallelFor(count, PARALLEL_STEP_GRAIN,
+            [=](unsigned int begin, unsigned int end) {
+                stepInstancesRange(angles, velocities, scale, dt, begin, end, transforms);
+            });
+}
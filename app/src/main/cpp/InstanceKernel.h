@@ -0,0 +1,27 @@
+//
+// Per-frame instance animation used by Renderer::step().
+//
+
+#ifndef OPENGL_DEMO_INSTANCEKERNEL_H
+#define OPENGL_DEMO_INSTANCEKERNEL_H
+
+// Instance counts at or above this are split across WorkerPool::shared().
+#define PARALLEL_STEP_MIN_INSTANCES 16384
+
+// Advances angles[i] by velocities[i] * dt, wrapping into (-2pi, 2pi), and
+// writes one vec4 scale/rotation transform per instance:
+//     ( c*scale[0], s*scale[1], -s*scale[0], c*scale[1] )
+// Transforms are written front to back in whole 64-byte blocks of four
+// instances so mapped write-combined buffers see only full-line streams.
+void stepInstances(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int count, float* transforms);
+
+// Same as stepInstances() on the calling thread only, for [begin, end).
+void stepInstancesRange(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int begin, unsigned int end, float* transforms);
+
+// Straightforward scalar sinf/cosf version, kept as reference.
+void stepInstancesScalar(float* angles, const float* velocities, const float scale[2],
+        float dt, unsigned int begin, unsigned int end, float* transforms);
+
+#endif //OPENGL_DEMO_INSTANCEKERNEL_H
@@ -0,0 +1,121 @@
+//
+// SIMD 4x4 matrix kernels, see MatrixMath.h.
+//
+
+#include "MatrixMath.h"
+
+#include "Simd.h"
+
+void mat4Multiply(const glm::aligned_mat4& a, const glm::aligned_mat4& b, glm::aligned_mat4* out) {
+    // Each column of the product combines a's columns, weighted by the
+    // matching column of b. b's column j is read before out's is written.
+    const v4f a0 = v4fLoad(&a[0][0]), a1 = v4fLoad(&a[1][0]);
+    const v4f a2 = v4fLoad(&a[2][0]), a3 = v4fLoad(&a[3][0]);
+    for (int j = 0; j < 4; j++) {
+        const float* bj = &b[j][0];
+        v4f r = v4fMul(a0, v4fSplat(bj[0]));
+        r = v4fMadd(a1, v4fSplat(bj[1]), r);
+        r = v4fMadd(a2, v4fSplat(bj[2]), r);
+        r = v4fMadd(a3, v4fSplat(bj[3]), r);
+        v4fStore(&(*out)[j][0], r);
+    }
+}
+
+void mat4TransformPoints(const glm::aligned_mat4& m, const float* x, const float* y,
+        const float* z, unsigned int count, float* outX, float* outY, float* outZ) {
+    v4f e[4][3];
+    for (int c = 0; c < 4; c++)
+        for (int r = 0; r < 3; r++)
+            e[c][r] = v4fSplat(m[c][r]);
+    unsigned int i = 0;
+    for (; i + 4 <= count; i += 4) {
+        v4f px = v4fLoad(x + i), py = v4fLoad(y + i), pz = v4fLoad(z + i);
+        v4f o[3];
+        for (int r = 0; r < 3; r++) {
+            o[r] = v4fMadd(e[0][r], px, e[3][r]);
+            o[r] = v4fMadd(e[1][r], py, o[r]);
+            o[r] = v4fMadd(e[2][r], pz, o[r]);
+        }
+        v4fStore(outX + i, o[0]);
+        v4fStore(outY + i, o[1]);
+        v4fStore(outZ + i, o[2]);
+    }
+    for (; i < count; i++) {
+        float px = x[i], py = y[i], pz = z[i];
+        outX[i] = m[0][0] * px + m[1][0] * py + m[2][0] * pz + m[3][0];
+        outY[i] = m[0][1] * px + m[1][1] * py + m[2][1] * pz + m[3][1];
+        outZ[i] = m[0][2] * px + m[1][2] * py + m[2][2] * pz + m[3][2];
+    }
+}
+
+// Cramer's rule as in Intel's "Streaming SIMD Extensions - Inverse of 4x4
+// Matrix" (AP-928): the 2x2 products of pairs of rows give the cofactors
+// four at a time, with only the pair and half swaps for shuffles. Rows 1
+// and 3 are loaded with their halves swapped. Works on either layout, as
+// the inverse of the transpose is the transpose of the inverse.
+glm::aligned_mat4 mat4Inverse(const glm::aligned_mat4& m) {
+    v4f row0, row1, row2, row3;
+    v4fLoadTransposed4(&m[0][0], &row0, &row1, &row2, &row3);
+    row1 = v4fSwapHalves(row1);
+    row3 = v4fSwapHalves(row3);
+
+    v4f minor0, minor1, minor2, minor3, tmp;
+
+    tmp = v4fSwapPairs(v4fMul(row2, row3));
+    minor0 = v4fMul(row1, tmp);
+    minor1 = v4fMul(row0, tmp);
+    tmp = v4fSwapHalves(tmp);
+    minor0 = v4fSub(v4fMul(row1, tmp), minor0);
+    minor1 = v4fSwapHalves(v4fSub(v4fMul(row0, tmp), minor1));
+
+    tmp = v4fSwapPairs(v4fMul(row1, row2));
+    minor0 = v4fMadd(row3, tmp, minor0);
+    minor3 = v4fMul(row0, tmp);
+    tmp = v4fSwapHalves(tmp);
+    minor0 = v4fSub(minor0, v4fMul(row3, tmp));
+    minor3 = v4fSwapHalves(v4fSub(v4fMul(row0, tmp), minor3));
+
+    tmp = v4fSwapPairs(v4fMul(v4fSwapHalves(row1), row3));
+    row2 = v4fSwapHalves(row2);
+    minor0 = v4fMadd(row2, tmp, minor0);
+    minor2 = v4fMul(row0, tmp);
+    tmp = v4fSwapHalves(tmp);
+    minor0 = v4fSub(minor0, v4fMul(row2, tmp));
+    minor2 = v4fSwapHalves(v4fSub(v4fMul(row0, tmp), minor2));
+
+    tmp = v4fSwapPairs(v4fMul(row0, row1));
+    minor2 = v4fMadd(row3, tmp, minor2);
+    minor3 = v4fSub(v4fMul(row2, tmp), minor3);
+    tmp = v4fSwapHalves(tmp);
+    minor2 = v4fSub(v4fMul(row3, tmp), minor2);
+    minor3 = v4fSub(minor3, v4fMul(row2, tmp));
+
+    tmp = v4fSwapPairs(v4fMul(row0, row3));
+    minor1 = v4fSub(minor1, v4fMul(row2, tmp));
+    minor2 = v4fMadd(row1, tmp, minor2);
+    tmp = v4fSwapHalves(tmp);
+    minor1 = v4fMadd(row2, tmp, minor1);
+    minor2 = v4fSub(minor2, v4fMul(row1, tmp));
+
+    tmp = v4fSwapPairs(v4fMul(row0, row2));
+    minor1 = v4fMadd(row3, tmp, minor1);
+    minor3 = v4fSub(minor3, v4fMul(row1, tmp));
+    tmp = v4fSwapHalves(tmp);
+    minor1 = v4fSub(minor1, v4fMul(row3, tmp));
+    minor3 = v4fMadd(row1, tmp, minor3);
+
+    // The determinant is row 0 against its cofactors, summed across.
+    v4f det = v4fMul(row0, minor0);
+    det = v4fAdd(v4fSwapHalves(det), det);
+    det = v4fAdd(v4fSwapPairs(det), det);
+    float lanes[4];
+    v4fStore(lanes, det);
+    const v4f invDet = v4fSplat(1.0f / lanes[0]);
+
+    glm::aligned_mat4 result;
+    v4fStore(&result[0][0], v4fMul(minor0, invDet));
+    v4fStore(&result[1][0], v4fMul(minor1, invDet));
+    v4fStore(&result[2][0], v4fMul(minor2, invDet));
+    v4fStore(&result[3][0], v4fMul(minor3, invDet));
+    return result;
+}
@@ -0,0 +1,32 @@
+//
+// 4x4 float matrix kernels on GLM's aligned types (gtc/type_aligned.hpp),
+// for the matrix work done every frame: camera matrices, lights and
+// instances into view space.
+//
+// The vendored GLM (0.9.9.3) turns its SIMD configuration on by itself
+// for both the arm64 and x86 builds, which makes the aligned types 16-byte
+// aligned, but its kernels are SSE only: on x86 glm::aligned_mat4 math
+// runs through them, on NEON it stays scalar. These are written once on
+// Simd.h, so they run as NEON on arm64 and SSE on x86, and move points
+// four per iteration instead of one.
+//
+
+#ifndef OPENGL_DEMO_MATRIXMATH_H
+#define OPENGL_DEMO_MATRIXMATH_H
+
+#include "glm/glm.hpp"
+#include "glm/gtc/type_aligned.hpp"
+
+// out = a * b. out may be a or b.
+void mat4Multiply(const glm::aligned_mat4& a, const glm::aligned_mat4& b, glm::aligned_mat4* out);
+
+// The points (x[i], y[i], z[i], 1) through m, for an affine m: only the
+// xyz of the result are written, to outX, outY and outZ, which may be the
+// inputs.
+void mat4TransformPoints(const glm::aligned_mat4& m, const float* x, const float* y,
+        const float* z, unsigned int count, float* outX, float* outY, float* outZ);
+
+// The inverse by cofactors, for an invertible m.
+glm::aligned_mat4 mat4Inverse(const glm::aligned_mat4& m);
+
+#endif //OPENGL_DEMO_MATRIXMATH_H
@@ -0,0 +1,169 @@
+//
+// Mesh loading, see Mesh.h.
+//
+
+#include "Mesh.h"
+
+#include <float.h>
+
+#if HAVE_ASSIMP
+#include <assimp/Importer.hpp>
+#include <assimp/scene.h>
+#include <assimp/postprocess.h>
+#endif
+
+#include "gles3jni.h"
+
+static Aabb emptyAabb() {
+    Aabb aabb;
+    aabb.min = glm::vec3(FLT_MAX);
+    aabb.max = glm::vec3(-FLT_MAX);
+    return aabb;
+}
+
+// Sphere around the box center; slightly looser than a minimal sphere but
+// stable and cheap to compute.
+static BoundingSphere sphereFromAabb(const Aabb& aabb) {
+    BoundingSphere sphere;
+    sphere.center = 0.5f * (aabb.min + aabb.max);
+    sphere.radius = 0.5f * glm::length(aabb.max - aabb.min);
+    return sphere;
+}
+
+#if HAVE_ASSIMP
+bool LoadMesh(const char *path, Mesh *mesh) {
+    Assimp::Importer importer;
+    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
+
+    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
+        ALOGE("ERROR::ASSIMP:: %s", importer.GetErrorString());
+        return false;
+    }
+    ALOGV("ASSIMP::Success %u meshes", scene->mNumMeshes);
+
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    mesh->subMeshes.clear();
+    mesh->bounds = emptyAabb();
+
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+        const aiMesh *src = scene->mMeshes[m];
+        const unsigned int baseVertex = (unsigned int)mesh->vertices.size();
+
+        SubMesh subMesh;
+        subMesh.firstIndex = (unsigned int)mesh->indices.size();
+        subMesh.bounds = emptyAabb();
+
+        for (unsigned int i = 0; i < src->mNumVertices; ++i) {
+            Vertex2 vertex2;
+            vertex2.Position.x = src->mVertices[i].x;
+            vertex2.Position.y = src->mVertices[i].y;
+            vertex2.Position.z = src->mVertices[i].z;
+
+            if (src->mNormals) {
+                vertex2.Normal.x = src->mNormals[i].x;
+                vertex2.Normal.y = src->mNormals[i].y;
+                vertex2.Normal.z = src->mNormals[i].z;
+            } else {
+                vertex2.Normal = glm::vec3(0.0f, 0.0f, 1.0f);
+            }
+
+            if (src->mTextureCoords[0]) {
+                vertex2.TexCoords.x = src->mTextureCoords[0][i].x;
+                vertex2.TexCoords.y = src->mTextureCoords[0][i].y;
+            } else {
+                vertex2.TexCoords = glm::vec2(0.0f);
+            }
+
+            subMesh.bounds.min = glm::min(subMesh.bounds.min, vertex2.Position);
+            subMesh.bounds.max = glm::max(subMesh.bounds.max, vertex2.Position);
+            mesh->vertices.push_back(vertex2);
+        }
+
+        for (unsigned int i = 0; i < src->mNumFaces; ++i) {
+            for (unsigned int j = 0; j < src->mFaces[i].mNumIndices; ++j) {
+                mesh->indices.push_back(baseVertex + src->mFaces[i].mIndices[j]);
+            }
+        }
+
+        subMesh.indexCount = (unsigned int)mesh->indices.size() - subMesh.firstIndex;
+        if (subMesh.indexCount == 0)
+            continue;
+        subMesh.sphere = sphereFromAabb(subMesh.bounds);
+        mesh->bounds.min = glm::min(mesh->bounds.min, subMesh.bounds.min);
+        mesh->bounds.max = glm::max(mesh->bounds.max, subMesh.bounds.max);
+        mesh->subMeshes.push_back(subMesh);
+    }
+
+    if (mesh->subMeshes.empty()) {
+        ALOGE("ERROR::MESH:: %s has no triangles", path);
+        return false;
+    }
+    mesh->sphere = sphereFromAabb(mesh->bounds);
+    return true;
+}
+#else
+bool LoadMesh(const char *path, Mesh *mesh) {
+    ALOGE("ERROR::MESH:: can't load %s, built without assimp", path);
+    return false;
+}
+#endif
+
+// Appends the box [min, max] as a submesh of its own: four vertices per
+// face, each with the face normal and the whole texture, wound
+// counterclockwise seen from outside.
+static void appendBox(const glm::vec3& min, const glm::vec3& max, Mesh* mesh) {
+    static const float CORNERS[4][2] = {{0.0f, 0.0f}, {1.0f, 0.0f}, {1.0f, 1.0f}, {0.0f, 1.0f}};
+    SubMesh subMesh;
+    subMesh.firstIndex = (unsigned int)mesh->indices.size();
+    subMesh.indexCount = 36;
+    subMesh.bounds.min = min;
+    subMesh.bounds.max = max;
+    subMesh.sphere = sphereFromAabb(subMesh.bounds);
+    for (int axis = 0; axis < 3; axis++) {
+        for (int side = 0; side < 2; side++) {
+            // Face axes u and v with u x v pointing out of the face.
+            const int u = side ? (axis + 1) % 3 : (axis + 2) % 3;
+            const int v = side ? (axis + 2) % 3 : (axis + 1) % 3;
+            const unsigned int base = (unsigned int)mesh->vertices.size();
+            for (int k = 0; k < 4; k++) {
+                Vertex2 vertex2;
+                vertex2.Position[axis] = side ? max[axis] : min[axis];
+                vertex2.Position[u] = min[u] + CORNERS[k][0] * (max[u] - min[u]);
+                vertex2.Position[v] = min[v] + CORNERS[k][1] * (max[v] - min[v]);
+                vertex2.Normal = glm::vec3(0.0f);
+                vertex2.Normal[axis] = side ? 1.0f : -1.0f;
+                vertex2.TexCoords = glm::vec2(CORNERS[k][0], CORNERS[k][1]);
+                mesh->vertices.push_back(vertex2);
+            }
+            static const unsigned int QUAD_INDICES[6] = {0, 1, 2, 0, 2, 3};
+            for (int i = 0; i < 6; i++)
+                mesh->indices.push_back(base + QUAD_INDICES[i]);
+        }
+    }
+    mesh->subMeshes.push_back(subMesh);
+}
+
+void MakeChairMesh(Mesh *mesh) {
+    mesh->vertices.clear();
+    mesh->indices.clear();
+    mesh->subMeshes.clear();
+
+    // Seat, back, then the legs, one unit tall and centered on the origin
+    // like the chair asset.
+    const float legHalf = 0.03f;
+    appendBox(glm::vec3(-0.3f, -0.05f, -0.3f), glm::vec3(0.3f, 0.03f, 0.3f), mesh);
+    appendBox(glm::vec3(-0.3f, 0.03f, -0.3f), glm::vec3(0.3f, 0.5f, -0.24f), mesh);
+    for (int i = 0; i < 4; i++) {
+        glm::vec3 center((i & 1) ? 0.25f : -0.25f, 0.0f, (i & 2) ? 0.25f : -0.25f);
+        appendBox(glm::vec3(center.x - legHalf, -0.5f, center.z - legHalf),
+                glm::vec3(center.x + legHalf, -0.05f, center.z + legHalf), mesh);
+    }
+
+    mesh->bounds = emptyAabb();
+    for (size_t i = 0; i < mesh->subMeshes.size(); i++) {
+        mesh->bounds.min = glm::min(mesh->bounds.min, mesh->subMeshes[i].bounds.min);
+        mesh->bounds.max = glm::max(mesh->bounds.max, mesh->subMeshes[i].bounds.max);
+    }
+    mesh->sphere = sphereFromAabb(mesh->bounds);
+}
@@ -0,0 +1,54 @@
+//
+// Mesh data loaded through assimp, or built in code, with per-submesh
+// bounds for culling.
+//
+
+#ifndef OPENGL_DEMO_MESH_H
+#define OPENGL_DEMO_MESH_H
+
+#include <vector>
+
+#include "glm/glm.hpp"
+
+struct Vertex2 {
+    glm::vec3 Position;
+    glm::vec3 Normal;
+    glm::vec2 TexCoords;
+};
+
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+struct BoundingSphere {
+    glm::vec3 center;
+    float radius;
+};
+
+// One aiMesh of the scene: a range of Mesh::indices. Indices are already
+// rebased onto the shared vertex array.
+struct SubMesh {
+    unsigned int firstIndex;
+    unsigned int indexCount;
+    Aabb bounds;
+    BoundingSphere sphere;
+};
+
+struct Mesh {
+    std::vector<Vertex2> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<SubMesh> subMeshes;
+    Aabb bounds;
+    BoundingSphere sphere;
+};
+
+// Loads every mesh of the scene at path into mesh. Returns false on error,
+// and always in builds without assimp (HAVE_ASSIMP unset).
+bool LoadMesh(const char *path, Mesh *mesh);
+
+// A chair of six boxes, one submesh each, for scenes that can't depend on
+// an asset file, such as the regression suite's.
+void MakeChairMesh(Mesh *mesh);
+
+#endif //OPENGL_DEMO_MESH_H
@@ -0,0 +1,222 @@
+//
+// Occlusion culling with asynchronous query results, see OcclusionCuller.h.
+//
+
+#include "OcclusionCuller.h"
+
+#include <string.h>
+
+#include "glm/gtc/type_ptr.hpp"
+#include "Vertices.h"
+
+#define PROXY_POS_ATTRIB 0
+// Proxies are grown slightly so they never sit behind the surface they bound.
+#define PROXY_INFLATE 1.01f
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+static const char PROXY_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "layout(location=" STRV(PROXY_POS_ATTRIB) ") in vec3 pos;\n"
+        "uniform mat4 mvp_mat;\n"
+        "uniform vec3 center;\n"
+        "uniform vec3 extent;\n"
+        "void main() {\n"
+        "    gl_Position = mvp_mat * vec4(center + pos * extent, 1.0);\n"
+        "}\n";
+
+static const char PROXY_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision lowp float;\n"
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    outColor = vec4(1.0);\n"
+        "}\n";
+
+OcclusionCuller::OcclusionCuller()
+:   mProgram(0),
+    mVB(0),
+    mVAO(0),
+    mMvpUniform(-1),
+    mCenterUniform(-1),
+    mExtentUniform(-1),
+    mViewProj(1.0f),
+    mEyePos(0.0f),
+    mFrame(0),
+    mSlots(1)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void OcclusionCuller::destroy() {
+    if (!mAllQueries.empty())
+        glDeleteQueries((GLsizei)mAllQueries.size(), &mAllQueries[0]);
+    mAllQueries.clear();
+    mFreeQueries.clear();
+    mInFlight.clear();
+    glDeleteVertexArrays(1, &mVAO);
+    glDeleteBuffers(1, &mVB);
+    glDeleteProgram(mProgram);
+    mVAO = mVB = mProgram = 0;
+}
+
+bool OcclusionCuller::init() {
+    mProgram = createProgram(PROXY_VERTEX_SHADER, PROXY_FRAGMENT_SHADER);
+    if (!mProgram)
+        return false;
+    mMvpUniform = glGetUniformLocation(mProgram, "mvp_mat");
+    mCenterUniform = glGetUniformLocation(mProgram, "center");
+    mExtentUniform = glGetUniformLocation(mProgram, "extent");
+
+    // CUBE_VERTICES is a [-0.5, 0.5]^3 triangle list with interleaved normals.
+    glGenBuffers(1, &mVB);
+    glBindBuffer(GL_ARRAY_BUFFER, mVB);
+    glBufferData(GL_ARRAY_BUFFER, CUBE_VERTIC_NUM * 6*sizeof(float), CUBE_VERTICES, GL_STATIC_DRAW);
+
+    glGenVertexArrays(1, &mVAO);
+    glBindVertexArray(mVAO);
+    glVertexAttribPointer(PROXY_POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, 6*sizeof(float), (const GLvoid*)0);
+    glEnableVertexAttribArray(PROXY_POS_ATTRIB);
+    glBindVertexArray(0);
+
+    return !checkGlError("OcclusionCuller::init");
+}
+
+void OcclusionCuller::setObjectCount(unsigned int count) {
+    // Queries still in flight refer to the old object numbering.
+    for (size_t i = 0; i < mInFlight.size(); i++)
+        mFreeQueries.push_back(mInFlight[i].query);
+    mInFlight.clear();
+    for (size_t i = 0; i < mSlots.size(); i++)
+        mSlots[i].requests.clear();
+
+    mVisible.assign(count, 1);
+    mPending.assign(count, 0);
+    mLastQueryFrame.resize(count);
+    // Stagger the periodic re-tests so they don't all land on one frame.
+    for (unsigned int i = 0; i < count; i++)
+        mLastQueryFrame[i] = mFrame - (i % OCCLUSION_VISIBLE_REQUERY_INTERVAL);
+}
+
+void OcclusionCuller::setRequestSlots(unsigned int count) {
+    mSlots.resize(count > 0 ? count : 1);
+    for (size_t i = 0; i < mSlots.size(); i++)
+        mSlots[i].requests.clear();
+}
+
+void OcclusionCuller::setCamera(const glm::mat4& viewProj, const glm::vec3& eyePos) {
+    mViewProj = viewProj;
+    mEyePos = eyePos;
+}
+
+GLuint OcclusionCuller::allocQuery() {
+    if (mFreeQueries.empty()) {
+        GLuint query = 0;
+        glGenQueries(1, &query);
+        mAllQueries.push_back(query);
+        return query;
+    }
+    GLuint query = mFreeQueries.back();
+    mFreeQueries.pop_back();
+    return query;
+}
+
+void OcclusionCuller::beginFrame() {
+    mFrame++;
+    memset(&mStats, 0, sizeof(mStats));
+    for (size_t i = 0; i < mSlots.size(); i++)
+        mSlots[i].objectsCulled = 0;
+
+    // In-flight queries are in issue order, so stop at the first one that is
+    // too recent or not available yet; later ones won't be ready either.
+    size_t done = 0;
+    for (; done < mInFlight.size(); done++) {
+        const PendingQuery& pending = mInFlight[done];
+        if (mFrame - pending.frame < OCCLUSION_QUERY_LATENCY)
+            break;
+        GLuint available = GL_FALSE;
+        glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            break;
+        GLuint anySamples = GL_TRUE;
+        glGetQueryObjectuiv(pending.query, GL_QUERY_RESULT, &anySamples);
+
+        mVisible[pending.object] = anySamples ? 1 : 0;
+        mPending[pending.object] = 0;
+        mFreeQueries.push_back(pending.query);
+        mStats.resultsRead++;
+    }
+    mInFlight.erase(mInFlight.begin(), mInFlight.begin() + done);
+}
+
+void OcclusionCuller::requestQuery(unsigned int slot, unsigned int object,
+        const Aabb& worldBounds) {
+    RequestSlot& requests = mSlots[slot];
+    if (!mVisible[object])
+        requests.objectsCulled++;
+    if (mPending[object])
+        return;
+    if (mVisible[object] &&
+            mFrame - mLastQueryFrame[object] < OCCLUSION_VISIBLE_REQUERY_INTERVAL)
+        return;
+
+    // A proxy around the camera would be clipped by the near plane and
+    // report hidden; such objects are simply visible.
+    if (glm::all(glm::greaterThanEqual(mEyePos, worldBounds.min)) &&
+            glm::all(glm::lessThanEqual(mEyePos, worldBounds.max))) {
+        mVisible[object] = 1;
+        mLastQueryFrame[object] = mFrame;
+        return;
+    }
+
+    Request request;
+    request.object = object;
+    request.center = 0.5f * (worldBounds.min + worldBounds.max);
+    request.extent = PROXY_INFLATE * (worldBounds.max - worldBounds.min);
+    requests.requests.push_back(request);
+}
+
+void OcclusionCuller::issueQueries(GLStateCache& state) {
+    // Slots are drained in order, so queries keep a deterministic order.
+    size_t numRequests = 0;
+    for (size_t i = 0; i < mSlots.size(); i++) {
+        mStats.objectsCulled += mSlots[i].objectsCulled;
+        numRequests += mSlots[i].requests.size();
+    }
+    if (numRequests == 0)
+        return;
+
+    state.useProgram(mProgram);
+    state.bindVertexArray(mVAO);
+    glUniformMatrix4fv(mMvpUniform, 1, GL_FALSE, glm::value_ptr(mViewProj));
+    state.colorMask(false);
+    state.depthMask(false);
+
+    for (size_t s = 0; s < mSlots.size(); s++) {
+        std::vector<Request>& requests = mSlots[s].requests;
+        for (size_t i = 0; i < requests.size(); i++) {
+            const Request& request = requests[i];
+            PendingQuery pending;
+            pending.query = allocQuery();
+            pending.object = request.object;
+            pending.frame = mFrame;
+
+            glUniform3fv(mCenterUniform, 1, glm::value_ptr(request.center));
+            glUniform3fv(mExtentUniform, 1, glm::value_ptr(request.extent));
+            glBeginQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE, pending.query);
+            glDrawArrays(GL_TRIANGLES, 0, CUBE_VERTIC_NUM);
+            glEndQuery(GL_ANY_SAMPLES_PASSED_CONSERVATIVE);
+
+            mPending[request.object] = 1;
+            mLastQueryFrame[request.object] = mFrame;
+            mInFlight.push_back(pending);
+        }
+        requests.clear();
+    }
+    mStats.queriesIssued = (unsigned int)numRequests;
+
+    state.colorMask(true);
+    state.depthMask(true);
+    checkGlError("OcclusionCuller::issueQueries");
+}
@@ -0,0 +1,102 @@
+//
+// Hardware occlusion culling with bounding-box proxies. Query results are
+// read back a frame or more after they were issued so the CPU never waits
+// on the GPU, and objects found visible are only re-tested periodically.
+//
+
+#ifndef OPENGL_DEMO_OCCLUSIONCULLER_H
+#define OPENGL_DEMO_OCCLUSIONCULLER_H
+
+#include <vector>
+
+#include "gles3jni.h"
+#include "glm/glm.hpp"
+#include "Mesh.h"
+
+// Results are consumed no earlier than this many frames after the query.
+#define OCCLUSION_QUERY_LATENCY 1
+// Visible objects are re-tested only every this many frames.
+#define OCCLUSION_VISIBLE_REQUERY_INTERVAL 8
+
+class OcclusionCuller {
+public:
+    struct Stats {
+        unsigned int queriesIssued;
+        unsigned int resultsRead;
+        unsigned int objectsCulled;     // requested objects that were skipped
+    };
+
+    OcclusionCuller();
+
+    bool init();
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mProgram != 0; }
+    // Forgets all history; every object starts out visible.
+    void setObjectCount(unsigned int count);
+    void setCamera(const glm::mat4& viewProj, const glm::vec3& eyePos);
+
+    // Reads back whatever query results have arrived. Call once per frame
+    // before any isVisible()/requestQuery().
+    void beginFrame();
+
+    // Last known visibility. Objects never tested count as visible.
+    bool isVisible(unsigned int object) const { return mVisible[object] != 0; }
+
+    // Number of independent request lists. Defaults to one.
+    void setRequestSlots(unsigned int count);
+
+    // Declares that object passed frustum culling this frame. The culler
+    // decides whether it needs a new query, and counts it as culled if it
+    // is currently known to be hidden. Calls for distinct objects through
+    // distinct slots may run concurrently.
+    void requestQuery(unsigned int slot, unsigned int object, const Aabb& worldBounds);
+
+    // Draws the proxies for this frame's queries. Call after the visible
+    // geometry so its depth acts as the occluder.
+    void issueQueries(GLStateCache& state);
+
+    const Stats& frameStats() const { return mStats; }
+
+private:
+    struct Request {
+        unsigned int object;
+        glm::vec3 center;
+        glm::vec3 extent;
+    };
+    struct RequestSlot {
+        std::vector<Request> requests;
+        unsigned int objectsCulled;
+    };
+    struct PendingQuery {
+        GLuint query;
+        unsigned int object;
+        uint64_t frame;
+    };
+
+    GLuint allocQuery();
+
+    GLuint mProgram;
+    GLuint mVB;
+    GLuint mVAO;
+    GLint mMvpUniform;
+    GLint mCenterUniform;
+    GLint mExtentUniform;
+
+    glm::mat4 mViewProj;
+    glm::vec3 mEyePos;
+    uint64_t mFrame;
+
+    std::vector<uint8_t> mVisible;
+    std::vector<uint8_t> mPending;
+    std::vector<uint64_t> mLastQueryFrame;
+
+    std::vector<RequestSlot> mSlots;
+    std::vector<PendingQuery> mInFlight;
+    std::vector<GLuint> mFreeQueries;
+    std::vector<GLuint> mAllQueries;
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_OCCLUSIONCULLER_H
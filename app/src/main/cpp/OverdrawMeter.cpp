@@ -0,0 +1,78 @@
+//
+// Overdraw measurement, see OverdrawMeter.h.
+//
+
+#include "OverdrawMeter.h"
+
+#include "RenderPass.h"
+
+static const char COUNT_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    outColor = vec4(1.0 / 255.0);\n"
+        "}\n";
+
+OverdrawMeter::OverdrawMeter()
+:   mProgram(0),
+    mCount(-1),
+    mDepth(-1)
+{}
+
+bool OverdrawMeter::init(const char* vertexShader) {
+    mProgram = createProgram(vertexShader, COUNT_FRAGMENT_SHADER);
+    return mProgram != 0;
+}
+
+void OverdrawMeter::destroy() {
+    glDeleteProgram(mProgram);
+    mProgram = 0;
+}
+
+void OverdrawMeter::begin(GLStateCache& state, RenderTargetPool& pool, int width, int height) {
+    RenderTargetDesc count = { width / OVERDRAW_DOWNSCALE, height / OVERDRAW_DOWNSCALE, GL_R8, 1 };
+    if (count.width < 1)
+        count.width = 1;
+    if (count.height < 1)
+        count.height = 1;
+    RenderTargetDesc depth = count;
+    depth.format = GL_DEPTH_COMPONENT24;
+    mCount = pool.acquire(count, state);
+    mDepth = pool.acquire(depth, state);
+
+    RenderPass pass(pool.framebuffer(mCount, mDepth), count.width, count.height);
+    pass.clearColor[0] = pass.clearColor[1] = pass.clearColor[2] = pass.clearColor[3] = 0.0f;
+    pass.begin(state);
+
+    state.setEnabled(GL_BLEND, true);
+    state.blendFunc(GL_ONE, GL_ONE);
+    state.setEnabled(GL_DEPTH_TEST, true);
+    state.depthFunc(GL_LESS);
+    state.depthMask(true);
+    state.colorMask(true);
+    state.useProgram(mProgram);
+}
+
+OverdrawMeter::Result OverdrawMeter::end(GLStateCache& state, RenderTargetPool& pool) {
+    const RenderTargetDesc& desc = pool.desc(mCount);
+    mPixels.resize((size_t)desc.width * desc.height * 4);
+    glReadPixels(0, 0, desc.width, desc.height, GL_RGBA, GL_UNSIGNED_BYTE, &mPixels[0]);
+
+    Result result;
+    result.fragments = result.coveredPixels = 0;
+    for (size_t i = 0; i < mPixels.size(); i += 4) {
+        result.fragments += mPixels[i];
+        result.coveredPixels += mPixels[i] != 0;
+    }
+
+    RenderPass pass(pool.framebuffer(mCount, mDepth), desc.width, desc.height);
+    pass.colorStore = STORE_ACTION_DISCARD;
+    pass.end(state);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    pool.release(mCount);
+    pool.release(mDepth);
+    mCount = mDepth = -1;
+    checkGlError("OverdrawMeter::end");
+    return result;
+}
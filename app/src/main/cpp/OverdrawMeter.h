@@ -0,0 +1,55 @@
+//
+// Measures overdraw: how many fragments pass the depth test per covered
+// pixel when a scene is drawn in its usual order with depth writes on.
+// Every passing fragment adds 1/255 to an R8 target with additive blending;
+// the target is read back once and summed. That is how many times the
+// main fragment shader would run without a depth pre-pass, against once
+// per pixel with one.
+//
+
+#ifndef OPENGL_DEMO_OVERDRAWMETER_H
+#define OPENGL_DEMO_OVERDRAWMETER_H
+
+#include <vector>
+
+#include "gles3jni.h"
+#include "RenderTargetPool.h"
+
+// Measure at this fraction of the scene size per axis; overdraw is a ratio
+// and barely changes with resolution.
+#define OVERDRAW_DOWNSCALE 2
+
+class OverdrawMeter {
+public:
+    struct Result {
+        uint64_t fragments;     // in pixels of the measured size
+        uint64_t coveredPixels;
+        float overdraw() const { return coveredPixels ? float(fragments) / coveredPixels : 0.0f; }
+    };
+
+    OverdrawMeter();
+
+    // vertexShader must write gl_Position like the scene's; the meter adds
+    // its own fragment shader. Uniforms are set through program().
+    bool init(const char* vertexShader);
+    // Deletes the program. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mProgram != 0; }
+    GLuint program() const { return mProgram; }
+
+    // Binds a cleared counting target for a scene of width x height and the
+    // counting program, with depth test and writes on. Issue the draws with
+    // the program bound, then call end().
+    void begin(GLStateCache& state, RenderTargetPool& pool, int width, int height);
+    // Reads the counts back, which waits for the GPU, and releases the
+    // target. Leaves blending with the demo's alpha blend function.
+    Result end(GLStateCache& state, RenderTargetPool& pool);
+
+private:
+    GLuint mProgram;
+    int mCount;     // pool target, -1 outside begin()/end()
+    int mDepth;
+    std::vector<uint8_t> mPixels;
+};
+
+#endif //OPENGL_DEMO_OVERDRAWMETER_H
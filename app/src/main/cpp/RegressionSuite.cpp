@@ -0,0 +1,426 @@
+//
+// Golden image and frame time regression suite, see RegressionSuite.h.
+//
+
+#include "RegressionSuite.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+
+#include <EGL/egl.h>
+
+#include "BatchRenderer.h"
+#include "DepthOfField.h"
+#include "ImageFile.h"
+#include "Mesh.h"
+#include "RenderTargetPool.h"
+
+// Side of the checkered albedo texture given to the ES 3 renderer.
+#define REGRESSION_ALBEDO_SIZE 64
+// Gain of the error in the diff images.
+#define REGRESSION_DIFF_GAIN 4.0f
+
+// What one scene produced: its last frame, top row first, and the time of
+// every timed frame.
+struct SceneRun {
+    std::vector<uint8_t> image;
+    std::vector<double> frameMs;
+};
+
+// The offscreen output of every scene: RGBA8 and depth renderbuffers, so
+// nothing goes through a renderer's texture bindings.
+struct OutputTarget {
+    GLuint framebuffer;
+    GLuint renderbuffers[2];
+};
+
+static bool createOutput(OutputTarget* output) {
+    glGenRenderbuffers(2, output->renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, output->renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, REGRESSION_WIDTH, REGRESSION_HEIGHT);
+    glBindRenderbuffer(GL_RENDERBUFFER, output->renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, REGRESSION_WIDTH,
+            REGRESSION_HEIGHT);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+    glGenFramebuffers(1, &output->framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, output->framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER,
+            output->renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+            output->renderbuffers[1]);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete && !checkGlError("createOutput");
+}
+
+static void destroyOutput(OutputTarget* output) {
+    glDeleteFramebuffers(1, &output->framebuffer);
+    glDeleteRenderbuffers(2, output->renderbuffers);
+}
+
+// Renders the warm-up frames, then the timed ones, each finished before
+// the next, and reads back the last.
+template <typename Fn>
+static void runScene(Fn frame, GLuint framebuffer, SceneRun* run) {
+    for (int i = 0; i < REGRESSION_WARMUP_FRAMES; i++)
+        frame();
+    glFinish();
+    run->frameMs.clear();
+    for (int i = 0; i < REGRESSION_TIMED_FRAMES; i++) {
+        uint64_t startNs = nowNs();
+        frame();
+        glFinish();
+        run->frameMs.push_back((nowNs() - startNs) * 1e-6);
+    }
+
+    const int w = REGRESSION_WIDTH, h = REGRESSION_HEIGHT;
+    std::vector<uint8_t> bottomUp(w * h * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &bottomUp[0]);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+    run->image.resize(bottomUp.size());
+    for (int y = 0; y < h; y++)
+        memcpy(&run->image[y * w * 4], &bottomUp[(h - 1 - y) * w * 4], w * 4);
+    // Alpha is never compared; opaque, the images look as they would on
+    // screen. The grid's vertex colors, for one, have an alpha of 0.
+    for (size_t i = 3; i < run->image.size(); i += 4)
+        run->image[i] = 255;
+}
+
+// Squares of cell pixels alternating between a and b.
+static void makeCheckerboard(int w, int h, int cell, uint32_t a, uint32_t b,
+        std::vector<uint32_t>* pixels) {
+    pixels->resize(w * h);
+    for (int y = 0; y < h; y++)
+        for (int x = 0; x < w; x++)
+            (*pixels)[y * w + x] = ((x / cell + y / cell) & 1) ? a : b;
+}
+
+// The chair scene with count copies of the chair, 0 for the renderer's
+// default.
+static bool renderChairs(GLuint framebuffer, unsigned int count, SceneRun* run) {
+    // Built in code, so the scene needs no asset on the machine.
+    Mesh chair;
+    MakeChairMesh(&chair);
+    Renderer* renderer = createES3Renderer(&chair);
+    if (!renderer)
+        return false;
+    renderer->setFixedClock(REGRESSION_FRAME_NS);
+    renderer->setOutputFramebuffer(framebuffer);
+    // Stands in for the bitmap the activity loads.
+    std::vector<uint32_t> albedo;
+    makeCheckerboard(REGRESSION_ALBEDO_SIZE, REGRESSION_ALBEDO_SIZE, 8, 0xff3a6b9eu,
+            0xff2c4a70u, &albedo);
+    renderer->set2DTexture(&albedo[0], REGRESSION_ALBEDO_SIZE, REGRESSION_ALBEDO_SIZE);
+    if (count)
+        renderer->setInstanceCount(count);
+    renderer->resize(REGRESSION_WIDTH, REGRESSION_HEIGHT);
+    runScene([&] { renderer->render(); }, framebuffer, run);
+    delete renderer;
+    return true;
+}
+
+static bool renderChair(GLuint framebuffer, SceneRun* run) {
+    return renderChairs(framebuffer, 0, run);
+}
+
+static bool renderCrowd(GLuint framebuffer, SceneRun* run) {
+    return renderChairs(framebuffer, REGRESSION_CROWD_INSTANCES, run);
+}
+
+static bool renderGrid(GLuint framebuffer, SceneRun* run) {
+    Renderer* renderer = createES2Renderer();
+    if (!renderer)
+        return false;
+    renderer->setFixedClock(REGRESSION_FRAME_NS);
+    renderer->setOutputFramebuffer(framebuffer);
+    renderer->resize(REGRESSION_WIDTH, REGRESSION_HEIGHT);
+    runScene([&] { renderer->render(); }, framebuffer, run);
+    delete renderer;
+    return true;
+}
+
+// Like benchDepthOfField, on a pattern instead of noise so that the image
+// is the same every run: a checkerboard, with depth ramping left to right
+// through the focus distance so the CoC covers its whole range.
+static bool renderDepthOfField(GLuint framebuffer, SceneRun* run) {
+    const int w = REGRESSION_WIDTH, h = REGRESSION_HEIGHT;
+    GLStateCache state;
+    RenderTargetPool pool;
+    DepthOfField dof;
+    if (!dof.init()) {
+        dof.destroy();
+        return false;
+    }
+    dof.resize(w, h, 1);
+    dof.setFocus(0.2f, 2.0f * DOF_MAX_COC_PX, 0.1f, 100.0f);
+
+    std::vector<uint32_t> color;
+    makeCheckerboard(w, h, 8, 0xff20c0f0u, 0xff402010u, &color);
+    std::vector<uint32_t> depth(w * h);
+    for (int i = 0; i < w * h; i++)
+        depth[i] = (uint32_t)(float(i % w) / (w - 1) * 4294967295.0);
+    GLuint textures[2];
+    glGenTextures(2, textures);
+    state.bindTexture(0, GL_TEXTURE_2D, textures[0]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, &color[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    state.bindTexture(0, GL_TEXTURE_2D, textures[1]);
+    glTexStorage2D(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT24, w, h);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, &depth[0]);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+    runScene([&] {
+        dof.apply(state, pool, textures[0], textures[1], framebuffer, w, h);
+        pool.endFrame(state);
+    }, framebuffer, run);
+
+    state.forgetTexture(textures[0]);
+    state.forgetTexture(textures[1]);
+    glDeleteTextures(2, textures);
+    pool.destroy(state);
+    dof.destroy();
+    glBindVertexArray(0);
+    glUseProgram(0);
+    return true;
+}
+
+ImageDifference compareImages(const uint8_t* a, const uint8_t* b, int w, int h,
+        std::vector<uint8_t>* diff) {
+    ImageDifference result;
+    memset(&result, 0, sizeof(result));
+
+    // Differences in luma and two color differences, BT.709 weights, 0 to 1.
+    const size_t n = (size_t)w * h;
+    std::vector<float> opponent(3 * n);
+    double squared = 0.0;
+    for (size_t i = 0; i < n; i++) {
+        float d[3];
+        for (int c = 0; c < 3; c++) {
+            int e = (int)a[4 * i + c] - (int)b[4 * i + c];
+            squared += e * e;
+            d[c] = e * (1.0f / 255.0f);
+        }
+        if (d[0] != 0.0f || d[1] != 0.0f || d[2] != 0.0f)
+            result.pixels++;
+        float y = 0.2126f * d[0] + 0.7152f * d[1] + 0.0722f * d[2];
+        opponent[3 * i] = y;
+        opponent[3 * i + 1] = 0.5389f * (d[2] - y);
+        opponent[3 * i + 2] = 0.6350f * (d[0] - y);
+    }
+    double mse = squared / (3.0 * n);
+    result.psnr = mse > 0.0 ? 10.0 * log10(255.0 * 255.0 / mse) : INFINITY;
+
+    // The blur is linear, so blurring the difference is the difference of
+    // the blurred images. Chroma counts half, as the eye resolves it worse.
+    std::vector<float> error(n);
+    static const float WEIGHTS[3] = { 0.25f, 0.5f, 0.25f };
+    double sum = 0.0;
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            float blurred[3] = { 0.0f, 0.0f, 0.0f };
+            for (int j = -1; j <= 1; j++) {
+                int sy = std::min(std::max(y + j, 0), h - 1);
+                for (int i = -1; i <= 1; i++) {
+                    int sx = std::min(std::max(x + i, 0), w - 1);
+                    float weight = WEIGHTS[j + 1] * WEIGHTS[i + 1];
+                    const float* d = &opponent[3 * ((size_t)sy * w + sx)];
+                    for (int c = 0; c < 3; c++)
+                        blurred[c] += weight * d[c];
+                }
+            }
+            float e = sqrtf(blurred[0] * blurred[0] +
+                    0.5f * (blurred[1] * blurred[1] + blurred[2] * blurred[2]));
+            error[(size_t)y * w + x] = std::min(e, 1.0f);
+            sum += error[(size_t)y * w + x];
+        }
+    }
+    result.perceptualMean = float(sum / n);
+
+    if (diff) {
+        diff->resize(4 * n);
+        for (size_t i = 0; i < n; i++) {
+            float red = std::min(REGRESSION_DIFF_GAIN * error[i], 1.0f);
+            for (int c = 0; c < 3; c++)
+                (*diff)[4 * i + c] = (uint8_t)(b[4 * i + c] / 4);
+            (*diff)[4 * i] = (uint8_t)std::max((float)(*diff)[4 * i], red * 255.0f);
+            (*diff)[4 * i + 3] = 255;
+        }
+    }
+
+    size_t rank = n * 99 / 100;
+    std::nth_element(error.begin(), error.begin() + rank, error.end());
+    result.perceptual = error[rank];
+    return result;
+}
+
+// A baseline frame time in ms, or 0 if there is none.
+static double readBaseline(const std::string& path) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file)
+        return 0.0;
+    double ms = 0.0;
+    if (fscanf(file, "%lf", &ms) != 1)
+        ms = 0.0;
+    fclose(file);
+    return ms;
+}
+
+static bool writeBaseline(const std::string& path, double ms) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file)
+        return false;
+    fprintf(file, "%.3f\n", ms);
+    return fclose(file) == 0;
+}
+
+static double percentile(std::vector<double> values, unsigned int percent) {
+    size_t rank = (values.size() - 1) * percent / 100;
+    std::nth_element(values.begin(), values.begin() + rank, values.end());
+    return values[rank];
+}
+
+int runRegressionSuite(const RegressionOptions& options) {
+    HeadlessContext context;
+    if (eglGetCurrentContext() == EGL_NO_CONTEXT && !context.create())
+        return -1;
+    const char* version = (const char*)glGetString(GL_VERSION);
+    if (!version || !strstr(version, "OpenGL ES 3.")) {
+        ALOGE("regression: needs OpenGL ES 3, got %s", version ? version : "nothing");
+        return -1;
+    }
+#if DYNAMIC_ES3
+    if (!gl3stubInit())
+        return -1;
+#endif
+
+    OutputTarget output;
+    if (!createOutput(&output)) {
+        ALOGE("regression: can't create the %dx%d output", REGRESSION_WIDTH, REGRESSION_HEIGHT);
+        destroyOutput(&output);
+        return -1;
+    }
+
+    struct Scene {
+        const char* name;
+        bool (*render)(GLuint framebuffer, SceneRun* run);
+    };
+    static const Scene SCENES[] = {
+        { "chair", renderChair },
+        { "crowd", renderCrowd },
+        { "dof", renderDepthOfField },
+        { "grid", renderGrid },
+    };
+    const int w = REGRESSION_WIDTH, h = REGRESSION_HEIGHT;
+    const float maxSlowdown = options.maxSlowdown > 0.0f ? options.maxSlowdown :
+            REGRESSION_MAX_SLOWDOWN;
+    const std::string goldenDir = options.goldenDir;
+    const std::string reportDir = options.reportDir;
+
+    std::string reportPath = reportDir + "/regression.txt";
+    FILE* report = fopen(reportPath.c_str(), "w");
+    if (!report)
+        ALOGE("regression: can't write %s", reportPath.c_str());
+    char line[256];
+    auto emit = [&](const char* text) {
+        ALOGV("regression: %s", text);
+        if (report)
+            fprintf(report, "%s\n", text);
+    };
+    snprintf(line, sizeof(line), "%s, %dx%d, %d timed frames after %d; failing below %.1f dB, "
+             "above %.3f perceptual error, or %.0f%% over the baseline time",
+             (const char*)glGetString(GL_RENDERER), w, h, REGRESSION_TIMED_FRAMES,
+             REGRESSION_WARMUP_FRAMES, REGRESSION_MIN_PSNR, REGRESSION_MAX_PERCEPTUAL,
+             maxSlowdown * 100.0f);
+    emit(line);
+    emit("scene   result      psnr dB  perceptual (mean)  median ms  p90 ms  baseline ms  change");
+
+    int failures = 0;
+    for (size_t s = 0; s < sizeof(SCENES) / sizeof(SCENES[0]); s++) {
+        const Scene& scene = SCENES[s];
+        std::string golden = goldenDir + "/" + scene.name + ".png";
+        std::string timing = goldenDir + "/" + scene.name + ".timing";
+        SceneRun run;
+        if (!scene.render(output.framebuffer, &run)) {
+            snprintf(line, sizeof(line), "%-7s unavailable", scene.name);
+            emit(line);
+            failures++;
+            continue;
+        }
+        double median = percentile(run.frameMs, 50);
+        double p90 = percentile(run.frameMs, 90);
+
+        if (options.updateGoldens) {
+            bool written = writePng(golden.c_str(), &run.image[0], w * 4, w, h) &&
+                    writeBaseline(timing, median);
+            snprintf(line, sizeof(line), "%-7s %-10s  %7s  %17s  %9.2f  %6.2f",
+                     scene.name, written ? "updated" : "NOT WRITTEN", "", "", median, p90);
+            emit(line);
+            if (!written)
+                failures++;
+            continue;
+        }
+
+        std::vector<uint8_t> expected;
+        int goldenWidth = 0, goldenHeight = 0;
+        bool haveGolden = readPng(golden.c_str(), &expected, &goldenWidth, &goldenHeight) &&
+                goldenWidth == w && goldenHeight == h;
+        ImageDifference difference;
+        memset(&difference, 0, sizeof(difference));
+        std::vector<uint8_t> diff;
+        bool imageOk = false;
+        if (haveGolden) {
+            difference = compareImages(&expected[0], &run.image[0], w, h, &diff);
+            imageOk = difference.psnr >= REGRESSION_MIN_PSNR &&
+                    difference.perceptual <= REGRESSION_MAX_PERCEPTUAL;
+        }
+        if (!imageOk) {
+            writePng((reportDir + "/" + scene.name + "_actual.png").c_str(), &run.image[0],
+                    w * 4, w, h);
+            if (haveGolden)
+                writePng((reportDir + "/" + scene.name + "_diff.png").c_str(), &diff[0],
+                        w * 4, w, h);
+        }
+
+        double baseline = readBaseline(timing);
+        double change = baseline > 0.0 ? median / baseline - 1.0 : 0.0;
+        bool slow = change > maxSlowdown && median - baseline > REGRESSION_MIN_SLOWDOWN_MS;
+
+        const char* result = !haveGolden ? "NO GOLDEN" :
+                (!imageOk && slow ? "IMAGE+SLOW" : (!imageOk ? "IMAGE" : (slow ? "SLOW" : "ok")));
+        char psnr[16], perceptual[32], reference[16], delta[16];
+        if (haveGolden)
+            snprintf(psnr, sizeof(psnr), "%7.2f", difference.psnr);
+        else
+            snprintf(psnr, sizeof(psnr), "%7s", "-");
+        snprintf(perceptual, sizeof(perceptual), "%.4f (%.4f)", difference.perceptual,
+                 difference.perceptualMean);
+        if (baseline > 0.0) {
+            snprintf(reference, sizeof(reference), "%.2f", baseline);
+            snprintf(delta, sizeof(delta), "%+.1f%%", change * 100.0);
+        } else {
+            strcpy(reference, "-");
+            strcpy(delta, "-");
+        }
+        snprintf(line, sizeof(line), "%-7s %-10s  %s  %17s  %9.2f  %6.2f  %11s  %6s",
+                 scene.name, result, psnr, haveGolden ? perceptual : "-", median, p90,
+                 reference, delta);
+        emit(line);
+        if (!imageOk || slow)
+            failures++;
+    }
+
+    snprintf(line, sizeof(line), "%d of %d scenes failed", failures,
+             (int)(sizeof(SCENES) / sizeof(SCENES[0])));
+    emit(line);
+    if (report)
+        fclose(report);
+    destroyOutput(&output);
+    return failures;
+}
@@ -0,0 +1,82 @@
+//
+// Rendering regression suite: canonical scenes rendered headlessly into an
+// offscreen target, compared with golden images and timed, for a CI
+// machine running Mesa's llvmpipe or for a device. The scenes are
+//   chair: RendererES3, MakeChairMesh with the PBR shader and every post pass
+//   crowd: the same with REGRESSION_CROWD_INSTANCES chairs, enough to be
+//          culled on the GPU with ES 3.1 and on the worker pool without
+//   dof:   DepthOfField alone, on a test pattern with a depth ramp
+//   grid:  RendererES2, the instanced quads laid out by calcSceneParams
+// The renderers run on a fixed clock (Renderer::setFixedClock), so a
+// frame's image only depends on the GPU and driver; goldens are only
+// valid for the GL_RENDERER that made them, which the report names.
+//
+// Images are compared by PSNR and by a perceptual error in the spirit of
+// FLIP, much simplified: the difference in an opponent color space, low
+// passed over 3x3 pixels so that an edge moved by a pixel blurs away while
+// a wrongly shaded area does not. Frame times are the median over
+// REGRESSION_TIMED_FRAMES frames, each finished on its own, compared with
+// the time stored alongside the golden.
+//
+// Every run writes one report, regression.txt, of both. Scenes that fail
+// the image test also get <scene>_actual.png and <scene>_diff.png there.
+//
+// On the host, tools/RegressionMain.cpp runs it as the CMake test
+// "regression", against the goldens in tools/golden made on llvmpipe.
+//
+
+#ifndef OPENGL_DEMO_REGRESSIONSUITE_H
+#define OPENGL_DEMO_REGRESSIONSUITE_H
+
+#include <vector>
+
+#include "gles3jni.h"
+
+#define REGRESSION_WIDTH 320
+#define REGRESSION_HEIGHT 240
+#define REGRESSION_CROWD_INSTANCES 1600
+// Frames rendered before the timed ones; the image is the last timed one.
+#define REGRESSION_WARMUP_FRAMES 8
+#define REGRESSION_TIMED_FRAMES 30
+// Step of the fixed clock, 60 Hz.
+#define REGRESSION_FRAME_NS 16666667ull
+// An image fails below this PSNR, in dB, or when the 99th percentile of
+// the perceptual error is above this.
+#define REGRESSION_MIN_PSNR 40.0
+#define REGRESSION_MAX_PERCEPTUAL 0.05f
+// Frame time regressions beyond this fraction of the baseline are flagged,
+// if they also add this much: below it, the scheduler's noise dominates.
+#define REGRESSION_MAX_SLOWDOWN 0.3f
+#define REGRESSION_MIN_SLOWDOWN_MS 0.5
+
+struct RegressionOptions {
+    // Goldens are <scene>.png, with the baseline frame time in <scene>.timing.
+    const char* goldenDir;
+    const char* reportDir;
+    // Writes this run's images and times as the new goldens instead of
+    // comparing with them.
+    bool updateGoldens;
+    // Fraction over the baseline frame time flagged as a regression,
+    // REGRESSION_MAX_SLOWDOWN unless set.
+    float maxSlowdown;
+};
+
+struct ImageDifference {
+    double psnr;            // over RGB, infinite for identical images
+    float perceptual;       // 99th percentile of the per-pixel error, 0 to 1
+    float perceptualMean;
+    unsigned int pixels;    // that differ at all
+};
+
+// Compares two RGBA8 images of w x h, ignoring alpha. diff, if not NULL,
+// gets an RGBA8 image of the error in red over a dimmed b.
+ImageDifference compareImages(const uint8_t* a, const uint8_t* b, int w, int h,
+        std::vector<uint8_t>* diff);
+
+// Renders every scene on a HeadlessContext of its own, or on the current
+// context if there is one, and writes the report. Returns the number of
+// scenes that failed, on their image or their time, or -1 without a usable
+// ES 3 context.
+int runRegressionSuite(const RegressionOptions& options);
+
+#endif //OPENGL_DEMO_REGRESSIONSUITE_H
@@ -0,0 +1,77 @@
+//
+// Load and store actions, see RenderPass.h.
+//
+
+#include "RenderPass.h"
+
+RenderPass::RenderPass(GLuint framebuffer, GLsizei width, GLsizei height)
+:   framebuffer(framebuffer),
+    width(width),
+    height(height),
+    colorLoad(LOAD_ACTION_CLEAR),
+    colorStore(STORE_ACTION_STORE),
+    depthLoad(LOAD_ACTION_CLEAR),
+    depthStore(STORE_ACTION_DISCARD),
+    clearDepth(1.0f),
+    resolveFramebuffer(0)
+{
+    clearColor[0] = 0.2f;
+    clearColor[1] = 0.2f;
+    clearColor[2] = 0.6f;
+    clearColor[3] = 1.0f;
+}
+
+// The default framebuffer names its buffers differently, and its depth
+// usually shares storage with stencil, so both go together.
+void RenderPass::invalidate(bool color, bool depth) const {
+    GLenum attachments[3];
+    GLsizei count = 0;
+    if (color)
+        attachments[count++] = framebuffer ? GL_COLOR_ATTACHMENT0 : GL_COLOR;
+    if (depth && framebuffer) {
+        attachments[count++] = GL_DEPTH_ATTACHMENT;
+    } else if (depth) {
+        attachments[count++] = GL_DEPTH;
+        attachments[count++] = GL_STENCIL;
+    }
+    if (count > 0)
+        glInvalidateFramebuffer(GL_FRAMEBUFFER, count, attachments);
+}
+
+void RenderPass::begin(GLStateCache& state) const {
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    state.viewport(0, 0, width, height);
+
+    invalidate(colorLoad == LOAD_ACTION_DONT_CARE, depthLoad == LOAD_ACTION_DONT_CARE);
+
+    GLbitfield clearMask = 0;
+    if (colorLoad == LOAD_ACTION_CLEAR) {
+        state.colorMask(true);
+        glClearColor(clearColor[0], clearColor[1], clearColor[2], clearColor[3]);
+        clearMask |= GL_COLOR_BUFFER_BIT;
+    }
+    if (depthLoad == LOAD_ACTION_CLEAR) {
+        state.depthMask(true);
+        glClearDepthf(clearDepth);
+        clearMask |= GL_DEPTH_BUFFER_BIT;
+    }
+    if (clearMask)
+        glClear(clearMask);
+}
+
+void RenderPass::end(GLStateCache& state) const {
+    GLbitfield resolveMask = 0;
+    if (colorStore == STORE_ACTION_RESOLVE)
+        resolveMask |= GL_COLOR_BUFFER_BIT;
+    if (depthStore == STORE_ACTION_RESOLVE)
+        resolveMask |= GL_DEPTH_BUFFER_BIT;
+    if (resolveMask) {
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, resolveMask, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    // Once resolved, the samples are as dead as discarded contents.
+    invalidate(colorStore != STORE_ACTION_STORE, depthStore != STORE_ACTION_STORE);
+}
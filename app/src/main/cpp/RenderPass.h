@@ -0,0 +1,62 @@
+//
+// A render pass is one framebuffer from first draw to last, with explicit
+// load and store actions for its color and depth contents. On tiled GPUs
+// these decide whether tile memory is filled from DRAM at the start and
+// written back at the end:
+//   load:  CLEAR     -> glClear
+//          LOAD      -> nothing, previous contents are read in
+//          DONT_CARE -> glInvalidateFramebuffer before drawing
+//   store: STORE     -> nothing, contents are written back
+//          DISCARD   -> glInvalidateFramebuffer after drawing
+//          RESOLVE   -> glBlitFramebuffer into resolveFramebuffer, then the
+//                       multisampled attachment is invalidated
+// Invalidation needs ES 3.0; don't use DONT_CARE, DISCARD or RESOLVE from
+// the ES 2 renderer.
+//
+
+#ifndef OPENGL_DEMO_RENDERPASS_H
+#define OPENGL_DEMO_RENDERPASS_H
+
+#include "gles3jni.h"
+
+enum LoadAction {
+    LOAD_ACTION_LOAD,
+    LOAD_ACTION_CLEAR,
+    LOAD_ACTION_DONT_CARE,
+};
+
+enum StoreAction {
+    STORE_ACTION_STORE,
+    STORE_ACTION_DISCARD,
+    STORE_ACTION_RESOLVE,
+};
+
+class RenderPass {
+public:
+    // Clears color to the demo background and depth to 1, keeps color and
+    // discards depth: the usual main pass.
+    RenderPass(GLuint framebuffer, GLsizei width, GLsizei height);
+
+    // Binds the framebuffer and sets the viewport, then applies the load
+    // actions. Clearing turns the color and depth masks on.
+    void begin(GLStateCache& state) const;
+    // Applies the store actions. Leaves the pass's framebuffer bound.
+    void end(GLStateCache& state) const;
+
+    GLuint framebuffer;         // 0 is the default framebuffer
+    GLsizei width;
+    GLsizei height;
+    LoadAction colorLoad;
+    StoreAction colorStore;
+    LoadAction depthLoad;       // ignored if there is no depth attachment
+    StoreAction depthStore;
+    GLfloat clearColor[4];
+    GLfloat clearDepth;
+    // Single-sampled target of STORE_ACTION_RESOLVE, same size.
+    GLuint resolveFramebuffer;
+
+private:
+    void invalidate(bool color, bool depth) const;
+};
+
+#endif //OPENGL_DEMO_RENDERPASS_H
@@ -0,0 +1,122 @@
+//
+// Sorted draw submission, see RenderQueue.h.
+//
+
+#include "RenderQueue.h"
+
+#include <string.h>
+
+#define DRAW_KEY_STATE_MASK ((1ull << DRAW_KEY_STATE_BITS) - 1)
+#define DRAW_KEY_DEPTH_MAX  ((1u << DRAW_KEY_DEPTH_BITS) - 1)
+
+uint64_t RenderQueue::makeKey(DrawPass pass, unsigned int program, unsigned int textureSet,
+        unsigned int vao, float depth) {
+    if (depth < 0.0f)
+        depth = 0.0f;
+    else if (depth > 1.0f)
+        depth = 1.0f;
+    uint64_t z = (uint64_t)(depth * DRAW_KEY_DEPTH_MAX);
+    uint64_t state = ((program & DRAW_KEY_STATE_MASK) << (2*DRAW_KEY_STATE_BITS)) |
+            ((textureSet & DRAW_KEY_STATE_MASK) << DRAW_KEY_STATE_BITS) |
+            (vao & DRAW_KEY_STATE_MASK);
+    uint64_t key = (uint64_t)pass << (64 - DRAW_KEY_PASS_BITS);
+
+    if (pass == DRAW_PASS_BLENDED) {
+        // far to near: invert depth and sort it ahead of state
+        key |= (DRAW_KEY_DEPTH_MAX - z) << (3*DRAW_KEY_STATE_BITS);
+        key |= state;
+    } else {
+        key |= state << DRAW_KEY_DEPTH_BITS;
+        key |= z;
+    }
+    return key;
+}
+
+RenderQueue::RenderQueue() {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void RenderQueue::clear() {
+    mItems.clear();
+    mOrder.clear();
+}
+
+DrawItem& RenderQueue::push(uint64_t key) {
+    DrawItem item;
+    memset(&item, 0, sizeof(item));
+    item.key = key;
+    item.instanceAttrib = -1;
+    mItems.push_back(item);
+    return mItems.back();
+}
+
+void RenderQueue::sort() {
+    const size_t n = mItems.size();
+    mOrder.resize(n);
+    mScratch.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        mOrder[i].key = mItems[i].key;
+        mOrder[i].item = (uint32_t)i;
+    }
+    if (n < 2)
+        return;
+
+    SortEntry* src = &mOrder[0];
+    SortEntry* dst = &mScratch[0];
+    for (unsigned int shift = 0; shift < 64; shift += 8) {
+        size_t offsets[256];
+        memset(offsets, 0, sizeof(offsets));
+        for (size_t i = 0; i < n; i++)
+            offsets[(src[i].key >> shift) & 0xFF]++;
+        if (offsets[(src[0].key >> shift) & 0xFF] == n)
+            continue;   // every key has this digit: nothing to reorder
+
+        size_t sum = 0;
+        for (int d = 0; d < 256; d++) {
+            size_t count = offsets[d];
+            offsets[d] = sum;
+            sum += count;
+        }
+        for (size_t i = 0; i < n; i++)
+            dst[offsets[(src[i].key >> shift) & 0xFF]++] = src[i];
+
+        SortEntry* tmp = src;
+        src = dst;
+        dst = tmp;
+    }
+    if (src != &mOrder[0])
+        memcpy(&mOrder[0], src, n * sizeof(SortEntry));
+}
+
+void RenderQueue::record(CommandList& list, size_t begin, size_t end) const {
+    for (size_t i = begin; i < end; i++) {
+        const DrawItem& item = mItems[mOrder[i].item];
+
+        list.useProgram(item.program);
+        list.bindVertexArray(item.vao);
+        for (int unit = 0; unit < DRAW_ITEM_MAX_TEXTURES; unit++) {
+            if (item.textures[unit] != 0)
+                list.bindTexture(unit, GL_TEXTURE_2D, item.textures[unit]);
+        }
+        if (item.depthFunc != 0)
+            list.depthState(item.depthFunc, item.depthWrite, item.colorWrite);
+        if (item.instanceAttrib >= 0)
+            list.vertexStream((GLuint)item.instanceAttrib, item.instanceComponents, 0,
+                    item.instanceBuffer, item.instanceOffset);
+        if (item.indirectBuffer != 0)
+            list.drawIndirect(item.mode, item.indexType, item.indirectBuffer, item.first);
+        else
+            list.draw(item.mode, item.count, item.indexType, item.first, item.instanceCount);
+    }
+}
+
+const RenderQueue::Stats& RenderQueue::submit(GLStateCache& state) {
+    memset(&mStats, 0, sizeof(mStats));
+    if (mOrder.size() != mItems.size())
+        sort();
+
+    mCommands.reset();
+    record(mCommands, 0, mOrder.size());
+    mCommands.execute(state, &mStats);
+    return mStats;
+}
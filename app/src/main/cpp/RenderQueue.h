@@ -0,0 +1,103 @@
+//
+// Sorted draw submission. Every draw is recorded as a DrawItem with a packed
+// 64-bit key, the queue is radix sorted by key and submitted in one loop so
+// state changes only happen where the key changes.
+//
+
+#ifndef OPENGL_DEMO_RENDERQUEUE_H
+#define OPENGL_DEMO_RENDERQUEUE_H
+
+#include <vector>
+
+#include "gles3jni.h"
+#include "CommandList.h"
+
+// Most significant field first, so sorting by key orders by pass, then
+// state, then depth. Blended items swap depth in front of the state fields,
+// since their order matters more than state changes.
+//
+//   opaque:  | pass:4 | program:12 | textures:12 | vao:12 | depth:24 |
+//   blended: | pass:4 | ~depth:24  | program:12  | textures:12 | vao:12 |
+#define DRAW_KEY_PASS_BITS      4
+#define DRAW_KEY_STATE_BITS     12
+#define DRAW_KEY_DEPTH_BITS     24
+
+enum DrawPass {
+    DRAW_PASS_DEPTH,        // depth-only pre-pass
+    DRAW_PASS_OPAQUE,       // front to back
+    DRAW_PASS_BLENDED,      // back to front
+    DRAW_PASS_OVERLAY,
+};
+
+#define DRAW_ITEM_MAX_TEXTURES 2
+
+struct DrawItem {
+    uint64_t key;
+
+    GLuint program;
+    GLuint vao;
+    GLuint textures[DRAW_ITEM_MAX_TEXTURES];    // GL_TEXTURE_2D on units 0..n, 0 = unused
+    // Depth function and write masks. 0 leaves the depth state as it is.
+    GLenum depthFunc;
+    bool depthWrite;
+    bool colorWrite;
+
+    GLenum mode;
+    GLsizei count;
+    GLenum indexType;           // 0 for glDrawArrays
+    uintptr_t first;            // byte offset in the index buffer, or first vertex
+    GLsizei instanceCount;      // 0 for non-instanced draws
+    // Non-zero draws with glDrawElementsIndirect (ES 3.1) from the command
+    // at byte offset first in this buffer; count and instanceCount are unused.
+    GLuint indirectBuffer;
+
+    // Optional per-draw instance stream: instanceAttrib is re-pointed at
+    // instanceBuffer + instanceOffset before the draw. -1 if unused.
+    GLint instanceAttrib;
+    GLint instanceComponents;
+    GLuint instanceBuffer;
+    uintptr_t instanceOffset;
+};
+
+class RenderQueue {
+public:
+    typedef CommandList::Stats Stats;
+
+    // depth is normalized view depth in [0, 1]. program, textureSet and vao
+    // are small ids; only their low 12 bits take part in the key.
+    static uint64_t makeKey(DrawPass pass, unsigned int program, unsigned int textureSet,
+            unsigned int vao, float depth);
+
+    RenderQueue();
+
+    void clear();
+    // Returns an item to fill in, with everything zeroed and no instance stream.
+    DrawItem& push(uint64_t key);
+    size_t size() const { return mItems.size(); }
+
+    // LSD radix sort by key, 8 bits per pass. Passes where every key has
+    // the same digit are skipped, so mostly-uniform keys sort in a few passes.
+    void sort();
+    // Records sorted items [begin, end) into list. Doesn't touch GL, so
+    // disjoint ranges can be recorded on different threads after sort().
+    void record(CommandList& list, size_t begin, size_t end) const;
+    // Records and replays every item in sorted order on the GL thread, with
+    // state changes filtered through state. Returns this frame's counters.
+    const Stats& submit(GLStateCache& state);
+
+    const Stats& stats() const { return mStats; }
+
+private:
+    struct SortEntry {
+        uint64_t key;
+        uint32_t item;
+    };
+
+    std::vector<DrawItem> mItems;
+    std::vector<SortEntry> mOrder;
+    std::vector<SortEntry> mScratch;
+    CommandList mCommands;
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_RENDERQUEUE_H
@@ -0,0 +1,217 @@
+//
+// Transient render target pool, see RenderTargetPool.h.
+//
+
+#include "RenderTargetPool.h"
+
+#include <string.h>
+
+static bool isDepthFormat(GLenum format) {
+    switch (format) {
+        case GL_DEPTH_COMPONENT16:
+        case GL_DEPTH_COMPONENT24:
+        case GL_DEPTH_COMPONENT32F:
+        case GL_DEPTH24_STENCIL8:
+        case GL_DEPTH32F_STENCIL8:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool hasStencil(GLenum format) {
+    return format == GL_DEPTH24_STENCIL8 || format == GL_DEPTH32F_STENCIL8;
+}
+
+// What the driver most likely allocates, for the memory report.
+static unsigned int bytesPerPixel(GLenum format) {
+    switch (format) {
+        case GL_R8:
+            return 1;
+        case GL_R16F:
+        case GL_RG8:
+        case GL_DEPTH_COMPONENT16:
+            return 2;
+        case GL_RGBA16F:
+        case GL_RG32F:
+        case GL_DEPTH32F_STENCIL8:
+            return 8;
+        case GL_RGBA32F:
+            return 16;
+        default:
+            return 4;
+    }
+}
+
+static uint64_t targetBytes(const RenderTargetDesc& desc) {
+    return (uint64_t)desc.width * desc.height * desc.samples * bytesPerPixel(desc.format);
+}
+
+RenderTargetPool::RenderTargetPool()
+:   mFrame(0),
+    mFrameBytes(0),
+    mFrameUnaliasedBytes(0)
+{
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+void RenderTargetPool::destroy(GLStateCache& state) {
+    for (size_t i = 0; i < mTargets.size(); i++)
+        deleteTarget((int)i, state);
+    mTargets.clear();
+    mFramebuffers.clear();
+}
+
+void RenderTargetPool::deleteTarget(int target, GLStateCache& state) {
+    Target& t = mTargets[target];
+    if (t.name == 0)
+        return;
+
+    for (size_t i = 0; i < mFramebuffers.size();) {
+        const Framebuffer& fb = mFramebuffers[i];
+        bool attached = fb.depth == target;
+        for (int c = 0; c < RT_POOL_MAX_COLORS; c++)
+            attached = attached || fb.colors[c] == target;
+        if (attached) {
+            glDeleteFramebuffers(1, &mFramebuffers[i].framebuffer);
+            mFramebuffers[i] = mFramebuffers.back();
+            mFramebuffers.pop_back();
+        } else {
+            i++;
+        }
+    }
+    if (t.desc.samples > 1) {
+        glDeleteRenderbuffers(1, &t.name);
+    } else {
+        state.forgetTexture(t.name);
+        glDeleteTextures(1, &t.name);
+    }
+    mStats.residentBytes -= targetBytes(t.desc);
+    mStats.frees++;
+    t.name = 0;
+    t.inUse = false;
+}
+
+int RenderTargetPool::acquire(const RenderTargetDesc& desc, GLStateCache& state) {
+    // Prefer the target released last: its memory is the most likely to
+    // still be in cache, or in tile memory on a tiler.
+    int found = -1;
+    int freeSlot = -1;
+    for (size_t i = 0; i < mTargets.size(); i++) {
+        const Target& t = mTargets[i];
+        if (t.name == 0) {
+            freeSlot = (int)i;
+        } else if (!t.inUse && t.desc.width == desc.width && t.desc.height == desc.height &&
+                t.desc.format == desc.format && t.desc.samples == desc.samples &&
+                (found < 0 || t.lastUsedFrame >= mTargets[found].lastUsedFrame)) {
+            found = (int)i;
+        }
+    }
+
+    if (found < 0) {
+        Target t;
+        t.desc = desc;
+        t.name = 0;
+        t.lastUsedFrame = mFrame - 1;
+        if (desc.samples > 1) {
+            glGenRenderbuffers(1, &t.name);
+            glBindRenderbuffer(GL_RENDERBUFFER, t.name);
+            glRenderbufferStorageMultisample(GL_RENDERBUFFER, desc.samples, desc.format,
+                    desc.width, desc.height);
+        } else {
+            GLenum filter = isDepthFormat(desc.format) ? GL_NEAREST : GL_LINEAR;
+            glGenTextures(1, &t.name);
+            state.bindTexture(0, GL_TEXTURE_2D, t.name);
+            glTexStorage2D(GL_TEXTURE_2D, 1, desc.format, desc.width, desc.height);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        }
+        if (freeSlot >= 0) {
+            mTargets[freeSlot] = t;
+            found = freeSlot;
+        } else {
+            mTargets.push_back(t);
+            found = (int)mTargets.size() - 1;
+        }
+        mStats.allocations++;
+        mStats.residentBytes += targetBytes(desc);
+        ALOGV("RenderTargetPool: new %dx%d format 0x%04x x%d", desc.width, desc.height,
+                desc.format, desc.samples);
+    }
+
+    Target& t = mTargets[found];
+    t.inUse = true;
+    if (t.lastUsedFrame != mFrame) {
+        t.lastUsedFrame = mFrame;
+        mFrameBytes += targetBytes(desc);
+    }
+    mFrameUnaliasedBytes += targetBytes(desc);
+    return found;
+}
+
+void RenderTargetPool::release(int target) {
+    mTargets[target].inUse = false;
+}
+
+GLuint RenderTargetPool::framebuffer(int color, int depth) {
+    return framebuffer(&color, 1, depth);
+}
+
+GLuint RenderTargetPool::framebuffer(const int* colors, int colorCount, int depth) {
+    Framebuffer fb;
+    for (int c = 0; c < RT_POOL_MAX_COLORS; c++)
+        fb.colors[c] = c < colorCount ? colors[c] : -1;
+    fb.depth = depth;
+    for (size_t i = 0; i < mFramebuffers.size(); i++) {
+        if (memcmp(mFramebuffers[i].colors, fb.colors, sizeof(fb.colors)) == 0 &&
+                mFramebuffers[i].depth == depth)
+            return mFramebuffers[i].framebuffer;
+    }
+
+    glGenFramebuffers(1, &fb.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, fb.framebuffer);
+    GLenum drawBuffers[RT_POOL_MAX_COLORS];
+    for (int i = 0; i <= RT_POOL_MAX_COLORS; i++) {
+        int target = i < RT_POOL_MAX_COLORS ? fb.colors[i] : depth;
+        if (target < 0)
+            continue;
+        const Target& t = mTargets[target];
+        GLenum attachment = GL_COLOR_ATTACHMENT0 + i;
+        if (i == RT_POOL_MAX_COLORS)
+            attachment = hasStencil(t.desc.format) ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+        else
+            drawBuffers[i] = attachment;
+        if (t.desc.samples > 1)
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, t.name);
+        else
+            glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, t.name, 0);
+    }
+    // Only attachment 0 is drawn to by default.
+    if (colorCount > 1)
+        glDrawBuffers(colorCount, drawBuffers);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        ALOGE("RenderTargetPool: framebuffer %d/%d incomplete (0x%04x)", fb.colors[0], depth,
+                status);
+    mFramebuffers.push_back(fb);
+    return fb.framebuffer;
+}
+
+void RenderTargetPool::endFrame(GLStateCache& state) {
+    for (size_t i = 0; i < mTargets.size(); i++) {
+        const Target& t = mTargets[i];
+        if (t.inUse)
+            ALOGE("RenderTargetPool: target %zu still in use at the end of the frame", i);
+        if (t.name != 0 && mFrame - t.lastUsedFrame >= RT_POOL_IDLE_FRAMES)
+            deleteTarget((int)i, state);
+    }
+
+    if (mFrameBytes > mStats.peakBytes)
+        mStats.peakBytes = mFrameBytes;
+    if (mFrameUnaliasedBytes > mStats.peakUnaliasedBytes)
+        mStats.peakUnaliasedBytes = mFrameUnaliasedBytes;
+    mFrameBytes = mFrameUnaliasedBytes = 0;
+    mFrame++;
+}
@@ -0,0 +1,100 @@
+//
+// Pool of offscreen render targets with per-frame lifetimes. Passes acquire
+// a target by size, format and sample count, and release it as soon as the
+// last pass that reads it has been issued; a later acquire with the same
+// description in the same frame gets the same texture back. Targets whose
+// lifetimes don't overlap therefore share memory, and since the pool keeps
+// them across frames nothing is allocated in steady state.
+//
+// GL ES can't place textures of different formats in the same memory, so
+// only identically described targets alias.
+//
+
+#ifndef OPENGL_DEMO_RENDERTARGETPOOL_H
+#define OPENGL_DEMO_RENDERTARGETPOOL_H
+
+#include <vector>
+
+#include "gles3jni.h"
+
+// Targets unused for this many frames are deleted, e.g. after a resize.
+#define RT_POOL_IDLE_FRAMES 2
+// Color attachments of one pooled framebuffer.
+#define RT_POOL_MAX_COLORS 2
+
+struct RenderTargetDesc {
+    GLsizei width;
+    GLsizei height;
+    GLenum format;      // sized internal format
+    // > 1 makes a multisampled renderbuffer, which can't be sampled and is
+    // only useful as a resolve source.
+    GLsizei samples;
+};
+
+class RenderTargetPool {
+public:
+    struct Stats {
+        uint64_t allocations;       // textures and renderbuffers created
+        uint64_t frees;
+        // Largest sum over one frame of the targets in use, and of every
+        // acquire as if each had its own target.
+        uint64_t peakBytes;
+        uint64_t peakUnaliasedBytes;
+        uint64_t residentBytes;     // allocated now, in use or idle
+    };
+
+    RenderTargetPool();
+
+    // Deletes every target. The owner's context must be current.
+    void destroy(GLStateCache& state);
+
+    // Returns a free target matching desc, creating it if there is none.
+    // Contents are undefined: another pass may have used it earlier in the
+    // frame. Color targets filter linearly, depth targets are nearest.
+    int acquire(const RenderTargetDesc& desc, GLStateCache& state);
+    // The target may be handed out again by the next acquire(). Passes
+    // reading it must already have been issued.
+    void release(int target);
+
+    // Texture name, or renderbuffer name if multisampled.
+    GLuint name(int target) const { return mTargets[target].name; }
+    const RenderTargetDesc& desc(int target) const { return mTargets[target].desc; }
+    // Framebuffer with color and, unless it is -1, depth attached. Created on
+    // first use and kept as long as both targets.
+    GLuint framebuffer(int color, int depth = -1);
+    // Same with colorCount color targets on attachments 0 and up, each
+    // drawn to by the fragment output of the same location.
+    GLuint framebuffer(const int* colors, int colorCount, int depth);
+
+    // Deletes targets idle for RT_POOL_IDLE_FRAMES. Every target must have
+    // been released.
+    void endFrame(GLStateCache& state);
+
+    const Stats& stats() const { return mStats; }
+
+private:
+    struct Target {
+        RenderTargetDesc desc;
+        GLuint name;            // 0 if the slot is free
+        bool inUse;
+        unsigned int lastUsedFrame;
+    };
+
+    struct Framebuffer {
+        int colors[RT_POOL_MAX_COLORS];    // -1 past the last one
+        int depth;
+        GLuint framebuffer;
+    };
+
+    void deleteTarget(int target, GLStateCache& state);
+
+    std::vector<Target> mTargets;
+    std::vector<Framebuffer> mFramebuffers;
+    unsigned int mFrame;
+    uint64_t mFrameBytes;
+    uint64_t mFrameUnaliasedBytes;
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_RENDERTARGETPOOL_H
@@ -17,6 +17,29 @@
 #include "gles3jni.h"
 #include <EGL/egl.h>
 
+#include <vector>
+
+#include "RenderPass.h"
+#include "Simd.h"
+
+// Upper bound for the uniform-array pseudo-instancing batch. The real batch
+// size is also limited by GL_MAX_VERTEX_UNIFORM_VECTORS (2 vectors/instance).
+#define MAX_BATCH_INSTANCES 64
+// Reserve a few uniform vectors for the implementation.
+#define RESERVED_UNIFORM_VECTORS 8
+// Use uniform batches while they need at most this many draws per frame,
+// otherwise transform on the CPU and draw everything at once.
+#define UNIFORM_BATCH_MAX_DRAWS 2
+// Frames between two stats reports.
+#define STATS_INTERVAL 300
+// Define ES2_FORCE_DRAW_MODE (e.g. to DRAW_PER_INSTANCE) to pin one path when
+// comparing the numbers reported by reportStats().
+
+// GLushort indices reach 65536 vertices, 4 per quad. Longer runs of quads
+// are drawn this many at a time, moving the vertex pointers between draws
+// so every run uses the same indices.
+#define QUADS_PER_DRAW 16384
+
 static const char VERTEX_SHADER[] =
     "#version 100\n"
     "uniform mat2 scaleRot;\n"
@@ -29,6 +52,34 @@ static const char VERTEX_SHADER[] =
     "    vColor = color;\n"
     "}\n";
 
+// Pseudo-instancing: each vertex carries the index of its quad within the
+// batch, used to fetch that quad's transform from uniform arrays.
+// BATCH_SIZE is prepended as a #define when the program is built.
+static const char BATCH_VERTEX_SHADER[] =
+    "uniform vec4 scaleRot[BATCH_SIZE];\n"
+    "uniform vec2 offset[BATCH_SIZE];\n"
+    "attribute vec2 pos;\n"
+    "attribute vec4 color;\n"
+    "attribute float instance;\n"
+    "varying vec4 vColor;\n"
+    "void main() {\n"
+    "    int i = int(instance);\n"
+    "    vec4 m = scaleRot[i];\n"
+    "    gl_Position = vec4(mat2(m.xy, m.zw)*pos + offset[i], 0.0, 1.0);\n"
+    "    vColor = color;\n"
+    "}\n";
+
+// Positions arrive already in clip space from transformQuads().
+static const char CPU_VERTEX_SHADER[] =
+    "#version 100\n"
+    "attribute vec2 pos;\n"
+    "attribute vec4 color;\n"
+    "varying vec4 vColor;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(pos, 0.0, 1.0);\n"
+    "    vColor = color;\n"
+    "}\n";
+
 static const char FRAGMENT_SHADER[] =
     "#version 100\n"
     "precision mediump float;\n"
@@ -37,6 +88,36 @@ static const char FRAGMENT_SHADER[] =
     "    gl_FragColor = vColor;\n"
     "}\n";
 
+struct BatchVertex {
+    GLfloat pos[2];
+    GLubyte rgba[4];
+    GLfloat instance;
+};
+
+// Writes the four clip-space corners of each quad as x,y pairs, in QUAD order.
+static void transformQuads(const float* scaleRot, const float* offsets,
+        unsigned int count, float* out) {
+    const float quadX[4] = {QUAD[0].pos[0], QUAD[1].pos[0], QUAD[2].pos[0], QUAD[3].pos[0]};
+    const float quadY[4] = {QUAD[0].pos[1], QUAD[1].pos[1], QUAD[2].pos[1], QUAD[3].pos[1]};
+    const v4f px = v4fLoad(quadX);
+    const v4f py = v4fLoad(quadY);
+
+    for (unsigned int i = 0; i < count; i++) {
+        const float* m = scaleRot + 4*i;
+        v4f x = v4fMadd(v4fSplat(m[0]), px,
+                v4fMadd(v4fSplat(m[2]), py, v4fSplat(offsets[2*i + 0])));
+        v4f y = v4fMadd(v4fSplat(m[1]), px,
+                v4fMadd(v4fSplat(m[3]), py, v4fSplat(offsets[2*i + 1])));
+        v4fStoreInterleaved2(out + 8*i, x, y);
+    }
+}
+
+// GL calls drawPerInstance() makes outside the state cache: two attribute
+// pointers and two enables, then two uniforms and a draw per quad.
+static unsigned int perInstanceGlCalls(unsigned int numInstances) {
+    return 4 + 3*numInstances;
+}
+
 class RendererES2: public Renderer {
 public:
     RendererES2();
@@ -44,12 +125,27 @@ public:
     bool init();
 
 private:
-    virtual float* mapOffsetBuf();
+    enum DrawMode {
+        DRAW_PER_INSTANCE,      // one glDrawArrays per quad
+        DRAW_UNIFORM_BATCH,     // pseudo-instancing from uniform arrays
+        DRAW_CPU_TRANSFORM,     // CPU-transformed quads in a streaming VBO
+    };
+
+    virtual float* mapOffsetBuf(unsigned int count);
     virtual void unmapOffsetBuf();
-    virtual float* mapTransformBuf();
+    virtual float* mapTransformBuf(unsigned int count);
     virtual void unmapTransformBuf();
     virtual void draw(unsigned int numInstances);
 
+    bool initBatchPath();
+    bool initCpuPath();
+    bool reserveQuads(unsigned int quads);
+    DrawMode chooseDrawMode(unsigned int numInstances) const;
+    unsigned int drawPerInstance(unsigned int numInstances);
+    unsigned int drawUniformBatches(unsigned int numInstances);
+    unsigned int drawCpuTransformed(unsigned int numInstances);
+    void reportStats(DrawMode mode, unsigned int numInstances);
+
     const EGLContext mEglContext;
     GLuint mProgram;
     GLuint mVB;
@@ -58,8 +154,35 @@ private:
     GLint mScaleRotUniform;
     GLint mOffsetUniform;
 
-    float mOffsets[2*MAX_INSTANCES];
-    float mScaleRot[4*MAX_INSTANCES];   // array of 2x2 column-major matrices
+    // Shared by both batched paths: 6 indices per quad, for mQuadCapacity
+    // quads, as is mCpuColorVB.
+    GLuint mQuadIndices;
+    unsigned int mQuadCapacity;
+
+    GLuint mBatchProgram;
+    GLuint mBatchVB;
+    GLint mBatchPosAttrib;
+    GLint mBatchColorAttrib;
+    GLint mBatchInstanceAttrib;
+    GLint mBatchScaleRotUniform;
+    GLint mBatchOffsetUniform;
+    unsigned int mBatchSize;
+
+    GLuint mCpuProgram;
+    GLuint mCpuColorVB;
+    GLuint mCpuPosVB;
+    GLsizeiptr mCpuPosCapacity;     // bytes
+    GLint mCpuPosAttrib;
+    GLint mCpuColorAttrib;
+
+    unsigned int mStatsFrames;
+    uint64_t mStatsDrawCalls;
+    uint64_t mStatsGlCalls;
+    uint64_t mStatsCpuNs;
+
+    AlignedArray<float> mOffsets;
+    AlignedArray<float> mScaleRot;      // array of 2x2 column-major matrices
+    AlignedArray<float> mCpuPositions;
 };
 
 Renderer* createES2Renderer() {
@@ -78,10 +201,32 @@ RendererES2::RendererES2()
     mPosAttrib(-1),
     mColorAttrib(-1),
     mScaleRotUniform(-1),
-    mOffsetUniform(-1)
+    mOffsetUniform(-1),
+    mQuadIndices(0),
+    mQuadCapacity(0),
+    mBatchProgram(0),
+    mBatchVB(0),
+    mBatchPosAttrib(-1),
+    mBatchColorAttrib(-1),
+    mBatchInstanceAttrib(-1),
+    mBatchScaleRotUniform(-1),
+    mBatchOffsetUniform(-1),
+    mBatchSize(0),
+    mCpuProgram(0),
+    mCpuColorVB(0),
+    mCpuPosVB(0),
+    mCpuPosCapacity(0),
+    mCpuPosAttrib(-1),
+    mCpuColorAttrib(-1),
+    mStatsFrames(0),
+    mStatsDrawCalls(0),
+    mStatsGlCalls(0),
+    mStatsCpuNs(0)
 {}
 
 bool RendererES2::init() {
+    mGLState.invalidate();
+
     mProgram = createProgram(VERTEX_SHADER, FRAGMENT_SHADER);
     if (!mProgram)
         return false;
@@ -91,13 +236,116 @@ bool RendererES2::init() {
     mOffsetUniform = glGetUniformLocation(mProgram, "offset");
 
     glGenBuffers(1, &mVB);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB);
     glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD), &QUAD[0], GL_STATIC_DRAW);
 
+    glGenBuffers(1, &mQuadIndices);
+
+    // The batched paths are optional; draw() falls back to one draw call
+    // per instance if they can't be set up.
+    if (!initBatchPath())
+        ALOGE("ES2 uniform batching unavailable");
+    if (!initCpuPath())
+        ALOGE("ES2 CPU transform path unavailable");
+    // Enough for a uniform batch; the CPU path grows it to its quad count.
+    if (!reserveQuads(mBatchSize > 0 ? mBatchSize : 1))
+        return false;
+
     ALOGV("Using OpenGL ES 2.0 renderer");
     return true;
 }
 
+bool RendererES2::initBatchPath() {
+    GLint maxVectors = 0;
+    glGetIntegerv(GL_MAX_VERTEX_UNIFORM_VECTORS, &maxVectors);
+    int batchSize = (maxVectors - RESERVED_UNIFORM_VECTORS) / 2;
+    if (batchSize > MAX_BATCH_INSTANCES)
+        batchSize = MAX_BATCH_INSTANCES;
+    if (batchSize < 2)
+        return false;
+
+    char src[sizeof(BATCH_VERTEX_SHADER) + 64];
+    snprintf(src, sizeof(src), "#version 100\n#define BATCH_SIZE %d\n%s",
+            batchSize, BATCH_VERTEX_SHADER);
+    mBatchProgram = createProgram(src, FRAGMENT_SHADER);
+    if (!mBatchProgram)
+        return false;
+    mBatchPosAttrib = glGetAttribLocation(mBatchProgram, "pos");
+    mBatchColorAttrib = glGetAttribLocation(mBatchProgram, "color");
+    mBatchInstanceAttrib = glGetAttribLocation(mBatchProgram, "instance");
+    mBatchScaleRotUniform = glGetUniformLocation(mBatchProgram, "scaleRot");
+    mBatchOffsetUniform = glGetUniformLocation(mBatchProgram, "offset");
+    mBatchSize = (unsigned int)batchSize;
+
+    BatchVertex vertices[4*MAX_BATCH_INSTANCES];
+    for (int q = 0; q < batchSize; q++) {
+        for (int v = 0; v < 4; v++) {
+            BatchVertex& bv = vertices[4*q + v];
+            memcpy(bv.pos, QUAD[v].pos, sizeof(bv.pos));
+            memcpy(bv.rgba, QUAD[v].rgba, sizeof(bv.rgba));
+            bv.instance = (GLfloat)q;
+        }
+    }
+    glGenBuffers(1, &mBatchVB);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mBatchVB);
+    glBufferData(GL_ARRAY_BUFFER, 4*batchSize*sizeof(BatchVertex), vertices, GL_STATIC_DRAW);
+
+    return !checkGlError("RendererES2::initBatchPath");
+}
+
+bool RendererES2::initCpuPath() {
+    mCpuProgram = createProgram(CPU_VERTEX_SHADER, FRAGMENT_SHADER);
+    if (!mCpuProgram)
+        return false;
+    mCpuPosAttrib = glGetAttribLocation(mCpuProgram, "pos");
+    mCpuColorAttrib = glGetAttribLocation(mCpuProgram, "color");
+
+    // Both are filled as the quad count grows, by reserveQuads() and
+    // drawCpuTransformed().
+    GLuint vbs[2];
+    glGenBuffers(2, vbs);
+    mCpuColorVB = vbs[0];
+    mCpuPosVB = vbs[1];
+
+    return !checkGlError("RendererES2::initCpuPath");
+}
+
+// Grows the quad indices, and the CPU path's per-vertex colors, to cover
+// min(quads, QUADS_PER_DRAW) quads. Capacity at least doubles each time, so
+// a growing scene only reallocates a few times.
+bool RendererES2::reserveQuads(unsigned int quads) {
+    if (quads > QUADS_PER_DRAW)
+        quads = QUADS_PER_DRAW;
+    if (quads <= mQuadCapacity)
+        return true;
+    unsigned int capacity = 2 * mQuadCapacity > quads ? 2 * mQuadCapacity : quads;
+    if (capacity > QUADS_PER_DRAW)
+        capacity = QUADS_PER_DRAW;
+
+    std::vector<GLushort> indices(6 * capacity);
+    for (unsigned int q = 0; q < capacity; q++) {
+        GLushort base = (GLushort)(4*q);
+        GLushort* quad = &indices[6*q];
+        quad[0] = base + 0; quad[1] = base + 1; quad[2] = base + 2;
+        quad[3] = base + 2; quad[4] = base + 1; quad[5] = base + 3;
+    }
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mQuadIndices);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0],
+            GL_STATIC_DRAW);
+
+    if (mCpuColorVB) {
+        std::vector<GLubyte> colors(4*4 * capacity);
+        for (unsigned int q = 0; q < capacity; q++) {
+            for (int v = 0; v < 4; v++)
+                memcpy(&colors[4*(4*q + v)], QUAD[v].rgba, 4);
+        }
+        mGLState.bindBuffer(GL_ARRAY_BUFFER, mCpuColorVB);
+        glBufferData(GL_ARRAY_BUFFER, colors.size(), &colors[0], GL_STATIC_DRAW);
+    }
+    mQuadCapacity = capacity;
+    return !checkGlError("RendererES2::reserveQuads");
+}
+
 RendererES2::~RendererES2() {
     /* The destructor may be called after the context has already been
      * destroyed, in which case our objects have already been destroyed.
@@ -107,36 +355,180 @@ RendererES2::~RendererES2() {
      */
     if (eglGetCurrentContext() != mEglContext)
         return;
-    glDeleteBuffers(1, &mVB);
+    GLuint buffers[] = {mVB, mQuadIndices, mBatchVB, mCpuColorVB, mCpuPosVB};
+    glDeleteBuffers(sizeof(buffers) / sizeof(buffers[0]), buffers);
     glDeleteProgram(mProgram);
+    glDeleteProgram(mBatchProgram);
+    glDeleteProgram(mCpuProgram);
 }
 
-float* RendererES2::mapOffsetBuf() {
-    return mOffsets;
+float* RendererES2::mapOffsetBuf(unsigned int count) {
+    // Transforms only come with the second frame's step(); until then the
+    // quads are collapsed to their centers.
+    if (!mOffsets.resize(2 * (size_t)count) || !mScaleRot.resize(4 * (size_t)count))
+        return NULL;
+    memset(mScaleRot.data(), 0, 4 * (size_t)count * sizeof(float));
+    return mOffsets.data();
 }
 
 void RendererES2::unmapOffsetBuf() {
 }
 
-float* RendererES2::mapTransformBuf() {
-    return mScaleRot;
+float* RendererES2::mapTransformBuf(unsigned int count) {
+    return mScaleRot.resize(4 * (size_t)count) ? mScaleRot.data() : NULL;
 }
 
 void RendererES2::unmapTransformBuf() {
 }
 
+RendererES2::DrawMode RendererES2::chooseDrawMode(unsigned int numInstances) const {
+#ifdef ES2_FORCE_DRAW_MODE
+    return ES2_FORCE_DRAW_MODE;
+#else
+    bool canBatch = mBatchProgram != 0;
+    bool canTransform = mCpuProgram != 0;
+    if (canBatch && (!canTransform || numInstances <= UNIFORM_BATCH_MAX_DRAWS * mBatchSize))
+        return DRAW_UNIFORM_BATCH;
+    if (canTransform)
+        return DRAW_CPU_TRANSFORM;
+    return DRAW_PER_INSTANCE;
+#endif
+}
+
 void RendererES2::draw(unsigned int numInstances) {
-    glUseProgram(mProgram);
+    uint64_t startNs = nowNs();
+
+    // No glInvalidateFramebuffer in ES 2, so depth is stored like color.
+    RenderPass pass(mOutputFramebuffer, mWidth, mHeight);
+    pass.depthStore = STORE_ACTION_STORE;
+    pass.begin(mGLState);
+
+    DrawMode mode = chooseDrawMode(numInstances);
+    unsigned int drawCalls = 0;
+    switch (mode) {
+        case DRAW_UNIFORM_BATCH:
+            drawCalls = drawUniformBatches(numInstances);
+            break;
+        case DRAW_CPU_TRANSFORM:
+            drawCalls = drawCpuTransformed(numInstances);
+            break;
+        default:
+            drawCalls = drawPerInstance(numInstances);
+            break;
+    }
+    pass.end(mGLState);
+
+    mStatsCpuNs += nowNs() - startNs;
+    mStatsDrawCalls += drawCalls;
+    reportStats(mode, numInstances);
+}
 
-    glBindBuffer(GL_ARRAY_BUFFER, mVB);
+unsigned int RendererES2::drawPerInstance(unsigned int numInstances) {
+    mGLState.useProgram(mProgram);
+
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB);
     glVertexAttribPointer(mPosAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, pos));
     glVertexAttribPointer(mColorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, rgba));
     glEnableVertexAttribArray(mPosAttrib);
     glEnableVertexAttribArray(mColorAttrib);
 
     for (unsigned int i = 0; i < numInstances; i++) {
-        glUniformMatrix2fv(mScaleRotUniform, 1, GL_FALSE, mScaleRot + 4*i);
-        glUniform2fv(mOffsetUniform, 1, mOffsets + 2*i);
+        glUniformMatrix2fv(mScaleRotUniform, 1, GL_FALSE, mScaleRot.data() + 4*i);
+        glUniform2fv(mOffsetUniform, 1, mOffsets.data() + 2*i);
         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     }
+    mStatsGlCalls += perInstanceGlCalls(numInstances);
+    return numInstances;
+}
+
+unsigned int RendererES2::drawUniformBatches(unsigned int numInstances) {
+    mGLState.useProgram(mBatchProgram);
+
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mBatchVB);
+    glVertexAttribPointer(mBatchPosAttrib, 2, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (const GLvoid*)offsetof(BatchVertex, pos));
+    glVertexAttribPointer(mBatchColorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BatchVertex), (const GLvoid*)offsetof(BatchVertex, rgba));
+    glVertexAttribPointer(mBatchInstanceAttrib, 1, GL_FLOAT, GL_FALSE, sizeof(BatchVertex), (const GLvoid*)offsetof(BatchVertex, instance));
+    glEnableVertexAttribArray(mBatchPosAttrib);
+    glEnableVertexAttribArray(mBatchColorAttrib);
+    glEnableVertexAttribArray(mBatchInstanceAttrib);
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mQuadIndices);
+
+    unsigned int drawCalls = 0;
+    for (unsigned int first = 0; first < numInstances; first += mBatchSize) {
+        unsigned int count = numInstances - first;
+        if (count > mBatchSize)
+            count = mBatchSize;
+        // mScaleRot is already packed as one column-major mat2 per vec4.
+        glUniform4fv(mBatchScaleRotUniform, count, mScaleRot.data() + 4*first);
+        glUniform2fv(mBatchOffsetUniform, count, mOffsets.data() + 2*first);
+        glDrawElements(GL_TRIANGLES, 6*count, GL_UNSIGNED_SHORT, 0);
+        drawCalls++;
+    }
+
+    // Don't leave the extra attribute enabled for programs that don't feed it.
+    glDisableVertexAttribArray(mBatchInstanceAttrib);
+    mStatsGlCalls += 7 + 3*drawCalls;
+    return drawCalls;
+}
+
+unsigned int RendererES2::drawCpuTransformed(unsigned int numInstances) {
+    if (!mCpuPositions.resize(8 * (size_t)numInstances) || !reserveQuads(numInstances))
+        return 0;
+    transformQuads(mScaleRot.data(), mOffsets.data(), numInstances, mCpuPositions.data());
+
+    mGLState.useProgram(mCpuProgram);
+
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mCpuColorVB);
+    glVertexAttribPointer(mCpuColorAttrib, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0, 0);
+    glEnableVertexAttribArray(mCpuColorAttrib);
+
+    // Respecify the whole store so the driver can orphan the copy still in
+    // use by the previous frame instead of stalling on it. The store only
+    // grows, doubling, so its size stays the same from frame to frame.
+    GLsizeiptr bytes = 8 * (GLsizeiptr)numInstances * sizeof(float);
+    if (bytes > mCpuPosCapacity)
+        mCpuPosCapacity = 2 * mCpuPosCapacity > bytes ? 2 * mCpuPosCapacity : bytes;
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mCpuPosVB);
+    glBufferData(GL_ARRAY_BUFFER, mCpuPosCapacity, NULL, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, mCpuPositions.data());
+    glEnableVertexAttribArray(mCpuPosAttrib);
+
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mQuadIndices);
+    unsigned int drawCalls = 0;
+    for (unsigned int first = 0; first < numInstances; first += QUADS_PER_DRAW) {
+        unsigned int count = numInstances - first;
+        if (count > QUADS_PER_DRAW)
+            count = QUADS_PER_DRAW;
+        glVertexAttribPointer(mCpuPosAttrib, 2, GL_FLOAT, GL_FALSE, 0,
+                (const GLvoid*)(8*sizeof(float) * (size_t)first));
+        glDrawElements(GL_TRIANGLES, 6*count, GL_UNSIGNED_SHORT, 0);
+        drawCalls++;
+    }
+
+    mStatsGlCalls += 5 + 2*drawCalls;
+    return drawCalls;
+}
+
+void RendererES2::reportStats(DrawMode mode, unsigned int numInstances) {
+    static const char* MODE_NAMES[] = {"per-instance", "uniform batch", "CPU transform"};
+
+    if (++mStatsFrames < STATS_INTERVAL)
+        return;
+
+    // mStatsGlCalls and the per-instance reference only count the calls that
+    // bypass the state cache; the ones it issues are reported below.
+    float frames = (float)mStatsFrames;
+    const GLStateCache::Stats& state = mGLState.stats();
+    ALOGV("ES2 %s: %u instances, %.1f draws/frame, %.1f GL calls/frame "
+          "(per-instance path: %u draws, %u calls), %.1f us CPU/frame",
+          MODE_NAMES[mode], numInstances, mStatsDrawCalls / frames, mStatsGlCalls / frames,
+          numInstances, perInstanceGlCalls(numInstances), mStatsCpuNs / frames * 0.001f);
+    ALOGV("state cache: %.1f calls issued, %.1f redundant calls filtered per frame",
+          state.issued / frames, state.filtered / frames);
+    mGLState.resetStats();
+
+    mStatsFrames = 0;
+    mStatsDrawCalls = 0;
+    mStatsGlCalls = 0;
+    mStatsCpuNs = 0;
 }
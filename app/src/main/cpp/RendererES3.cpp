@@ -18,6 +18,8 @@
 #include <EGL/egl.h>
 
 #include <math.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 
 #include "glm/gtc/matrix_transform.hpp" // glm::translate, glm::rotate, glm::scale, glm::perspective
@@ -28,10 +30,24 @@
 #include "glm/matrix.hpp"
 
 #include "Vertices.h"
-
-#include <assimp/Importer.hpp>
-#include <assimp/scene.h>
-#include <assimp/postprocess.h>
+#include "Mesh.h"
+#include "Culling.h"
+#include "GpuCuller.h"
+#include "OcclusionCuller.h"
+#include "RenderQueue.h"
+#include "CommandList.h"
+#include "WorkerPool.h"
+#include "StreamBuffer.h"
+#include "DepthOfField.h"
+#include "DynamicResolution.h"
+#include "OverdrawMeter.h"
+#include "Ibl.h"
+#include "ClusteredLighting.h"
+#include "MatrixMath.h"
+#include "RenderPass.h"
+#include "RenderTargetPool.h"
+#include "ToneMapper.h"
+#include "WeightedBlendedOit.h"
 
 
 
@@ -42,6 +58,59 @@
 #define COLOR_ATTRIB 1
 #define SCALEROT_ATTRIB 2
 #define OFFSET_ATTRIB 3
+#define NORMAL_ATTRIB 4
+#define INSTANCE_POS_ATTRIB 5
+// Light glows, in a VAO of their own.
+#define GLOW_LIGHT_ATTRIB 0
+#define GLOW_COLOR_ATTRIB 1
+
+#define CAMERA_NEAR 0.01f
+#define CAMERA_FAR 10.0f
+
+// The loaded mesh is instanced on a square grid of this many per side,
+// unless setInstanceCount() asks for a number.
+#define MESH_INSTANCES_PER_SIDE 1
+// Frames between two culling stats reports.
+#define CULL_STATS_INTERVAL 300
+// Instances per culling job. Each job culls one submesh over this many
+// instances and becomes one instanced draw.
+#define CULL_CHUNK_INSTANCES 1024
+// Below this many objects waking the workers costs more than culling inline.
+#define PARALLEL_CULL_MIN_OBJECTS 8192
+// With ES 3.1, this many objects or more are culled on the GPU and drawn
+// indirectly. Below it the CPU path is worth more: occlusion culling and
+// the depth pre-pass decision both need visibility on the CPU.
+#define GPU_CULL_MIN_OBJECTS 4096
+// Sorted queue items recorded per command list.
+#define RECORD_CHUNK_ITEMS 64
+// Depth of field CoC scale, see DepthOfField::setFocus(). Focus is on the
+// center of the instance grid.
+#define DOF_APERTURE 20.0f
+// The depth of field scene target is multisampled and resolved before the
+// post passes; 1 turns that off.
+#define SCENE_MSAA_SAMPLES 4
+// GPU time per frame the dynamic resolution aims for, with some headroom
+// under a 60 Hz vsync.
+#define DYNRES_TARGET_MS 14.0f
+// The depth pre-pass is used when the main-shader fragments it saves,
+// weighted by this, outnumber the vertices it adds. A Cook-Torrance
+// fragment looping over its cluster's lights costs far more than a
+// position-only vertex.
+#define DEPTH_PREPASS_FRAGMENT_COST 8.0f
+// Procedural sky used for image-based lighting, equirectangular.
+#define IBL_SKY_WIDTH 256
+#define IBL_SKY_HEIGHT 128
+// Small colored point lights orbiting the mesh, on top of the key light.
+#define ORBIT_LIGHTS 64
+// The key light is the shader's former hard-coded light. Its intensity
+// makes up for the falloff at the mesh.
+#define KEY_LIGHT_POS glm::vec3(1.0f, 0.5f, 2.0f)
+#define KEY_LIGHT_INTENSITY 6.0f
+#define KEY_LIGHT_RADIUS 20.0f
+// Each orbit light has a transparent glow this big, as a fraction of the
+// mesh size, and this opaque at its center.
+#define LIGHT_GLOW_SIZE 0.04f
+#define LIGHT_GLOW_OPACITY 0.6f
 
 static const char VERTEX_SHADER_BAK[] =
     "#version 300 es\n"
@@ -61,33 +130,118 @@ static const char VERTEX_SHADER[] =
         "#version 300 es\n"
         "layout(location = " STRV(POS_ATTRIB) ") in vec3 pos;\n"
         "layout(location=" STRV(COLOR_ATTRIB) ") in vec2 color;\n"
-                   "layout(location = 4) in vec3 normal;\n"
+        "layout(location=" STRV(NORMAL_ATTRIB) ") in vec3 normal;\n"
+        "layout(location=" STRV(INSTANCE_POS_ATTRIB) ") in vec3 instancePos;\n"
         "out vec2 vTexCood;\n"
         "out vec4 v_world_pos;\n"
         "out vec3 v_normal;\n"
         "uniform mat4 mvp_mat;\n"
+        "invariant gl_Position;\n"
         "void main() {\n"
-        "    gl_Position = mvp_mat * vec4(pos, 1.0);\n"
-        "    v_world_pos = vec4(pos, 1.0);\n"
+        "    vec4 world_pos = vec4(pos + instancePos, 1.0);\n"
+        "    gl_Position = mvp_mat * world_pos;\n"
+        "    v_world_pos = world_pos;\n"
         "    v_normal = normal;\n"
         "    vTexCood = color;\n"
         "}\n";
 
+// Depth pre-pass: positions only, from their own 12-byte stream. gl_Position
+// is invariant and computed exactly as in VERTEX_SHADER, so the main pass
+// can test against it with GL_LEQUAL.
+static const char DEPTH_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "layout(location = " STRV(POS_ATTRIB) ") in vec3 pos;\n"
+        "layout(location=" STRV(INSTANCE_POS_ATTRIB) ") in vec3 instancePos;\n"
+        "uniform mat4 mvp_mat;\n"
+        "invariant gl_Position;\n"
+        "void main() {\n"
+        "    vec4 world_pos = vec4(pos + instancePos, 1.0);\n"
+        "    gl_Position = mvp_mat * world_pos;\n"
+        "}\n";
+
+static const char DEPTH_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "void main() {\n"
+        "}\n";
+
+// Light glows: a camera-facing quad per orbit light, with its corners from
+// gl_VertexID and the light's position and glow size in glowLight.
+static const char GLOW_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "layout(location = " STRV(GLOW_LIGHT_ATTRIB) ") in vec4 glowLight;\n"
+        "layout(location = " STRV(GLOW_COLOR_ATTRIB) ") in vec3 glowColor;\n"
+        "uniform mat4 view_mat;\n"
+        "uniform mat4 projection_mat;\n"
+        "out vec2 vCorner;\n"
+        "out vec3 vColor;\n"
+        "out float vDepth;\n"
+        "void main() {\n"
+        "    vCorner = vec2(float((gl_VertexID & 1) << 1), float(gl_VertexID & 2)) - 1.0;\n"
+        "    vec4 view_pos = view_mat * vec4(glowLight.xyz, 1.0);\n"
+        "    view_pos.xy += vCorner * glowLight.w;\n"
+        "    vColor = glowColor;\n"
+        "    vDepth = -view_pos.z / " STRV(CAMERA_FAR) ";\n"
+        "    gl_Position = projection_mat * view_pos;\n"
+        "}\n";
+
+// Both glow fragment shaders: a round spot fading out to its edge.
+#define GLOW_FRAGMENT_SHAPE \
+        "in vec2 vCorner;\n" \
+        "in vec3 vColor;\n" \
+        "in float vDepth;\n" \
+        "vec4 glow() {\n" \
+        "    float r2 = dot(vCorner, vCorner);\n" \
+        "    if (r2 >= 1.0)\n" \
+        "        discard;\n" \
+        "    float falloff = 1.0 - r2;\n" \
+        "    return vec4(vColor, " STRV(LIGHT_GLOW_OPACITY) " * falloff * falloff);\n" \
+        "}\n"
+
+// Blended straight into the scene, for when order-independent
+// transparency is unavailable.
+static const char GLOW_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        GLOW_FRAGMENT_SHAPE
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    outColor = glow();\n"
+        "}\n";
+
+static const char GLOW_OIT_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        GLOW_FRAGMENT_SHAPE
+        WBOIT_FRAGMENT_OUTPUTS
+        "void main() {\n"
+        "    writeTransparent(glow(), vDepth);\n"
+        "}\n";
+
 
 static const char FRAGMENT_SHADER[] =
         "#version 300 es\n"
         "precision mediump float;\n"
+        "precision highp int;\n"
         "in vec2 vTexCood;\n"
         "in vec4 v_world_pos;\n"
         "in vec3 v_normal;\n"
         "out vec4 outColor;\n"
         "uniform sampler2D texture0;\n"
+        "uniform sampler2D brdfLut;\n"
+        "uniform samplerCube prefilteredEnv;\n"
+        "uniform vec3 shIrradiance[" STRV(IBL_SH_COEFFS) "];\n"
+        "uniform float prefilteredMaxLod;\n"
+        "uniform vec3 eyePos;\n"
+        // Clustered point lights, see ClusteredLighting.h.
+        "uniform highp sampler2D lightData;\n"
+        "uniform highp usampler2D clusterGrid;\n"
+        "uniform highp usampler2D lightIndices;\n"
+        "uniform highp vec4 clusterParams;\n"
+        "uniform highp vec2 depthRange;\n"
+        "uniform bool clusteredLights;\n"
         ""
         "#define PI 3.14159265\n"
         ""
-        "vec3 eye_pos = vec3(0.0, 0.0, 1.0);\n"
-        "vec3 light = vec3(1.0, 1.0, 1.0);\n"
-        "vec3 light_pos = vec3(1.0, 0.5, 2.0);\n"
         "float alpha = 0.3;\n"
         "vec3 f0 = vec3(0.56, 0.57, 0.58);\n"
         ""
@@ -97,20 +251,30 @@ static const char FRAGMENT_SHADER[] =
         "   }\n"
         ""
         "vec3 fresnel(float hdotv, vec3 f0) {\n"
-        "   return f0 + (1.0 - f0) * pow((1.0 - hdotv), 1.0);\n"
+        "   return f0 + (1.0 - f0) * pow(clamp(1.0 - hdotv, 0.0, 1.0), 5.0);\n"
         "   }\n"
         ""
+        // Irradiance from the SH coefficients, already divided by pi.
+        "vec3 irradiance(vec3 n) {\n"
+        "   return shIrradiance[0] * 0.282095\n"
+        "        + shIrradiance[1] * 0.488603 * n.y\n"
+        "        + shIrradiance[2] * 0.488603 * n.z\n"
+        "        + shIrradiance[3] * 0.488603 * n.x\n"
+        "        + shIrradiance[4] * 1.092548 * n.x * n.y\n"
+        "        + shIrradiance[5] * 1.092548 * n.y * n.z\n"
+        "        + shIrradiance[6] * 0.315392 * (3.0 * n.z * n.z - 1.0)\n"
+        "        + shIrradiance[7] * 1.092548 * n.x * n.z\n"
+        "        + shIrradiance[8] * 0.546274 * (n.x * n.x - n.y * n.y);\n"
+        "   }\n"
         ""
-        "void main() {\n"
-        "   vec3 albedo = texture(texture0, vTexCood).rgb;\n"
-        "   vec3 ambient = albedo * vec3(0.1);\n"
-        ""
-        "    vec3 n = normalize(v_normal);\n"
-        ""
-        //        " if (!gl_FrontFacing)   n = -n;\n"
+        // Windowed inverse square, zero at the light's radius.
+        "float attenuation(float d, float radius) {\n"
+        "   float x = d / radius;\n"
+        "   float window = clamp(1.0 - x * x * x * x, 0.0, 1.0);\n"
+        "   return window * window / (d * d + 1.0);\n"
+        "   }\n"
         ""
-        "    vec3 l = normalize(light_pos - v_world_pos.xyz);\n"
-        "    vec3 v = normalize(eye_pos - v_world_pos.xyz);\n"
+        "vec3 direct_light(vec3 n, vec3 v, vec3 l, vec3 albedo, vec3 light) {\n"
         "    vec3 h = normalize(l + v);\n"
         "    float n_dot_h = dot(n , h);\n"
         ""
@@ -129,7 +293,54 @@ static const char FRAGMENT_SHADER[] =
         "    denominator = max(denominator, 0.001);\n"
         "    vec3 func_kc =  D * G * F / denominator;\n"
         "    vec3 brdf = (1.0 - func_kc) * albedo / PI + func_kc;\n"
-        "    vec3 final_color = brdf * light * max(dot(n, l), 0.0) + ambient;\n"
+        "    return brdf * light * max(dot(n, l), 0.0);\n"
+        "   }\n"
+        ""
+        "uvec2 find_cluster() {\n"
+        "    highp float ndc_z = 2.0 * gl_FragCoord.z - 1.0;\n"
+        "    highp float depth = 2.0 * depthRange.x * depthRange.y /\n"
+        "            (depthRange.y + depthRange.x - ndc_z * (depthRange.y - depthRange.x));\n"
+        "    ivec3 cluster = ivec3(gl_FragCoord.xy / clusterParams.xy,\n"
+        "            log(depth) * clusterParams.z + clusterParams.w);\n"
+        "    cluster = clamp(cluster, ivec3(0),\n"
+        "            ivec3(" STRV(CLUSTER_TILES_X) " - 1, " STRV(CLUSTER_TILES_Y) " - 1, " STRV(CLUSTER_SLICES) " - 1));\n"
+        "    return texelFetch(clusterGrid,\n"
+        "            ivec2(cluster.x + cluster.y * " STRV(CLUSTER_TILES_X) ", cluster.z), 0).rg;\n"
+        "   }\n"
+        ""
+        ""
+        "void main() {\n"
+        "   vec3 albedo = texture(texture0, vTexCood).rgb;\n"
+        ""
+        "    vec3 n = normalize(v_normal);\n"
+        ""
+        //        " if (!gl_FrontFacing)   n = -n;\n"
+        ""
+        "    vec3 v = normalize(eyePos - v_world_pos.xyz);\n"
+        "    vec3 direct = vec3(0.0);\n"
+        "    uvec2 cluster = clusteredLights ? find_cluster() : uvec2(0u);\n"
+        "    for (uint i = cluster.x; i < cluster.x + cluster.y; i++) {\n"
+        "        int light = int(texelFetch(lightIndices,\n"
+        "                ivec2(i % " STRV(CLUSTER_INDEX_WIDTH) "u, i / " STRV(CLUSTER_INDEX_WIDTH) "u), 0).r);\n"
+        "        vec4 pos_radius = texelFetch(lightData, ivec2(light, 0), 0);\n"
+        "        vec3 to_light = pos_radius.xyz - v_world_pos.xyz;\n"
+        "        float d = length(to_light);\n"
+        // Froxels are conservative; past the radius x^4 below would
+        // overflow mediump.
+        "        if (d >= pos_radius.w) continue;\n"
+        "        vec3 radiance = texelFetch(lightData, ivec2(light, 1), 0).rgb *\n"
+        "                attenuation(d, pos_radius.w);\n"
+        "        direct += direct_light(n, v, to_light / max(d, 0.0001), albedo, radiance);\n"
+        "    }\n"
+        ""
+        // Split-sum image-based ambient.
+        "    float n_dot_v = max(dot(n, v), 0.0);\n"
+        "    vec2 env_brdf = texture(brdfLut, vec2(n_dot_v, sqrt(alpha))).rg;\n"
+        "    vec3 specular_ibl = textureLod(prefilteredEnv, reflect(-v, n),\n"
+        "            sqrt(alpha) * prefilteredMaxLod).rgb * (f0 * env_brdf.x + env_brdf.y);\n"
+        "    vec3 kd = 1.0 - fresnel(n_dot_v, f0);\n"
+        "    vec3 ambient = kd * albedo * max(irradiance(n), 0.0) + specular_ibl;\n"
+        "    vec3 final_color = direct + ambient;\n"
         "    outColor = vec4(final_color, 1.0);\n"
 
         "}\n";
@@ -147,56 +358,6 @@ static const char FRAGMENT_PBR_SHADER[] =
         "}\n";
 
 
-static const char FRAGMENT_SHADER_DOF[] =
-        "#version 300 es\n"
-                "precision mediump float;\n"
-                "out vec4 outColor;\n"
-                "in vec2 vTexCood;\n"
-                "uniform sampler2D texture0;\n"
-                "uniform sampler2D texture1;\n"
-                ""
-                "vec4 uniformDistribution(float c, sampler2D texture_orig, vec2 tex_c) {\n"
-                "    if (c < 0.0000001) { return texture(texture_orig, tex_c); }\n"
-                "    float r = c / 2.0f;\n"
-                "    float a = 4.0 * r * r;\n"
-                "    vec4 dis_color;\n"
-                "    float step = 1.0f / 1280.0f;\n"
-                "    //vec4 intensity = texture(texture_orig, tex_c) / a;\n"
-                "    for (float row = -step * r; row <= step * r; row += step) {\n"
-                "        for (float col = -step * r; col <= step * r; col += step) {\n"
-                "            dis_color += texture(texture_orig, vec2(tex_c.x + row, tex_c.y + col));\n"
-                "        }\n"
-                "    }\n"
-                "    dis_color /= a;\n"
-                "    return dis_color;\n"
-                "}\n"
-                ""
-                ""
-                "void main() {\n"
-                "//outColor = texture(texture0, vTexCood);\n"
-                "float depth = texture(texture1, vTexCood).r;\n"
-                "float real_z = (0.1 * 100.0) / (100.0 - depth * (100.0 - 0.1));\n"
-                ""
-                "float c = 2.0 * abs(5.0 * (10.0 - 1.0 / real_z) - 1.0);\n"
-                "c = c > 18.0f ? 18.0f : c;\n"
-                "    float r = c / 2.0f;\n"
-                "    float even_r = roundEven(r);\n"
-                ""
-                "    vec4 dis_color = vec4(0, 0, 0, 1.0);\n"
-                "    float step = 1.0f / 1280.0f;\n"
-                "    float index = 0.0;\n"
-                "    for (float row = -even_r; row <= even_r; row += 2.0) {\n"
-                "        for (float col = -even_r; col <= even_r; col += 2.0) {\n"
-                "dis_color += texture(texture0, vec2(vTexCood.x + col * step, vTexCood.y + row * step));\n"
-                "index++;\n"
-                "        }\n"
-                "    }\n"
-                "    dis_color /= index;\n"
-                "    outColor = dis_color;\n"                ""
-                ""
-                ""
-                "}\n";
-
 /*static const float TEX_COORD[] = {
         0, 1,
         1, 1,
@@ -218,22 +379,11 @@ static const float TEX_COORD[] = {
 };
 
 
-struct Vertex2 {
-    glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec2 TexCoords;
-};
-
-
-std::vector<Vertex2> g_vertex_data;
-std::vector<unsigned int> g_indices_data;
-
-
 class RendererES3: public Renderer {
 public:
     RendererES3();
     virtual ~RendererES3();
-    bool init();
+    bool init(const Mesh* mesh);
 
     void set2DTexture(uint32_t *data, int width, int height) override;
 
@@ -241,24 +391,147 @@ public:
 
     void resize(int w, int h) override;
 
-private:
-    enum {VB_INSTANCE, VB_SCALEROT, VB_OFFSET, VB_COUNT};
+    void setFixedClock(uint64_t frameNs) override;
+
+    // About count copies of the mesh, on a square grid, right away. With
+    // enough of them the culling goes to the worker pool, or to the GPU on
+    // ES 3.1.
+    void setInstanceCount(unsigned int count) override;
 
-    virtual float* mapOffsetBuf();
-    virtual void unmapOffsetBuf();
-    virtual float* mapTransformBuf();
-    virtual void unmapTransformBuf();
+    void setOcclusionAbTest(bool enabled) override;
+
+private:
+    // Per-frame data (visible instance positions, light glows) is streamed
+    // through mStream instead of dedicated buffers.
+    enum {VB_INSTANCE, VB_POSITION, VB_COUNT};
+
+    // Instances of one submesh that survived culling, stored contiguously in
+    // this frame's visible-instance allocation starting at firstInstance.
+    struct DrawBatch {
+        unsigned int subMesh;
+        unsigned int firstInstance;
+        unsigned int instanceCount;
+        float depth;    // nearest instance, normalized view depth
+    };
+
+    // The mesh instances are laid out by layoutMeshInstances() instead of
+    // the quad grid, so these are never called.
+    virtual float* mapOffsetBuf(unsigned int) { return NULL; }
+    virtual void unmapOffsetBuf() {}
+    virtual float* mapTransformBuf(unsigned int) { return NULL; }
+    virtual void unmapTransformBuf() {}
+    virtual bool usesInstanceGrid() const { return false; }
     virtual void draw(unsigned int numInstances);
 
+    bool reserveStream();
+    void layoutMeshInstances();
+    void cullMeshInstances();
+    void cullChunk(unsigned int chunk, float* dst);
+    void recordCommands();
+    void updateLights(uint64_t timeNs);
+    void setSceneSize(int w, int h);
+    void measureOverdraw();
+    void drawGlows(bool oit);
+    void reportFrameStats();
+
     const EGLContext mEglContext;
     GLuint mProgram;
     GLuint mVB[VB_COUNT];
+    GLuint mEBO;
     GLuint mVBState;
+    // Depth pre-pass: program and VAO over VB_POSITION.
+    GLuint mDepthProgram;
+    GLuint mDepthVBState;
+    // Light glows, blended directly or through mOit.
+    GLuint mGlowProgram;
+    GLuint mGlowOitProgram;
+    GLuint mGlowVBState;
+    std::vector<unsigned int> mGlowOrder;
+    std::vector<float> mGlowDepth;
+    GLuint mAlbedoTexture;
+    GLuint mDepthTexture;
+
+    // Offscreen targets of the post passes, acquired per frame.
+    RenderTargetPool mTargetPool;
+    DepthOfField mDof;
+    bool mDofEnabled;
+    DynamicResolution mDynRes;
+    bool mDynResEnabled;
+    WeightedBlendedOit mOit;
+    bool mOitEnabled;
+    // HDR scene color, tonemapped by whichever pass writes the output.
+    ToneMapper mToneMapper;
+    bool mHdrEnabled;
+    OverdrawMeter mOverdraw;
+    OverdrawMeter::Result mOverdrawResult;
+    bool mOverdrawDue;
+    bool mDepthPrepass;
+    // Size the scene is rendered at, the surface size scaled.
+    int mSceneWidth;
+    int mSceneHeight;
+    ImageBasedLighting mIbl;
+    ClusteredLighting mClusters;
+    // Without it the scene has no point lights, only ambient.
+    bool mClustersEnabled;
+    std::vector<PointLight> mLights;
+    StreamBuffer mStream;
+    GLintptr mVisibleOffset;    // this frame's visible-instance allocation
+
+    Mesh mMesh;
+    glm::aligned_mat4 mView;
+    glm::aligned_mat4 mProjection;
+    Frustum mFrustum;
+    // Objects are (submesh, instance) pairs: subMesh * mNumMeshInstances + instance.
+    OcclusionCuller mOcclusion;
+    bool mOcclusionEnabled;
+    // With mOcclusionAbTest, the average frame time of the last stats
+    // interval with occlusion culling off and on, 0 until measured.
+    bool mOcclusionAbTest;
+    float mOcclusionAbMs[2];
+    // Replaces the CPU culling when mGpuCulling; mBatches stay empty then.
+    GpuCuller mGpuCuller;
+    bool mGpuCulling;
+    // SoA world positions of the mesh instances, padded to a multiple of 4.
+    std::vector<float> mInstanceX;
+    std::vector<float> mInstanceY;
+    std::vector<float> mInstanceZ;
+    unsigned int mMeshInstanceTarget;   // 0 for MESH_INSTANCES_PER_SIDE^2
+    unsigned int mNumMeshInstances;
+    unsigned int mCullChunksPerSubMesh;
+    // Per-object scratch for the culling jobs, indexed like the objects.
+    std::vector<unsigned int> mVisible;
+    // One per culling job, instanceCount 0 if nothing survived.
+    std::vector<DrawBatch> mBatches;
+    RenderQueue mQueue;
+    // Recorded in parallel from disjoint ranges of the sorted queue,
+    // replayed in order on the GL thread.
+    std::vector<CommandList> mCommandLists;
+    unsigned int mNumCommandLists;
+
+    unsigned int mCullFrames;
+    uint64_t mCullTested;
+    uint64_t mCullVisible;
+    uint64_t mCullIndicesDrawn;
+    uint64_t mCullIndicesTotal;
+    uint64_t mCullNs;
+    uint64_t mOcclusionQueries;
+    uint64_t mOcclusionCulled;
+    uint64_t mLastDrawNs;
+    uint64_t mFrameNs;
+    uint64_t mQueueDraws;
+    uint64_t mProgramSwitches;
+    uint64_t mTextureSwitches;
+    uint64_t mVaoSwitches;
+    uint64_t mCommands;
+    uint64_t mCommandBytes;
+    uint64_t mCommandListsRecorded;
+    uint64_t mRecordNs;
+    uint64_t mReplayNs;
 };
 
-Renderer* createES3Renderer() {
+Renderer* createES3Renderer(const Mesh* mesh) {
     RendererES3* renderer = new RendererES3;
-    if (!renderer->init()) {
+    if (!renderer->init(mesh)) {
         delete renderer;
         return NULL;
     }
@@ -268,85 +541,175 @@ Renderer* createES3Renderer() {
 RendererES3::RendererES3()
 :   mEglContext(eglGetCurrentContext()),
     mProgram(0),
-    mVBState(0)
+    mEBO(0),
+    mVBState(0),
+    mDepthProgram(0),
+    mDepthVBState(0),
+    mGlowProgram(0),
+    mGlowOitProgram(0),
+    mGlowVBState(0),
+    mAlbedoTexture(0),
+    mDepthTexture(0),
+    mDofEnabled(false),
+    mDynResEnabled(false),
+    mOitEnabled(false),
+    mHdrEnabled(false),
+    mOverdrawDue(false),
+    mDepthPrepass(false),
+    mSceneWidth(0),
+    mSceneHeight(0),
+    mClustersEnabled(false),
+    mVisibleOffset(0),
+    mView(1.0f),
+    mProjection(1.0f),
+    mOcclusionEnabled(false),
+    mOcclusionAbTest(false),
+    mGpuCulling(false),
+    mMeshInstanceTarget(0),
+    mNumMeshInstances(0),
+    mCullChunksPerSubMesh(0),
+    mNumCommandLists(0),
+    mCullFrames(0),
+    mCullTested(0),
+    mCullVisible(0),
+    mCullIndicesDrawn(0),
+    mCullIndicesTotal(0),
+    mCullNs(0),
+    mOcclusionQueries(0),
+    mOcclusionCulled(0),
+    mLastDrawNs(0),
+    mFrameNs(0),
+    mQueueDraws(0),
+    mProgramSwitches(0),
+    mTextureSwitches(0),
+    mVaoSwitches(0),
+    mCommands(0),
+    mCommandBytes(0),
+    mCommandListsRecorded(0),
+    mRecordNs(0),
+    mReplayNs(0)
 {
     for (int i = 0; i < VB_COUNT; i++)
         mVB[i] = 0;
+    memset(&mOverdrawResult, 0, sizeof(mOverdrawResult));
+    memset(mOcclusionAbMs, 0, sizeof(mOcclusionAbMs));
+    // Accept everything until resize() sets up the camera.
+    for (int i = 0; i < 6; i++)
+        mFrustum.planes[i] = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
 }
 
-void LoadMesh(const char *path) {
-    Assimp::Importer importer;
-    const aiScene *scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
-
-    if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE || !scene->mRootNode) {
-        ALOGE("ERROR::ASSIMP:: %s", importer.GetErrorString());
-        return;
-    }
-    ALOGV("ASSIMP::Success ");
-    aiMesh *mesh = scene->mMeshes[0];
-
-
-    for (int i = 0; i < mesh->mNumVertices; ++i) {
-        Vertex2 vertex2;
-        vertex2.Position.x = mesh->mVertices[i].x;
-        vertex2.Position.y = mesh->mVertices[i].y;
-        vertex2.Position.z = mesh->mVertices[i].z;
-
-        vertex2.Normal.x = mesh->mNormals[i].x;
-        vertex2.Normal.y = mesh->mNormals[i].y;
-        vertex2.Normal.z = mesh->mNormals[i].z;
-
-        vertex2.TexCoords.x = mesh->mTextureCoords[0][i].x;
-        vertex2.TexCoords.y = mesh->mTextureCoords[0][i].y;
-
-        g_vertex_data.push_back(vertex2);
-    }
-
-
-
-    for (int i = 0; i < mesh->mNumFaces; ++i) {
-        for (int j = 0; j < mesh->mFaces[i].mNumIndices; ++j) {
-            g_indices_data.push_back(mesh->mFaces[i].mIndices[j]);
+// Centers a square grid of copies of the mesh on the XZ plane, spaced so
+// neighbouring bounding boxes don't touch.
+void RendererES3::layoutMeshInstances() {
+    int side = MESH_INSTANCES_PER_SIDE;
+    if (mMeshInstanceTarget)
+        side = std::max(1, (int)(sqrtf((float)mMeshInstanceTarget) + 0.5f));
+    glm::vec3 extent = mMesh.bounds.max - mMesh.bounds.min;
+    float spacing = 1.5f * fmaxf(extent.x, extent.z);
+
+    mNumMeshInstances = side * side;
+    unsigned int padded = (mNumMeshInstances + 3) & ~3u;
+    mInstanceX.assign(padded, 0.0f);
+    mInstanceY.assign(padded, 0.0f);
+    mInstanceZ.assign(padded, 0.0f);
+    for (int i = 0; i < side; i++) {
+        for (int j = 0; j < side; j++) {
+            mInstanceX[i*side + j] = spacing * (i - 0.5f * (side - 1));
+            mInstanceZ[i*side + j] = spacing * (j - 0.5f * (side - 1));
         }
     }
+    const unsigned int numSubMeshes = (unsigned int)mMesh.subMeshes.size();
+    mCullChunksPerSubMesh = (mNumMeshInstances + CULL_CHUNK_INSTANCES - 1) / CULL_CHUNK_INSTANCES;
+    mVisible.resize(mNumMeshInstances * numSubMeshes);
+    // Batches culled for the old layout must not be drawn.
+    mBatches.assign(mCullChunksPerSubMesh * numSubMeshes, DrawBatch());
+    mOcclusion.setObjectCount(mNumMeshInstances * numSubMeshes);
+    mOcclusion.setRequestSlots(mCullChunksPerSubMesh * numSubMeshes);
+
+    mGpuCulling = mGpuCuller.isInitialized() &&
+            mNumMeshInstances * numSubMeshes >= GPU_CULL_MIN_OBJECTS;
+    if (mGpuCulling)
+        mGpuCuller.setObjects(&mInstanceX[0], &mInstanceY[0], &mInstanceZ[0],
+                mNumMeshInstances, mMesh.subMeshes, mGLState);
 }
 
-
-bool RendererES3::init() {
+bool RendererES3::init(const Mesh* mesh) {
     const char *path = "/data/local/tmp/chair/chair.FBX";
 
-    LoadMesh(path);
+    if (mesh)
+        mMesh = *mesh;
+    else if (!LoadMesh(path, &mMesh))
+        return false;
+    mOcclusionEnabled = mOcclusion.init();
+    if (!mOcclusionEnabled)
+        ALOGE("Occlusion culling unavailable");
+    if (!mGpuCuller.init())
+        ALOGV("GPU culling needs ES 3.1, culling on the CPU");
+    mHdrEnabled = mToneMapper.init(mGLState);
+    if (!mHdrEnabled)
+        ALOGE("No float color targets, rendering the scene in RGBA8");
+    mDofEnabled = mDof.init(mToneMapper.sceneFormat());
+    if (!mDofEnabled)
+        ALOGE("Depth of field unavailable");
+    mDynResEnabled = mDynRes.init(DYNRES_TARGET_MS);
+    if (!mDynResEnabled)
+        ALOGE("Dynamic resolution unavailable");
+    mOitEnabled = mOit.init();
+    if (!mOitEnabled)
+        ALOGE("Order-independent transparency unavailable, sorting transparent draws");
+    Environment sky;
+    makeSkyEnvironment(IBL_SKY_WIDTH, IBL_SKY_HEIGHT, &sky);
+    if (!mIbl.init(sky, mGLState)) {
+        ALOGE("Image-based lighting unavailable, rendering without ambient light");
+        mIbl.destroy();
+    }
+    mClustersEnabled = mClusters.init(mGLState);
+    if (!mClustersEnabled) {
+        ALOGE("Clustered lighting unavailable, rendering without point lights");
+        mClusters.destroy();
+    }
+
+    // Nothing is known about a freshly (re)created context, and the setup
+    // above binds objects behind the cache's back.
+    mGLState.invalidate();
+    layoutMeshInstances();
 
     mProgram = createProgram(VERTEX_SHADER, FRAGMENT_SHADER);
     if (!mProgram)
         return false;
+    mDepthProgram = createProgram(DEPTH_VERTEX_SHADER, DEPTH_FRAGMENT_SHADER);
+    if (!mDepthProgram || !mOverdraw.init(DEPTH_VERTEX_SHADER))
+        ALOGE("Depth pre-pass unavailable");
+    mGlowProgram = createProgram(GLOW_VERTEX_SHADER, GLOW_FRAGMENT_SHADER);
+    if (!mGlowProgram)
+        return false;
+    if (mOitEnabled) {
+        mGlowOitProgram = createProgram(GLOW_VERTEX_SHADER, GLOW_OIT_FRAGMENT_SHADER);
+        if (!mGlowOitProgram)
+            return false;
+    }
+    mOverdrawDue = true;
 
-/*    glGenBuffers(VB_COUNT, mVB);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(QUAD), &QUAD[0], GL_STATIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_SCALEROT]);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * 4*sizeof(float), NULL, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_OFFSET]);
-    glBufferData(GL_ARRAY_BUFFER, MAX_INSTANCES * 2*sizeof(float), NULL, GL_STATIC_DRAW);*/
-
-    glGenBuffers(1, mVB);
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
-    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(g_vertex_data.size() * sizeof(Vertex2)),
-                 &g_vertex_data[0], GL_STATIC_DRAW);
+    glGenBuffers(VB_COUNT, mVB);
+    if (!reserveStream())
+        return false;
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(mMesh.vertices.size() * sizeof(Vertex2)),
+                 &mMesh.vertices[0], GL_STATIC_DRAW);
 
     glGenVertexArrays(1, &mVBState);
-    glBindVertexArray(mVBState);
+    mGLState.bindVertexArray(mVBState);
 
     // Position
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB[VB_INSTANCE]);
 //    glVertexAttribPointer(POS_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (const GLvoid*)offsetof(Vertex, pos));
     glVertexAttribPointer(POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2), (const GLvoid *) 0);
     glEnableVertexAttribArray(POS_ATTRIB);
 
     // Normal
-    glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
+    glVertexAttribPointer(NORMAL_ATTRIB, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
                           (const GLvoid *) (offsetof(Vertex2, Normal)));
-    glEnableVertexAttribArray(4);
+    glEnableVertexAttribArray(NORMAL_ATTRIB);
 
     // Texture Coordinates
     glVertexAttribPointer(COLOR_ATTRIB, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex2),
@@ -354,6 +717,29 @@ bool RendererES3::init() {
     glEnableVertexAttribArray(COLOR_ATTRIB);
 
 
+    // Per-instance position, re-pointed for every draw batch
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mStream.buffer());
+    glVertexAttribPointer(INSTANCE_POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) 0);
+    glVertexAttribDivisor(INSTANCE_POS_ATTRIB, 1);
+    glEnableVertexAttribArray(INSTANCE_POS_ATTRIB);
+
+    // The pre-pass only needs positions, de-interleaved so it fetches 12
+    // bytes per vertex instead of sizeof(Vertex2).
+    std::vector<float> positions(3 * mMesh.vertices.size());
+    for (size_t i = 0; i < mMesh.vertices.size(); i++)
+        memcpy(&positions[3 * i], &mMesh.vertices[i].Position, 3*sizeof(float));
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mVB[VB_POSITION]);
+    glBufferData(GL_ARRAY_BUFFER, static_cast<GLsizeiptr>(positions.size() * sizeof(float)),
+                 &positions[0], GL_STATIC_DRAW);
+    glGenVertexArrays(1, &mDepthVBState);
+    mGLState.bindVertexArray(mDepthVBState);
+    glVertexAttribPointer(POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, 3*sizeof(float), (const GLvoid *) 0);
+    glEnableVertexAttribArray(POS_ATTRIB);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mStream.buffer());
+    glVertexAttribPointer(INSTANCE_POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0, (const GLvoid *) 0);
+    glVertexAttribDivisor(INSTANCE_POS_ATTRIB, 1);
+    glEnableVertexAttribArray(INSTANCE_POS_ATTRIB);
+
 //    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     // End of vertice data
@@ -361,19 +747,48 @@ bool RendererES3::init() {
     checkGlError("Init()--001");
 
     // Element buffer objects
-    GLuint ebo;
-    glGenBuffers(1, &ebo);
+    glGenBuffers(1, &mEBO);
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 static_cast<GLsizeiptr>(g_indices_data.size() * sizeof(unsigned int)),
-                 &g_indices_data[0],
+                 static_cast<GLsizeiptr>(mMesh.indices.size() * sizeof(unsigned int)),
+                 &mMesh.indices[0],
                  GL_STATIC_DRAW);
-
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    glEnable(GL_DEPTH_TEST);
+    // The element buffer binding belongs to the VAO: the one above went to
+    // mDepthVBState, the main VAO needs it too.
+    mGLState.bindVertexArray(mVBState);
+    mGLState.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, mEBO);
+
+    // Glows are all per instance, re-pointed every frame.
+    glGenVertexArrays(1, &mGlowVBState);
+    mGLState.bindVertexArray(mGlowVBState);
+    glVertexAttribDivisor(GLOW_LIGHT_ATTRIB, 1);
+    glEnableVertexAttribArray(GLOW_LIGHT_ATTRIB);
+    glVertexAttribDivisor(GLOW_COLOR_ATTRIB, 1);
+    glEnableVertexAttribArray(GLOW_COLOR_ATTRIB);
+
+    // Blending is only on for the transparent draws, which set it up.
+    mGLState.setEnabled(GL_BLEND, false);
+    mGLState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+
+    mGLState.setEnabled(GL_DEPTH_TEST, true);
+
+    // Samplers never change: albedo on unit 0, depth on unit 1, the IBL
+    // LUT and prefiltered environment on units 2 and 3.
+    mGLState.useProgram(mProgram);
+    glUniform1i(glGetUniformLocation(mProgram, "texture0"), 0);
+    glUniform1i(glGetUniformLocation(mProgram, "texture1"), 1);
+    glUniform1i(glGetUniformLocation(mProgram, "brdfLut"), 2);
+    glUniform1i(glGetUniformLocation(mProgram, "prefilteredEnv"), 3);
+    glUniform3fv(glGetUniformLocation(mProgram, "shIrradiance"), IBL_SH_COEFFS,
+            mIbl.shIrradiance());
+    glUniform1f(glGetUniformLocation(mProgram, "prefilteredMaxLod"), mIbl.prefilteredMaxLod());
+    // Clustered lights on units 4 to 6.
+    glUniform1i(glGetUniformLocation(mProgram, "lightData"), 4);
+    glUniform1i(glGetUniformLocation(mProgram, "clusterGrid"), 5);
+    glUniform1i(glGetUniformLocation(mProgram, "lightIndices"), 6);
+    glUniform2f(glGetUniformLocation(mProgram, "depthRange"), CAMERA_NEAR, CAMERA_FAR);
+    glUniform1i(glGetUniformLocation(mProgram, "clusteredLights"), mClustersEnabled);
 
     ALOGV("Using OpenGL ES 3.0 renderer");
 
@@ -390,52 +805,506 @@ RendererES3::~RendererES3() {
      */
     if (eglGetCurrentContext() != mEglContext)
         return;
+    mOcclusion.destroy();
+    mGpuCuller.destroy();
+    mDof.destroy();
+    mDynRes.destroy();
+    mOverdraw.destroy();
+    mOit.destroy();
+    mToneMapper.destroy(mGLState);
+    glDeleteProgram(mDepthProgram);
+    glDeleteVertexArrays(1, &mDepthVBState);
+    glDeleteProgram(mGlowProgram);
+    glDeleteProgram(mGlowOitProgram);
+    glDeleteVertexArrays(1, &mGlowVBState);
+    mTargetPool.destroy(mGLState);
+    mIbl.destroy();
+    mClusters.destroy();
+    mStream.destroy();
     glDeleteVertexArrays(1, &mVBState);
     glDeleteBuffers(VB_COUNT, mVB);
+    glDeleteBuffers(1, &mEBO);
+    glDeleteTextures(1, &mAlbedoTexture);
+    glDeleteTextures(1, &mDepthTexture);
     glDeleteProgram(mProgram);
 }
 
-float* RendererES3::mapOffsetBuf() {
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_OFFSET]);
-    return (float*)glMapBufferRange(GL_ARRAY_BUFFER,
-            0, MAX_INSTANCES * 2*sizeof(float),
-            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+// Room for STREAM_FRAMES_IN_FLIGHT frames of visible instances and light
+// glows, plus alignment slack. A ring that is too small is replaced by one
+// at least twice its size; draws already issued keep the old buffer alive
+// until they complete.
+bool RendererES3::reserveStream() {
+    GLsizeiptr frameBytes = mNumMeshInstances * mMesh.subMeshes.size() * 3*sizeof(float) +
+            ORBIT_LIGHTS * 8*sizeof(float) + 1024;
+    GLsizeiptr capacity = STREAM_FRAMES_IN_FLIGHT * frameBytes;
+    if (capacity <= mStream.capacity())
+        return true;
+    if (mStream.isInitialized()) {
+        if (2 * mStream.capacity() > capacity)
+            capacity = 2 * mStream.capacity();
+        mGLState.forgetBuffer(mStream.buffer());
+        mStream.destroy();
+    }
+    return mStream.init(capacity, mGLState);
 }
 
-void RendererES3::unmapOffsetBuf() {
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+// Culls every (submesh, instance) pair against the camera frustum and the
+// occlusion results from earlier frames, and packs the positions of the
+// visible ones into a stream allocation, one contiguous run per chunk.
+// Every chunk owns the slices of the visible-instance allocation, mVisible
+// and the occlusion objects that start at its first object, so chunks run
+// independently.
+void RendererES3::cullChunk(unsigned int chunk, float* dst) {
+    const unsigned int s = chunk / mCullChunksPerSubMesh;
+    const unsigned int begin = (chunk % mCullChunksPerSubMesh) * CULL_CHUNK_INSTANCES;
+    const unsigned int end = begin + CULL_CHUNK_INSTANCES < mNumMeshInstances ?
+            begin + CULL_CHUNK_INSTANCES : mNumMeshInstances;
+    const unsigned int firstObject = s * mNumMeshInstances + begin;
+    const SubMesh& subMesh = mMesh.subMeshes[s];
+    unsigned int* visible = &mVisible[firstObject];
+
+    Frustum frustum = offsetFrustum(mFrustum, subMesh.sphere.center);
+    unsigned int numVisible = cullSpheres(frustum,
+            &mInstanceX[begin], &mInstanceY[begin], &mInstanceZ[begin],
+            NULL, subMesh.sphere.radius, end - begin, visible);
+
+    if (mOcclusionEnabled) {
+        unsigned int kept = 0;
+        for (unsigned int v = 0; v < numVisible; v++) {
+            unsigned int idx = begin + visible[v];
+            unsigned int object = s * mNumMeshInstances + idx;
+            glm::vec3 pos(mInstanceX[idx], mInstanceY[idx], mInstanceZ[idx]);
+            Aabb worldBounds = {subMesh.bounds.min + pos, subMesh.bounds.max + pos};
+            mOcclusion.requestQuery(chunk, object, worldBounds);
+            if (mOcclusion.isVisible(object))
+                visible[kept++] = visible[v];
+        }
+        numVisible = kept;
+    }
+
+    float* out = dst + 3*firstObject;
+    float nearest = CAMERA_FAR;
+    for (unsigned int v = 0; v < numVisible; v++) {
+        unsigned int idx = begin + visible[v];
+        out[3*v + 0] = mInstanceX[idx];
+        out[3*v + 1] = mInstanceY[idx];
+        out[3*v + 2] = mInstanceZ[idx];
+        glm::vec3 center = subMesh.sphere.center +
+                glm::vec3(mInstanceX[idx], mInstanceY[idx], mInstanceZ[idx]);
+        float viewZ = -(mView * glm::aligned_vec4(center, 1.0f)).z - subMesh.sphere.radius;
+        nearest = fminf(nearest, viewZ);
+    }
+    DrawBatch batch = {s, firstObject, numVisible, nearest / CAMERA_FAR};
+    mBatches[chunk] = batch;
 }
 
-float* RendererES3::mapTransformBuf() {
-    glBindBuffer(GL_ARRAY_BUFFER, mVB[VB_SCALEROT]);
-    return (float*)glMapBufferRange(GL_ARRAY_BUFFER,
-            0, MAX_INSTANCES * 4*sizeof(float),
-            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+void RendererES3::cullMeshInstances() {
+    uint64_t startNs = nowNs();
+    mOcclusion.beginFrame();
+
+    const unsigned int numSubMeshes = (unsigned int)mMesh.subMeshes.size();
+    for (size_t i = 0; i < mBatches.size(); i++)
+        mBatches[i].instanceCount = 0;
+    if (mNumMeshInstances == 0 || numSubMeshes == 0)
+        return;
+
+    StreamBuffer::Allocation visible = mStream.map(
+            mNumMeshInstances * numSubMeshes * 3*sizeof(float), 4*sizeof(float), mGLState);
+    if (!visible.ptr)
+        return;
+    float* dst = (float*)visible.ptr;
+    mVisibleOffset = visible.offset;
+
+    // The mapping is plain memory, so the jobs write straight into it.
+    const unsigned int numChunks = (unsigned int)mBatches.size();
+    const unsigned int grain = mNumMeshInstances * numSubMeshes < PARALLEL_CULL_MIN_OBJECTS ?
+            numChunks : 1;
+    WorkerPool::shared().parallelFor(numChunks, grain,
+            [this, dst](unsigned int begin, unsigned int end) {
+        for (unsigned int chunk = begin; chunk < end; chunk++)
+            cullChunk(chunk, dst);
+    });
+    mStream.commit(visible, mGLState);
+
+    for (size_t i = 0; i < mBatches.size(); i++) {
+        const DrawBatch& batch = mBatches[i];
+        mCullIndicesDrawn += (uint64_t)mMesh.subMeshes[batch.subMesh].indexCount * batch.instanceCount;
+        mCullVisible += batch.instanceCount;
+    }
+    for (unsigned int s = 0; s < numSubMeshes; s++)
+        mCullIndicesTotal += (uint64_t)mMesh.subMeshes[s].indexCount * mNumMeshInstances;
+    mCullTested += mNumMeshInstances * numSubMeshes;
+    mCullNs += nowNs() - startNs;
 }
 
-void RendererES3::unmapTransformBuf() {
-    glUnmapBuffer(GL_ARRAY_BUFFER);
+void RendererES3::recordCommands() {
+    uint64_t startNs = nowNs();
+    const unsigned int numItems = (unsigned int)mQueue.size();
+    mNumCommandLists = (numItems + RECORD_CHUNK_ITEMS - 1) / RECORD_CHUNK_ITEMS;
+    if (mCommandLists.size() < mNumCommandLists)
+        mCommandLists.resize(mNumCommandLists);
+
+    WorkerPool::shared().parallelFor(mNumCommandLists, 1,
+            [this, numItems](unsigned int begin, unsigned int end) {
+        for (unsigned int l = begin; l < end; l++) {
+            unsigned int first = l * RECORD_CHUNK_ITEMS;
+            unsigned int last = first + RECORD_CHUNK_ITEMS < numItems ?
+                    first + RECORD_CHUNK_ITEMS : numItems;
+            mCommandLists[l].reset();
+            mQueue.record(mCommandLists[l], first, last);
+        }
+    });
+    mRecordNs += nowNs() - startNs;
+}
+
+// The key light, then ORBIT_LIGHTS circling the mesh at different speeds
+// and heights, colored around the hue wheel.
+void RendererES3::updateLights(uint64_t timeNs) {
+    const glm::vec3 center = 0.5f * (mMesh.bounds.min + mMesh.bounds.max);
+    const float extent = glm::length(mMesh.bounds.max - mMesh.bounds.min);
+    // Wrapped so the float keeps sub-millisecond precision.
+    const float t = float(timeNs % 1000000000000ull) * 1e-9f;
+
+    mLights.resize(1 + ORBIT_LIGHTS);
+    PointLight key = {KEY_LIGHT_POS, KEY_LIGHT_RADIUS, glm::vec3(KEY_LIGHT_INTENSITY)};
+    mLights[0] = key;
+    for (int i = 0; i < ORBIT_LIGHTS; i++) {
+        float phase = float(TWO_PI) * i / ORBIT_LIGHTS;
+        float angle = phase + t * (0.3f + 0.1f * (i % 3));
+        float height = 0.4f * extent * sinf(3.0f * phase + t);
+        float ring = 0.6f * extent;
+        PointLight& light = mLights[1 + i];
+        light.position = center + glm::vec3(ring * cosf(angle), height, ring * sinf(angle));
+        light.radius = 0.35f * extent;
+        glm::vec3 hue = glm::abs(glm::mod(glm::vec3(6.0f * i / ORBIT_LIGHTS) +
+                glm::vec3(0.0f, 4.0f, 2.0f), 6.0f) - 3.0f) - 1.0f;
+        light.color = glm::clamp(hue, 0.0f, 1.0f);
+    }
+}
+
+void RendererES3::reportFrameStats() {
+    mOcclusionQueries += mOcclusion.frameStats().queriesIssued;
+    mOcclusionCulled += mOcclusion.frameStats().objectsCulled;
+    if (++mCullFrames < CULL_STATS_INTERVAL)
+        return;
+
+    float frames = (float)mCullFrames;
+    float frameMs = mFrameNs / frames * 0.000001f;
+    if (mGpuCulling) {
+        // What survived stays on the GPU.
+        ALOGV("cull: %.1f submesh instances tested on the GPU into %u indirect draws, "
+              "%.1f us/frame to dispatch; frame time %.2f ms",
+              mCullTested / frames, (unsigned int)mMesh.subMeshes.size(),
+              mCullNs / frames * 0.001f, frameMs);
+    } else {
+        ALOGV("cull: %.1f/%.1f submesh instances visible, %.1f%% of indices skipped, %.1f us/frame; "
+              "occlusion %s: %.1f queries, %.1f culled per frame; frame time %.2f ms",
+              mCullVisible / frames, mCullTested / frames,
+              mCullIndicesTotal ? 100.0f * (mCullIndicesTotal - mCullIndicesDrawn) / mCullIndicesTotal : 0.0f,
+              mCullNs / frames * 0.001f,
+              mOcclusionEnabled ? "on" : "off", mOcclusionQueries / frames, mOcclusionCulled / frames,
+              frameMs);
+    }
+    ALOGV("queue: %.1f draws, %.1f program, %.1f texture, %.1f VAO switches per frame",
+          mQueueDraws / frames, mProgramSwitches / frames, mTextureSwitches / frames,
+          mVaoSwitches / frames);
+    ALOGV("commands: %.1f lists, %.1f commands, %.1f KB per frame; record %.1f us, replay %.1f us",
+          mCommandListsRecorded / frames, mCommands / frames, mCommandBytes / frames / 1024.0f,
+          mRecordNs / frames * 0.001f, mReplayNs / frames * 0.001f);
+    const StreamBuffer::Stats& stream = mStream.stats();
+    ALOGV("stream: %.1f KB, %.1f allocations per frame; %u wraps, %u stalls (%.1f us total)",
+          stream.bytesStreamed / frames / 1024.0f, stream.allocations / frames,
+          stream.wraps, stream.stalls, stream.stallNs * 0.001f);
+    mStream.resetStats();
+    const ClusteredLighting::Stats& lights = mClusters.stats();
+    if (lights.assignments > 0) {
+        float assignments = (float)lights.assignments;
+        ALOGV("lights: %.1f lights, %.1f indices, %.1f/%d clusters lit, %.1f dropped per frame; "
+              "assign %.1f us, upload %.1f us",
+              lights.lights / assignments, lights.indices / assignments,
+              lights.activeClusters / assignments, CLUSTER_COUNT,
+              lights.droppedIndices / assignments,
+              lights.assignNs / assignments * 0.001f, lights.uploadNs / assignments * 0.001f);
+    }
+    mClusters.resetStats();
+    const RenderTargetPool::Stats& targets = mTargetPool.stats();
+    ALOGV("render targets: peak %.1f MB aliased, %.1f MB unaliased, %.1f MB resident; "
+          "%llu allocated, %llu freed",
+          targets.peakBytes / 1048576.0f, targets.peakUnaliasedBytes / 1048576.0f,
+          targets.residentBytes / 1048576.0f,
+          (unsigned long long)targets.allocations, (unsigned long long)targets.frees);
+    const DynamicResolution::Stats& dynres = mDynRes.stats();
+    if (dynres.frames > 0) {
+        ALOGV("resolution: scale %.2f average, now %dx%d; %s %.2f ms/frame, %u scale changes",
+              dynres.scaleSum / dynres.frames, mSceneWidth, mSceneHeight,
+              mDynRes.hasGpuTimer() ? "GPU" : "frame",
+              dynres.measurements ? dynres.frameMsSum / dynres.measurements : 0.0,
+              dynres.scaleChanges);
+    }
+    mDynRes.resetStats();
+    const ToneMapper::Stats& hdr = mToneMapper.stats();
+    if (mHdrEnabled) {
+        // The scene target is written by the scene pass and read by the
+        // last one, at least; blending and post passes add to that.
+        bool packed = mToneMapper.sceneFormat() == GL_R11F_G11F_B10F;
+        float sceneMB = 2.0f * mSceneWidth * mSceneHeight / 1048576.0f;
+        ALOGV("hdr: %s scene, %.1f MB/frame through it (%.1f as RGBA16F); exposure %.2f at "
+              "average luminance %.3f, %u readbacks %.1f frames late, %u frames skipped",
+              packed ? "R11F_G11F_B10F" : "RGBA16F", sceneMB * (packed ? 4 : 8), sceneMB * 8,
+              mToneMapper.exposure(), mToneMapper.averageLuminance(), hdr.readbacks,
+              hdr.readbacks ? float(hdr.latencyFrames) / hdr.readbacks : 0.0f, hdr.skipped);
+    }
+    mToneMapper.resetStats();
+    if (mOverdraw.isInitialized()) {
+        ALOGV("depth pre-pass %s: overdraw %.2f (%llu fragments over %llu pixels at 1/%d)",
+              mDepthPrepass ? "on" : "off", mOverdrawResult.overdraw(),
+              (unsigned long long)mOverdrawResult.fragments,
+              (unsigned long long)mOverdrawResult.coveredPixels, OVERDRAW_DOWNSCALE);
+        // The scene changes, so decide again.
+        mOverdrawDue = true;
+    }
+    ALOGV("state cache: %.1f calls issued, %.1f redundant calls filtered per frame",
+          mGLState.stats().issued / frames, mGLState.stats().filtered / frames);
+    mGLState.resetStats();
+    mCullFrames = 0;
+    mCullTested = mCullVisible = 0;
+    mCullIndicesDrawn = mCullIndicesTotal = 0;
+    mCullNs = 0;
+    mOcclusionQueries = mOcclusionCulled = 0;
+    mFrameNs = 0;
+    mQueueDraws = mProgramSwitches = mTextureSwitches = mVaoSwitches = 0;
+    mCommands = mCommandBytes = mCommandListsRecorded = 0;
+    mRecordNs = mReplayNs = 0;
+
+    // GPU culling has no occlusion pass to compare.
+    if (mOcclusionAbTest && mOcclusion.isInitialized() && !hasFixedClock() && !mGpuCulling) {
+        mOcclusionAbMs[mOcclusionEnabled] = frameMs;
+        if (mOcclusionAbMs[0] > 0.0f && mOcclusionAbMs[1] > 0.0f) {
+            float delta = mOcclusionAbMs[1] - mOcclusionAbMs[0];
+            ALOGV("occlusion A/B: %.2f ms/frame on, %.2f off, %+.2f ms (%+.1f%%) with it",
+                  mOcclusionAbMs[1], mOcclusionAbMs[0], delta,
+                  100.0f * delta / mOcclusionAbMs[0]);
+        }
+        mOcclusionEnabled = !mOcclusionEnabled;
+        mOcclusion.setObjectCount(mNumMeshInstances * (unsigned int)mMesh.subMeshes.size());
+    }
 }
 
 void RendererES3::draw(unsigned int numInstances) {
-    glUseProgram(mProgram);
-    glBindVertexArray(mVBState);
-//    glDrawArrays(GL_TRIANGLES, 0, CUBE_VERTIC_NUM);
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(g_indices_data.size()), GL_UNSIGNED_INT, 0);
+    uint64_t drawNs = nowNs();
+    uint64_t frameNs = mLastDrawNs > 0 ? drawNs - mLastDrawNs : 0;
+    mFrameNs += frameNs;
+    mLastDrawNs = drawNs;
+
+    if (mDynResEnabled) {
+        mDynRes.beginFrame();
+        int w, h;
+        mDynRes.scaledSize(mWidth, mHeight, &w, &h);
+        if (w != mSceneWidth || h != mSceneHeight)
+            setSceneSize(w, h);
+    }
+
+    if (mGpuCulling) {
+        uint64_t cullNs = nowNs();
+        mGpuCuller.cull(mFrustum, mGLState);
+        mCullTested += mGpuCuller.objectCount();
+        mCullNs += nowNs() - cullNs;
+    } else {
+        cullMeshInstances();
+    }
+    updateLights(frameTimeNs());
+    if (mClustersEnabled) {
+        mClusters.assign(&mLights[0], (unsigned int)mLights.size());
+        mClusters.upload(mGLState);
+    }
+
+    if (mOverdrawDue && mOverdraw.isInitialized() && mDepthProgram && !mGpuCulling)
+        measureOverdraw();
+
+    // Without depth of field the scene goes straight to the output
+    // framebuffer, or to a target that is copied into it: when it is
+    // smaller and upscaled, when the transparent pass needs its depth as a
+    // texture, or when it is HDR and tonemapped. Its depth is not needed
+    // after that.
+    bool scaled = mSceneWidth != mWidth || mSceneHeight != mHeight;
+    bool offscreen = scaled || mOitEnabled || mHdrEnabled;
+    RenderPass scenePass(mOutputFramebuffer, mSceneWidth, mSceneHeight);
+    int sceneColor = -1, sceneDepth = -1;
+    if (mDofEnabled) {
+        mDof.beginScene(mGLState, mTargetPool);
+    } else {
+        if (offscreen) {
+            RenderTargetDesc color = { mSceneWidth, mSceneHeight, mToneMapper.sceneFormat(), 1 };
+            RenderTargetDesc depth = { mSceneWidth, mSceneHeight, GL_DEPTH_COMPONENT24, 1 };
+            sceneColor = mTargetPool.acquire(color, mGLState);
+            sceneDepth = mTargetPool.acquire(depth, mGLState);
+            scenePass.framebuffer = mTargetPool.framebuffer(sceneColor, sceneDepth);
+            if (mOitEnabled)
+                scenePass.depthStore = STORE_ACTION_STORE;
+        }
+        scenePass.begin(mGLState);
+    }
+    // Opaque geometry is drawn without blending, which leaves early depth
+    // testing alone on every GPU. The post passes turn depth testing off.
+    mGLState.setEnabled(GL_BLEND, false);
+    mGLState.setEnabled(GL_DEPTH_TEST, true);
+
+    // With the pre-pass, the opaque pass only shades the fragments that
+    // ended up in front.
+    mQueue.clear();
+    for (size_t i = 0; i < mBatches.size(); i++) {
+        const DrawBatch& batch = mBatches[i];
+        if (batch.instanceCount == 0)
+            continue;
+        const SubMesh& subMesh = mMesh.subMeshes[batch.subMesh];
+        if (mDepthPrepass) {
+            DrawItem& depth = mQueue.push(RenderQueue::makeKey(DRAW_PASS_DEPTH,
+                    mDepthProgram, 0, mDepthVBState, batch.depth));
+            depth.program = mDepthProgram;
+            depth.vao = mDepthVBState;
+            depth.depthFunc = GL_LESS;
+            depth.depthWrite = true;
+            depth.colorWrite = false;
+            depth.mode = GL_TRIANGLES;
+            depth.count = static_cast<GLsizei>(subMesh.indexCount);
+            depth.indexType = GL_UNSIGNED_INT;
+            depth.first = subMesh.firstIndex * sizeof(unsigned int);
+            depth.instanceCount = static_cast<GLsizei>(batch.instanceCount);
+            depth.instanceAttrib = INSTANCE_POS_ATTRIB;
+            depth.instanceComponents = 3;
+            depth.instanceBuffer = mStream.buffer();
+            depth.instanceOffset = mVisibleOffset + batch.firstInstance * 3*sizeof(float);
+        }
+        DrawItem& item = mQueue.push(RenderQueue::makeKey(DRAW_PASS_OPAQUE,
+                mProgram, mAlbedoTexture, mVBState, batch.depth));
+        item.program = mProgram;
+        item.vao = mVBState;
+        item.textures[0] = mAlbedoTexture;
+        item.textures[1] = mDepthTexture;
+        item.depthFunc = mDepthPrepass ? GL_LEQUAL : GL_LESS;
+        item.depthWrite = !mDepthPrepass;
+        item.colorWrite = true;
+        item.mode = GL_TRIANGLES;
+        item.count = static_cast<GLsizei>(subMesh.indexCount);
+        item.indexType = GL_UNSIGNED_INT;
+        item.first = subMesh.firstIndex * sizeof(unsigned int);
+        item.instanceCount = static_cast<GLsizei>(batch.instanceCount);
+        item.instanceAttrib = INSTANCE_POS_ATTRIB;
+        item.instanceComponents = 3;
+        item.instanceBuffer = mStream.buffer();
+        item.instanceOffset = mVisibleOffset + batch.firstInstance * 3*sizeof(float);
+    }
+    // GPU culled: one indirect draw per submesh, of whatever survived.
+    for (unsigned int s = 0; mGpuCulling && s < mMesh.subMeshes.size(); s++) {
+        DrawItem& item = mQueue.push(RenderQueue::makeKey(DRAW_PASS_OPAQUE,
+                mProgram, mAlbedoTexture, mVBState, 0.0f));
+        item.program = mProgram;
+        item.vao = mVBState;
+        item.textures[0] = mAlbedoTexture;
+        item.textures[1] = mDepthTexture;
+        item.depthFunc = GL_LESS;
+        item.depthWrite = true;
+        item.colorWrite = true;
+        item.mode = GL_TRIANGLES;
+        item.indexType = GL_UNSIGNED_INT;
+        item.indirectBuffer = mGpuCuller.commandBuffer();
+        item.first = mGpuCuller.commandOffset(s);
+        item.instanceAttrib = INSTANCE_POS_ATTRIB;
+        item.instanceComponents = 3;
+        item.instanceBuffer = mGpuCuller.instanceBuffer();
+        item.instanceOffset = mGpuCuller.instanceOffset(s);
+    }
+    mQueue.sort();
+    recordCommands();
+
+    // Shared by every draw, so bound once outside the command lists.
+    mGLState.bindTexture(2, GL_TEXTURE_2D, mIbl.brdfLut());
+    mGLState.bindTexture(3, GL_TEXTURE_CUBE_MAP, mIbl.prefilteredEnv());
+    mGLState.bindTexture(4, GL_TEXTURE_2D, mClusters.lightTexture());
+    mGLState.bindTexture(5, GL_TEXTURE_2D, mClusters.clusterTexture());
+    mGLState.bindTexture(6, GL_TEXTURE_2D, mClusters.indexTexture());
+
+    uint64_t replayNs = nowNs();
+    CommandList::Stats replayStats;
+    memset(&replayStats, 0, sizeof(replayStats));
+    for (unsigned int l = 0; l < mNumCommandLists; l++) {
+        mCommandLists[l].execute(mGLState, &replayStats);
+        mCommandBytes += mCommandLists[l].sizeBytes();
+    }
+    mReplayNs += nowNs() - replayNs;
+    mCommandListsRecorded += mNumCommandLists;
+    mCommands += replayStats.commands;
+    mQueueDraws += replayStats.draws;
+    mProgramSwitches += replayStats.programSwitches;
+    mTextureSwitches += replayStats.textureSwitches;
+    mVaoSwitches += replayStats.vaoSwitches;
+
+    if (mOcclusionEnabled && !mGpuCulling)
+        mOcclusion.issueQueries(mGLState);
+    // Transparent draws go last. Without OIT they are blended into the
+    // scene pass, sorted; with it they get a pass of their own over the
+    // opaque scene once its depth is resolved.
+    if (!mOitEnabled)
+        drawGlows(false);
+    if (mDofEnabled) {
+        mDof.endScene(mGLState, mTargetPool);
+        if (mOitEnabled) {
+            mOit.begin(mGLState, mTargetPool, mDof.sceneDepthTarget());
+            drawGlows(true);
+            mOit.composite(mGLState, mTargetPool,
+                    mTargetPool.framebuffer(mDof.sceneColorTarget()));
+        }
+        // The exposure used is from earlier frames' readbacks.
+        if (mHdrEnabled) {
+            mToneMapper.meter(mGLState, mTargetPool.name(mDof.sceneColorTarget()), frameNs);
+            mDof.setExposure(mToneMapper.exposure());
+        }
+        mDof.apply(mGLState, mTargetPool, mOutputFramebuffer, mWidth, mHeight);
+    } else {
+        scenePass.end(mGLState);
+        if (mOitEnabled) {
+            mOit.begin(mGLState, mTargetPool, sceneDepth);
+            drawGlows(true);
+            mOit.composite(mGLState, mTargetPool, mTargetPool.framebuffer(sceneColor));
+        }
+        if (mHdrEnabled)
+            mToneMapper.meter(mGLState, mTargetPool.name(sceneColor), frameNs);
+        if (offscreen) {
+            RenderPass outputPass(mOutputFramebuffer, mWidth, mHeight);
+            outputPass.colorLoad = LOAD_ACTION_DONT_CARE;
+            outputPass.depthLoad = LOAD_ACTION_DONT_CARE;
+            outputPass.begin(mGLState);
+            if (scaled) {
+                mDynRes.upscale(mGLState, mTargetPool.name(sceneColor), mSceneWidth,
+                        mSceneHeight, mHdrEnabled ? mToneMapper.exposure() : 0.0f);
+            } else if (mHdrEnabled) {
+                mToneMapper.resolve(mGLState, mTargetPool.name(sceneColor));
+            } else {
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, mTargetPool.framebuffer(sceneColor));
+                glBlitFramebuffer(0, 0, mWidth, mHeight, 0, 0, mWidth, mHeight,
+                        GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            }
+            outputPass.end(mGLState);
+            mTargetPool.release(sceneColor);
+            mTargetPool.release(sceneDepth);
+        }
+    }
+    if (mDynResEnabled)
+        mDynRes.endFrame(frameNs);
+    mTargetPool.endFrame(mGLState);
+    mStream.endFrame();
+    reportFrameStats();
 }
 
 
 void RendererES3::set2DTexture(uint32_t *data, int width, int height) {
     Renderer::set2DTexture(data, width, height);
 
-    glUseProgram(mProgram);
-
-    GLuint texture;
-
-    glActiveTexture(GL_TEXTURE0);
-    glGenTextures(1, &texture);
+    mGLState.forgetTexture(mAlbedoTexture);
+    glDeleteTextures(1, &mAlbedoTexture);
+    glGenTextures(1, &mAlbedoTexture);
 
-    glBindTexture(GL_TEXTURE_2D, texture);
+    mGLState.bindTexture(0, GL_TEXTURE_2D, mAlbedoTexture);
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0 ,GL_RGBA, GL_UNSIGNED_BYTE, data);
 
@@ -443,22 +1312,17 @@ void RendererES3::set2DTexture(uint32_t *data, int width, int height) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-    glUniform1i(glGetUniformLocation(mProgram, "texture0"), 0);
 }
 
 
 void RendererES3::setDepthTexture(uint32_t *data, int width, int height) {
     Renderer::setDepthTexture(data, width, height);
 
-    glUseProgram(mProgram);
+    mGLState.forgetTexture(mDepthTexture);
+    glDeleteTextures(1, &mDepthTexture);
+    glGenTextures(1, &mDepthTexture);
 
-    GLuint texture;
-
-    glActiveTexture(GL_TEXTURE1);
-    glGenTextures(1, &texture);
-
-    glBindTexture(GL_TEXTURE_2D, texture);
+    mGLState.bindTexture(1, GL_TEXTURE_2D, mDepthTexture);
 
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0 ,GL_RGBA, GL_UNSIGNED_BYTE, data);
 
@@ -466,26 +1330,194 @@ void RendererES3::setDepthTexture(uint32_t *data, int width, int height) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+}
+
+// Counts the fragments the opaque pass would shade without a pre-pass: the
+// visible batches front to back, the order their sort keys give. Only done
+// now and then, since reading the counts back waits for the GPU.
+void RendererES3::measureOverdraw() {
+    std::vector<unsigned int> order;
+    uint64_t vertices = 0;
+    for (unsigned int i = 0; i < mBatches.size(); i++) {
+        if (mBatches[i].instanceCount == 0)
+            continue;
+        order.push_back(i);
+        vertices += (uint64_t)mMesh.subMeshes[mBatches[i].subMesh].indexCount *
+                mBatches[i].instanceCount;
+    }
+    std::sort(order.begin(), order.end(), [this](unsigned int a, unsigned int b) {
+        return mBatches[a].depth < mBatches[b].depth;
+    });
+
+    mOverdraw.begin(mGLState, mTargetPool, mSceneWidth, mSceneHeight);
+    mGLState.bindVertexArray(mDepthVBState);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mStream.buffer());
+    for (size_t i = 0; i < order.size(); i++) {
+        const DrawBatch& batch = mBatches[order[i]];
+        const SubMesh& subMesh = mMesh.subMeshes[batch.subMesh];
+        glVertexAttribPointer(INSTANCE_POS_ATTRIB, 3, GL_FLOAT, GL_FALSE, 0,
+                (const GLvoid*)(mVisibleOffset + batch.firstInstance * 3*sizeof(float)));
+        glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(subMesh.indexCount),
+                GL_UNSIGNED_INT, (const GLvoid*)(subMesh.firstIndex * sizeof(unsigned int)),
+                static_cast<GLsizei>(batch.instanceCount));
+    }
+    mOverdrawResult = mOverdraw.end(mGLState, mTargetPool);
+    mOverdrawDue = false;
+
+    // Counts are at 1/OVERDRAW_DOWNSCALE of the scene size per axis.
+    float saved = float(mOverdrawResult.fragments - mOverdrawResult.coveredPixels) *
+            OVERDRAW_DOWNSCALE * OVERDRAW_DOWNSCALE;
+    bool prepass = saved * DEPTH_PREPASS_FRAGMENT_COST > float(vertices);
+    if (prepass != mDepthPrepass)
+        ALOGV("Depth pre-pass %s: overdraw %.2f, %.0f fragments saved vs %llu vertices",
+              prepass ? "on" : "off", mOverdrawResult.overdraw(), saved,
+              (unsigned long long)vertices);
+    mDepthPrepass = prepass;
+}
 
+// Camera-facing glows around the orbit lights, drawn after the opaque scene
+// with depth testing and no depth writes. Into the OIT targets they go in
+// any order; blended straight into the scene they are sorted back to front.
+void RendererES3::drawGlows(bool oit) {
+    const unsigned int count = ORBIT_LIGHTS;
+    StreamBuffer::Allocation glows = mStream.map(count * 8*sizeof(float), 4*sizeof(float),
+            mGLState);
+    if (!glows.ptr)
+        return;
 
-    glUniform1i(glGetUniformLocation(mProgram, "texture1"), 1);
+    mGlowOrder.resize(count);
+    for (unsigned int i = 0; i < count; i++)
+        mGlowOrder[i] = i;
+    if (!oit) {
+        mGlowDepth.resize(count);
+        for (unsigned int i = 0; i < count; i++)
+            mGlowDepth[i] = (mView * glm::aligned_vec4(mLights[1 + i].position, 1.0f)).z;
+        std::sort(mGlowOrder.begin(), mGlowOrder.end(), [this](unsigned int a, unsigned int b) {
+            return mGlowDepth[a] < mGlowDepth[b];
+        });
+    }
+    const float size = LIGHT_GLOW_SIZE * glm::length(mMesh.bounds.max - mMesh.bounds.min);
+    float* dst = (float*)glows.ptr;
+    for (unsigned int i = 0; i < count; i++) {
+        const PointLight& light = mLights[1 + mGlowOrder[i]];
+        float glow[8] = {light.position.x, light.position.y, light.position.z, size,
+                light.color.r, light.color.g, light.color.b, 0.0f};
+        memcpy(dst + 8*i, glow, sizeof(glow));
+    }
+    mStream.commit(glows, mGLState);
+
+    if (!oit) {
+        mGLState.setEnabled(GL_BLEND, true);
+        mGLState.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        mGLState.setEnabled(GL_DEPTH_TEST, true);
+        mGLState.depthFunc(GL_LESS);
+        mGLState.depthMask(false);
+    }
+    mGLState.colorMask(true);
+    mGLState.useProgram(oit ? mGlowOitProgram : mGlowProgram);
+    mGLState.bindVertexArray(mGlowVBState);
+    mGLState.bindBuffer(GL_ARRAY_BUFFER, mStream.buffer());
+    glVertexAttribPointer(GLOW_LIGHT_ATTRIB, 4, GL_FLOAT, GL_FALSE, 8*sizeof(float),
+            (const GLvoid*)glows.offset);
+    glVertexAttribPointer(GLOW_COLOR_ATTRIB, 3, GL_FLOAT, GL_FALSE, 8*sizeof(float),
+            (const GLvoid*)(glows.offset + 4*sizeof(float)));
+    glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, static_cast<GLsizei>(count));
+}
+
+// Whatever adapts to how fast frames come makes their images depend on it
+// too: the scene goes full size, the exposure stays at 1, as without auto
+// exposure, and occlusion culling, which uses results of earlier frames,
+// is off.
+void RendererES3::setFixedClock(uint64_t frameNs) {
+    Renderer::setFixedClock(frameNs);
+    bool fixed = frameNs > 0;
+    mDynResEnabled = !fixed && mDynRes.isInitialized();
+    mToneMapper.setFixedExposure(fixed ? 1.0f : 0.0f);
+    mOcclusionEnabled = !fixed && mOcclusion.isInitialized();
+    mOcclusion.setObjectCount(mNumMeshInstances * (unsigned int)mMesh.subMeshes.size());
+    if (fixed && mWidth > 0)
+        setSceneSize(mWidth, mHeight);
+}
+
+void RendererES3::setOcclusionAbTest(bool enabled) {
+    mOcclusionAbTest = enabled;
+    mOcclusionAbMs[0] = mOcclusionAbMs[1] = 0.0f;
+    mOcclusionEnabled = !hasFixedClock() && mOcclusion.isInitialized();
+    mOcclusion.setObjectCount(mNumMeshInstances * (unsigned int)mMesh.subMeshes.size());
+}
+
+void RendererES3::setInstanceCount(unsigned int count) {
+    mMeshInstanceTarget = count;
+    layoutMeshInstances();
+    if (!reserveStream())
+        ALOGE("Out of memory for %u mesh instances", mNumMeshInstances);
+    mOverdrawDue = true;
+    ALOGV("%u mesh instances, culled %s", mNumMeshInstances,
+          mGpuCulling ? "on the GPU" : "on the CPU");
+}
+
+// Nothing is reallocated here: the next frame acquires targets of the new
+// size, and the pool drops the old ones once they go idle.
+void RendererES3::setSceneSize(int w, int h) {
+    mSceneWidth = w;
+    mSceneHeight = h;
+    // The cluster tiles are in pixels of the scene target.
+    mClusters.setCamera(mView, mProjection, CAMERA_NEAR, CAMERA_FAR, w, h);
+    mGLState.useProgram(mProgram);
+    glUniform4fv(glGetUniformLocation(mProgram, "clusterParams"), 1,
+            glm::value_ptr(mClusters.clusterParams()));
+    mDof.resize(w, h, SCENE_MSAA_SAMPLES);
 }
 
 void RendererES3::resize(int w, int h) {
     Renderer::resize(w, h);
 
-    glUseProgram(mProgram);
+    mGLState.useProgram(mProgram);
 
     // Uniforms
     glm::vec3 eye_pos = glm::vec3(1.0, 0.0, 2.0);
     glm::vec3 center_point = eye_pos * -1.0f;
-    glm::mat4 view_mat = glm::lookAt(eye_pos, center_point, glm::vec3(0.0, 1.0, 0.0));
-    glm::mat4 project_mat = glm::perspective((float)(1.0f * M_PI_4), (w * 1.0f / h * 1.0f), 0.01f, 10.0f);
+    glm::aligned_mat4 view_mat = glm::lookAt(eye_pos, center_point, glm::vec3(0.0, 1.0, 0.0));
+    glm::aligned_mat4 project_mat = glm::perspective((float)(1.0f * M_PI_4), (w * 1.0f / h * 1.0f), CAMERA_NEAR, CAMERA_FAR);
 
-    glm::mat4 mvp_mat = project_mat * view_mat;
+    glm::aligned_mat4 mvp_mat;
+    mat4Multiply(project_mat, view_mat, &mvp_mat);
+    mView = view_mat;
 
 //    ALOGE("%f", mvp_mat[0][0]);
 //    ALOGE("location %d", glGetUniformLocation(mProgram, "mvp_mat"));
     glUniformMatrix4fv(glGetUniformLocation(mProgram, "mvp_mat"), 1, GL_FALSE, glm::value_ptr(mvp_mat));
+    if (mDepthProgram) {
+        mGLState.useProgram(mDepthProgram);
+        glUniformMatrix4fv(glGetUniformLocation(mDepthProgram, "mvp_mat"), 1, GL_FALSE,
+                glm::value_ptr(mvp_mat));
+    }
+    if (mOverdraw.isInitialized()) {
+        mGLState.useProgram(mOverdraw.program());
+        glUniformMatrix4fv(glGetUniformLocation(mOverdraw.program(), "mvp_mat"), 1, GL_FALSE,
+                glm::value_ptr(mvp_mat));
+    }
+    GLuint glowPrograms[2] = { mGlowProgram, mGlowOitProgram };
+    for (int i = 0; i < 2; i++) {
+        if (!glowPrograms[i])
+            continue;
+        mGLState.useProgram(glowPrograms[i]);
+        glUniformMatrix4fv(glGetUniformLocation(glowPrograms[i], "view_mat"), 1, GL_FALSE,
+                glm::value_ptr(view_mat));
+        glUniformMatrix4fv(glGetUniformLocation(glowPrograms[i], "projection_mat"), 1, GL_FALSE,
+                glm::value_ptr(project_mat));
+    }
+    mGLState.useProgram(mProgram);
+    glUniform3fv(glGetUniformLocation(mProgram, "eyePos"), 1, glm::value_ptr(eye_pos));
+    mProjection = project_mat;
+    extractFrustum(mvp_mat, &mFrustum);
+    mOcclusion.setCamera(mvp_mat, eye_pos);
+    mOverdrawDue = true;
+
+    int sceneWidth = w, sceneHeight = h;
+    if (mDynResEnabled)
+        mDynRes.scaledSize(w, h, &sceneWidth, &sceneHeight);
+    setSceneSize(sceneWidth, sceneHeight);
+    mDof.setFocus(glm::length(eye_pos), DOF_APERTURE, CAMERA_NEAR, CAMERA_FAR);
     checkGlError("resize");
 }
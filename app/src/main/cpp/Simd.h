@@ -0,0 +1,372 @@
+//
+// Minimal 4-wide float SIMD wrapper used by the CPU-side kernels.
+// Maps to NEON on ARM, SSE on x86 and plain scalar code elsewhere.
+//
+
+#ifndef OPENGL_DEMO_SIMD_H
+#define OPENGL_DEMO_SIMD_H
+
+#include <math.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SIMD_NEON 1
+typedef float32x4_t v4f;
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SIMD_SSE 1
+typedef __m128 v4f;
+#else
+#define SIMD_SCALAR 1
+struct v4f { float v[4]; };
+#endif
+
+static inline v4f v4fLoad(const float* p) {
+#if SIMD_NEON
+    return vld1q_f32(p);
+#elif SIMD_SSE
+    return _mm_loadu_ps(p);
+#else
+    v4f r = {{p[0], p[1], p[2], p[3]}};
+    return r;
+#endif
+}
+
+static inline void v4fStore(float* p, v4f a) {
+#if SIMD_NEON
+    vst1q_f32(p, a);
+#elif SIMD_SSE
+    _mm_storeu_ps(p, a);
+#else
+    for (int i = 0; i < 4; i++) p[i] = a.v[i];
+#endif
+}
+
+static inline v4f v4fSplat(float s) {
+#if SIMD_NEON
+    return vdupq_n_f32(s);
+#elif SIMD_SSE
+    return _mm_set1_ps(s);
+#else
+    v4f r = {{s, s, s, s}};
+    return r;
+#endif
+}
+
+static inline v4f v4fAdd(v4f a, v4f b) {
+#if SIMD_NEON
+    return vaddq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_add_ps(a, b);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] + b.v[i];
+    return r;
+#endif
+}
+
+static inline v4f v4fMul(v4f a, v4f b) {
+#if SIMD_NEON
+    return vmulq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_mul_ps(a, b);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i];
+    return r;
+#endif
+}
+
+// a * b + c
+static inline v4f v4fMadd(v4f a, v4f b, v4f c) {
+#if SIMD_NEON
+    return vmlaq_f32(c, a, b);
+#elif SIMD_SSE
+    return _mm_add_ps(_mm_mul_ps(a, b), c);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] * b.v[i] + c.v[i];
+    return r;
+#endif
+}
+
+// Stores x0 y0 x1 y1 x2 y2 x3 y3.
+static inline void v4fStoreInterleaved2(float* p, v4f x, v4f y) {
+#if SIMD_NEON
+    float32x4x2_t xy = {{x, y}};
+    vst2q_f32(p, xy);
+#elif SIMD_SSE
+    _mm_storeu_ps(p, _mm_unpacklo_ps(x, y));
+    _mm_storeu_ps(p + 4, _mm_unpackhi_ps(x, y));
+#else
+    for (int i = 0; i < 4; i++) {
+        p[2*i + 0] = x.v[i];
+        p[2*i + 1] = y.v[i];
+    }
+#endif
+}
+
+static inline v4f v4fSub(v4f a, v4f b) {
+#if SIMD_NEON
+    return vsubq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_sub_ps(a, b);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] - b.v[i];
+    return r;
+#endif
+}
+
+static inline v4f v4fMin(v4f a, v4f b) {
+#if SIMD_NEON
+    return vminq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_min_ps(a, b);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+    return r;
+#endif
+}
+
+static inline v4f v4fMax(v4f a, v4f b) {
+#if SIMD_NEON
+    return vmaxq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_max_ps(a, b);
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+    return r;
+#endif
+}
+
+// Stores a0 b0 c0 d0 a1 b1 c1 d1 ... i.e. transposes four SoA vectors into
+// four contiguous AoS vec4s (64 bytes).
+static inline void v4fStoreInterleaved4(float* p, v4f a, v4f b, v4f c, v4f d) {
+#if SIMD_NEON
+    float32x4x4_t abcd = {{a, b, c, d}};
+    vst4q_f32(p, abcd);
+#elif SIMD_SSE
+    _MM_TRANSPOSE4_PS(a, b, c, d);
+    _mm_storeu_ps(p, a);
+    _mm_storeu_ps(p + 4, b);
+    _mm_storeu_ps(p + 8, c);
+    _mm_storeu_ps(p + 12, d);
+#else
+    for (int i = 0; i < 4; i++) {
+        p[4*i + 0] = a.v[i];
+        p[4*i + 1] = b.v[i];
+        p[4*i + 2] = c.v[i];
+        p[4*i + 3] = d.v[i];
+    }
+#endif
+}
+
+// The inverse of v4fStoreInterleaved4: a gets p[0] p[4] p[8] p[12], b gets
+// p[1] p[5] p[9] p[13] and so on, e.g. the rows of a column-major mat4.
+static inline void v4fLoadTransposed4(const float* p, v4f* a, v4f* b, v4f* c, v4f* d) {
+#if SIMD_NEON
+    float32x4x4_t abcd = vld4q_f32(p);
+    *a = abcd.val[0];
+    *b = abcd.val[1];
+    *c = abcd.val[2];
+    *d = abcd.val[3];
+#elif SIMD_SSE
+    __m128 r0 = _mm_loadu_ps(p), r1 = _mm_loadu_ps(p + 4);
+    __m128 r2 = _mm_loadu_ps(p + 8), r3 = _mm_loadu_ps(p + 12);
+    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+    *a = r0;
+    *b = r1;
+    *c = r2;
+    *d = r3;
+#else
+    for (int i = 0; i < 4; i++) {
+        a->v[i] = p[4*i + 0];
+        b->v[i] = p[4*i + 1];
+        c->v[i] = p[4*i + 2];
+        d->v[i] = p[4*i + 3];
+    }
+#endif
+}
+
+// Lanes 1 0 3 2.
+static inline v4f v4fSwapPairs(v4f a) {
+#if SIMD_NEON
+    return vrev64q_f32(a);
+#elif SIMD_SSE
+    return _mm_shuffle_ps(a, a, _MM_SHUFFLE(2, 3, 0, 1));
+#else
+    v4f r = {{a.v[1], a.v[0], a.v[3], a.v[2]}};
+    return r;
+#endif
+}
+
+// Lanes 2 3 0 1.
+static inline v4f v4fSwapHalves(v4f a) {
+#if SIMD_NEON
+    return vextq_f32(a, a, 2);
+#elif SIMD_SSE
+    return _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 0, 3, 2));
+#else
+    v4f r = {{a.v[2], a.v[3], a.v[0], a.v[1]}};
+    return r;
+#endif
+}
+
+// Lane masks produced by comparisons and consumed by v4fSelect.
+#if SIMD_NEON
+typedef uint32x4_t v4m;
+#elif SIMD_SSE
+typedef __m128 v4m;
+#else
+struct v4m { bool v[4]; };
+#endif
+
+static inline v4m v4fCmpGe(v4f a, v4f b) {
+#if SIMD_NEON
+    return vcgeq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_cmpge_ps(a, b);
+#else
+    v4m r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] >= b.v[i];
+    return r;
+#endif
+}
+
+static inline v4m v4fCmpLe(v4f a, v4f b) {
+#if SIMD_NEON
+    return vcleq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_cmple_ps(a, b);
+#else
+    v4m r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] <= b.v[i];
+    return r;
+#endif
+}
+
+// mask ? a : b, per lane
+static inline v4f v4fSelect(v4m mask, v4f a, v4f b) {
+#if SIMD_NEON
+    return vbslq_f32(mask, a, b);
+#elif SIMD_SSE
+    return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+#else
+    v4f r;
+    for (int i = 0; i < 4; i++) r.v[i] = mask.v[i] ? a.v[i] : b.v[i];
+    return r;
+#endif
+}
+
+static inline v4m v4fCmpGt(v4f a, v4f b) {
+#if SIMD_NEON
+    return vcgtq_f32(a, b);
+#elif SIMD_SSE
+    return _mm_cmpgt_ps(a, b);
+#else
+    v4m r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] > b.v[i];
+    return r;
+#endif
+}
+
+static inline v4m v4mAnd(v4m a, v4m b) {
+#if SIMD_NEON
+    return vandq_u32(a, b);
+#elif SIMD_SSE
+    return _mm_and_ps(a, b);
+#else
+    v4m r;
+    for (int i = 0; i < 4; i++) r.v[i] = a.v[i] && b.v[i];
+    return r;
+#endif
+}
+
+// One bit per lane, lane 0 in bit 0.
+static inline unsigned int v4mMoveMask(v4m m) {
+#if SIMD_NEON
+    static const uint32_t LANE_BITS[4] = {1, 2, 4, 8};
+    uint32x4_t bits = vandq_u32(m, vld1q_u32(LANE_BITS));
+#if defined(__aarch64__)
+    return vaddvq_u32(bits);
+#else
+    uint32x2_t sum = vadd_u32(vget_low_u32(bits), vget_high_u32(bits));
+    return vget_lane_u32(vpadd_u32(sum, sum), 0);
+#endif
+#elif SIMD_SSE
+    return (unsigned int)_mm_movemask_ps(m);
+#else
+    return (m.v[0] ? 1u : 0u) | (m.v[1] ? 2u : 0u) | (m.v[2] ? 4u : 0u) | (m.v[3] ? 8u : 0u);
+#endif
+}
+
+// Cephes-style sin/cos: reduce to [-pi/4, pi/4] around the nearest multiple
+// of pi/2, evaluate both minimax polynomials and swap/negate by quadrant.
+// Max error is a few ulp for |x| up to a few thousand radians.
+static inline void v4fSinCos(v4f x, v4f* sinOut, v4f* cosOut) {
+#if SIMD_SCALAR
+    for (int i = 0; i < 4; i++) {
+        sinOut->v[i] = sinf(x.v[i]);
+        cosOut->v[i] = cosf(x.v[i]);
+    }
+#else
+    const v4f DP1 = v4fSplat(-1.5703125f);
+    const v4f DP2 = v4fSplat(-4.837512969970703125e-4f);
+    const v4f DP3 = v4fSplat(-7.54978995489188216e-8f);
+
+#if SIMD_NEON
+    float32x4_t fq = vmulq_n_f32(x, 0.63661977236758134f);   // 2/pi
+#if defined(__aarch64__)
+    int32x4_t q = vcvtnq_s32_f32(fq);
+#else
+    float32x4_t half = vbslq_f32(vcgeq_f32(fq, vdupq_n_f32(0.0f)),
+            vdupq_n_f32(0.5f), vdupq_n_f32(-0.5f));
+    int32x4_t q = vcvtq_s32_f32(vaddq_f32(fq, half));
+#endif
+    float32x4_t j = vcvtq_f32_s32(q);
+#else
+    __m128i q = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134f)));
+    __m128 j = _mm_cvtepi32_ps(q);
+#endif
+
+    v4f r = v4fMadd(j, DP1, x);
+    r = v4fMadd(j, DP2, r);
+    r = v4fMadd(j, DP3, r);
+    v4f r2 = v4fMul(r, r);
+
+    v4f ps = v4fMadd(v4fSplat(-1.9515295891e-4f), r2, v4fSplat(8.3321608736e-3f));
+    ps = v4fMadd(ps, r2, v4fSplat(-1.6666654611e-1f));
+    ps = v4fMadd(v4fMul(ps, r2), r, r);
+
+    v4f pc = v4fMadd(v4fSplat(2.443315711809948e-5f), r2, v4fSplat(-1.388731625493765e-3f));
+    pc = v4fMadd(pc, r2, v4fSplat(4.166664568298827e-2f));
+    pc = v4fMadd(v4fMul(pc, r2), r2, v4fMadd(v4fSplat(-0.5f), r2, v4fSplat(1.0f)));
+
+    // quadrant 0: ( s,  c)  1: ( c, -s)  2: (-s, -c)  3: (-c,  s)
+#if SIMD_NEON
+    uint32x4_t uq = vreinterpretq_u32_s32(q);
+    uint32x4_t swap = vtstq_u32(uq, vdupq_n_u32(1));
+    uint32x4_t sinSign = vshlq_n_u32(vandq_u32(uq, vdupq_n_u32(2)), 30);
+    uint32x4_t cosSign = vshlq_n_u32(vandq_u32(vaddq_u32(uq, vdupq_n_u32(1)), vdupq_n_u32(2)), 30);
+    float32x4_t s = vbslq_f32(swap, pc, ps);
+    float32x4_t c = vbslq_f32(swap, ps, pc);
+    *sinOut = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(s), sinSign));
+    *cosOut = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(c), cosSign));
+#else
+    __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(
+            _mm_and_si128(q, _mm_set1_epi32(1)), _mm_set1_epi32(1)));
+    __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30));
+    __m128 cosSign = _mm_castsi128_ps(_mm_slli_epi32(
+            _mm_and_si128(_mm_add_epi32(q, _mm_set1_epi32(1)), _mm_set1_epi32(2)), 30));
+    __m128 s = v4fSelect(swap, pc, ps);
+    __m128 c = v4fSelect(swap, ps, pc);
+    *sinOut = _mm_xor_ps(s, sinSign);
+    *cosOut = _mm_xor_ps(c, cosSign);
+#endif
+#endif
+}
+
+#endif //OPENGL_DEMO_SIMD_H
@@ -0,0 +1,139 @@
+//
+// Ring sub-allocator for per-frame GPU data, see StreamBuffer.h.
+//
+
+#include "StreamBuffer.h"
+
+#include <string.h>
+
+// Upper bound for a single fence wait before giving up and logging.
+#define STREAM_WAIT_TIMEOUT_NS 1000000000ull
+
+StreamBuffer::StreamBuffer()
+:   mBuffer(0),
+    mCapacity(0),
+    mUniformAlignment(256),
+    mHead(0),
+    mFrameBegin(0),
+    mFrameBytes(0),
+    mMapped(false)
+{
+    resetStats();
+}
+
+bool StreamBuffer::init(GLsizeiptr capacity, GLStateCache& state) {
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &mUniformAlignment);
+    if (mUniformAlignment <= 0)
+        mUniformAlignment = 256;
+
+    glGenBuffers(1, &mBuffer);
+    state.bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    mCapacity = capacity;
+    mHead = mFrameBegin = 0;
+    mFrameBytes = 0;
+    return !checkGlError("StreamBuffer::init");
+}
+
+void StreamBuffer::destroy() {
+    for (size_t i = 0; i < mInFlight.size(); i++)
+        glDeleteSync(mInFlight[i].fence);
+    mInFlight.clear();
+    glDeleteBuffers(1, &mBuffer);
+    mBuffer = 0;
+    mCapacity = 0;
+}
+
+void StreamBuffer::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+bool StreamBuffer::overlaps(const Region& region, GLintptr begin, GLintptr end) const {
+    if (region.begin <= region.end)
+        return begin < region.end && region.begin < end;
+    // Wrapped: [region.begin, capacity) and [0, region.end).
+    return end > region.begin || begin < region.end;
+}
+
+void StreamBuffer::waitFor(const Region& region) {
+    GLenum result = glClientWaitSync(region.fence, 0, 0);
+    if (result == GL_TIMEOUT_EXPIRED) {
+        uint64_t startNs = nowNs();
+        result = glClientWaitSync(region.fence, GL_SYNC_FLUSH_COMMANDS_BIT, STREAM_WAIT_TIMEOUT_NS);
+        mStats.stalls++;
+        mStats.stallNs += nowNs() - startNs;
+    }
+    if (result == GL_WAIT_FAILED || result == GL_TIMEOUT_EXPIRED)
+        ALOGE("StreamBuffer: fence wait failed (0x%04x)", result);
+}
+
+StreamBuffer::Allocation StreamBuffer::map(GLsizeiptr size, GLsizeiptr alignment,
+        GLStateCache& state) {
+    Allocation allocation = {NULL, mBuffer, 0, size};
+    if (size <= 0 || mMapped)
+        return allocation;
+
+    GLintptr begin = (mHead + alignment - 1) & ~(GLintptr)(alignment - 1);
+    bool wrapped = begin + size > mCapacity;
+    if (wrapped) {
+        mStats.wraps++;
+        begin = 0;
+    }
+    GLintptr end = begin + size;
+    // Bytes skipped for alignment or at the wrap count against the frame too.
+    GLsizeiptr used = wrapped ? mCapacity - mHead + end : end - mHead;
+    if (mFrameBytes + used >= mCapacity) {
+        ALOGE("StreamBuffer: frame needs more than %ld bytes", (long)mCapacity);
+        return allocation;
+    }
+
+    // Regions retire in order, so waiting on the newest overlapping one
+    // covers all older ones.
+    size_t retired = 0;
+    for (size_t i = 0; i < mInFlight.size(); i++) {
+        if (overlaps(mInFlight[i], begin, end))
+            retired = i + 1;
+    }
+    if (retired > 0)
+        waitFor(mInFlight[retired - 1]);
+    for (size_t i = 0; i < retired; i++)
+        glDeleteSync(mInFlight[i].fence);
+    mInFlight.erase(mInFlight.begin(), mInFlight.begin() + retired);
+
+    state.bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    allocation.ptr = glMapBufferRange(GL_ARRAY_BUFFER, begin, size,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+    if (!allocation.ptr) {
+        checkGlError("StreamBuffer::map");
+        return allocation;
+    }
+    allocation.offset = begin;
+    mHead = end;
+    mFrameBytes += used;
+    mMapped = true;
+    mStats.allocations++;
+    mStats.bytesStreamed += size;
+    return allocation;
+}
+
+void StreamBuffer::commit(const Allocation& allocation, GLStateCache& state) {
+    if (!allocation.ptr)
+        return;
+    state.bindBuffer(GL_ARRAY_BUFFER, mBuffer);
+    // Offsets are relative to the mapped range.
+    glFlushMappedBufferRange(GL_ARRAY_BUFFER, 0, allocation.size);
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    mMapped = false;
+}
+
+void StreamBuffer::endFrame() {
+    if (mFrameBytes == 0)
+        return;
+    Region region;
+    region.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region.begin = mFrameBegin;
+    region.end = mHead;
+    mInFlight.push_back(region);
+    mFrameBegin = mHead;
+    mFrameBytes = 0;
+}
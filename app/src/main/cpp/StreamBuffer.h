@@ -0,0 +1,85 @@
+//
+// Ring sub-allocator for per-frame GPU data over one large buffer. Ranges
+// are mapped unsynchronized, so the driver never orphans or reallocates
+// storage; instead every frame's region is fenced and an allocation only
+// waits when it would overwrite data the GPU may still be reading.
+//
+
+#ifndef OPENGL_DEMO_STREAMBUFFER_H
+#define OPENGL_DEMO_STREAMBUFFER_H
+
+#include <deque>
+
+#include "gles3jni.h"
+
+// Frames the GPU may lag behind; the ring is sized for this many.
+#define STREAM_FRAMES_IN_FLIGHT 3
+
+class StreamBuffer {
+public:
+    struct Stats {
+        unsigned int allocations;
+        unsigned int wraps;         // allocations that restarted at offset 0
+        unsigned int stalls;        // fence waits that actually blocked
+        uint64_t stallNs;
+        uint64_t bytesStreamed;
+    };
+
+    // A mapped range. ptr is NULL if the allocation failed.
+    struct Allocation {
+        void* ptr;
+        GLuint buffer;
+        GLintptr offset;
+        GLsizeiptr size;
+    };
+
+    StreamBuffer();
+
+    bool init(GLsizeiptr capacity, GLStateCache& state);
+    // Deletes the buffer and fences. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mBuffer != 0; }
+
+    GLuint buffer() const { return mBuffer; }
+    GLsizeiptr capacity() const { return mCapacity; }
+    // GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, for allocations bound as uniform blocks.
+    GLint uniformAlignment() const { return mUniformAlignment; }
+
+    // Maps size bytes at an offset that is a multiple of alignment (a power
+    // of two). Only one allocation may be mapped at a time; commit() it
+    // before the next map(). Fails if a single frame asks for more than the
+    // whole ring.
+    Allocation map(GLsizeiptr size, GLsizeiptr alignment, GLStateCache& state);
+    // Flushes and unmaps the allocation. Its contents may be used by draws
+    // issued afterwards, until the end of the frame.
+    void commit(const Allocation& allocation, GLStateCache& state);
+
+    // Fences everything allocated since the previous endFrame().
+    void endFrame();
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+private:
+    struct Region {
+        GLsync fence;
+        GLintptr begin;
+        GLintptr end;       // may be below begin if the frame wrapped
+    };
+
+    bool overlaps(const Region& region, GLintptr begin, GLintptr end) const;
+    void waitFor(const Region& region);
+
+    GLuint mBuffer;
+    GLsizeiptr mCapacity;
+    GLint mUniformAlignment;
+    GLintptr mHead;
+    GLintptr mFrameBegin;
+    GLsizeiptr mFrameBytes;
+    bool mMapped;
+    std::deque<Region> mInFlight;
+
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_STREAMBUFFER_H
@@ -0,0 +1,266 @@
+//
+// HDR scene format, tonemap and auto exposure, see ToneMapper.h.
+//
+
+#include "ToneMapper.h"
+
+#include <string.h>
+
+#include "RenderPass.h"
+
+#define STR(s) #s
+#define STRV(s) STR(s)
+
+// log2(TONEMAP_LUMINANCE_SIZE) + 1
+#define TONEMAP_LUMINANCE_LEVELS 7
+
+static const char FULLSCREEN_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "out vec2 vTexCood;\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    vTexCood = p;\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+static const char RESOLVE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision mediump float;\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform sampler2D scene;\n"
+        TONEMAP_FUNCTION
+        "void main() {\n"
+        "    outColor = vec4(toneMap(texture(scene, vTexCood).rgb), 1.0);\n"
+        "}\n";
+
+// Four bilinear taps per luminance texel, so 16 scene texels count towards
+// it. Mipmapping then averages the logs, giving the geometric mean.
+static const char LUMINANCE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "#define SIZE " STRV(TONEMAP_LUMINANCE_SIZE) ".0\n"
+        "in vec2 vTexCood;\n"
+        "out vec4 outColor;\n"
+        "uniform mediump sampler2D scene;\n"
+        "void main() {\n"
+        "    float o = 0.25 / SIZE;\n"
+        "    vec3 c = texture(scene, vTexCood + vec2(-o, -o)).rgb +\n"
+        "             texture(scene, vTexCood + vec2(o, -o)).rgb +\n"
+        "             texture(scene, vTexCood + vec2(-o, o)).rgb +\n"
+        "             texture(scene, vTexCood + vec2(o, o)).rgb;\n"
+        "    float luminance = 0.25 * dot(c, vec3(0.2126, 0.7152, 0.0722));\n"
+        "    outColor = vec4(log2(max(luminance, 1e-4)));\n"
+        "}\n";
+
+bool ToneMapper::isColorRenderable(GLenum format, GLStateCache& state) {
+    GLuint texture = 0, framebuffer = 0;
+    glGenTextures(1, &texture);
+    state.bindTexture(0, GL_TEXTURE_2D, texture);
+    glTexStorage2D(GL_TEXTURE_2D, 1, format, 4, 4);
+    glGenFramebuffers(1, &framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+    bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &framebuffer);
+    state.forgetTexture(texture);
+    glDeleteTextures(1, &texture);
+    // A format the driver doesn't know fails glTexStorage2D; don't leave the
+    // error for someone else's checkGlError.
+    while (glGetError() != GL_NO_ERROR) {}
+    return complete;
+}
+
+ToneMapper::ToneMapper()
+:   mSceneFormat(GL_RGBA8),
+    mVAO(0),
+    mResolveProgram(0),
+    mResolveExposureUniform(-1),
+    mLuminanceProgram(0),
+    mLuminance(0),
+    mLuminanceFramebuffer(0),
+    mAverageFramebuffer(0),
+    mReadbackHead(0),
+    mReadbackTail(0),
+    mFrame(0),
+    mLogAverage(0.0f),
+    mHaveAverage(false),
+    mLogExposure(0.0f),
+    mFixedExposure(false)
+{
+    memset(mReadbacks, 0, sizeof(mReadbacks));
+    resetStats();
+}
+
+bool ToneMapper::init(GLStateCache& state) {
+    if (isColorRenderable(GL_R11F_G11F_B10F, state))
+        mSceneFormat = GL_R11F_G11F_B10F;
+    else if (isColorRenderable(GL_RGBA16F, state))
+        mSceneFormat = GL_RGBA16F;
+    else
+        return false;
+
+    mResolveProgram = createProgram(FULLSCREEN_VERTEX_SHADER, RESOLVE_FRAGMENT_SHADER);
+    if (!mResolveProgram) {
+        mSceneFormat = GL_RGBA8;
+        return false;
+    }
+    mResolveExposureUniform = glGetUniformLocation(mResolveProgram, "exposure");
+    glUseProgram(mResolveProgram);
+    glUniform1i(glGetUniformLocation(mResolveProgram, "scene"), 0);
+    glGenVertexArrays(1, &mVAO);
+    ALOGV("HDR scene in %s, %d bytes/px against 8 for RGBA16F",
+          mSceneFormat == GL_R11F_G11F_B10F ? "R11F_G11F_B10F" : "RGBA16F",
+          mSceneFormat == GL_R11F_G11F_B10F ? 4 : 8);
+
+    if (isColorRenderable(GL_R16F, state))
+        mLuminanceProgram = createProgram(FULLSCREEN_VERTEX_SHADER, LUMINANCE_FRAGMENT_SHADER);
+    if (mLuminanceProgram) {
+        glUseProgram(mLuminanceProgram);
+        glUniform1i(glGetUniformLocation(mLuminanceProgram, "scene"), 0);
+
+        glGenTextures(1, &mLuminance);
+        state.bindTexture(0, GL_TEXTURE_2D, mLuminance);
+        glTexStorage2D(GL_TEXTURE_2D, TONEMAP_LUMINANCE_LEVELS, GL_R16F,
+                TONEMAP_LUMINANCE_SIZE, TONEMAP_LUMINANCE_SIZE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glGenFramebuffers(1, &mLuminanceFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mLuminanceFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mLuminance, 0);
+        glGenFramebuffers(1, &mAverageFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, mAverageFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mLuminance,
+                TONEMAP_LUMINANCE_LEVELS - 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        for (int i = 0; i < TONEMAP_READBACKS; i++) {
+            glGenBuffers(1, &mReadbacks[i].buffer);
+            state.bindBuffer(GL_PIXEL_PACK_BUFFER, mReadbacks[i].buffer);
+            glBufferData(GL_PIXEL_PACK_BUFFER, 4*sizeof(float), NULL, GL_STREAM_READ);
+        }
+        state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    } else {
+        ALOGE("Auto exposure unavailable, exposure fixed at 1");
+    }
+    glUseProgram(0);
+    return !checkGlError("ToneMapper::init");
+}
+
+void ToneMapper::destroy(GLStateCache& state) {
+    for (int i = 0; i < TONEMAP_READBACKS; i++) {
+        if (mReadbacks[i].fence)
+            glDeleteSync(mReadbacks[i].fence);
+        state.forgetBuffer(mReadbacks[i].buffer);
+        glDeleteBuffers(1, &mReadbacks[i].buffer);
+    }
+    memset(mReadbacks, 0, sizeof(mReadbacks));
+    mReadbackHead = mReadbackTail = 0;
+    glDeleteFramebuffers(1, &mLuminanceFramebuffer);
+    glDeleteFramebuffers(1, &mAverageFramebuffer);
+    state.forgetTexture(mLuminance);
+    glDeleteTextures(1, &mLuminance);
+    glDeleteProgram(mLuminanceProgram);
+    glDeleteProgram(mResolveProgram);
+    glDeleteVertexArrays(1, &mVAO);
+    mLuminanceFramebuffer = mAverageFramebuffer = 0;
+    mLuminance = 0;
+    mLuminanceProgram = mResolveProgram = 0;
+    mVAO = 0;
+    mSceneFormat = GL_RGBA8;
+}
+
+void ToneMapper::resetStats() {
+    memset(&mStats, 0, sizeof(mStats));
+}
+
+// Oldest first, stopping at the first fence that hasn't passed; they pass
+// in order.
+void ToneMapper::readResults(GLStateCache& state) {
+    while (mReadbacks[mReadbackTail].fence) {
+        Readback& slot = mReadbacks[mReadbackTail];
+        GLenum result = glClientWaitSync(slot.fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED)
+            break;
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        mReadbackTail = (mReadbackTail + 1) % TONEMAP_READBACKS;
+        if (result == GL_WAIT_FAILED) {
+            ALOGE("ToneMapper: fence wait failed");
+            continue;
+        }
+
+        state.bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+        const float* average = (const float*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                4*sizeof(float), GL_MAP_READ_BIT);
+        if (average) {
+            mLogAverage = average[0];
+            mHaveAverage = true;
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        mStats.readbacks++;
+        mStats.latencyFrames += mFrame - slot.frame;
+    }
+}
+
+void ToneMapper::setFixedExposure(float exposure) {
+    mFixedExposure = exposure > 0.0f;
+    if (mFixedExposure)
+        mLogExposure = log2f(exposure);
+}
+
+void ToneMapper::meter(GLStateCache& state, GLuint scene, uint64_t elapsedNs) {
+    if (!mLuminance || mFixedExposure)
+        return;
+    mFrame++;
+    readResults(state);
+
+    if (mHaveAverage) {
+        float target = log2f(TONEMAP_KEY) - mLogAverage;
+        float lo = log2f(TONEMAP_MIN_EXPOSURE), hi = log2f(TONEMAP_MAX_EXPOSURE);
+        target = target < lo ? lo : (target > hi ? hi : target);
+        float rate = 1.0f - expf(-(elapsedNs * 1e-9f) / TONEMAP_ADAPT_SECONDS);
+        mLogExposure += (target - mLogExposure) * rate;
+    }
+
+    Readback& slot = mReadbacks[mReadbackHead];
+    if (slot.fence) {
+        mStats.skipped++;
+        return;
+    }
+
+    RenderPass pass(mLuminanceFramebuffer, TONEMAP_LUMINANCE_SIZE, TONEMAP_LUMINANCE_SIZE);
+    pass.colorLoad = LOAD_ACTION_DONT_CARE;
+    pass.begin(state);
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mLuminanceProgram);
+    state.bindTexture(0, GL_TEXTURE_2D, scene);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    pass.end(state);
+
+    state.bindTexture(0, GL_TEXTURE_2D, mLuminance);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, mAverageFramebuffer);
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    glReadPixels(0, 0, 1, 1, GL_RGBA, GL_FLOAT, 0);
+    state.bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.frame = mFrame;
+    mReadbackHead = (mReadbackHead + 1) % TONEMAP_READBACKS;
+    mStats.metered++;
+    checkGlError("ToneMapper::meter");
+}
+
+void ToneMapper::resolve(GLStateCache& state, GLuint scene) {
+    state.setEnabled(GL_BLEND, false);
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mResolveProgram);
+    glUniform1f(mResolveExposureUniform, exposure());
+    state.bindTexture(0, GL_TEXTURE_2D, scene);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
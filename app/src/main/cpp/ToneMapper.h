@@ -0,0 +1,125 @@
+//
+// HDR scene color and its way to the 8-bit default framebuffer. The scene
+// is lit into a float target, in the cheapest format the GPU can render:
+//   R11F_G11F_B10F: 4 bytes/px, no alpha, 6/6/5 bit mantissas
+//   RGBA16F:        8 bytes/px
+// Nothing reads the scene's alpha and the mantissas are finer than the
+// 8-bit output after the curve, so the packed format costs no visible
+// quality for half the bandwidth of every pass writing or reading it.
+//
+// Whatever pass writes the frame last applies the tonemap, exposure and
+// the ACES filmic curve, through TONEMAP_FUNCTION, so it costs no pass of
+// its own: the depth of field composite, the upscale, or resolve() here
+// in place of a blit.
+//
+// Exposure adapts to the scene's average log luminance, measured on a
+// TONEMAP_LUMINANCE_SIZE^2 downsample reduced by mipmapping to 1x1 and
+// read back through a ring of pixel pack buffers with fences. Results are
+// picked up frames later, when their fence has passed, so the CPU never
+// waits for the GPU.
+//
+
+#ifndef OPENGL_DEMO_TONEMAPPER_H
+#define OPENGL_DEMO_TONEMAPPER_H
+
+#include "gles3jni.h"
+
+// Side of the luminance target, a power of two.
+#define TONEMAP_LUMINANCE_SIZE 64
+// Readbacks in flight; a frame is skipped when all are.
+#define TONEMAP_READBACKS 3
+// Average luminance the exposure maps to middle grey.
+#define TONEMAP_KEY 0.18f
+#define TONEMAP_MIN_EXPOSURE 0.25f
+#define TONEMAP_MAX_EXPOSURE 8.0f
+// Time constant of the adaptation to a new average.
+#define TONEMAP_ADAPT_SECONDS 0.5f
+
+// GLSL for the last pass of a frame, after the precision statements:
+//   vec3 toneMap(vec3 color)
+// scales by the uniform exposure and applies the ACES filmic curve
+// (Narkowicz's fit). An exposure of 0, the default, passes color through,
+// for scenes that are not HDR. The demo has no sRGB handling anywhere, so
+// the curve's output is written as is.
+#define TONEMAP_FUNCTION \
+        "uniform highp float exposure;\n" \
+        "vec3 toneMap(vec3 color) {\n" \
+        "    if (exposure <= 0.0)\n" \
+        "        return color;\n" \
+        "    highp vec3 x = min(color * exposure, vec3(64.0));\n" \
+        "    return clamp(x * (2.51 * x + 0.03) / (x * (2.43 * x + 0.59) + 0.14), 0.0, 1.0);\n" \
+        "}\n"
+
+class ToneMapper {
+public:
+    struct Stats {
+        unsigned int metered;       // luminance reductions issued
+        unsigned int skipped;       // frames with every readback in flight
+        unsigned int readbacks;     // results picked up
+        unsigned int latencyFrames; // sum over readbacks of frames waited
+    };
+
+    ToneMapper();
+
+    // Returns false without a renderable float color format, leaving the
+    // scene format GL_RGBA8. Auto exposure also needs R16F targets; without
+    // them the exposure stays at 1.
+    bool init(GLStateCache& state);
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy(GLStateCache& state);
+    bool isInitialized() const { return mResolveProgram != 0; }
+
+    // Format of the scene color target.
+    GLenum sceneFormat() const { return mSceneFormat; }
+    // Whether a texture of format can be a framebuffer's color attachment.
+    static bool isColorRenderable(GLenum format, GLStateCache& state);
+
+    // Picks up finished readbacks, moves the exposure towards them over
+    // elapsedNs, and measures scene, a texture of the HDR scene, for a
+    // later frame. Leaves blending and depth testing disabled.
+    void meter(GLStateCache& state, GLuint scene, uint64_t elapsedNs);
+    // Holds the exposure at exposure and stops metering, so frames don't
+    // depend on when readbacks finish; 0 adapts again from there.
+    void setFixedExposure(float exposure);
+    // The exposure for the tonemap, for the uniform of TONEMAP_FUNCTION.
+    float exposure() const { return exp2f(mLogExposure); }
+    // Average luminance of the last result, 0 before any.
+    float averageLuminance() const { return mHaveAverage ? exp2f(mLogAverage) : 0.0f; }
+
+    // Draws scene tonemapped over the viewport of the bound framebuffer:
+    // the final blit, when no other pass writes the output.
+    void resolve(GLStateCache& state, GLuint scene);
+
+    const Stats& stats() const { return mStats; }
+    void resetStats();
+
+private:
+    struct Readback {
+        GLuint buffer;
+        GLsync fence;       // 0 when the slot is free
+        unsigned int frame;
+    };
+
+    void readResults(GLStateCache& state);
+
+    GLenum mSceneFormat;
+    GLuint mVAO;    // empty, the fullscreen triangle comes from gl_VertexID
+    GLuint mResolveProgram;
+    GLint mResolveExposureUniform;
+    GLuint mLuminanceProgram;
+    GLuint mLuminance;  // R16F, mipmapped down to 1x1
+    GLuint mLuminanceFramebuffer;   // level 0, drawn
+    GLuint mAverageFramebuffer;     // the 1x1 level, read back
+    Readback mReadbacks[TONEMAP_READBACKS];
+    unsigned int mReadbackHead;     // next slot to issue
+    unsigned int mReadbackTail;     // oldest slot in flight
+    unsigned int mFrame;
+
+    float mLogAverage;
+    bool mHaveAverage;
+    float mLogExposure;
+    bool mFixedExposure;
+    Stats mStats;
+};
+
+#endif //OPENGL_DEMO_TONEMAPPER_H
@@ -0,0 +1,134 @@
+//
+// Weighted blended order-independent transparency, see WeightedBlendedOit.h.
+//
+
+#include "WeightedBlendedOit.h"
+
+#include <EGL/egl.h>
+#include <string.h>
+
+#include "RenderPass.h"
+
+static const char COMPOSITE_VERTEX_SHADER[] =
+        "#version 300 es\n"
+        "void main() {\n"
+        "    vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));\n"
+        "    gl_Position = vec4(2.0 * p - 1.0, 0.0, 1.0);\n"
+        "}\n";
+
+// Output alpha is the revealage, blended with ONE_MINUS_SRC_ALPHA,
+// SRC_ALPHA: scene * revealage + average * (1 - revealage). Sums past the
+// half float range are clamped to something finite rather than dropped.
+static const char COMPOSITE_FRAGMENT_SHADER[] =
+        "#version 300 es\n"
+        "precision highp float;\n"
+        "uniform sampler2D accum;\n"
+        "uniform sampler2D revealage;\n"
+        "out vec4 outColor;\n"
+        "void main() {\n"
+        "    ivec2 p = ivec2(gl_FragCoord.xy);\n"
+        "    float reveal = texelFetch(revealage, p, 0).r;\n"
+        "    if (reveal >= 1.0)\n"
+        "        discard;\n"
+        "    vec4 sum = min(texelFetch(accum, p, 0), vec4(65504.0));\n"
+        "    outColor = vec4(sum.rgb / max(sum.a, 1e-5), reveal);\n"
+        "}\n";
+
+WeightedBlendedOit::WeightedBlendedOit()
+:   mBlendFunci(NULL),
+    mVAO(0),
+    mCompositeProgram(0),
+    mAccum(-1),
+    mRevealage(-1)
+{}
+
+bool WeightedBlendedOit::init() {
+    if (!hasExtension("GL_EXT_color_buffer_half_float") &&
+            !hasExtension("GL_EXT_color_buffer_float"))
+        return false;
+    // eglGetProcAddress may return stubs for anything, so only ask for
+    // entry points the context says it has.
+    GLint major = 0, minor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if (major > 3 || (major == 3 && minor >= 2))
+        mBlendFunci = (BlendFunciProc)eglGetProcAddress("glBlendFunci");
+    else if (hasExtension("GL_OES_draw_buffers_indexed"))
+        mBlendFunci = (BlendFunciProc)eglGetProcAddress("glBlendFunciOES");
+    else if (hasExtension("GL_EXT_draw_buffers_indexed"))
+        mBlendFunci = (BlendFunciProc)eglGetProcAddress("glBlendFunciEXT");
+    if (!mBlendFunci)
+        return false;
+
+    mCompositeProgram = createProgram(COMPOSITE_VERTEX_SHADER, COMPOSITE_FRAGMENT_SHADER);
+    if (!mCompositeProgram)
+        return false;
+    glUseProgram(mCompositeProgram);
+    glUniform1i(glGetUniformLocation(mCompositeProgram, "accum"), 0);
+    glUniform1i(glGetUniformLocation(mCompositeProgram, "revealage"), 1);
+    glUseProgram(0);
+    glGenVertexArrays(1, &mVAO);
+    return !checkGlError("WeightedBlendedOit::init");
+}
+
+void WeightedBlendedOit::destroy() {
+    glDeleteVertexArrays(1, &mVAO);
+    glDeleteProgram(mCompositeProgram);
+    mVAO = 0;
+    mCompositeProgram = 0;
+}
+
+void WeightedBlendedOit::begin(GLStateCache& state, RenderTargetPool& pool, int depthTarget) {
+    const RenderTargetDesc& depth = pool.desc(depthTarget);
+    RenderTargetDesc accum = { depth.width, depth.height, GL_RGBA16F, 1 };
+    RenderTargetDesc revealage = { depth.width, depth.height, GL_R8, 1 };
+    mAccum = pool.acquire(accum, state);
+    mRevealage = pool.acquire(revealage, state);
+
+    // The clears differ per buffer, so the pass only binds, and the opaque
+    // depth is loaded and kept for whatever reads it after the composite.
+    int colors[2] = { mAccum, mRevealage };
+    RenderPass pass(pool.framebuffer(colors, 2, depthTarget), depth.width, depth.height);
+    pass.colorLoad = LOAD_ACTION_LOAD;
+    pass.depthLoad = LOAD_ACTION_LOAD;
+    pass.depthStore = STORE_ACTION_STORE;
+    pass.begin(state);
+    static const GLfloat zero[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    static const GLfloat one[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    state.colorMask(true);
+    glClearBufferfv(GL_COLOR, 0, zero);
+    glClearBufferfv(GL_COLOR, 1, one);
+
+    // The cache sees ONE, ONE on every buffer; composite() sets a function
+    // that differs from it, which brings buffer 1 back in step.
+    state.setEnabled(GL_BLEND, true);
+    state.blendFunc(GL_ONE, GL_ONE);
+    mBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+    state.setEnabled(GL_DEPTH_TEST, true);
+    state.depthFunc(GL_LESS);
+    state.depthMask(false);
+}
+
+void WeightedBlendedOit::composite(GLStateCache& state, RenderTargetPool& pool, GLuint scene) {
+    const RenderTargetDesc& desc = pool.desc(mAccum);
+    RenderPass pass(scene, desc.width, desc.height);
+    pass.colorLoad = LOAD_ACTION_LOAD;
+    pass.depthLoad = LOAD_ACTION_LOAD;
+    pass.depthStore = STORE_ACTION_STORE;
+    pass.begin(state);
+
+    state.setEnabled(GL_DEPTH_TEST, false);
+    state.blendFunc(GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA);
+    state.bindVertexArray(mVAO);
+    state.useProgram(mCompositeProgram);
+    state.bindTexture(0, GL_TEXTURE_2D, pool.name(mAccum));
+    state.bindTexture(1, GL_TEXTURE_2D, pool.name(mRevealage));
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    state.blendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    pass.end(state);
+
+    pool.release(mAccum);
+    pool.release(mRevealage);
+    mAccum = mRevealage = -1;
+    checkGlError("WeightedBlendedOit::composite");
+}
@@ -0,0 +1,68 @@
+//
+// Weighted blended order-independent transparency (McGuire and Bavoil).
+// Transparent fragments are drawn in any order, with depth testing against
+// the opaque scene but no depth writes, into two targets:
+//   accumulation: RGBA16F, sum of premultiplied color * w and alpha * w
+//   revealage:    R8, product of (1 - alpha), cleared to 1
+// where w falls off with depth so nearer surfaces dominate. A composite
+// pass then blends the weighted average color over the opaque scene by
+// 1 - revealage. Nothing is sorted, on the CPU or otherwise.
+//
+// Needs float color targets (EXT_color_buffer_half_float or _float) and
+// per-buffer blend functions (ES 3.2 or OES/EXT_draw_buffers_indexed).
+//
+
+#ifndef OPENGL_DEMO_WEIGHTEDBLENDEDOIT_H
+#define OPENGL_DEMO_WEIGHTEDBLENDEDOIT_H
+
+#include "gles3jni.h"
+#include "RenderTargetPool.h"
+
+// GLSL for the fragment shaders of transparent draws, after the precision
+// statements: declares the two outputs and
+//   void writeTransparent(vec4 color, float depth)
+// with straight (not premultiplied) alpha and depth the view depth over
+// the far plane distance.
+#define WBOIT_FRAGMENT_OUTPUTS \
+        "layout(location = 0) out highp vec4 oitAccum;\n" \
+        "layout(location = 1) out highp vec4 oitRevealage;\n" \
+        "void writeTransparent(highp vec4 color, highp float depth) {\n" \
+        "    highp float d2 = depth * depth;\n" \
+        "    highp float w = color.a * clamp(0.03 / (1e-5 + d2 * d2), 1e-2, 3e3);\n" \
+        "    oitAccum = vec4(color.rgb * color.a, color.a) * w;\n" \
+        "    oitRevealage = vec4(color.a);\n" \
+        "}\n"
+
+class WeightedBlendedOit {
+public:
+    WeightedBlendedOit();
+
+    // Returns false if the extensions above are missing.
+    bool init();
+    // Deletes the GL objects. The owner's context must be current.
+    void destroy();
+    bool isInitialized() const { return mCompositeProgram != 0; }
+
+    // Acquires and clears the two targets at the size of depthTarget, the
+    // opaque scene's depth, which is attached for testing and kept. Leaves
+    // the per-buffer blend functions, blending and depth testing on and
+    // depth writes off. Issue the transparent draws, then composite().
+    void begin(GLStateCache& state, RenderTargetPool& pool, int depthTarget);
+    // Blends the transparent layers over the opaque color in scene, a
+    // framebuffer the size of the targets, and releases them. Leaves scene
+    // bound, depth testing off and blending on with the demo's alpha blend
+    // function on every buffer.
+    void composite(GLStateCache& state, RenderTargetPool& pool, GLuint scene);
+
+private:
+    typedef void (GL_APIENTRY* BlendFunciProc)(GLuint buf, GLenum src, GLenum dst);
+
+    BlendFunciProc mBlendFunci;
+    GLuint mVAO;    // empty, the fullscreen triangle comes from gl_VertexID
+    GLuint mCompositeProgram;
+    // Pool targets between begin() and composite(), -1 otherwise.
+    int mAccum;
+    int mRevealage;
+};
+
+#endif //OPENGL_DEMO_WEIGHTEDBLENDEDOIT_H
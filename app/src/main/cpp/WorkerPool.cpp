@@ -0,0 +1,106 @@
+//
+// Small fork-join thread pool, see WorkerPool.h.
+//
+
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned int numWorkers)
+:   mQuit(false),
+    mGeneration(0),
+    mActiveWorkers(0),
+    mFn(NULL),
+    mCount(0),
+    mGrain(1),
+    mNumChunks(0),
+    mNextChunk(0),
+    mChunksDone(0)
+{
+    for (unsigned int i = 0; i < numWorkers; i++)
+        mThreads.push_back(std::thread(&WorkerPool::workerLoop, this));
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mQuit = true;
+    }
+    mWake.notify_all();
+    for (size_t i = 0; i < mThreads.size(); i++)
+        mThreads[i].join();
+}
+
+WorkerPool& WorkerPool::shared() {
+    static WorkerPool pool(std::thread::hardware_concurrency() > 1 ?
+            std::thread::hardware_concurrency() - 1 : 0);
+    return pool;
+}
+
+void WorkerPool::parallelFor(unsigned int count, unsigned int grain, const RangeFn& fn) {
+    if (grain == 0)
+        grain = 1;
+    unsigned int numChunks = (count + grain - 1) / grain;
+    if (numChunks <= 1 || mThreads.empty()) {
+        if (count > 0)
+            fn(0, count);
+        return;
+    }
+
+    std::lock_guard<std::mutex> submit(mSubmitMutex);
+    {
+        // Workers that woke up late for the previous job may still be polling
+        // its chunk counter; let them drain before the job fields change.
+        std::unique_lock<std::mutex> lock(mMutex);
+        mDone.wait(lock, [this] { return mActiveWorkers == 0; });
+        mFn = &fn;
+        mCount = count;
+        mGrain = grain;
+        mNumChunks = numChunks;
+        mChunksDone = 0;
+        mNextChunk = 0;
+        mGeneration++;
+    }
+    mWake.notify_all();
+
+    while (runChunk()) {
+    }
+
+    std::unique_lock<std::mutex> lock(mMutex);
+    mDone.wait(lock, [this] { return mChunksDone == mNumChunks; });
+}
+
+bool WorkerPool::runChunk() {
+    unsigned int chunk = mNextChunk.fetch_add(1);
+    if (chunk >= mNumChunks)
+        return false;
+
+    unsigned int begin = chunk * mGrain;
+    unsigned int end = begin + mGrain < mCount ? begin + mGrain : mCount;
+    (*mFn)(begin, end);
+
+    if (mChunksDone.fetch_add(1) + 1 == mNumChunks) {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mDone.notify_all();
+    }
+    return true;
+}
+
+void WorkerPool::workerLoop() {
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(mMutex);
+            mWake.wait(lock, [this, seen] { return mQuit || mGeneration != seen; });
+            if (mQuit)
+                return;
+            seen = mGeneration;
+            mActiveWorkers++;
+        }
+        while (runChunk()) {
+        }
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mActiveWorkers--;
+        }
+        mDone.notify_all();
+    }
+}
@@ -0,0 +1,54 @@
+//
+// Small fork-join thread pool for splitting CPU-side per-frame work
+// (instance animation, culling, light binning) across cores.
+//
+
+#ifndef OPENGL_DEMO_WORKERPOOL_H
+#define OPENGL_DEMO_WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class WorkerPool {
+public:
+    typedef std::function<void(unsigned int begin, unsigned int end)> RangeFn;
+
+    explicit WorkerPool(unsigned int numWorkers);
+    ~WorkerPool();
+
+    // Splits [0, count) into chunks of `grain` items and runs fn on them,
+    // on the workers and the calling thread. Returns when every chunk is done.
+    void parallelFor(unsigned int count, unsigned int grain, const RangeFn& fn);
+
+    // Worker threads plus the calling thread.
+    unsigned int threadCount() const { return (unsigned int)mThreads.size() + 1; }
+
+    // Process-wide pool with one worker per additional CPU.
+    static WorkerPool& shared();
+
+private:
+    void workerLoop();
+    bool runChunk();
+
+    std::vector<std::thread> mThreads;
+    std::mutex mSubmitMutex;    // one parallelFor at a time
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::condition_variable mDone;
+    bool mQuit;
+    uint64_t mGeneration;
+    unsigned int mActiveWorkers;    // workers inside the chunk loop
+
+    const RangeFn* mFn;
+    unsigned int mCount;
+    unsigned int mGrain;
+    unsigned int mNumChunks;
+    std::atomic<unsigned int> mNextChunk;
+    std::atomic<unsigned int> mChunksDone;
+};
+
+#endif //OPENGL_DEMO_WORKERPOOL_H
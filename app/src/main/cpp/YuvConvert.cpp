@@ -0,0 +1,205 @@
+//
+// RGBA8 to I420 conversion, scalar and SIMD, see YuvConvert.h.
+//
+
+#include "YuvConvert.h"
+#include "Simd.h"
+
+// Pixels per SIMD step, on each of two rows.
+#define YUV_SIMD_WIDTH 16
+
+size_t i420Size(int width, int height) {
+    size_t chroma = (size_t)((width + 1) / 2) * (size_t)((height + 1) / 2);
+    return (size_t)width * (size_t)height + 2 * chroma;
+}
+
+I420Planes i420Planes(uint8_t* buffer, int width, int height) {
+    size_t chroma = (size_t)((width + 1) / 2) * (size_t)((height + 1) / 2);
+    I420Planes planes;
+    planes.y = buffer;
+    planes.u = planes.y + (size_t)width * (size_t)height;
+    planes.v = planes.u + chroma;
+    return planes;
+}
+
+static inline uint8_t luma(int r, int g, int b) {
+    return (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+// Converts the row pair starting at row y, from column x0 (even) to the
+// end. The last row and column of odd sizes stand in for their missing
+// neighbours in the chroma average.
+static void convertRowPairScalar(const uint8_t* rgba, ptrdiff_t stride, int width, int height,
+        const I420Planes& out, int y, int x0) {
+    const uint8_t* row0 = rgba + y * stride;
+    const uint8_t* row1 = y + 1 < height ? row0 + stride : row0;
+    uint8_t* y0 = out.y + (size_t)y * width;
+    uint8_t* y1 = y + 1 < height ? y0 + width : NULL;
+    int chromaWidth = (width + 1) / 2;
+    uint8_t* u = out.u + (size_t)(y / 2) * chromaWidth;
+    uint8_t* v = out.v + (size_t)(y / 2) * chromaWidth;
+
+    for (int x = x0; x < width; x += 2) {
+        int right = x + 1 < width ? 4 : 0;
+        const uint8_t* p00 = row0 + x * 4;
+        const uint8_t* p01 = p00 + right;
+        const uint8_t* p10 = row1 + x * 4;
+        const uint8_t* p11 = p10 + right;
+
+        y0[x] = luma(p00[0], p00[1], p00[2]);
+        if (right)
+            y0[x + 1] = luma(p01[0], p01[1], p01[2]);
+        if (y1) {
+            y1[x] = luma(p10[0], p10[1], p10[2]);
+            if (right)
+                y1[x + 1] = luma(p11[0], p11[1], p11[2]);
+        }
+
+        int r = (p00[0] + p01[0] + p10[0] + p11[0] + 2) >> 2;
+        int g = (p00[1] + p01[1] + p10[1] + p11[1] + 2) >> 2;
+        int b = (p00[2] + p01[2] + p10[2] + p11[2] + 2) >> 2;
+        u[x / 2] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+        v[x / 2] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+    }
+}
+
+void rgbaToI420Scalar(const uint8_t* rgba, ptrdiff_t stride, int width, int height,
+        const I420Planes& out) {
+    for (int y = 0; y < height; y += 2)
+        convertRowPairScalar(rgba, stride, width, height, out, y, 0);
+}
+
+#if SIMD_NEON
+
+static inline uint8x8_t lumaNeon(uint8x8_t r, uint8x8_t g, uint8x8_t b) {
+    uint16x8_t t = vmull_u8(r, vdup_n_u8(66));
+    t = vmlal_u8(t, g, vdup_n_u8(129));
+    t = vmlal_u8(t, b, vdup_n_u8(25));
+    t = vaddq_u16(t, vdupq_n_u16(128));
+    return vadd_u8(vshrn_n_u16(t, 8), vdup_n_u8(16));
+}
+
+static inline uint8x16_t lumaNeon(uint8x16x4_t p) {
+    return vcombine_u8(lumaNeon(vget_low_u8(p.val[0]), vget_low_u8(p.val[1]), vget_low_u8(p.val[2])),
+            lumaNeon(vget_high_u8(p.val[0]), vget_high_u8(p.val[1]), vget_high_u8(p.val[2])));
+}
+
+static inline uint8x8_t chromaNeon(int16x8_t r, int16x8_t g, int16x8_t b,
+        int16_t kr, int16_t kg, int16_t kb) {
+    int16x8_t t = vmulq_n_s16(r, kr);
+    t = vmlaq_n_s16(t, g, kg);
+    t = vmlaq_n_s16(t, b, kb);
+    t = vshrq_n_s16(vaddq_s16(t, vdupq_n_s16(128)), 8);
+    return vqmovun_s16(vaddq_s16(t, vdupq_n_s16(128)));
+}
+
+static void convertRowPairSimd(const uint8_t* row0, const uint8_t* row1,
+        uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v) {
+    uint8x16x4_t top = vld4q_u8(row0);
+    uint8x16x4_t bottom = vld4q_u8(row1);
+    vst1q_u8(y0, lumaNeon(top));
+    vst1q_u8(y1, lumaNeon(bottom));
+
+    // 2x2 sums: pairwise across the row, then accumulate the row below.
+    // The rounding shift is the (sum + 2) >> 2 of the scalar code.
+    int16x8_t r = vreinterpretq_s16_u16(vrshrq_n_u16(
+            vpadalq_u8(vpaddlq_u8(top.val[0]), bottom.val[0]), 2));
+    int16x8_t g = vreinterpretq_s16_u16(vrshrq_n_u16(
+            vpadalq_u8(vpaddlq_u8(top.val[1]), bottom.val[1]), 2));
+    int16x8_t b = vreinterpretq_s16_u16(vrshrq_n_u16(
+            vpadalq_u8(vpaddlq_u8(top.val[2]), bottom.val[2]), 2));
+    vst1_u8(u, chromaNeon(r, g, b, -38, -74, 112));
+    vst1_u8(v, chromaNeon(r, g, b, 112, -94, -18));
+}
+
+#elif SIMD_SSE
+
+// Channels of 8 pixels, each a 16-bit lane.
+struct Channels16 {
+    __m128i r, g, b;
+};
+
+static inline Channels16 unpackSse(const uint8_t* p) {
+    const __m128i mask = _mm_set1_epi32(0xff);
+    __m128i a = _mm_loadu_si128((const __m128i*)p);
+    __m128i c = _mm_loadu_si128((const __m128i*)(p + 16));
+    Channels16 ch;
+    ch.r = _mm_packs_epi32(_mm_and_si128(a, mask), _mm_and_si128(c, mask));
+    ch.g = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 8), mask),
+            _mm_and_si128(_mm_srli_epi32(c, 8), mask));
+    ch.b = _mm_packs_epi32(_mm_and_si128(_mm_srli_epi32(a, 16), mask),
+            _mm_and_si128(_mm_srli_epi32(c, 16), mask));
+    return ch;
+}
+
+// Fits 16 bits unsigned: at most 220 * 255 + 128.
+static inline __m128i lumaSse(const Channels16& ch) {
+    __m128i t = _mm_mullo_epi16(ch.r, _mm_set1_epi16(66));
+    t = _mm_add_epi16(t, _mm_mullo_epi16(ch.g, _mm_set1_epi16(129)));
+    t = _mm_add_epi16(t, _mm_mullo_epi16(ch.b, _mm_set1_epi16(25)));
+    t = _mm_srli_epi16(_mm_add_epi16(t, _mm_set1_epi16(128)), 8);
+    return _mm_add_epi16(t, _mm_set1_epi16(16));
+}
+
+// Sums of horizontal pairs of 16 pixels, as 8 16-bit lanes.
+static inline __m128i pairSumsSse(__m128i lo, __m128i hi) {
+    const __m128i ones = _mm_set1_epi16(1);
+    return _mm_packs_epi32(_mm_madd_epi16(lo, ones), _mm_madd_epi16(hi, ones));
+}
+
+// Fits 16 bits signed: at most 112 * 255 + 128 either way.
+static inline __m128i chromaSse(__m128i r, __m128i g, __m128i b,
+        int16_t kr, int16_t kg, int16_t kb) {
+    __m128i t = _mm_mullo_epi16(r, _mm_set1_epi16(kr));
+    t = _mm_add_epi16(t, _mm_mullo_epi16(g, _mm_set1_epi16(kg)));
+    t = _mm_add_epi16(t, _mm_mullo_epi16(b, _mm_set1_epi16(kb)));
+    t = _mm_srai_epi16(_mm_add_epi16(t, _mm_set1_epi16(128)), 8);
+    t = _mm_add_epi16(t, _mm_set1_epi16(128));
+    return _mm_packus_epi16(t, t);
+}
+
+static void convertRowPairSimd(const uint8_t* row0, const uint8_t* row1,
+        uint8_t* y0, uint8_t* y1, uint8_t* u, uint8_t* v) {
+    Channels16 top0 = unpackSse(row0);
+    Channels16 top1 = unpackSse(row0 + 32);
+    Channels16 bottom0 = unpackSse(row1);
+    Channels16 bottom1 = unpackSse(row1 + 32);
+    _mm_storeu_si128((__m128i*)y0, _mm_packus_epi16(lumaSse(top0), lumaSse(top1)));
+    _mm_storeu_si128((__m128i*)y1, _mm_packus_epi16(lumaSse(bottom0), lumaSse(bottom1)));
+
+    const __m128i two = _mm_set1_epi16(2);
+    __m128i r = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairSumsSse(top0.r, top1.r),
+            pairSumsSse(bottom0.r, bottom1.r)), two), 2);
+    __m128i g = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairSumsSse(top0.g, top1.g),
+            pairSumsSse(bottom0.g, bottom1.g)), two), 2);
+    __m128i b = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(pairSumsSse(top0.b, top1.b),
+            pairSumsSse(bottom0.b, bottom1.b)), two), 2);
+    _mm_storel_epi64((__m128i*)u, chromaSse(r, g, b, -38, -74, 112));
+    _mm_storel_epi64((__m128i*)v, chromaSse(r, g, b, 112, -94, -18));
+}
+
+#endif
+
+void rgbaToI420(const uint8_t* rgba, ptrdiff_t stride, int width, int height,
+        const I420Planes& out) {
+#if SIMD_SCALAR
+    rgbaToI420Scalar(rgba, stride, width, height, out);
+#else
+    int chromaWidth = (width + 1) / 2;
+    int simdWidth = width / YUV_SIMD_WIDTH * YUV_SIMD_WIDTH;
+    for (int y = 0; y < height; y += 2) {
+        int x = 0;
+        if (y + 1 < height) {
+            const uint8_t* row0 = rgba + y * stride;
+            uint8_t* y0 = out.y + (size_t)y * width;
+            uint8_t* u = out.u + (size_t)(y / 2) * chromaWidth;
+            uint8_t* v = out.v + (size_t)(y / 2) * chromaWidth;
+            for (; x < simdWidth; x += YUV_SIMD_WIDTH)
+                convertRowPairSimd(row0 + x * 4, row0 + stride + x * 4,
+                        y0 + x, y0 + width + x, u + x / 2, v + x / 2);
+        }
+        if (x < width)
+            convertRowPairScalar(rgba, stride, width, height, out, y, x);
+    }
+#endif
+}
@@ -0,0 +1,39 @@
+//
+// RGBA8 to I420 (YUV 4:2:0 planar) conversion for video encoders. BT.601
+// limited range in integer arithmetic:
+//   Y = (( 66 R + 129 G +  25 B + 128) >> 8) + 16
+//   U = ((-38 R -  74 G + 112 B + 128) >> 8) + 128
+//   V = ((112 R -  94 G -  18 B + 128) >> 8) + 128
+// with U and V taken from the rounded average of each 2x2 block. The SIMD
+// version does 16 pixels of two rows at a time (NEON or SSE2) and matches
+// the scalar one bit for bit.
+//
+
+#ifndef OPENGL_DEMO_YUVCONVERT_H
+#define OPENGL_DEMO_YUVCONVERT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Planes of an I420 image: Y is width x height, U and V are
+// (width + 1) / 2 x (height + 1) / 2, each tightly packed.
+struct I420Planes {
+    uint8_t* y;
+    uint8_t* u;
+    uint8_t* v;
+};
+
+// Bytes of an I420 image of that size.
+size_t i420Size(int width, int height);
+// Points the planes into a buffer of i420Size() bytes.
+I420Planes i420Planes(uint8_t* buffer, int width, int height);
+
+// Converts width x height RGBA8 pixels, rows stride bytes apart. A negative
+// stride with rgba at the last row flips the image, as glReadPixels rows
+// come bottom up.
+void rgbaToI420Scalar(const uint8_t* rgba, ptrdiff_t stride, int width, int height,
+        const I420Planes& out);
+void rgbaToI420(const uint8_t* rgba, ptrdiff_t stride, int width, int height,
+        const I420Planes& out);
+
+#endif //OPENGL_DEMO_YUVCONVERT_H
@@ -14,14 +14,21 @@
  * limitations under the License.
  */
 
-#include <jni.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#if defined(__ANDROID__)
+#include <jni.h>
 #include <android/bitmap.h>
+#endif
 
 #include "gles3jni.h"
+#include "BatchRenderer.h"
+#include "RegressionSuite.h"
+#include "Benchmark.h"
+#include "InstanceKernel.h"
+#include "Ibl.h"
 
 
 const Vertex QUAD[4] = {
@@ -44,6 +51,31 @@ bool checkGlError(const char* funcName) {
     return false;
 }
 
+bool hasExtension(const char* name) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for (GLint i = 0; i < count; i++) {
+        const char* ext = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+        if (ext && strcmp(ext, name) == 0)
+            return true;
+    }
+    return false;
+}
+
+// EGL lists its extensions in one space separated string.
+bool hasEglExtension(EGLDisplay display, const char* name) {
+    const char* extensions = eglQueryString(display, EGL_EXTENSIONS);
+    size_t length = strlen(name);
+    while (extensions && *extensions) {
+        const char* end = strchr(extensions, ' ');
+        size_t n = end ? (size_t)(end - extensions) : strlen(extensions);
+        if (n == length && strncmp(extensions, name, length) == 0)
+            return true;
+        extensions = end ? end + 1 : NULL;
+    }
+    return false;
+}
+
 GLuint createShader(GLenum shaderType, const char* src) {
     GLuint shader = glCreateShader(shaderType);
     if (!shader) {
@@ -63,7 +95,8 @@ GLuint createShader(GLenum shaderType, const char* src) {
             if (infoLog) {
                 glGetShaderInfoLog(shader, infoLogLen, NULL, infoLog);
                 ALOGE("Could not compile %s shader:\n%s\n",
-                        shaderType == GL_VERTEX_SHADER ? "vertex" : "fragment",
+                        shaderType == GL_VERTEX_SHADER ? "vertex" :
+                        shaderType == GL_FRAGMENT_SHADER ? "fragment" : "compute",
                         infoLog);
                 free(infoLog);
             }
@@ -121,31 +154,85 @@ exit:
     return program;
 }
 
-static void printGlString(const char* name, GLenum s) {
-    const char* v = (const char*)glGetString(s);
-    ALOGV("GL %s: %s\n", name, v);
+#if HAVE_ES31_API
+GLuint createComputeProgram(const char* src) {
+    GLuint shader = createShader(GL_COMPUTE_SHADER, src);
+    if (!shader)
+        return 0;
+    GLuint program = glCreateProgram();
+    if (!program) {
+        checkGlError("glCreateProgram");
+        glDeleteShader(shader);
+        return 0;
+    }
+    glAttachShader(program, shader);
+    glLinkProgram(program);
+    glDeleteShader(shader);
+    GLint linked = GL_FALSE;
+    glGetProgramiv(program, GL_LINK_STATUS, &linked);
+    if (!linked) {
+        GLint infoLogLen = 0;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &infoLogLen);
+        if (infoLogLen) {
+            GLchar* infoLog = (GLchar*)malloc(infoLogLen);
+            if (infoLog) {
+                glGetProgramInfoLog(program, infoLogLen, NULL, infoLog);
+                ALOGE("Could not link compute program:\n%s\n", infoLog);
+                free(infoLog);
+            }
+        }
+        glDeleteProgram(program);
+        program = 0;
+    }
+    return program;
+}
+#endif
+
+uint64_t nowNs() {
+    timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec*1000000000ull + now.tv_nsec;
 }
 
 // ----------------------------------------------------------------------------
 
 Renderer::Renderer()
-:   mNumInstances(0),
-    mLastFrameNs(0)
+:   mWidth(0),
+    mHeight(0),
+    mOutputFramebuffer(0),
+    mInstanceTarget(0),
+    mNumInstances(0),
+    mGridAspect(1.0f),
+    mPortrait(false),
+    mLastFrameNs(0),
+    mFixedFrameNs(0),
+    mFixedClockNs(0)
 {
+    memset(mGridCells, 0, sizeof(mGridCells));
     memset(mScale, 0, sizeof(mScale));
-    memset(mAngularVelocity, 0, sizeof(mAngularVelocity));
-    memset(mAngles, 0, sizeof(mAngles));
 }
 
 Renderer::~Renderer() {
 }
 
 void Renderer::resize(int w, int h) {
-/*
-    auto offsets = mapOffsetBuf();
-    calcSceneParams(w, h, offsets);
-    unmapOffsetBuf();
+    calcSceneParams(w, h);
+    if (!usesInstanceGrid())
+        mNumInstances = 0;
+    if (!mAngles.resize(mNumInstances) || !mAngularVelocity.resize(mNumInstances)) {
+        ALOGE("Out of memory for %u instances", mNumInstances);
+        mNumInstances = 0;
+    }
+    auto offsets = mNumInstances ? mapOffsetBuf(mNumInstances) : NULL;
+    if (offsets) {
+        layoutInstances(offsets);
+        unmapOffsetBuf();
+    } else {
+        mNumInstances = 0;
+    }
 
+    if (mFixedFrameNs)
+        srand48(RENDERER_FIXED_SEED);
     // Auto gives a signed int :-(
     for (auto i = (unsigned)0; i < mNumInstances; i++) {
         mAngles[i] = drand48() * TWO_PI;
@@ -153,89 +240,96 @@ void Renderer::resize(int w, int h) {
     }
 
     mLastFrameNs = 0;
-*/
 
-    glViewport(0, 0, w, h);
+    mWidth = w;
+    mHeight = h;
+    mGLState.viewport(0, 0, w, h);
 }
 
-void Renderer::calcSceneParams(unsigned int w, unsigned int h,
-        float* offsets) {
-    // number of cells along the larger screen dimension
-    const float NCELLS_MAJOR = MAX_INSTANCES_PER_SIDE;
-    // cell size in scene space
-    const float CELL_SIZE = 2.0f / NCELLS_MAJOR;
-
+void Renderer::calcSceneParams(unsigned int w, unsigned int h) {
     // Calculations are done in "landscape", i.e. assuming dim[0] >= dim[1].
     // Only at the end are values put in the opposite order if h > w.
     const float dim[2] = {fmaxf(w,h), fminf(w,h)};
     const float aspect[2] = {dim[0] / dim[1], dim[1] / dim[0]};
-    const float scene2clip[2] = {1.0f, aspect[0]};
-    const int ncells[2] = {
-            static_cast<int>(NCELLS_MAJOR),
-            (int)floorf(NCELLS_MAJOR * aspect[1])
-    };
-
-    float centers[2][MAX_INSTANCES_PER_SIDE];
-    for (int d = 0; d < 2; d++) {
-        auto offset = -ncells[d] / NCELLS_MAJOR; // -1.0 for d=0
-        for (auto i = 0; i < ncells[d]; i++) {
-            centers[d][i] = scene2clip[d] * (CELL_SIZE*(i + 0.5f) + offset);
-        }
-    }
 
-    int major = w >= h ? 0 : 1;
-    int minor = w >= h ? 1 : 0;
-    // outer product of centers[0] and centers[1]
-    for (int i = 0; i < ncells[0]; i++) {
-        for (int j = 0; j < ncells[1]; j++) {
-            int idx = i*ncells[1] + j;
-            offsets[2*idx + major] = centers[0][i];
-            offsets[2*idx + minor] = centers[1][j];
+    // number of cells along the larger screen dimension: square cells
+    // holding about mInstanceTarget instances have aspect[0] times as many
+    // along it as along the shorter one.
+    unsigned int major = INSTANCES_PER_SIDE;
+    if (mInstanceTarget)
+        major = (unsigned int)floorf(sqrtf(mInstanceTarget * aspect[0]));
+    if (major < 1)
+        major = 1;
+    unsigned int minor = (unsigned int)floorf(major * aspect[1]);
+    if (minor < 1)
+        minor = 1;
+    // cell size in scene space
+    const float CELL_SIZE = 2.0f / major;
+
+    mGridCells[0] = major;
+    mGridCells[1] = minor;
+    mGridAspect = aspect[0];
+    mPortrait = h > w;
+    mNumInstances = major * minor;
+    mScale[mPortrait ? 1 : 0] = 0.5f * CELL_SIZE;
+    mScale[mPortrait ? 0 : 1] = 0.5f * CELL_SIZE * aspect[0];
+}
+
+// Instance i*cells[1] + j sits at the center of cell (i, j), computed
+// directly from the indices so the grid needs no storage of its own.
+void Renderer::layoutInstances(float* offsets) const {
+    const float NCELLS_MAJOR = (float)mGridCells[0];
+    const float CELL_SIZE = 2.0f / NCELLS_MAJOR;
+    const float scene2clip[2] = {1.0f, mGridAspect};
+    float origin[2];
+    for (int d = 0; d < 2; d++)
+        origin[d] = -(float)mGridCells[d] / NCELLS_MAJOR; // -1.0 for d=0
+
+    const int major = mPortrait ? 1 : 0;
+    const int minor = mPortrait ? 0 : 1;
+    for (unsigned int i = 0; i < mGridCells[0]; i++) {
+        float x = scene2clip[0] * (CELL_SIZE*(i + 0.5f) + origin[0]);
+        float* row = offsets + 2 * (size_t)i * mGridCells[1];
+        for (unsigned int j = 0; j < mGridCells[1]; j++) {
+            row[2*j + major] = x;
+            row[2*j + minor] = scene2clip[1] * (CELL_SIZE*(j + 0.5f) + origin[1]);
         }
     }
+}
 
-    mNumInstances = ncells[0] * ncells[1];
-    mScale[major] = 0.5f * CELL_SIZE * scene2clip[0];
-    mScale[minor] = 0.5f * CELL_SIZE * scene2clip[1];
+void Renderer::setInstanceCount(unsigned int count) {
+    mInstanceTarget = count;
+    if (mWidth > 0 && mHeight > 0)
+        resize(mWidth, mHeight);
+}
+
+void Renderer::setFixedClock(uint64_t frameNs) {
+    mFixedFrameNs = frameNs;
+    mFixedClockNs = 0;
+    mLastFrameNs = 0;
 }
 
 void Renderer::step() {
-    timespec now;
-    clock_gettime(CLOCK_MONOTONIC, &now);
-    auto nowNs = now.tv_sec*1000000000ull + now.tv_nsec;
+    auto frameNs = frameTimeNs();
 
     if (mLastFrameNs > 0) {
-        float dt = float(nowNs - mLastFrameNs) * 0.000000001f;
-
-        for (unsigned int i = 0; i < mNumInstances; i++) {
-            mAngles[i] += mAngularVelocity[i] * dt;
-            if (mAngles[i] >= TWO_PI) {
-                mAngles[i] -= TWO_PI;
-            } else if (mAngles[i] <= -TWO_PI) {
-                mAngles[i] += TWO_PI;
-            }
-        }
+        float dt = float(frameNs - mLastFrameNs) * 0.000000001f;
 
-        float* transforms = mapTransformBuf();
-        for (unsigned int i = 0; i < mNumInstances; i++) {
-            float s = sinf(mAngles[i]);
-            float c = cosf(mAngles[i]);
-            transforms[4*i + 0] =  c * mScale[0];
-            transforms[4*i + 1] =  s * mScale[1];
-            transforms[4*i + 2] = -s * mScale[0];
-            transforms[4*i + 3] =  c * mScale[1];
+        float* transforms = mNumInstances ? mapTransformBuf(mNumInstances) : NULL;
+        if (transforms) {
+            stepInstances(mAngles.data(), mAngularVelocity.data(), mScale, dt, mNumInstances,
+                    transforms);
+            unmapTransformBuf();
         }
-        unmapTransformBuf();
     }
 
-    mLastFrameNs = nowNs;
+    mLastFrameNs = frameNs;
 }
 
 void Renderer::render() {
-//    step();
-
-    glClearColor(0.2f, 0.2f, 0.6f, 1.0f);
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    if (mFixedFrameNs)
+        mFixedClockNs += mFixedFrameNs;
+    step();
     draw(mNumInstances);
     checkGlError("Renderer::render");
 }
@@ -249,13 +343,29 @@ void Renderer::setDepthTexture(uint32_t *data, int width, int height) {
 }
 
 // ----------------------------------------------------------------------------
+// JNI entry points of the app. Host builds only get the tools in tools/.
+
+#if defined(__ANDROID__)
+
+static void printGlString(const char* name, GLenum s) {
+    const char* v = (const char*)glGetString(s);
+    ALOGV("GL %s: %s\n", name, v);
+}
 
 static Renderer* g_renderer = NULL;
 
 extern "C" {
     JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jclass type);
+    JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_setCacheDir(JNIEnv* env, jclass type, jstring dir);
     JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_resize(JNIEnv* env, jclass type, jint width, jint height);
     JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_step(JNIEnv* env, jclass type);
+    JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_setInstanceCount(JNIEnv* env, jclass type, jint count);
+    JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_setOcclusionAbTest(JNIEnv* env, jclass type, jboolean enabled);
+    JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_benchmark(JNIEnv* env, jclass type);
+    JNIEXPORT jint JNICALL Java_com_android_gles3jni_GLES3JNILib_renderBatch(JNIEnv* env,
+            jclass type, jobjectArray modelPaths, jstring outputDir, jint views, jint size);
+    JNIEXPORT jint JNICALL Java_com_android_gles3jni_GLES3JNILib_runRegression(JNIEnv* env,
+            jclass type, jstring goldenDir, jstring reportDir, jboolean updateGoldens);
     JNIEXPORT void JNICALL Java_com_android_gles3jni_GLES3JNILib_set2DTexture(
             JNIEnv *env, jclass type, jobject bmp, jint height, jint width);
 
@@ -291,6 +401,13 @@ Java_com_android_gles3jni_GLES3JNILib_init(JNIEnv* env, jclass type) {
     }
 }
 
+JNIEXPORT void JNICALL
+Java_com_android_gles3jni_GLES3JNILib_setCacheDir(JNIEnv* env, jclass type, jstring dir) {
+    const char* chars = env->GetStringUTFChars(dir, NULL);
+    setIblCacheDir(chars);
+    env->ReleaseStringUTFChars(dir, chars);
+}
+
 JNIEXPORT void JNICALL
 Java_com_android_gles3jni_GLES3JNILib_resize(JNIEnv* env, jclass type, jint width, jint height) {
     if (g_renderer) {
@@ -305,6 +422,56 @@ Java_com_android_gles3jni_GLES3JNILib_step(JNIEnv* env, jclass type) {
     }
 }
 
+JNIEXPORT void JNICALL
+Java_com_android_gles3jni_GLES3JNILib_setInstanceCount(JNIEnv* env, jclass type, jint count) {
+    if (g_renderer) {
+        g_renderer->setInstanceCount(count > 0 ? (unsigned int)count : 0);
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_android_gles3jni_GLES3JNILib_setOcclusionAbTest(JNIEnv* env, jclass type, jboolean enabled) {
+    if (g_renderer) {
+        g_renderer->setOcclusionAbTest(enabled != 0);
+    }
+}
+
+JNIEXPORT void JNICALL
+Java_com_android_gles3jni_GLES3JNILib_benchmark(JNIEnv* env, jclass type) {
+    runBenchmarks();
+}
+
+JNIEXPORT jint JNICALL
+Java_com_android_gles3jni_GLES3JNILib_renderBatch(JNIEnv* env, jclass type,
+        jobjectArray modelPaths, jstring outputDir, jint views, jint size) {
+    std::vector<std::string> paths;
+    jsize count = env->GetArrayLength(modelPaths);
+    for (jsize i = 0; i < count; i++) {
+        jstring path = (jstring)env->GetObjectArrayElement(modelPaths, i);
+        const char* chars = env->GetStringUTFChars(path, NULL);
+        paths.push_back(chars);
+        env->ReleaseStringUTFChars(path, chars);
+        env->DeleteLocalRef(path);
+    }
+    const char* dir = env->GetStringUTFChars(outputDir, NULL);
+    BatchOptions options = { size, size, (unsigned int)views, BATCH_FORMAT_PNG, dir };
+    int rendered = renderBatch(paths, options);
+    env->ReleaseStringUTFChars(outputDir, dir);
+    return rendered;
+}
+
+JNIEXPORT jint JNICALL
+Java_com_android_gles3jni_GLES3JNILib_runRegression(JNIEnv* env, jclass type,
+        jstring goldenDir, jstring reportDir, jboolean updateGoldens) {
+    const char* golden = env->GetStringUTFChars(goldenDir, NULL);
+    const char* report = env->GetStringUTFChars(reportDir, NULL);
+    RegressionOptions options = { golden, report, updateGoldens != 0, 0.0f };
+    int failures = runRegressionSuite(options);
+    env->ReleaseStringUTFChars(reportDir, report);
+    env->ReleaseStringUTFChars(goldenDir, golden);
+    return failures;
+}
+
 void Java_com_android_gles3jni_GLES3JNILib_set2DTexture(JNIEnv *env, jclass type, jobject bmp,
                                                         jint height, jint width) {
     uint32_t *bmp_data = nullptr;
@@ -342,3 +509,4 @@ void Java_com_android_gles3jni_GLES3JNILib_setDepthTexture(JNIEnv *env, jclass t
     AndroidBitmap_unlockPixels(env, bmp);
 }
 
+#endif // __ANDROID__
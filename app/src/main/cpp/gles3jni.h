@@ -17,14 +17,21 @@
 #ifndef GLES3JNI_H
 #define GLES3JNI_H 1
 
+#if defined(__ANDROID__)
 #include <android/log.h>
+#else
+#include <stdio.h>
+#endif
 #include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 
 #if DYNAMIC_ES3
 #include "gl3stub.h"
 #else
-// Include the latest possible header file( GL version header )
-#if __ANDROID_API__ >= 24
+// Include the latest possible header file( GL version header ). Host
+// builds (the regression and batch tools, on Mesa) get the ES 3.2 one.
+#if !defined(__ANDROID__) || __ANDROID_API__ >= 24
 #include <GLES3/gl32.h>
 #elif __ANDROID_API__ >= 21
 #include <GLES3/gl31.h>
@@ -33,25 +40,52 @@
 #endif
 
 #endif
+#include <EGL/egl.h>
+
+// ES 3.1 entry points (compute shaders, indirect draws) are only declared,
+// and exported by libGLESv3, from API 21 on. Code using them also has to
+// check the context version.
+#if !DYNAMIC_ES3 && (!defined(__ANDROID__) || __ANDROID_API__ >= 21)
+#define HAVE_ES31_API 1
+#else
+#define HAVE_ES31_API 0
+#endif
+
+#include "AlignedArray.h"
+#include "GLStateCache.h"
 
 #define DEBUG 1
 
 #define LOG_TAG "GLES3JNI"
+#if defined(__ANDROID__)
 #define ALOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
 #if DEBUG
 #define ALOGV(...) __android_log_print(ANDROID_LOG_VERBOSE, LOG_TAG, __VA_ARGS__)
 #else
 #define ALOGV(...)
 #endif
+#else
+// Off the device, the log goes to stderr, one line per call.
+#define LOG_TO_STDERR(...) (fprintf(stderr, LOG_TAG ": " __VA_ARGS__), fputc('\n', stderr))
+#define ALOGE(...) LOG_TO_STDERR(__VA_ARGS__)
+#if DEBUG
+#define ALOGV(...) LOG_TO_STDERR(__VA_ARGS__)
+#else
+#define ALOGV(...)
+#endif
+#endif
 
 // ----------------------------------------------------------------------------
 // Types, functions, and data used by both ES2 and ES3 renderers.
 // Defined in gles3jni.cpp.
 
-#define MAX_INSTANCES_PER_SIDE 16
-#define MAX_INSTANCES   (MAX_INSTANCES_PER_SIDE * MAX_INSTANCES_PER_SIDE)
+// Instances along the longer side of the screen unless setInstanceCount()
+// asks for a number.
+#define INSTANCES_PER_SIDE 16
 #define TWO_PI          (2.0 * M_PI)
 #define MAX_ROT_SPEED   (0.3 * TWO_PI)
+// drand48 seed of the instance spins under a fixed clock.
+#define RENDERER_FIXED_SEED 0x5eed
 
 // This demo uses three coordinate spaces:
 // - The model (a quad) is in a [-1 .. 1]^2 space
@@ -73,8 +107,17 @@ extern const Vertex QUAD[4];
 
 // returns true if a GL error occurred
 extern bool checkGlError(const char* funcName);
+// returns true if the current ES 3 context lists the GL extension name
+extern bool hasExtension(const char* name);
+// returns true if display lists the EGL extension name
+extern bool hasEglExtension(EGLDisplay display, const char* name);
 extern GLuint createShader(GLenum shaderType, const char* src);
 extern GLuint createProgram(const char* vtxSrc, const char* fragSrc);
+#if HAVE_ES31_API
+extern GLuint createComputeProgram(const char* src);
+#endif
+// CLOCK_MONOTONIC time in nanoseconds
+extern uint64_t nowNs();
 
 // ----------------------------------------------------------------------------
 // Interface to the ES2 and ES3 renderers, used by JNI code.
@@ -89,33 +132,83 @@ public:
 
     virtual void setDepthTexture(uint32_t *data, int width, int height);
 
+    // Renders into framebuffer instead of the default one, for offscreen
+    // rendering. It must be the size given to resize(), with a color and a
+    // depth attachment.
+    void setOutputFramebuffer(GLuint framebuffer) { mOutputFramebuffer = framebuffer; }
+    // With frameNs > 0, animation advances by frameNs every frame instead of
+    // following the clock, and resize() spins the instances the same way
+    // every time, so a given frame always renders the same image. 0 goes
+    // back to the clock.
+    virtual void setFixedClock(uint64_t frameNs);
+    // Lays out about count instances, in as many rows and columns of square
+    // cells as fit the screen's aspect; only memory bounds count. 0 goes
+    // back to INSTANCES_PER_SIDE along the longer side. Applies from the
+    // next resize(), or right away if the renderer already has a size.
+    // Renderers without the instance grid apply it to what they instance.
+    virtual void setInstanceCount(unsigned int count);
+    // Turns occlusion culling off and on every stats interval and logs the
+    // frame time of each, for an A/B comparison on device. Ignored while
+    // the clock is fixed and by renderers without occlusion culling.
+    virtual void setOcclusionAbTest(bool) {}
 
 protected:
     Renderer();
 
-    // return a pointer to a buffer of MAX_INSTANCES * sizeof(vec2).
+    // All state changes of the renderer should go through here.
+    GLStateCache mGLState;
+    // Size of the output, from the last resize().
+    int mWidth;
+    int mHeight;
+    // Where the output goes, 0 for the default framebuffer.
+    GLuint mOutputFramebuffer;
+
+    // Time of the current frame, from the clock or the fixed clock.
+    uint64_t frameTimeNs() const { return mFixedFrameNs ? mFixedClockNs : nowNs(); }
+    bool hasFixedClock() const { return mFixedFrameNs > 0; }
+
+    // return a pointer to a buffer of count * sizeof(vec2), growing it as
+    // needed, or NULL if it can't be had.
     // the buffer is filled with per-instance offsets, then unmapped.
-    virtual float* mapOffsetBuf() = 0;
+    virtual float* mapOffsetBuf(unsigned int count) = 0;
     virtual void unmapOffsetBuf() = 0;
-    // return a pointer to a buffer of MAX_INSTANCES * sizeof(vec4).
+    // return a pointer to a buffer of count * sizeof(vec4), or NULL.
     // the buffer is filled with per-instance scale and rotation transforms.
-    virtual float* mapTransformBuf() = 0;
+    virtual float* mapTransformBuf(unsigned int count) = 0;
     virtual void unmapTransformBuf() = 0;
 
+    // Renders a frame, clearing the output framebuffer itself: each
+    // renderer picks the load and store actions of its passes.
     virtual void draw(unsigned int numInstances) = 0;
+    // Whether draw() uses the instance grid. Without it there are no
+    // instances: nothing is laid out, animated or mapped, and draw() gets 0.
+    virtual bool usesInstanceGrid() const { return true; }
 
 private:
-    void calcSceneParams(unsigned int w, unsigned int h, float* offsets);
+    void calcSceneParams(unsigned int w, unsigned int h);
+    void layoutInstances(float* offsets) const;
     void step();
 
+    unsigned int mInstanceTarget;   // 0 for INSTANCES_PER_SIDE
     unsigned int mNumInstances;
+    // The grid from calcSceneParams(): cells along the longer and the
+    // shorter side, the scene to clip scale of the shorter one, and whether
+    // the longer side is the height.
+    unsigned int mGridCells[2];
+    float mGridAspect;
+    bool mPortrait;
     float mScale[2];
-    float mAngularVelocity[MAX_INSTANCES];
+    AlignedArray<float> mAngularVelocity;
     uint64_t mLastFrameNs;
-    float mAngles[MAX_INSTANCES];
+    AlignedArray<float> mAngles;
+    uint64_t mFixedFrameNs;     // 0 to follow the clock
+    uint64_t mFixedClockNs;
 };
 
+struct Mesh;
+
 extern Renderer* createES2Renderer();
-extern Renderer* createES3Renderer();
+// Renders mesh, or the chair asset pushed to the device when mesh is NULL.
+extern Renderer* createES3Renderer(const Mesh* mesh = NULL);
 
 #endif // GLES3JNI_H
@@ -0,0 +1,55 @@
+//
+// Host runner of the batch renderer, for the asset pipeline:
+//   batch_render [--views <n>] [--size <pixels>] [--raw] <output dir> <model>...
+// Writes views images around each model, see BatchRenderer.h; throughput
+// goes to stderr. The exit status is 0 if every model was rendered, 1 if
+// some failed to load, 255 on bad arguments or without a usable OpenGL
+// ES 3 context. Needs a build with assimp to load models.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "BatchRenderer.h"
+
+#define BATCH_DEFAULT_VIEWS 8
+#define BATCH_DEFAULT_SIZE 256
+
+static int usage() {
+    fprintf(stderr, "usage: batch_render [--views <n>] [--size <pixels>] [--raw] "
+            "<output dir> <model>...\n");
+    return 255;
+}
+
+int main(int argc, char** argv) {
+    int views = BATCH_DEFAULT_VIEWS;
+    int size = BATCH_DEFAULT_SIZE;
+    BatchImageFormat format = BATCH_FORMAT_PNG;
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--views") == 0 && arg + 1 < argc)
+            views = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--size") == 0 && arg + 1 < argc)
+            size = atoi(argv[++arg]);
+        else if (strcmp(argv[arg], "--raw") == 0)
+            format = BATCH_FORMAT_RAW;
+        else
+            return usage();
+    }
+    if (argc - arg < 2 || views < 1 || size < 1)
+        return usage();
+    const char* outputDir = argv[arg++];
+    if (mkdir(outputDir, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "batch_render: can't create %s: %s\n", outputDir, strerror(errno));
+        return 255;
+    }
+    std::vector<std::string> paths(argv + arg, argv + argc);
+
+    BatchOptions options = { size, size, (unsigned int)views, format, outputDir };
+    int rendered = renderBatch(paths, options);
+    if (rendered < 0)
+        return 255;
+    return rendered == (int)paths.size() ? 0 : 1;
+}
@@ -0,0 +1,73 @@
+//
+// Host runner of the regression suite, for a CI machine with Mesa:
+//   regression_suite [--update] [--max-slowdown <fraction>] <golden dir> <report dir>
+// After the scenes it runs the CPU checks that have a pass or fail result:
+// the dynamic resolution controller's convergence under simulated load.
+// The exit status is the number of scenes and checks that failed, 255
+// without a usable OpenGL ES 3 context. EGL_PLATFORM=surfaceless runs it
+// with no display at all.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <string>
+
+#include "Benchmark.h"
+#include "Ibl.h"
+#include "RegressionSuite.h"
+
+static int usage() {
+    fprintf(stderr, "usage: regression_suite [--update] [--max-slowdown <fraction>] "
+            "<golden dir> <report dir>\n");
+    return 255;
+}
+
+int main(int argc, char** argv) {
+    RegressionOptions options = { NULL, NULL, false, 0.0f };
+    int arg = 1;
+    for (; arg < argc && strncmp(argv[arg], "--", 2) == 0; arg++) {
+        if (strcmp(argv[arg], "--update") == 0)
+            options.updateGoldens = true;
+        else if (strcmp(argv[arg], "--max-slowdown") == 0 && arg + 1 < argc)
+            options.maxSlowdown = (float)atof(argv[++arg]);
+        else
+            return usage();
+    }
+    if (argc - arg != 2)
+        return usage();
+    options.goldenDir = argv[arg];
+    options.reportDir = argv[arg + 1];
+    const char* dirs[2] = { options.goldenDir, options.reportDir };
+    for (int i = options.updateGoldens ? 0 : 1; i < 2; i++) {
+        if (mkdir(dirs[i], 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "regression_suite: can't create %s: %s\n", dirs[i], strerror(errno));
+            return 255;
+        }
+    }
+
+    // Lighting is cached next to the report, so runs after the first load
+    // the same data instead of regenerating it.
+    std::string iblDir = std::string(options.reportDir) + "/ibl";
+    setIblCacheDir(iblDir.c_str());
+
+    int failures = runRegressionSuite(options);
+    if (failures < 0)
+        return 255;
+
+    // The checks go at the end of the suite's report.
+    std::string reportPath = std::string(options.reportDir) + "/regression.txt";
+    FILE* report = fopen(reportPath.c_str(), "a");
+    bool converged = benchDynamicResolution();
+    if (!converged)
+        failures++;
+    if (report) {
+        fprintf(report, "dynres controller %s\n", converged ? "ok" : "FAILED to converge");
+        fclose(report);
+    }
+
+    fprintf(stderr, "regression_suite: %d failed, report in %s\n", failures, reportPath.c_str());
+    return failures;
+}
@@ -27,8 +27,32 @@ public class GLES3JNILib {
      }
 
      public static native void init();
+     // Directory for precomputed lighting data, normally
+     // Context.getCacheDir(). Call it before init().
+     public static native void setCacheDir(String dir);
      public static native void resize(int width, int height);
      public static native void step();
+     // Lays out about count instances instead of the default grid, 0 to go
+     // back to it: quads on ES 2, copies of the mesh on ES 3. Call it on the
+     // GL thread; it takes effect immediately.
+     public static native void setInstanceCount(int count);
+     // Alternates occlusion culling off and on every stats report and logs
+     // the frame time with and without it. Call it on the GL thread.
+     public static native void setOcclusionAbTest(boolean enabled);
+     // Runs the native CPU microbenchmarks, results go to logcat.
+     public static native void benchmark();
+     // Renders views images around each model into outputDir, as PNGs of
+     // size x size, without a window. Call it from a thread with no GL
+     // context. Returns the number of models rendered, or -1 without
+     // OpenGL ES 3. Throughput goes to logcat.
+     public static native int renderBatch(String[] modelPaths, String outputDir, int views, int size);
+     // Renders the regression scenes headlessly and compares them with the
+     // goldens in goldenDir, or replaces the goldens when updateGoldens.
+     // Call it from a thread with no GL context. Writes regression.txt to
+     // reportDir and returns the number of scenes that failed, or -1
+     // without OpenGL ES 3.
+     public static native int runRegression(String goldenDir, String reportDir,
+             boolean updateGoldens);
 
      public static native void set2DTexture(Bitmap bmp, int height, int width);
 
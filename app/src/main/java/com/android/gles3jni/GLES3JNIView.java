@@ -27,6 +27,8 @@ import javax.microedition.khronos.opengles.GL10;
 class GLES3JNIView extends GLSurfaceView {
     private static final String TAG = "GLES3JNI";
     private static final boolean DEBUG = true;
+    private static final boolean RUN_BENCHMARKS = false;
+    private static final boolean OCCLUSION_AB_TEST = false;
 
     public GLES3JNIView(Context context) {
         super(context);
@@ -68,7 +70,14 @@ class GLES3JNIView extends GLSurfaceView {
         }
 
         public void onSurfaceCreated(GL10 gl, EGLConfig config) {
+            if (RUN_BENCHMARKS) {
+                GLES3JNILib.benchmark();
+            }
+            GLES3JNILib.setCacheDir(getContext().getCacheDir().getPath());
             GLES3JNILib.init();
+            if (OCCLUSION_AB_TEST) {
+                GLES3JNILib.setOcclusionAbTest(true);
+            }
         }
     }
 }